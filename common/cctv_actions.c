@@ -0,0 +1,172 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Action Templates
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_actions.h"
+
+#include "cctv_ctrlpt.h"
+#include "sample_util.h"
+#include "upnptools.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*! Request template of one action. */
+struct CCTvActionTemplate {
+	char *name;
+	IXML_Document *doc;
+};
+
+/*! Templates of one service, immutable once published. */
+struct CCTvActionTable {
+	int count;
+	struct CCTvActionTemplate *templates;
+};
+
+/*! Published with a release store, read with acquire loads. */
+static struct CCTvActionTable *ActionTables[CCTV_SERVICE_SERVCOUNT];
+
+static void CCTvActionTableFree(struct CCTvActionTable *table)
+{
+	int i;
+
+	if (!table)
+		return;
+	for (i = 0; i < table->count; i++) {
+		free(table->templates[i].name);
+		if (table->templates[i].doc)
+			ixmlDocument_free(table->templates[i].doc);
+	}
+	free(table->templates);
+	free(table);
+}
+
+/*!
+ * \brief Whether an action of the SCPD has an input argument, in which case
+ * a fixed request cannot be built for it.
+ */
+static int CCTvActionHasInput(IXML_Element *action)
+{
+	IXML_NodeList *dirs;
+	IXML_Node *text;
+	const char *dir;
+	unsigned long i;
+	int input = 0;
+
+	dirs = ixmlElement_getElementsByTagName(action, "direction");
+	if (!dirs)
+		return 0;
+	for (i = 0; i < ixmlNodeList_length(dirs) && !input; i++) {
+		text = ixmlNode_getFirstChild(ixmlNodeList_item(dirs, i));
+		dir = text ? ixmlNode_getNodeValue(text) : NULL;
+		if (dir && strcmp(dir, "in") == 0)
+			input = 1;
+	}
+	ixmlNodeList_free(dirs);
+
+	return input;
+}
+
+int CCTvActionCacheLoad(int service, const char *serviceType,
+	IXML_Document *scpd)
+{
+	struct CCTvActionTable *table;
+	struct CCTvActionTable *expected = NULL;
+	struct CCTvActionTemplate *t;
+	IXML_NodeList *actions;
+	IXML_Element *action;
+	unsigned long n;
+	unsigned long i;
+
+	if (service < 0 || service >= CCTV_SERVICE_SERVCOUNT)
+		return CCTV_ERROR;
+	if (CCTvActionCacheReady(service))
+		return 0;
+	actions = ixmlDocument_getElementsByTagName(scpd, "action");
+	if (!actions)
+		return CCTV_ERROR;
+	n = ixmlNodeList_length(actions);
+	table = (struct CCTvActionTable *)calloc(1, sizeof *table);
+	if (table)
+		table->templates = (struct CCTvActionTemplate *)calloc(
+			n ? n : 1, sizeof *table->templates);
+	if (!table || !table->templates) {
+		free(table);
+		ixmlNodeList_free(actions);
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < n; i++) {
+		action = (IXML_Element *)ixmlNodeList_item(actions, i);
+		if (CCTvActionHasInput(action))
+			continue;
+		t = &table->templates[table->count];
+		/* the action's own name comes before its arguments' */
+		t->name = SampleUtil_GetFirstElementItem(action, "name");
+		if (!t->name)
+			continue;
+		t->doc = UpnpMakeAction(t->name, serviceType, 0, NULL);
+		if (!t->doc) {
+			free(t->name);
+			t->name = NULL;
+			continue;
+		}
+		table->count++;
+	}
+	ixmlNodeList_free(actions);
+
+	/* two devices may be added at the same time; the first one wins */
+	if (!__atomic_compare_exchange_n(&ActionTables[service], &expected,
+		table, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		CCTvActionTableFree(table);
+		return 0;
+	}
+	SampleUtil_Print("Built %d action templates for %s\n", table->count,
+		serviceType);
+
+	return table->count;
+}
+
+int CCTvActionCacheReady(int service)
+{
+	return __atomic_load_n(&ActionTables[service], __ATOMIC_ACQUIRE) !=
+		NULL;
+}
+
+IXML_Document *CCTvActionCacheGet(int service, const char *actionName)
+{
+	const struct CCTvActionTable *table;
+	int i;
+
+	table = __atomic_load_n(&ActionTables[service], __ATOMIC_ACQUIRE);
+	if (!table)
+		return NULL;
+	/* a handful of actions, a scan beats hashing */
+	for (i = 0; i < table->count; i++) {
+		if (strcmp(table->templates[i].name, actionName) == 0)
+			return table->templates[i].doc;
+	}
+
+	return NULL;
+}
+
+void CCTvActionCacheClear(void)
+{
+	int service;
+
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		CCTvActionTableFree(__atomic_exchange_n(&ActionTables[service],
+			NULL, __ATOMIC_ACQ_REL));
+	}
+}
+
+/*! @} Control Point Action Templates */
+
+/*! @} UpnpSamples */
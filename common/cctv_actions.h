@@ -0,0 +1,74 @@
+#ifndef UPNP_CCTV_ACTIONS_H
+#define UPNP_CCTV_ACTIONS_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Action Templates
+ *
+ * @{
+ *
+ * \file
+ *
+ * The control service has a small fixed action set, and none of its actions
+ * takes an input argument. Instead of building and freeing a request
+ * document on every send, one is built per action when the SCPD of the
+ * service is first seen, and reused for every device. Templates are never
+ * modified once published, so any number of threads may send them at once.
+ */
+
+#include "upnp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * \brief Build the templates of a service from its SCPD: one per action
+ * without input arguments. Does nothing if the service already has them.
+ *
+ * \return The number of templates built, or CCTV_ERROR.
+ */
+int CCTvActionCacheLoad(
+	/*! [in] Service index, below CCTV_SERVICE_SERVCOUNT. */
+	int service,
+	/*! [in] Service type, for the request namespace. */
+	const char *serviceType,
+	/*! [in] SCPD of the service. */
+	IXML_Document *scpd);
+
+/*!
+ * \brief Whether the templates of a service are built.
+ */
+int CCTvActionCacheReady(
+	/*! [in] Service index. */
+	int service);
+
+/*!
+ * \brief Look up the request template of an action. Does not allocate.
+ *
+ * \return The template, to be passed to the SDK and not modified or freed,
+ * or NULL if there is none.
+ */
+IXML_Document *CCTvActionCacheGet(
+	/*! [in] Service index. */
+	int service,
+	/*! [in] Action name. */
+	const char *actionName);
+
+/*!
+ * \brief Free all templates. No thread may be using them.
+ */
+void CCTvActionCacheClear(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Action Templates */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_ACTIONS_H */
@@ -0,0 +1,653 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Command Socket
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_ctlsock.h"
+
+#include "cctv_ctrlpt.h"
+#include "sample_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*! A growable byte buffer. */
+struct CCTvCtlSockBuf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+/*! One client connection, served by its own thread. */
+struct CCTvCtlSockConn {
+	int fd;
+	/*! Never reused, see struct CCTvCtlSockOrigin. */
+	unsigned long id;
+	/*! Pipe waking up the thread when a result is queued. */
+	int wake[2];
+	ithread_t thread;
+	/*! Set by the thread once it is done with the connection. */
+	int finished;
+	/*! The thread is to stop reading, only seen by it. */
+	int closing;
+	/*! Received, not yet run. */
+	struct CCTvCtlSockBuf in;
+	/*! Replies not yet written. */
+	struct CCTvCtlSockBuf out;
+	/*! Output of the command running. */
+	struct CCTvCtlSockBuf output;
+	int truncated;
+	/*! Results not yet moved to out, guarded by CtlSockMutex. */
+	struct CCTvCtlSockBuf results;
+	struct CCTvCtlSockConn *next;
+};
+
+/*! The connection and tag of the command running on this thread. */
+static __thread struct CCTvCtlSockConn *CtlSockCurrent;
+static __thread const char *CtlSockCurrentTag;
+static __thread int CtlSockCurrentBatch;
+
+/*! Set from start to CCTvCtlSockDestroy(), only by the caller of those. */
+static int CtlSockInitialized;
+
+/*! Guards everything below. */
+static ithread_mutex_t CtlSockMutex;
+static int CtlSockRunning;
+static unsigned long CtlSockNextId;
+static int CtlSockFd = -1;
+static ithread_t CtlSockAcceptThread;
+static char CtlSockPath[sizeof ((struct sockaddr_un *)0)->sun_path];
+static CCTvCtlSockExecFn CtlSockExec;
+static struct CCTvCtlSockConn *CtlSockConns;
+static struct CCTvCtlSockStats CtlSockStats;
+
+/*!
+ * \brief Append to a buffer, growing it as needed.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR if out of memory.
+ */
+static int CCTvCtlSockAppend(struct CCTvCtlSockBuf *buf, const char *data,
+	size_t len)
+{
+	char *grown;
+	size_t cap;
+
+	if (buf->len + len > buf->cap) {
+		cap = buf->cap ? buf->cap : 4096;
+		while (cap < buf->len + len)
+			cap *= 2;
+		grown = (char *)realloc(buf->data, cap);
+		if (!grown)
+			return CCTV_ERROR;
+		buf->data = grown;
+		buf->cap = cap;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Drop the first len bytes of a buffer.
+ */
+static void CCTvCtlSockConsume(struct CCTvCtlSockBuf *buf, size_t len)
+{
+	memmove(buf->data, buf->data + len, buf->len - len);
+	buf->len -= len;
+}
+
+/*!
+ * \brief SampleUtil_Print() capture of the command running.
+ */
+static void CCTvCtlSockCapture(const char *text, void *arg)
+{
+	struct CCTvCtlSockConn *conn = (struct CCTvCtlSockConn *)arg;
+	size_t len = strlen(text);
+
+	if (conn->truncated)
+		return;
+	if (conn->output.len + len > CCTV_CTLSOCK_MAX_OUTPUT ||
+	    CCTvCtlSockAppend(&conn->output, text, len) != CCTV_SUCCESS)
+		conn->truncated = 1;
+}
+
+/*!
+ * \brief Append a reply to a buffer.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR if out of memory.
+ */
+static int CCTvCtlSockFormat(struct CCTvCtlSockBuf *buf, const char *tag,
+	int batchnum, const char *status, const char *output, size_t len)
+{
+	char header[CCTV_CTLSOCK_MAX_TAG + 64];
+	int n;
+
+	if (batchnum > 0)
+		n = snprintf(header, sizeof header, "%s.%d %s %lu\n", tag,
+			batchnum, status, (unsigned long)len);
+	else
+		n = snprintf(header, sizeof header, "%s %s %lu\n", tag,
+			status, (unsigned long)len);
+	if (CCTvCtlSockAppend(buf, header, (size_t)n) != CCTV_SUCCESS ||
+	    CCTvCtlSockAppend(buf, output, len) != CCTV_SUCCESS)
+		return CCTV_ERROR;
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Queue a reply.
+ */
+static void CCTvCtlSockReply(struct CCTvCtlSockConn *conn, const char *tag,
+	int batchnum, int ok, const char *output, size_t len)
+{
+	/* on failure the client sees the connection close */
+	if (CCTvCtlSockFormat(&conn->out, tag, batchnum, ok ? "ok" : "error",
+		output, len) != CCTV_SUCCESS)
+		conn->closing = 1;
+	ithread_mutex_lock(&CtlSockMutex);
+	CtlSockStats.replies++;
+	ithread_mutex_unlock(&CtlSockMutex);
+}
+
+/*!
+ * \brief Run one command line and queue its reply.
+ */
+static void CCTvCtlSockRun(struct CCTvCtlSockConn *conn, const char *tag,
+	int batchnum, const char *line, size_t len)
+{
+	static const char toolong[] = "Command line too long\n";
+	static const char truncated[] = "... output truncated\n";
+	char cmdline[CCTV_CTLSOCK_MAX_LINE];
+	int rc;
+
+	if (len >= sizeof cmdline) {
+		rc = CCTV_ERROR;
+		CCTvCtlSockReply(conn, tag, batchnum, 0, toolong,
+			sizeof toolong - 1);
+	} else {
+		memcpy(cmdline, line, len);
+		cmdline[len] = '\0';
+		conn->output.len = 0;
+		conn->truncated = 0;
+		SampleUtil_SetCapture(CCTvCtlSockCapture, conn);
+		CtlSockCurrent = conn;
+		CtlSockCurrentTag = tag;
+		CtlSockCurrentBatch = batchnum;
+		rc = CtlSockExec(cmdline);
+		CtlSockCurrent = NULL;
+		SampleUtil_SetCapture(NULL, NULL);
+		if (conn->truncated &&
+		    CCTvCtlSockAppend(&conn->output, truncated,
+			sizeof truncated - 1) != CCTV_SUCCESS)
+			conn->closing = 1;
+		CCTvCtlSockReply(conn, tag, batchnum, rc == CCTV_SUCCESS,
+			conn->output.data ? conn->output.data : "",
+			conn->output.len);
+	}
+	ithread_mutex_lock(&CtlSockMutex);
+	CtlSockStats.commands++;
+	if (rc != CCTV_SUCCESS)
+		CtlSockStats.errors++;
+	ithread_mutex_unlock(&CtlSockMutex);
+}
+
+/*!
+ * \brief Run the commands of a batch, one per line, skipping empty lines.
+ */
+static void CCTvCtlSockRunBatch(struct CCTvCtlSockConn *conn, const char *tag,
+	const char *batch, size_t len)
+{
+	const char *end = batch + len;
+	const char *eol;
+	size_t linelen;
+	int batchnum = 0;
+
+	while (batch < end && !conn->closing) {
+		eol = (const char *)memchr(batch, '\n', (size_t)(end - batch));
+		if (!eol)
+			eol = end;
+		linelen = (size_t)(eol - batch);
+		if (linelen && batch[linelen - 1] == '\r')
+			linelen--;
+		if (linelen)
+			CCTvCtlSockRun(conn, tag, ++batchnum, batch, linelen);
+		batch = eol + 1;
+	}
+	ithread_mutex_lock(&CtlSockMutex);
+	CtlSockStats.batches++;
+	ithread_mutex_unlock(&CtlSockMutex);
+}
+
+/*!
+ * \brief Run the next complete request in the input buffer.
+ *
+ * \return 1 if one was run, 0 if more input is needed, CCTV_ERROR if the
+ * connection must be closed.
+ */
+static int CCTvCtlSockNext(struct CCTvCtlSockConn *conn)
+{
+	static const char notag[] = "Expected '<tag> <command>'\n";
+	char tag[CCTV_CTLSOCK_MAX_TAG];
+	const char *line = conn->in.data;
+	const char *eol;
+	const char *cmd;
+	size_t linelen;
+	size_t taglen;
+	size_t request;
+	long batch;
+	char *endp;
+
+	if (!conn->in.len)
+		return 0;
+	eol = (const char *)memchr(line, '\n', conn->in.len);
+	if (!eol)
+		return conn->in.len > CCTV_CTLSOCK_MAX_REQUEST ? CCTV_ERROR : 0;
+	linelen = (size_t)(eol - line);
+	request = linelen + 1;
+	if (linelen && line[linelen - 1] == '\r')
+		linelen--;
+	taglen = 0;
+	while (taglen < linelen && line[taglen] != ' ')
+		taglen++;
+	if (taglen == 0) {
+		/* an empty line */
+		CCTvCtlSockConsume(&conn->in, request);
+		return 1;
+	}
+	if (taglen >= sizeof tag)
+		taglen = sizeof tag - 1;
+	memcpy(tag, line, taglen);
+	tag[taglen] = '\0';
+	cmd = line + taglen;
+	while (cmd < line + linelen && *cmd == ' ')
+		cmd++;
+	if (cmd == line + linelen) {
+		CCTvCtlSockReply(conn, tag, 0, 0, notag, sizeof notag - 1);
+		CCTvCtlSockConsume(&conn->in, request);
+		return 1;
+	}
+	if (*cmd != '*') {
+		CCTvCtlSockRun(conn, tag, 0, cmd, (size_t)(line + linelen - cmd));
+		CCTvCtlSockConsume(&conn->in, request);
+		return 1;
+	}
+	batch = strtol(cmd + 1, &endp, 10);
+	if (endp == cmd + 1 || batch < 0 || batch > CCTV_CTLSOCK_MAX_BATCH)
+		return CCTV_ERROR;
+	if (conn->in.len < request + (size_t)batch)
+		return 0;
+	CCTvCtlSockRunBatch(conn, tag, conn->in.data + request, (size_t)batch);
+	CCTvCtlSockConsume(&conn->in, request + (size_t)batch);
+
+	return 1;
+}
+
+/*!
+ * \brief Write the queued replies.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR if the client is gone.
+ */
+static int CCTvCtlSockFlush(struct CCTvCtlSockConn *conn)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < conn->out.len) {
+		n = send(conn->fd, conn->out.data + done, conn->out.len - done,
+			MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return CCTV_ERROR;
+		done += (size_t)n;
+		ithread_mutex_lock(&CtlSockMutex);
+		CtlSockStats.writes++;
+		ithread_mutex_unlock(&CtlSockMutex);
+	}
+	conn->out.len = 0;
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Move the queued results behind the replies, once the replies of
+ * the commands they belong to are there.
+ */
+static void CCTvCtlSockTakeResults(struct CCTvCtlSockConn *conn)
+{
+	char drain[64];
+
+	while (read(conn->wake[0], drain, sizeof drain) > 0)
+		;
+	ithread_mutex_lock(&CtlSockMutex);
+	if (conn->results.len) {
+		if (CCTvCtlSockAppend(&conn->out, conn->results.data,
+			conn->results.len) != CCTV_SUCCESS)
+			conn->closing = 1;
+		conn->results.len = 0;
+	}
+	ithread_mutex_unlock(&CtlSockMutex);
+}
+
+/*!
+ * \brief Thread of a connection: read, run what is complete, and write the
+ * replies and results once it would wait.
+ */
+static void *CCTvCtlSockServe(void *arg)
+{
+	struct CCTvCtlSockConn *conn = (struct CCTvCtlSockConn *)arg;
+	struct pollfd fds[2];
+	char chunk[16384];
+	ssize_t n;
+	int rc = 0;
+
+	fds[0].fd = conn->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = conn->wake[0];
+	fds[1].events = POLLIN;
+	while (!conn->closing) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[0].revents) {
+			n = recv(conn->fd, chunk, sizeof chunk, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0 ||
+			    CCTvCtlSockAppend(&conn->in, chunk, (size_t)n) !=
+				CCTV_SUCCESS)
+				break;
+			while (!conn->closing &&
+			       (rc = CCTvCtlSockNext(conn)) > 0)
+				;
+			if (rc == CCTV_ERROR)
+				conn->closing = 1;
+		}
+		CCTvCtlSockTakeResults(conn);
+		if (CCTvCtlSockFlush(conn) != CCTV_SUCCESS)
+			break;
+	}
+
+	ithread_mutex_lock(&CtlSockMutex);
+	conn->finished = 1;
+	CtlSockStats.open--;
+	ithread_mutex_unlock(&CtlSockMutex);
+
+	return NULL;
+}
+
+static void CCTvCtlSockFree(struct CCTvCtlSockConn *conn)
+{
+	close(conn->fd);
+	close(conn->wake[0]);
+	close(conn->wake[1]);
+	free(conn->in.data);
+	free(conn->out.data);
+	free(conn->output.data);
+	free(conn->results.data);
+	free(conn);
+}
+
+/*!
+ * \brief Join and free the connections whose thread is done. Called with
+ * the lock held.
+ */
+static void CCTvCtlSockReap(void)
+{
+	struct CCTvCtlSockConn **pconn = &CtlSockConns;
+	struct CCTvCtlSockConn *conn;
+
+	while ((conn = *pconn)) {
+		if (!conn->finished) {
+			pconn = &conn->next;
+			continue;
+		}
+		*pconn = conn->next;
+		/* finished is set last thing, the join is short */
+		ithread_join(conn->thread, NULL);
+		CCTvCtlSockFree(conn);
+	}
+}
+
+static void *CCTvCtlSockAccept(void *arg)
+{
+	struct CCTvCtlSockConn *conn;
+	int fd;
+
+	while (1) {
+		fd = accept(CtlSockFd, NULL, NULL);
+		ithread_mutex_lock(&CtlSockMutex);
+		if (!CtlSockRunning) {
+			ithread_mutex_unlock(&CtlSockMutex);
+			if (fd >= 0)
+				close(fd);
+			break;
+		}
+		CCTvCtlSockReap();
+		if (fd < 0) {
+			ithread_mutex_unlock(&CtlSockMutex);
+			if (errno != EINTR && errno != ECONNABORTED)
+				SampleUtil_Print("Command socket: accept "
+					"failed -- %d\n", errno);
+			continue;
+		}
+		conn = NULL;
+		if (CtlSockStats.open < CCTV_CTLSOCK_MAX_CONNS)
+			conn = (struct CCTvCtlSockConn *)calloc(1, sizeof *conn);
+		if (conn && pipe(conn->wake) != 0) {
+			free(conn);
+			conn = NULL;
+		}
+		if (conn) {
+			conn->fd = fd;
+			conn->id = ++CtlSockNextId;
+			/* a result never waits for the connection thread */
+			fcntl(conn->wake[0], F_SETFL, O_NONBLOCK);
+			fcntl(conn->wake[1], F_SETFL, O_NONBLOCK);
+			if (ithread_create(&conn->thread, NULL, CCTvCtlSockServe,
+				conn) != 0) {
+				close(conn->wake[0]);
+				close(conn->wake[1]);
+				free(conn);
+				conn = NULL;
+			}
+		}
+		if (!conn) {
+			CtlSockStats.refused++;
+			close(fd);
+		} else {
+			conn->next = CtlSockConns;
+			CtlSockConns = conn;
+			CtlSockStats.connections++;
+			CtlSockStats.open++;
+		}
+		ithread_mutex_unlock(&CtlSockMutex);
+	}
+
+	return NULL;
+	arg = arg;
+}
+
+int CCTvCtlSockStart(const char *path, CCTvCtlSockExecFn exec)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd;
+
+	if (CtlSockFd >= 0 || !exec || strlen(path) >= sizeof addr.sun_path)
+		return CCTV_ERROR;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return CCTV_ERROR;
+	/* left over by an earlier run that did not stop */
+	unlink(path);
+	mask = umask(077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+	    listen(fd, CCTV_CTLSOCK_MAX_CONNS) != 0) {
+		umask(mask);
+		SampleUtil_Print("Command socket: cannot listen on %s -- %d\n",
+			path, errno);
+		close(fd);
+		return CCTV_ERROR;
+	}
+	umask(mask);
+
+	if (!CtlSockInitialized) {
+		ithread_mutex_init(&CtlSockMutex, 0);
+		CtlSockInitialized = 1;
+	}
+	strcpy(CtlSockPath, path);
+	CtlSockExec = exec;
+	CtlSockConns = NULL;
+	memset(&CtlSockStats, 0, sizeof CtlSockStats);
+	CtlSockFd = fd;
+	CtlSockRunning = 1;
+	if (ithread_create(&CtlSockAcceptThread, NULL, CCTvCtlSockAccept,
+		NULL) != 0) {
+		CtlSockRunning = 0;
+		CtlSockFd = -1;
+		close(fd);
+		unlink(path);
+		return CCTV_ERROR;
+	}
+	SampleUtil_Print("Command socket listening on %s\n", path);
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvCtlSockStop(void)
+{
+	struct CCTvCtlSockConn *conn;
+
+	if (CtlSockFd < 0)
+		return;
+	ithread_mutex_lock(&CtlSockMutex);
+	CtlSockRunning = 0;
+	/* wakes up the accept and every recv */
+	shutdown(CtlSockFd, SHUT_RDWR);
+	for (conn = CtlSockConns; conn; conn = conn->next)
+		shutdown(conn->fd, SHUT_RDWR);
+	ithread_mutex_unlock(&CtlSockMutex);
+	ithread_join(CtlSockAcceptThread, NULL);
+	while ((conn = CtlSockConns)) {
+		CtlSockConns = conn->next;
+		ithread_join(conn->thread, NULL);
+		CCTvCtlSockFree(conn);
+	}
+	close(CtlSockFd);
+	CtlSockFd = -1;
+	unlink(CtlSockPath);
+}
+
+void CCTvCtlSockDestroy(void)
+{
+	if (CtlSockFd >= 0 || !CtlSockInitialized)
+		return;
+	ithread_mutex_destroy(&CtlSockMutex);
+	CtlSockInitialized = 0;
+}
+
+void CCTvCtlSockGetOrigin(struct CCTvCtlSockOrigin *origin)
+{
+	if (!CtlSockCurrent) {
+		origin->conn = 0;
+		origin->tag[0] = '\0';
+		return;
+	}
+	origin->conn = CtlSockCurrent->id;
+	if (CtlSockCurrentBatch > 0)
+		snprintf(origin->tag, sizeof origin->tag, "%s.%d",
+			CtlSockCurrentTag, CtlSockCurrentBatch);
+	else
+		snprintf(origin->tag, sizeof origin->tag, "%s",
+			CtlSockCurrentTag);
+}
+
+void CCTvCtlSockComplete(const struct CCTvCtlSockOrigin *origin, int ok,
+	const char *output, size_t len)
+{
+	struct CCTvCtlSockConn *conn;
+	size_t mark = 0;
+	int rc = CCTV_ERROR;
+
+	/* an origin from the socket means it was started */
+	if (!origin->conn)
+		return;
+	ithread_mutex_lock(&CtlSockMutex);
+	for (conn = CtlSockConns; conn; conn = conn->next) {
+		if (conn->id == origin->conn)
+			break;
+	}
+	if (conn && !conn->finished &&
+	    conn->results.len + len <= CCTV_CTLSOCK_MAX_PENDING) {
+		mark = conn->results.len;
+		rc = CCTvCtlSockFormat(&conn->results, origin->tag, 0,
+			ok ? "done" : "failed", output, len);
+		/* no partial reply */
+		if (rc != CCTV_SUCCESS)
+			conn->results.len = mark;
+	}
+	if (rc != CCTV_SUCCESS) {
+		CtlSockStats.dropped++;
+	} else {
+		CtlSockStats.results++;
+		/* the pipe being full means a wake-up is pending anyway */
+		if (write(conn->wake[1], "", 1) < 0 && errno != EAGAIN)
+			SampleUtil_Print("Command socket: cannot wake "
+				"connection -- %d\n", errno);
+	}
+	ithread_mutex_unlock(&CtlSockMutex);
+}
+
+void CCTvCtlSockGetStats(struct CCTvCtlSockStats *stats)
+{
+	if (CtlSockFd < 0) {
+		memset(stats, 0, sizeof *stats);
+		return;
+	}
+	ithread_mutex_lock(&CtlSockMutex);
+	*stats = CtlSockStats;
+	ithread_mutex_unlock(&CtlSockMutex);
+}
+
+void CCTvCtlSockPrintStats(void)
+{
+	struct CCTvCtlSockStats stats;
+
+	if (CtlSockFd < 0)
+		return;
+	CCTvCtlSockGetStats(&stats);
+	SampleUtil_Print("Command socket %s:\n"
+		"  connections     %lu (%d open, %lu refused)\n"
+		"  commands        %lu (%lu failed, %lu batches)\n"
+		"  replies         %lu in %lu writes\n"
+		"  results         %lu (%lu dropped)\n",
+		CtlSockPath, stats.connections, stats.open, stats.refused,
+		stats.commands, stats.errors, stats.batches,
+		stats.replies, stats.writes, stats.results, stats.dropped);
+}
+
+/*! @} Control Point Command Socket */
+
+/*! @} UpnpSamples */
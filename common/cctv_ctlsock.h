@@ -0,0 +1,182 @@
+#ifndef UPNP_CCTV_CTLSOCK_H
+#define UPNP_CCTV_CTLSOCK_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Command Socket
+ *
+ * @{
+ *
+ * \file
+ *
+ * Serves the command set of the control point on a Unix domain socket,
+ * for scripts. A client sends requests without waiting for replies:
+ *
+ *     <tag> <command> [<args>]\n
+ *
+ * runs one command, and
+ *
+ *     <tag> *<length>\n
+ *     <length> bytes of commands, one per line
+ *
+ * runs a batch. Every command gets one reply, in the order sent:
+ *
+ *     <tag> <status> <length>\n
+ *     <length> bytes of output
+ *
+ * where status is "ok" or "error" and the output is what the command
+ * printed. The commands of a batch reply as <tag>.1, <tag>.2 and so on.
+ * Replies are written once no complete request is left to run, so a
+ * pipelined client gets many in one write.
+ *
+ * Each connection has its own thread running its commands one at a time.
+ *
+ * A command whose result arrives later, e.g. an action or a GetVar,
+ * replies "ok" once its request is sent. The result follows as one more
+ * reply with the tag of the command, after that of the command:
+ *
+ *     <tag> <status> <length>\n
+ *     <length> bytes of output
+ *
+ * where status is "done" or "failed". Results for a connection that was
+ * closed meanwhile are dropped.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Connections served at once; further ones are closed. */
+#define CCTV_CTLSOCK_MAX_CONNS 16
+
+/*! Longest tag. */
+#define CCTV_CTLSOCK_MAX_TAG 32
+
+/*! Longest command line, as the command interpreter reads them
+ * (CCTV_MAX_CMDLINE of cctv_ctrlpt.h, which users include). */
+#define CCTV_CTLSOCK_MAX_LINE CCTV_MAX_CMDLINE
+
+/*! Longest request line, and longest batch. */
+#define CCTV_CTLSOCK_MAX_REQUEST 4096
+#define CCTV_CTLSOCK_MAX_BATCH (1024 * 1024)
+
+/*! Output of a command kept for its reply, the rest is dropped. */
+#define CCTV_CTLSOCK_MAX_OUTPUT (8 * 1024 * 1024)
+
+/*! Results kept for a connection until its thread writes them; further
+ * ones are dropped. */
+#define CCTV_CTLSOCK_MAX_PENDING (1024 * 1024)
+
+/*! Where the result of a command is to go once it arrives. */
+struct CCTvCtlSockOrigin {
+	/*! Connection, 0 if the command did not come from the socket. */
+	unsigned long conn;
+	/*! Tag of the command, with its number within a batch. */
+	char tag[CCTV_CTLSOCK_MAX_TAG + 16];
+};
+
+/*!
+ * \brief Run one command line; what it prints with SampleUtil_Print() is
+ * its output.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the command is unknown, its
+ * arguments are wrong or it is refused.
+ */
+typedef int (*CCTvCtlSockExecFn)(
+	/*! [in] Command line, without the newline. May be modified. */
+	char *cmdline);
+
+/*! Counters of the command socket. */
+struct CCTvCtlSockStats {
+	/*! Connections accepted, refused, and open now. */
+	unsigned long connections;
+	unsigned long refused;
+	int open;
+	/*! Commands run, and those that failed. */
+	unsigned long commands;
+	unsigned long errors;
+	/*! Batches received. */
+	unsigned long batches;
+	/*! Replies written, and write calls they took. */
+	unsigned long replies;
+	unsigned long writes;
+	/*! Results replied, and those dropped. */
+	unsigned long results;
+	unsigned long dropped;
+};
+
+/*!
+ * \brief Listen on a socket and serve commands. An existing socket file
+ * at path is replaced; the new one is only accessible to the user.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if already started or the socket
+ * cannot be set up.
+ */
+int CCTvCtlSockStart(
+	/*! [in] File name of the socket. */
+	const char *path,
+	/*! [in] Runs the commands. */
+	CCTvCtlSockExecFn exec);
+
+/*!
+ * \brief Close the socket and all connections, waiting for the commands
+ * running to finish. Does nothing if not started. Must not be called from
+ * a command.
+ */
+void CCTvCtlSockStop(void);
+
+/*!
+ * \brief Free what CCTvCtlSockComplete() uses, once it cannot be called
+ * any more: after the client is unregistered. Does nothing if not started.
+ */
+void CCTvCtlSockDestroy(void);
+
+/*!
+ * \brief Get where the result of the command running on this thread is to
+ * go, to be kept with its request.
+ */
+void CCTvCtlSockGetOrigin(
+	/*! [out] Origin, with conn 0 outside a command of the socket. */
+	struct CCTvCtlSockOrigin *origin);
+
+/*!
+ * \brief Reply the result of a command, from any thread. The connection
+ * thread writes it. Does nothing for an origin outside the socket, or
+ * once the connection is closed.
+ */
+void CCTvCtlSockComplete(
+	/*! [in] Origin of the command. */
+	const struct CCTvCtlSockOrigin *origin,
+	/*! [in] 1 for "done", 0 for "failed". */
+	int ok,
+	/*! [in] Output. */
+	const char *output,
+	/*! [in] Length of the output. */
+	size_t len);
+
+/*!
+ * \brief Get the counters.
+ */
+void CCTvCtlSockGetStats(
+	/*! [out] Counters. */
+	struct CCTvCtlSockStats *stats);
+
+/*!
+ * \brief Print the counters with SampleUtil_Print(), if started.
+ */
+void CCTvCtlSockPrintStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Command Socket */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_CTLSOCK_H */
@@ -43,15 +43,53 @@
 
 #include "cctv_ctrlpt.h"
 
+#include "cctv_actions.h"
+#include "cctv_ctlsock.h"
+#include "cctv_discovery.h"
+#include "cctv_fanout.h"
+#include "cctv_metrics.h"
+#include "cctv_poll.h"
+#include "cctv_propset.h"
+#include "cctv_recovery.h"
+#include "cctv_research.h"
+#include "cctv_router.h"
+#include "cctv_snapshot.h"
+#include "cctv_subscribe.h"
 #include "upnp.h"
 
+#include <time.h>
+#include <unistd.h>
+
 /*!
- * Mutex for protecting the global device list in a multi-threaded,
- * asynchronous environment. All functions should lock this mutex before
- * reading or writing the device list. 
+ * Mutex serializing the writers of the global device table (add, remove,
+ * resubscribe, expiry). Readers do not take it, they use
+ * CCTvDeviceTableReadBegin()/CCTvDeviceTableReadEnd() on DeviceTable.
  */
 ithread_mutex_t DeviceListMutex;
 
+/*!
+ * Mutex protecting the fields of a device node that change after it was
+ * published: SID and VariableStrVal contents, and HotTable. It is only
+ * held for the copy or the sweep, never across SDK calls or printing.
+ */
+ithread_mutex_t DeviceStateMutex;
+
+/*!
+ * Expiry, power, temperature, recovery state and subscription of every
+ * device, for sweeps over the whole fleet. Guarded by DeviceStateMutex.
+ */
+struct CCTvHotTable HotTable;
+
+/*!
+ * ServiceIds seen so far, shared by the devices. Only added to, with
+ * DeviceListMutex held, and freed on exit.
+ */
+struct CCTvInterned {
+	struct CCTvInterned *next;
+	char *str;
+};
+static struct CCTvInterned *Interned;
+
 UpnpClient_Handle ctrlpt_handle = -1;
 
 /*! Device type for cctv device. */
@@ -76,24 +114,304 @@ char CCTvVarCount[CCTV_SERVICE_SERVCOUNT] =
 int default_timeout = 1801;
 
 /*!
-   The first node in the global device list, or NULL if empty 
+   All known devices, indexed by UDN, SID, EventURL and ControlURL 
+ */
+struct CCTvDeviceTable DeviceTable;
+
+/*!
+   Advertisement expiry and re-search timers of all known devices 
+ */
+struct CCTvTimerWheel TimerWheel;
+
+/*!
+   Part this control point plays in a sharded one, set before the start 
+ */
+enum CCTvShardRole {
+	CCTV_ROLE_ALONE = 0,
+	CCTV_ROLE_FRONTEND,
+	CCTV_ROLE_WORKER
+};
+static enum CCTvShardRole ShardRole = CCTV_ROLE_ALONE;
+
+/*!
+   Action names owning a latency slot, claimed on first completion; the
+   last slot is shared by all further names 
+ */
+static const char *LatencyActions[CCTV_LATENCY_ACTIONS];
+
+/*!
+   Action latency of all devices together, by latency slot 
+ */
+static struct CCTvHistogram ActionLatency[CCTV_LATENCY_ACTIONS];
+
+/*!
+   Cookie of every action request, to time it 
+ */
+struct CCTvActionCookie {
+	/* CLOCK_MONOTONIC microseconds the request was sent at */
+	double sent;
+	int slot;
+	/* cookie of the fan-out the request belongs to, or NULL */
+	void *fanout;
+	/* command socket request to reply the result to, if any */
+	struct CCTvCtlSockOrigin origin;
+	char ControlURL[NAME_SIZE];
+};
+
+/*!
+   Cookie of a GetVar request of the command socket 
+ */
+struct CCTvGetVarCookie {
+	struct CCTvCtlSockOrigin origin;
+};
+
+/*! A device restored from a snapshot, whose description is still to be
+ * queued for download. */
+struct CCTvVerifyItem {
+	char *UDN;
+	char *location;
+};
+
+/*!
+ * Restored devices, queued by VerifyTimer as fast as the discovery pool
+ * takes them. Filled before the timer is armed, then only used by it.
+ */
+static struct CCTvVerifyItem *VerifyItems;
+static int VerifyCount;
+static int VerifyCapacity;
+static int VerifyNext;
+static struct CCTvTimer VerifyTimer;
+static int Restored;
+
+/* Milliseconds before queueing more when the discovery queue is full */
+#define CCTV_VERIFY_RETRY_MS 50
+
+/*! Events whose SID is not indexed yet, kept at most. */
+#define CCTV_PARKED_EVENTS 64
+/*! Microseconds an event waits for the SUBSCRIBE_COMPLETE of its SID. */
+#define CCTV_PARKED_EVENT_US 30000000.0
+
+/*! An event that arrived before the SUBSCRIBE_COMPLETE of its SID. */
+struct CCTvParkedEvent {
+	Upnp_SID sid;
+	int evntkey;
+	/*! The property set, serialized, since the SDK frees the document. */
+	DOMString changes;
+	double parked;
+};
+
+/*!
+ * The initial event of a subscription can overtake its
+ * SUBSCRIBE_COMPLETE. Such events wait here, oldest first, until
+ * CCTvCtrlPointHandleSubscribeComplete() indexes the SID.
+ */
+static struct CCTvParkedEvent ParkedEvents[CCTV_PARKED_EVENTS];
+static int ParkedCount;
+static ithread_mutex_t ParkedMutex;
+
+/*! Metrics of the control point, see CtrlPointMetrics. */
+enum CCTvCtrlPointMetricId {
+	METRIC_SSDP_ALIVE = 0,
+	METRIC_SSDP_SEARCH,
+	METRIC_SSDP_BYEBYE,
+	METRIC_DEVICES,
+	METRIC_DISCOVERY_PENDING,
+	METRIC_DESCRIPTIONS_OK,
+	METRIC_DESCRIPTIONS_ERROR,
+	METRIC_DISCOVERY_DROPPED,
+	METRIC_SUBSCRIBE_OK,
+	METRIC_SUBSCRIBE_ERROR,
+	METRIC_RENEW_OK,
+	METRIC_RENEW_ERROR,
+	METRIC_SUBSCRIPTION_LOST_RENEWAL,
+	METRIC_SUBSCRIPTION_LOST_EXPIRED,
+	METRIC_EVENTS,
+	METRIC_ACTIONS_SENT,
+	/* ok, error and timeout in this order, see CCTvCtrlPointOutcome() */
+	METRIC_ACTIONS_OK,
+	METRIC_ACTIONS_ERROR,
+	METRIC_ACTIONS_TIMEOUT,
+	METRIC_ACTION_SECONDS,
+	METRIC_GETVAR_SENT,
+	METRIC_GETVAR_OK,
+	METRIC_GETVAR_ERROR,
+	METRIC_GETVAR_TIMEOUT,
+	METRIC_POLL_INFLIGHT,
+	METRIC_POLL_QUEUED,
+	METRIC_RECOVERY_HEALTHY,
+	METRIC_RECOVERY_SUSPECT,
+	METRIC_RECOVERY_REBOOTING,
+	METRIC_RECOVERY_AWAITING,
+	METRIC_RECOVERY_VERIFIED,
+	METRIC_RECOVERY_ESCALATED,
+	METRIC_RECOVERY_REBOOTS,
+	METRIC_RECOVERY_ESCALATIONS,
+	METRIC_LOG_DROPPED
+};
+
+/*!
+ * \brief Read a metric the modules count themselves.
+ */
+static long CCTvCtrlPointMetric(int which)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDiscoveryStats discovery;
+	struct CCTvPollStats poll;
+	struct CCTvRecoveryStats recovery;
+	sample_log_stats log;
+	long value;
+	int token;
+
+	switch (which) {
+	case METRIC_DEVICES:
+		reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+		value = reg->count;
+		CCTvDeviceTableReadEnd(&DeviceTable, token);
+		return value;
+	case METRIC_DISCOVERY_PENDING:
+	case METRIC_DESCRIPTIONS_OK:
+	case METRIC_DESCRIPTIONS_ERROR:
+	case METRIC_DISCOVERY_DROPPED:
+		CCTvDiscoveryGetStats(&discovery);
+		return which == METRIC_DISCOVERY_PENDING ? discovery.pending :
+			which == METRIC_DESCRIPTIONS_OK ? (long)discovery.fetched :
+			which == METRIC_DESCRIPTIONS_ERROR ? (long)discovery.failed :
+			(long)discovery.dropped;
+	case METRIC_POLL_INFLIGHT:
+	case METRIC_POLL_QUEUED:
+		CCTvPollGetStats(&poll);
+		return which == METRIC_POLL_INFLIGHT ? poll.inflight :
+			(long)poll.queued;
+	case METRIC_RECOVERY_REBOOTS:
+	case METRIC_RECOVERY_ESCALATIONS:
+		CCTvRecoveryGetStats(&recovery);
+		return which == METRIC_RECOVERY_REBOOTS ?
+			(long)recovery.reboots : (long)recovery.escalations;
+	case METRIC_LOG_DROPPED:
+		SampleUtil_GetLogStats(&log);
+		return (long)log.dropped;
+	default:
+		/* the camera states */
+		CCTvRecoveryGetStats(&recovery);
+		return (long)recovery.state[which - METRIC_RECOVERY_HEALTHY];
+	}
+}
+
+/*! Latency of all actions sent, for the metrics. */
+static struct CCTvHistogram MetricActionLatency;
+
+#define CCTV_CP_READ(name, help, type, which) \
+	CCTV_METRIC_READ_INIT(name, help, type, CCTvCtrlPointMetric, which)
+
+static struct CCTvMetric CtrlPointMetrics[] = {
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_ssdp_total{type=\"alive\"}",
+		"SSDP advertisements and search responses received."),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_ctrlpt_ssdp_total{type=\"search_result\"}", NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_ssdp_total{type=\"byebye\"}",
+		NULL),
+	CCTV_CP_READ("cctv_ctrlpt_devices", "Devices in the device list.",
+		CCTV_METRIC_GAUGE, METRIC_DEVICES),
+	CCTV_CP_READ("cctv_ctrlpt_discovery_pending",
+		"Descriptions queued or being downloaded.",
+		CCTV_METRIC_GAUGE, METRIC_DISCOVERY_PENDING),
+	CCTV_CP_READ("cctv_ctrlpt_descriptions_total{result=\"ok\"}",
+		"Description downloads.",
+		CCTV_METRIC_COUNTER, METRIC_DESCRIPTIONS_OK),
+	CCTV_CP_READ("cctv_ctrlpt_descriptions_total{result=\"error\"}",
+		NULL, CCTV_METRIC_COUNTER, METRIC_DESCRIPTIONS_ERROR),
+	CCTV_CP_READ("cctv_ctrlpt_discovery_dropped_total",
+		"Notifications dropped because the discovery queue was full.",
+		CCTV_METRIC_COUNTER, METRIC_DISCOVERY_DROPPED),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_subscriptions_total{result=\"ok\"}",
+		"Subscription requests answered."),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_ctrlpt_subscriptions_total{result=\"error\"}", NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_renewals_total{result=\"ok\"}",
+		"Subscription renewals answered."),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_renewals_total{result=\"error\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_ctrlpt_subscriptions_lost_total{reason=\"renewal_failed\"}",
+		"Subscriptions the SDK gave up on."),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_ctrlpt_subscriptions_lost_total{reason=\"expired\"}", NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_events_received_total",
+		"GENA events received."),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_actions_sent_total",
+		"Actions sent."),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_actions_total{result=\"ok\"}",
+		"Actions answered, failed or timed out."),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_actions_total{result=\"error\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_actions_total{result=\"timeout\"}",
+		NULL),
+	CCTV_METRIC_HISTOGRAM_INIT("cctv_ctrlpt_action_seconds",
+		"Time from sending an action until its answer.",
+		&MetricActionLatency),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_getvar_sent_total",
+		"GetVar requests sent, polls included."),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_getvar_total{result=\"ok\"}",
+		"GetVar requests answered, failed or timed out."),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_getvar_total{result=\"error\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_ctrlpt_getvar_total{result=\"timeout\"}",
+		NULL),
+	CCTV_CP_READ("cctv_ctrlpt_poll_inflight", "Polls outstanding.",
+		CCTV_METRIC_GAUGE, METRIC_POLL_INFLIGHT),
+	CCTV_CP_READ("cctv_ctrlpt_poll_queued",
+		"Polls due but held back by the rate or in-flight limit.",
+		CCTV_METRIC_GAUGE, METRIC_POLL_QUEUED),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_cameras{state=\"healthy\"}",
+		"Cameras in each recovery state.",
+		CCTV_METRIC_GAUGE, METRIC_RECOVERY_HEALTHY),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_cameras{state=\"suspect\"}", NULL,
+		CCTV_METRIC_GAUGE, METRIC_RECOVERY_SUSPECT),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_cameras{state=\"rebooting\"}", NULL,
+		CCTV_METRIC_GAUGE, METRIC_RECOVERY_REBOOTING),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_cameras{state=\"awaiting\"}", NULL,
+		CCTV_METRIC_GAUGE, METRIC_RECOVERY_AWAITING),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_cameras{state=\"verified\"}", NULL,
+		CCTV_METRIC_GAUGE, METRIC_RECOVERY_VERIFIED),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_cameras{state=\"escalated\"}", NULL,
+		CCTV_METRIC_GAUGE, METRIC_RECOVERY_ESCALATED),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_reboots_total",
+		"Reboots sent by the recovery engine.",
+		CCTV_METRIC_COUNTER, METRIC_RECOVERY_REBOOTS),
+	CCTV_CP_READ("cctv_ctrlpt_recovery_escalations_total",
+		"Cameras the recovery engine gave up on.",
+		CCTV_METRIC_COUNTER, METRIC_RECOVERY_ESCALATIONS),
+	CCTV_CP_READ("cctv_ctrlpt_log_dropped_total",
+		"Console messages dropped because the output lagged behind.",
+		CCTV_METRIC_COUNTER, METRIC_LOG_DROPPED)
+};
+
+/*!
+ * \brief Offset of the ok, error or timeout metric of an answer.
  */
-struct CCTvDeviceNode *GlobalDeviceList = NULL;
+static int CCTvCtrlPointOutcome(int errCode)
+{
+	if (errCode == UPNP_E_SUCCESS)
+		return 0;
+
+	return errCode == UPNP_E_TIMEDOUT ? 2 : 1;
+}
 
 /********************************************************************************
- * CCTvCtrlPointDeleteNode
+ * CCTvCtrlPointFreeNode
  *
  * Description: 
- *       Delete a device node from the global device list.  Note that this
- *       function is NOT thread safe, and should be called from another
- *       function that has already locked the global device list.
+ *       Unsubscribe from and free a device node, see
+ *       CCTvCtrlPointDeleteNode.
  *
  * Parameters:
  *   node -- The device node
+ *   async -- 1 to send the UNSUBSCRIBEs and not wait for them, as the
+ *            timer wheel thread must: the device is usually gone then,
+ *            and waiting for the HTTP timeout would hold up every timer
  *
  ********************************************************************************/
-int
-CCTvCtrlPointDeleteNode( struct CCTvDeviceNode *node )
+static int CCTvCtrlPointFreeNode(struct CCTvDeviceNode *node, int async)
 {
 	int rc, service, var;
 
@@ -103,15 +421,35 @@ CCTvCtrlPointDeleteNode( struct CCTvDeviceNode *node )
 		return CCTV_ERROR;
 	}
 
+	/* waits for a callback still using the node, unless it is the
+	 * expiry callback deleting its own node */
+	CCTvTimerCancel(&TimerWheel, &node->device.ExpiryTimer);
+	CCTvTimerCancel(&TimerWheel, &node->device.SearchTimer);
+	CCTvPollRemove(node->device.UDN);
+	CCTvRecoveryRemove(node->device.UDN);
+
 	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		/* stop retrying, and make a late SUBSCRIBE_COMPLETE release
+		 * its SID */
+		CCTvSubscribeCancel(node->device.CCTvService[service].EventURL);
 		/*
 		   If we have a valid control SID, then unsubscribe 
 		 */
 		if (strcmp(node->device.CCTvService[service].SID, "") != 0) {
-			rc = UpnpUnSubscribe(ctrlpt_handle,
+			/* the SID is copied into the job */
+			rc = async ? UpnpUnSubscribeAsync(ctrlpt_handle,
+					node->device.CCTvService[service].SID,
+					CCTvCtrlPointCallbackEventHandler,
+					NULL) :
+				UpnpUnSubscribe(ctrlpt_handle,
 					     node->device.CCTvService[service].
 					     SID);
-			if (UPNP_E_SUCCESS == rc) {
+			if (async && UPNP_E_SUCCESS == rc) {
+				SAMPLE_LOG(SAMPLE_LOG_DEBUG,
+				    "Unsubscribing from CCTv %s EventURL with SID=%s\n",
+				     CCTvServiceName[service],
+				     node->device.CCTvService[service].SID);
+			} else if (UPNP_E_SUCCESS == rc) {
 				SampleUtil_Print
 				    ("Unsubscribed from CCTv %s EventURL with SID=%s\n",
 				     CCTvServiceName[service],
@@ -122,14 +460,12 @@ CCTvCtrlPointDeleteNode( struct CCTvDeviceNode *node )
 				     CCTvServiceName[service], rc);
 			}
 		}
-
-		for (var = 0; var < CCTvVarCount[service]; var++) {
-			if (node->device.CCTvService[service].VariableStrVal[var]) {
-				free(node->device.
-				     CCTvService[service].VariableStrVal[var]);
-			}
-		}
 	}
+	for (var = 0; var < CCTV_LATENCY_ACTIONS; var++)
+		free(node->device.Latency[var]);
+	ithread_mutex_lock(&DeviceStateMutex);
+	CCTvHotFree(&HotTable, node->device.Slot);
+	ithread_mutex_unlock(&DeviceStateMutex);
 
 	/*Notify New Device Added */
 	SampleUtil_StateUpdate(NULL, NULL, node->device.UDN, DEVICE_REMOVED);
@@ -139,6 +475,24 @@ CCTvCtrlPointDeleteNode( struct CCTvDeviceNode *node )
 	return CCTV_SUCCESS;
 }
 
+/********************************************************************************
+ * CCTvCtrlPointDeleteNode
+ *
+ * Description: 
+ *       Unsubscribe from and free a device node.  The node must already
+ *       have been removed from the global device table, so that no
+ *       reader can reach it any more.  Neither lock needs to be held.
+ *
+ * Parameters:
+ *   node -- The device node
+ *
+ ********************************************************************************/
+int
+CCTvCtrlPointDeleteNode( struct CCTvDeviceNode *node )
+{
+	return CCTvCtrlPointFreeNode(node, 0);
+}
+
 /********************************************************************************
  * CCTvCtrlPointRemoveDevice
  *
@@ -151,36 +505,27 @@ CCTvCtrlPointDeleteNode( struct CCTvDeviceNode *node )
  ********************************************************************************/
 int CCTvCtrlPointRemoveDevice(const char *UDN)
 {
-	struct CCTvDeviceNode *curdevnode;
-	struct CCTvDeviceNode *prevdevnode;
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *curdevnode = NULL;
 
 	ithread_mutex_lock(&DeviceListMutex);
 
-	curdevnode = GlobalDeviceList;
-	if (!curdevnode) {
+	reg = CCTvDeviceTableWriterView(&DeviceTable);
+	if (!reg->count) {
 		SampleUtil_Print(
 			"WARNING: CCTvCtrlPointRemoveDevice: Device list empty\n");
 	} else {
-		if (0 == strcmp(curdevnode->device.UDN, UDN)) {
-			GlobalDeviceList = curdevnode->next;
-			CCTvCtrlPointDeleteNode(curdevnode);
-		} else {
-			prevdevnode = curdevnode;
-			curdevnode = curdevnode->next;
-			while (curdevnode) {
-				if (strcmp(curdevnode->device.UDN, UDN) == 0) {
-					prevdevnode->next = curdevnode->next;
-					CCTvCtrlPointDeleteNode(curdevnode);
-					break;
-				}
-				prevdevnode = curdevnode;
-				curdevnode = curdevnode->next;
-			}
-		}
+		curdevnode = CCTvRegistryFind(reg, CCTV_KEY_UDN, UDN, NULL);
+		if (curdevnode)
+			CCTvDeviceTableRemove(&DeviceTable, curdevnode);
 	}
 
 	ithread_mutex_unlock(&DeviceListMutex);
 
+	/* unsubscribing is a network round trip, do it after unlocking */
+	if (curdevnode)
+		CCTvCtrlPointDeleteNode(curdevnode);
+
 	return CCTV_SUCCESS;
 }
 
@@ -196,21 +541,35 @@ int CCTvCtrlPointRemoveDevice(const char *UDN)
  ********************************************************************************/
 int CCTvCtrlPointRemoveAll(void)
 {
-	struct CCTvDeviceNode *curdevnode, *next;
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode **nodes = NULL;
+	int count;
+	int i;
 
 	ithread_mutex_lock(&DeviceListMutex);
 
-	curdevnode = GlobalDeviceList;
-	GlobalDeviceList = NULL;
-
-	while (curdevnode) {
-		next = curdevnode->next;
-		CCTvCtrlPointDeleteNode(curdevnode);
-		curdevnode = next;
+	reg = CCTvDeviceTableWriterView(&DeviceTable);
+	count = reg->count;
+	if (count) {
+		nodes = (struct CCTvDeviceNode **)malloc(
+			count * sizeof (struct CCTvDeviceNode *));
+		if (nodes) {
+			memcpy(nodes, reg->devices,
+				count * sizeof (struct CCTvDeviceNode *));
+			CCTvDeviceTableClear(&DeviceTable);
+		}
 	}
 
 	ithread_mutex_unlock(&DeviceListMutex);
 
+	if (count && !nodes) {
+		SampleUtil_Print("ERROR: CCTvCtrlPointRemoveAll: out of memory\n");
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < count; i++)
+		CCTvCtrlPointDeleteNode(nodes[i]);
+	free(nodes);
+
 	return CCTV_SUCCESS;
 }
 
@@ -230,6 +589,7 @@ int CCTvCtrlPointRefresh(void)
 	int rc;
 
 	CCTvCtrlPointRemoveAll();
+	CCTvDiscoveryStartRound();
 	/* Search for all devices of type cctvdevice version 1,
 	 * waiting for up to 5 seconds for the response */
 	rc = UpnpSearchAsync(ctrlpt_handle, 5, CCTvDeviceType, NULL);
@@ -242,6 +602,50 @@ int CCTvCtrlPointRefresh(void)
 	return CCTV_SUCCESS;
 }
 
+/********************************************************************************
+ * CCTvCtrlPointGetVarCallback
+ *
+ * Description: 
+ *       Callback of a GetVar request of the command socket: handle the
+ *       completion as any other, then reply the value as the result of
+ *       the command.  Frees the cookie.
+ *
+ * Parameters:
+ *   EventType -- UPNP_CONTROL_GET_VAR_COMPLETE
+ *   Event -- The completion
+ *   Cookie -- struct CCTvGetVarCookie
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointGetVarCallback(Upnp_EventType EventType,
+	const void *Event, void *Cookie)
+{
+	struct CCTvGetVarCookie *cookie = (struct CCTvGetVarCookie *)Cookie;
+	UpnpStateVarComplete *sv_event = (UpnpStateVarComplete *)Event;
+	int errCode = UpnpStateVarComplete_get_ErrCode(sv_event);
+	const char *varName;
+	const char *value;
+	char output[2 * NAME_SIZE];
+	int len;
+
+	CCTvCtrlPointCallbackEventHandler(EventType, Event, NULL);
+	varName = UpnpString_get_String(
+		UpnpStateVarComplete_get_StateVarName(sv_event));
+	value = UpnpStateVarComplete_get_CurrentVal(sv_event);
+	if (errCode == UPNP_E_SUCCESS)
+		len = snprintf(output, sizeof output, "%s=%s\n", varName,
+			value ? value : "");
+	else
+		len = snprintf(output, sizeof output, "%s %d\n", varName,
+			errCode);
+	if (len >= (int)sizeof output)
+		len = (int)sizeof output - 1;
+	CCTvCtlSockComplete(&cookie->origin, errCode == UPNP_E_SUCCESS,
+		output, (size_t)len);
+	free(cookie);
+
+	return 0;
+}
+
 /********************************************************************************
  * CCTvCtrlPointGetVar
  *
@@ -257,29 +661,47 @@ int CCTvCtrlPointRefresh(void)
  ********************************************************************************/
 int CCTvCtrlPointGetVar(int service, int devnum, const char *varname)
 {
+	const struct CCTvRegistry *reg;
 	struct CCTvDeviceNode *devnode;
+	struct CCTvGetVarCookie *cookie = NULL;
+	struct CCTvCtlSockOrigin origin;
+	int token;
 	int rc;
 
-	ithread_mutex_lock(&DeviceListMutex);
+	/* a command of the command socket gets the value as its result */
+	CCTvCtlSockGetOrigin(&origin);
+	if (origin.conn) {
+		cookie = (struct CCTvGetVarCookie *)malloc(sizeof *cookie);
+		if (!cookie)
+			return CCTV_ERROR;
+		cookie->origin = origin;
+	}
 
-	rc = CCTvCtrlPointGetDevice(devnum, &devnode);
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+
+	rc = CCTvCtrlPointGetDevice(reg, devnum, &devnode);
 
 	if (CCTV_SUCCESS == rc) {
 		rc = UpnpGetServiceVarStatusAsync(
 			ctrlpt_handle,
 			devnode->device.CCTvService[service].ControlURL,
 			varname,
-			CCTvCtrlPointCallbackEventHandler,
-			NULL);
+			cookie ? CCTvCtrlPointGetVarCallback :
+				CCTvCtrlPointCallbackEventHandler,
+			cookie);
 		if (rc != UPNP_E_SUCCESS) {
 			SampleUtil_Print(
 				"Error in UpnpGetServiceVarStatusAsync -- %d\n",
 				rc);
 			rc = CCTV_ERROR;
+		} else {
+			CCTvMetricsAdd(&CtrlPointMetrics[METRIC_GETVAR_SENT], 1);
+			cookie = NULL;
 		}
 	}
 
-	ithread_mutex_unlock(&DeviceListMutex);
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+	free(cookie);
 
 	return rc;
 }
@@ -290,473 +712,1886 @@ int CCTvCtrlPointGetPower(int devnum)
 }
 
 /********************************************************************************
- * CCTvCtrlPointSendAction
+ * CCTvCtrlPointRecoveryReport
  *
  * Description: 
- *       Send an Action request to the specified service of a device.
+ *       Report the outcome of a request, or an event, to the recovery
+ *       engine, by the UDN of the device it came from.
  *
  * Parameters:
- *   service -- The service
- *   devnum -- The number of the device (order in the list,
- *             starting with 1)
- *   actionname -- The name of the action.
- *   param_name -- An array of parameter names
- *   param_val -- The corresponding parameter values
- *   param_count -- The number of parameters
+ *   which -- The kind of key
+ *   key -- The SID, event URL or control URL the outcome belongs to
+ *   ok -- Whether the device answered, see CCTvRecoveryAnswered
  *
  ********************************************************************************/
-int CCTvCtrlPointSendAction(
-	int service,
-	int devnum,
-	const char *actionname,
-	const char **param_name,
-	char **param_val,
-	int param_count)
+static void CCTvCtrlPointRecoveryReport(enum CCTvRegistryKey which,
+	const char *key, int ok)
 {
-	struct CCTvDeviceNode *devnode;
-	IXML_Document *actionNode = NULL;
-	int rc = CCTV_SUCCESS;
-	int param;
-
-	ithread_mutex_lock(&DeviceListMutex);
-
-	rc = CCTvCtrlPointGetDevice(devnum, &devnode);
-	if (CCTV_SUCCESS == rc) {
-		if (0 == param_count) {
-			actionNode =
-			    UpnpMakeAction(actionname, CCTvServiceType[service],
-					   0, NULL);
-		} else {
-			for (param = 0; param < param_count; param++) {
-				if (UpnpAddToAction
-				    (&actionNode, actionname,
-				     CCTvServiceType[service], param_name[param],
-				     param_val[param]) != UPNP_E_SUCCESS) {
-					SampleUtil_Print
-					    ("ERROR: CCTvCtrlPointSendAction: Trying to add action param\n");
-					/*return -1; // TBD - BAD! leaves mutex locked */
-				}
-			}
-		}
-
-		rc = UpnpSendActionAsync(ctrlpt_handle,
-					 devnode->device.
-					 CCTvService[service].ControlURL,
-					 CCTvServiceType[service], NULL,
-					 actionNode,
-					 CCTvCtrlPointCallbackEventHandler, NULL);
-
-		if (rc != UPNP_E_SUCCESS) {
-			SampleUtil_Print("Error in UpnpSendActionAsync -- %d\n",
-					 rc);
-			rc = CCTV_ERROR;
-		}
-	}
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *node;
+	char UDN[NAME_SIZE];
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	node = CCTvRegistryFind(reg, which, key, NULL);
+	if (node)
+		strcpy(UDN, node->device.UDN);
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	if (node)
+		CCTvRecoveryReport(UDN, ok);
+}
 
-	ithread_mutex_unlock(&DeviceListMutex);
+static double CCTvCtrlPointNowUs(void)
+{
+	struct timespec ts;
 
-	if (actionNode)
-		ixmlDocument_free(actionNode);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return rc;
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
 }
 
 /********************************************************************************
- * CCTvCtrlPointSendActionNumericArg
+ * CCTvCtrlPointLatencySlot
  *
- * Description:Send an action with one argument to a device in the global device list.
+ * Description: 
+ *       Find the latency slot of an action name, claiming a free one
+ *       for a new name.  Lock-free; names are never released.
  *
  * Parameters:
- *   devnum -- The number of the device (order in the list, starting with 1)
- *   service -- CCTV_SERVICE_CONTROL or CCTV_SERVICE_PICTURE
- *   actionName -- The device action, i.e., "SetChannel"
- *   paramName -- The name of the parameter that is being passed
- *   paramValue -- Actual value of the parameter being passed
+ *   actionname -- The name of the action
  *
  ********************************************************************************/
-int CCTvCtrlPointSendActionNumericArg(int devnum, int service,
-	const char *actionName, const char *paramName, int paramValue)
+static int CCTvCtrlPointLatencySlot(const char *actionname)
 {
-	char param_val_a[50];
-	char *param_val = param_val_a;
+	const char *name;
+	char *copy = NULL;
+	int slot;
+
+	for (slot = 0; slot < CCTV_LATENCY_ACTIONS - 1; slot++) {
+		name = __atomic_load_n(&LatencyActions[slot], __ATOMIC_ACQUIRE);
+		if (!name) {
+			if (!copy && !(copy = strdup(actionname)))
+				break;
+			if (__atomic_compare_exchange_n(&LatencyActions[slot],
+				&name, copy, 0, __ATOMIC_ACQ_REL,
+				__ATOMIC_ACQUIRE))
+				return slot;
+			/* lost the slot, name is the winner's */
+		}
+		if (strcmp(name, actionname) == 0)
+			break;
+	}
+	free(copy);
 
-	sprintf(param_val_a, "%d", paramValue);
-	return CCTvCtrlPointSendAction(
-		service, devnum, actionName, &paramName,
-		&param_val, 1);
+	return slot;
 }
 
-int CCTvCtrlPointSendPowerOn(int devnum)
+static const char *CCTvCtrlPointLatencyName(int slot)
 {
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "PowerOn", NULL, NULL, 0);
-}
+	const char *name;
 
-int CCTvCtrlPointSendPowerOff(int devnum)
-{
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "PowerOff", NULL, NULL, 0);
-}
+	name = __atomic_load_n(&LatencyActions[slot], __ATOMIC_ACQUIRE);
 
-int CCTvCtrlPointSendReboot(int devnum)
-{
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "Reboot", NULL, NULL, 0);
+	return name ? name : "(other)";
 }
-int CCTvCtrlPointSendBottomMountLeft(int devnum)
+
+/********************************************************************************
+ * CCTvCtrlPointNewCookie
+ *
+ * Description: 
+ *       Allocate the cookie of an action request, stamped with the
+ *       current time.  Free it if the request is not sent.
+ *
+ * Parameters:
+ *   actionname -- The name of the action
+ *   controlURL -- The control URL the request goes to
+ *   fanout -- The cookie of the fan-out, or NULL
+ *
+ ********************************************************************************/
+static struct CCTvActionCookie *CCTvCtrlPointNewCookie(
+	const char *actionname, const char *controlURL, void *fanout)
 {
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "BottomMountLeft",NULL,NULL,0);
+	struct CCTvActionCookie *cookie;
+
+	cookie = (struct CCTvActionCookie *)malloc(sizeof *cookie);
+	if (!cookie)
+		return NULL;
+	cookie->slot = CCTvCtrlPointLatencySlot(actionname);
+	cookie->fanout = fanout;
+	/* the fan-out replies for all its requests at once */
+	if (fanout)
+		cookie->origin.conn = 0;
+	else
+		CCTvCtlSockGetOrigin(&cookie->origin);
+	strncpy(cookie->ControlURL, controlURL, sizeof cookie->ControlURL - 1);
+	cookie->ControlURL[sizeof cookie->ControlURL - 1] = '\0';
+	cookie->sent = CCTvCtrlPointNowUs();
+
+	return cookie;
 }
 
-int CCTvCtrlPointSendBottomMountRight(int devnum)
+static struct CCTvHistogram *CCTvCtrlPointDeviceLatency(
+	struct CCTvDeviceNode *node, int slot)
 {
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "BottomMountRight",NULL,NULL,0);
+	struct CCTvHistogram *h;
+	struct CCTvHistogram *expected = NULL;
+
+	h = __atomic_load_n(&node->device.Latency[slot], __ATOMIC_ACQUIRE);
+	if (h)
+		return h;
+	h = (struct CCTvHistogram *)calloc(1, sizeof *h);
+	if (!h)
+		return NULL;
+	/* two completions of one device may race for the first record */
+	if (!__atomic_compare_exchange_n(&node->device.Latency[slot],
+		&expected, h, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(h);
+		h = expected;
+	}
 
+	return h;
 }
-int CCTvCtrlPointSendBottomMountMiddle(int devnum)
-{
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "BottomMountMiddle",NULL,NULL,0);
 
-}
-int CCTvCtrlPointSendTopMountUp(int devnum)
-{
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "TopMountUp",NULL,NULL,0);
-}
-int CCTvCtrlPointSendTopMountDown(int devnum)
-{
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "TopMountDown",NULL,NULL,0);
-}
-int CCTvCtrlPointSendTopMountMiddle(int devnum)
-{
-	return CCTvCtrlPointSendAction(
-		CCTV_SERVICE_CONTROL, devnum, "TopMountMiddle",NULL,NULL,0);
-}
 /********************************************************************************
- * CCTvCtrlPointGetDevice
+ * CCTvCtrlPointHandleActionComplete
  *
  * Description: 
- *       Given a list number, returns the pointer to the device
- *       node at that position in the global device list.  Note
- *       that this function is not thread safe.  It must be called 
- *       from a function that has locked the global device list.
+ *       Record the latency of a completed action request, failed ones
+ *       included, pass a fan-out request on to the fan-out, and reply
+ *       the result of a command socket request.  Frees the cookie.
  *
  * Parameters:
- *   devnum -- The number of the device (order in the list,
- *             starting with 1)
- *   devnode -- The output device node pointer
+ *   cookie -- The cookie the request was sent with
+ *   errCode -- The UPnP error code of the request
+ *   result -- The response, or NULL
  *
  ********************************************************************************/
-int CCTvCtrlPointGetDevice(int devnum, struct CCTvDeviceNode **devnode)
+static void CCTvCtrlPointHandleActionComplete(
+	struct CCTvActionCookie *cookie, int errCode, IXML_Document *result)
 {
-	int count = devnum;
-	struct CCTvDeviceNode *tmpdevnode = NULL;
-
-	if (count)
-		tmpdevnode = GlobalDeviceList;
-	while (--count && tmpdevnode) {
-		tmpdevnode = tmpdevnode->next;
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *node;
+	struct CCTvHistogram *h;
+	char UDN[NAME_SIZE];
+	DOMString response = NULL;
+	char line[2 * NAME_SIZE];
+	char *output;
+	size_t len;
+	size_t extra;
+	double elapsed;
+	unsigned long us;
+	int token;
+
+	elapsed = CCTvCtrlPointNowUs() - cookie->sent;
+	us = elapsed > 0 ? (unsigned long)elapsed : 0;
+	CCTvHistogramRecord(&ActionLatency[cookie->slot], us);
+	CCTvMetricsObserve(&CtrlPointMetrics[METRIC_ACTION_SECONDS], us);
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	node = CCTvRegistryFind(reg, CCTV_KEY_CONTROLURL, cookie->ControlURL,
+		NULL);
+	if (node) {
+		h = CCTvCtrlPointDeviceLatency(node, cookie->slot);
+		if (h)
+			CCTvHistogramRecord(h, us);
+		strcpy(UDN, node->device.UDN);
 	}
-	if (!tmpdevnode) {
-		SampleUtil_Print("Error finding CCTvDevice number -- %d\n",
-				 devnum);
-		return CCTV_ERROR;
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	if (node && strcmp(CCTvCtrlPointLatencyName(cookie->slot),
+		CCTV_RECOVERY_ACTION) == 0)
+		CCTvRecoveryRebootAnswered(UDN, errCode);
+	else if (node)
+		CCTvRecoveryReport(UDN, CCTvRecoveryAnswered(errCode));
+
+	if (cookie->fanout)
+		CCTvFanoutComplete(cookie->fanout, errCode);
+	else if (errCode != UPNP_E_SUCCESS)
+		SampleUtil_Print("Error in  Action Complete Callback -- %d\n",
+			errCode);
+	if (cookie->origin.conn) {
+		if (errCode == UPNP_E_SUCCESS && result)
+			response = ixmlPrintNode((IXML_Node *)result);
+		snprintf(line, sizeof line, "%s %s %.1f ms %d\n",
+			CCTvCtrlPointLatencyName(cookie->slot),
+			node ? UDN : cookie->ControlURL, elapsed / 1e3, errCode);
+		/* the first line, then the response */
+		len = strlen(line);
+		extra = response ? strlen(response) : 0;
+		output = (char *)malloc(len + extra);
+		if (output) {
+			memcpy(output, line, len);
+			if (extra)
+				memcpy(output + len, response, extra);
+			CCTvCtlSockComplete(&cookie->origin,
+				errCode == UPNP_E_SUCCESS, output, len + extra);
+			free(output);
+		}
+		if (response)
+			ixmlFreeDOMString(response);
 	}
-	*devnode = tmpdevnode;
-
-	return CCTV_SUCCESS;
+	free(cookie);
 }
 
 /********************************************************************************
- * CCTvCtrlPointPrintList
+ * CCTvCtrlPointSendActionTo
  *
  * Description: 
- *       Print the universal device names for each device in the global device list
+ *       Send an action request to a device node, timed through its
+ *       cookie.  Must be called inside a read section.
  *
  * Parameters:
- *   None
+ *   devnode -- The device node
+ *   service -- The service index
+ *   actionname -- The name of the action
+ *   actionNode -- The action request, still owned by the caller
  *
  ********************************************************************************/
-int CCTvCtrlPointPrintList()
+static int CCTvCtrlPointSendActionTo(struct CCTvDeviceNode *devnode,
+	int service, const char *actionname, IXML_Document *actionNode)
 {
-	struct CCTvDeviceNode *tmpdevnode;
-	int i = 0;
-
-	ithread_mutex_lock(&DeviceListMutex);
+	struct CCTvActionCookie *cookie;
+	int rc;
 
-	SampleUtil_Print("CCTvCtrlPointPrintList:\n");
-	tmpdevnode = GlobalDeviceList;
-	while (tmpdevnode) {
-		SampleUtil_Print(" %3d -- %s\n", ++i, tmpdevnode->device.UDN);
-		tmpdevnode = tmpdevnode->next;
+	/* without a cookie the action is just not timed */
+	cookie = CCTvCtrlPointNewCookie(actionname,
+		devnode->device.CCTvService[service].ControlURL, NULL);
+	rc = UpnpSendActionAsync(ctrlpt_handle,
+				 devnode->device.CCTvService[service].ControlURL,
+				 CCTvServiceType[service], NULL,
+				 actionNode,
+				 CCTvCtrlPointCallbackEventHandler, cookie);
+	if (rc != UPNP_E_SUCCESS) {
+		SampleUtil_Print("Error in UpnpSendActionAsync -- %d\n", rc);
+		free(cookie);
+		return CCTV_ERROR;
 	}
-	SampleUtil_Print("\n");
-	ithread_mutex_unlock(&DeviceListMutex);
+	CCTvMetricsAdd(&CtrlPointMetrics[METRIC_ACTIONS_SENT], 1);
 
 	return CCTV_SUCCESS;
 }
 
 /********************************************************************************
- * CCTvCtrlPointPrintDevice
+ * CCTvCtrlPointSendAction
  *
  * Description: 
- *       Print the identifiers and state table for a device from
- *       the global device list.
+ *       Send an Action request to the specified service of a device.
  *
  * Parameters:
+ *   service -- The service
  *   devnum -- The number of the device (order in the list,
  *             starting with 1)
+ *   actionname -- The name of the action.
+ *   param_name -- An array of parameter names
+ *   param_val -- The corresponding parameter values
+ *   param_count -- The number of parameters
  *
  ********************************************************************************/
-int CCTvCtrlPointPrintDevice(int devnum)
+int CCTvCtrlPointSendAction(
+	int service,
+	int devnum,
+	const char *actionname,
+	const char **param_name,
+	char **param_val,
+	int param_count)
 {
-	struct CCTvDeviceNode *tmpdevnode;
-	int i = 0, service, var;
-	char spacer[15];
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *devnode;
+	IXML_Document *actionNode = NULL;
+	int rc = CCTV_SUCCESS;
+	int cached = 0;
+	int param;
+	int token;
 
-	if (devnum <= 0) {
-		SampleUtil_Print(
-			"Error in CCTvCtrlPointPrintDevice: "
-			"invalid devnum = %d\n",
-			devnum);
-		return CCTV_ERROR;
+	/* build the request before touching the device table */
+	if (0 == param_count) {
+		actionNode = CCTvActionCacheGet(service, actionname);
+		if (actionNode)
+			cached = 1;
+		else
+			actionNode =
+			    UpnpMakeAction(actionname, CCTvServiceType[service],
+					   0, NULL);
+	} else {
+		for (param = 0; param < param_count; param++) {
+			if (UpnpAddToAction
+			    (&actionNode, actionname,
+			     CCTvServiceType[service], param_name[param],
+			     param_val[param]) != UPNP_E_SUCCESS) {
+				SampleUtil_Print
+				    ("ERROR: CCTvCtrlPointSendAction: Trying to add action param\n");
+			}
+		}
 	}
 
-	ithread_mutex_lock(&DeviceListMutex);
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
 
-	SampleUtil_Print("CCTvCtrlPointPrintDevice:\n");
-	tmpdevnode = GlobalDeviceList;
-	while (tmpdevnode) {
-		i++;
-		if (i == devnum)
+	rc = CCTvCtrlPointGetDevice(reg, devnum, &devnode);
+	if (CCTV_SUCCESS == rc)
+		rc = CCTvCtrlPointSendActionTo(devnode, service, actionname,
+			actionNode);
+
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	if (actionNode && !cached)
+		ixmlDocument_free(actionNode);
+
+	return rc;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointFanoutSend
+ *
+ * Description: 
+ *       Send one request of a fan-out.  The completion comes back to
+ *       the callback with the cookie.
+ *
+ * Parameters:
+ *   controlURL -- The control URL of the device
+ *   serviceType -- The service type of the action
+ *   actionname -- The name of the action
+ *   action -- The action request
+ *   fanout -- The cookie of the request within the fan-out
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointFanoutSend(const char *controlURL,
+	const char *serviceType, const char *actionname,
+	IXML_Document *action, void *fanout)
+{
+	struct CCTvActionCookie *cookie;
+	int rc;
+
+	cookie = CCTvCtrlPointNewCookie(actionname, controlURL, fanout);
+	if (!cookie)
+		return UPNP_E_OUTOF_MEMORY;
+	rc = UpnpSendActionAsync(ctrlpt_handle, controlURL, serviceType,
+		NULL, action, CCTvCtrlPointCallbackEventHandler, cookie);
+	if (rc != UPNP_E_SUCCESS)
+		free(cookie);
+	else
+		CCTvMetricsAdd(&CtrlPointMetrics[METRIC_ACTIONS_SENT], 1);
+
+	return rc;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointRecoveryProbe
+ *
+ * Description: 
+ *       Recovery callback: query the Power variable of a device, whose
+ *       outcome the GET_VAR_COMPLETE handler reports back.
+ *
+ * Parameters:
+ *   UDN -- The UDN of the device
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointRecoveryProbe(const char *UDN)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *devnode;
+	int rc = CCTV_ERROR;
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	devnode = CCTvRegistryFind(reg, CCTV_KEY_UDN, UDN, NULL);
+	if (devnode && UpnpGetServiceVarStatusAsync(ctrlpt_handle,
+		devnode->device.CCTvService[CCTV_SERVICE_CONTROL].ControlURL,
+		"Power", CCTvCtrlPointCallbackEventHandler, NULL) ==
+		UPNP_E_SUCCESS) {
+		CCTvMetricsAdd(&CtrlPointMetrics[METRIC_GETVAR_SENT], 1);
+		rc = CCTV_SUCCESS;
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	return rc;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointRecoveryReboot
+ *
+ * Description: 
+ *       Recovery callback: send Reboot to a device.  Goes the way of
+ *       CCTvCtrlPointSendReboot, but addresses the device by UDN, since
+ *       its number may change between the decision and the send.
+ *
+ * Parameters:
+ *   UDN -- The UDN of the device
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointRecoveryReboot(const char *UDN)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *devnode;
+	IXML_Document *actionNode;
+	int rc = CCTV_ERROR;
+	int cached = 1;
+	int token;
+
+	actionNode = CCTvActionCacheGet(CCTV_SERVICE_CONTROL,
+		CCTV_RECOVERY_ACTION);
+	if (!actionNode) {
+		cached = 0;
+		actionNode = UpnpMakeAction(CCTV_RECOVERY_ACTION,
+			CCTvServiceType[CCTV_SERVICE_CONTROL], 0, NULL);
+	}
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	devnode = CCTvRegistryFind(reg, CCTV_KEY_UDN, UDN, NULL);
+	if (devnode && actionNode)
+		rc = CCTvCtrlPointSendActionTo(devnode, CCTV_SERVICE_CONTROL,
+			CCTV_RECOVERY_ACTION, actionNode);
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	if (actionNode && !cached)
+		ixmlDocument_free(actionNode);
+
+	return rc;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointRecoveryChanged
+ *
+ * Description: 
+ *       Recovery callback: copy the recovery state of a device into
+ *       HotTable.
+ *
+ * Parameters:
+ *   UDN -- The UDN of the device
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointRecoveryChanged(const char *UDN)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *devnode;
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	devnode = CCTvRegistryFind(reg, CCTV_KEY_UDN, UDN, NULL);
+	if (devnode && devnode->device.Slot >= 0) {
+		ithread_mutex_lock(&DeviceStateMutex);
+		/* read under the lock, so that racing callbacks store the
+		 * latest state last */
+		CCTV_HOT(&HotTable, devnode->device.Slot, health) =
+			(unsigned char)CCTvRecoveryGetState(UDN);
+		ithread_mutex_unlock(&DeviceStateMutex);
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointSelected
+ *
+ * Description: 
+ *       Check whether a device matches a fan-out selector.
+ *
+ * Parameters:
+ *   node -- The device node
+ *   devnum -- The number of the device
+ *   selector -- See CCTvCtrlPointFleetAction
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointSelected(const struct CCTvDeviceNode *node,
+	int devnum, const char *selector)
+{
+	const char *p = selector;
+	const char *end;
+	size_t len;
+	int lo;
+	int hi;
+
+	if (strcmp(selector, "all") == 0)
+		return 1;
+	if (strncmp(selector, "name=", 5) == 0)
+		return strstr(node->device.FriendlyName, selector + 5) != NULL;
+	while (*p) {
+		end = strchr(p, ',');
+		len = end ? (size_t)(end - p) : strlen(p);
+		if (strncmp(p, "uuid:", 5) == 0) {
+			if (strlen(node->device.UDN) == len &&
+			    strncmp(node->device.UDN, p, len) == 0)
+				return 1;
+		} else if (sscanf(p, "%d-%d", &lo, &hi) == 2) {
+			if (devnum >= lo && devnum <= hi)
+				return 1;
+		} else if (sscanf(p, "%d", &lo) == 1 && devnum == lo) {
+			return 1;
+		}
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+
+	return 0;
+}
+
+int CCTvCtrlPointFleetAction(const char *actionname, const char *selector,
+	int maxinflight)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *node;
+	IXML_Document *actionNode;
+	char **UDNs = NULL;
+	char **controlURLs = NULL;
+	int n = 0;
+	int rc = CCTV_ERROR;
+	int cached = 1;
+	int token;
+	int i;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	if (reg->count > 0) {
+		UDNs = (char **)calloc((size_t)reg->count, sizeof *UDNs);
+		controlURLs = (char **)calloc((size_t)reg->count,
+			sizeof *controlURLs);
+	}
+	for (i = 0; UDNs && controlURLs && i < reg->count; i++) {
+		node = reg->devices[i];
+		if (!node->device.CCTvService[CCTV_SERVICE_CONTROL].ControlURL[0] ||
+		    !CCTvCtrlPointSelected(node, i + 1, selector))
+			continue;
+		UDNs[n] = strdup(node->device.UDN);
+		controlURLs[n] = strdup(
+			node->device.CCTvService[CCTV_SERVICE_CONTROL].ControlURL);
+		n++;
+		if (!UDNs[n - 1] || !controlURLs[n - 1])
 			break;
-		tmpdevnode = tmpdevnode->next;
 	}
-	if (!tmpdevnode) {
-		SampleUtil_Print(
-			"Error in CCTvCtrlPointPrintDevice: "
-			"invalid devnum = %d  --  actual device count = %d\n",
-			devnum, i);
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	if (n == 0) {
+		SampleUtil_Print("No device matches %s\n", selector);
+	} else if (!UDNs[n - 1] || !controlURLs[n - 1]) {
+		SampleUtil_Print("Error in CCTvCtrlPointFleetAction: "
+			"out of memory\n");
 	} else {
-		SampleUtil_Print(
-			"  CCTvDevice -- %d\n"
-			"    |                  \n"
-			"    +- UDN        = %s\n"
-			"    +- DescDocURL     = %s\n"
-			"    +- FriendlyName   = %s\n"
-			"    +- PresURL        = %s\n"
-			"    +- Adver. TimeOut = %d\n",
-			devnum,
-			tmpdevnode->device.UDN,
-			tmpdevnode->device.DescDocURL,
-			tmpdevnode->device.FriendlyName,
-			tmpdevnode->device.PresURL,
-			tmpdevnode->device.AdvrTimeOut);
-		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
-			if (service < CCTV_SERVICE_SERVCOUNT - 1)
-				sprintf(spacer, "    |    ");
-			else
-				sprintf(spacer, "         ");
-			SampleUtil_Print(
-				"    |                  \n"
-				"    +- CCTv %s Service\n"
-				"%s+- ServiceId       = %s\n"
-				"%s+- ServiceType     = %s\n"
-				"%s+- EventURL        = %s\n"
-				"%s+- ControlURL      = %s\n"
-				"%s+- SID             = %s\n"
-				"%s+- ServiceStateTable\n",
-				CCTvServiceName[service],
-				spacer,
-				tmpdevnode->device.CCTvService[service].ServiceId,
-				spacer,
-				tmpdevnode->device.CCTvService[service].ServiceType,
-				spacer,
-				tmpdevnode->device.CCTvService[service].EventURL,
-				spacer,
-				tmpdevnode->device.CCTvService[service].ControlURL,
-				spacer,
-				tmpdevnode->device.CCTvService[service].SID,
-				spacer);
-			for (var = 0; var < CCTvVarCount[service]; var++) {
-				SampleUtil_Print(
-					"%s     +- %-10s = %s\n",
-					spacer,
-					CCTvVarName[service][var],
-					tmpdevnode->device.CCTvService[service].VariableStrVal[var]);
-			}
+		/* one request document serves every device */
+		actionNode = CCTvActionCacheGet(CCTV_SERVICE_CONTROL,
+			actionname);
+		if (!actionNode) {
+			cached = 0;
+			actionNode = UpnpMakeAction(actionname,
+				CCTvServiceType[CCTV_SERVICE_CONTROL], 0, NULL);
+		}
+		if (!actionNode)
+			SampleUtil_Print("Error in CCTvCtrlPointFleetAction: "
+				"cannot build %s\n", actionname);
+		else
+			rc = CCTvFanoutSubmit(actionname,
+				CCTvServiceType[CCTV_SERVICE_CONTROL],
+				actionNode, !cached, (const char **)UDNs,
+				(const char **)controlURLs, n, maxinflight,
+				NULL, NULL);
+	}
+	for (i = 0; i < n; i++) {
+		free(UDNs[i]);
+		free(controlURLs[i]);
+	}
+	free(UDNs);
+	free(controlURLs);
+
+	return rc;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointSendActionNumericArg
+ *
+ * Description:Send an action with one argument to a device in the global device list.
+ *
+ * Parameters:
+ *   devnum -- The number of the device (order in the list, starting with 1)
+ *   service -- CCTV_SERVICE_CONTROL or CCTV_SERVICE_PICTURE
+ *   actionName -- The device action, i.e., "SetChannel"
+ *   paramName -- The name of the parameter that is being passed
+ *   paramValue -- Actual value of the parameter being passed
+ *
+ ********************************************************************************/
+int CCTvCtrlPointSendActionNumericArg(int devnum, int service,
+	const char *actionName, const char *paramName, int paramValue)
+{
+	char param_val_a[50];
+	char *param_val = param_val_a;
+
+	sprintf(param_val_a, "%d", paramValue);
+	return CCTvCtrlPointSendAction(
+		service, devnum, actionName, &paramName,
+		&param_val, 1);
+}
+
+int CCTvCtrlPointSendPowerOn(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "PowerOn", NULL, NULL, 0);
+}
+
+int CCTvCtrlPointSendPowerOff(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "PowerOff", NULL, NULL, 0);
+}
+
+int CCTvCtrlPointSendReboot(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "Reboot", NULL, NULL, 0);
+}
+int CCTvCtrlPointSendBottomMountLeft(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "BottomMountLeft",NULL,NULL,0);
+}
+
+int CCTvCtrlPointSendBottomMountRight(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "BottomMountRight",NULL,NULL,0);
+
+}
+int CCTvCtrlPointSendBottomMountMiddle(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "BottomMountMiddle",NULL,NULL,0);
+
+}
+int CCTvCtrlPointSendTopMountUp(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "TopMountUp",NULL,NULL,0);
+}
+int CCTvCtrlPointSendTopMountDown(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "TopMountDown",NULL,NULL,0);
+}
+int CCTvCtrlPointSendTopMountMiddle(int devnum)
+{
+	return CCTvCtrlPointSendAction(
+		CCTV_SERVICE_CONTROL, devnum, "TopMountMiddle",NULL,NULL,0);
+}
+/********************************************************************************
+ * CCTvCtrlPointGetDevice
+ *
+ * Description: 
+ *       Given a list number, returns the pointer to the device
+ *       node at that position in the global device list.  The node
+ *       is only valid for as long as the read section (or writer
+ *       lock) reg was obtained under.
+ *
+ * Parameters:
+ *   reg -- The registry returned by CCTvDeviceTableReadBegin
+ *   devnum -- The number of the device (order in the list,
+ *             starting with 1)
+ *   devnode -- The output device node pointer
+ *
+ ********************************************************************************/
+int CCTvCtrlPointGetDevice(const struct CCTvRegistry *reg, int devnum,
+	struct CCTvDeviceNode **devnode)
+{
+	struct CCTvDeviceNode *tmpdevnode;
+
+	tmpdevnode = CCTvRegistryGet(reg, devnum);
+	if (!tmpdevnode) {
+		SampleUtil_Print("Error finding CCTvDevice number -- %d\n",
+				 devnum);
+		return CCTV_ERROR;
+	}
+	*devnode = tmpdevnode;
+
+	return CCTV_SUCCESS;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointCopyName
+ *
+ * Description: 
+ *       Copy a string of a device node for printing, truncated to
+ *       NAME_SIZE bytes.
+ *
+ * Parameters:
+ *   to -- NAME_SIZE bytes
+ *   from -- The string, or NULL for an empty one
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointCopyName(char *to, const char *from)
+{
+	strncpy(to, from ? from : "", NAME_SIZE - 1);
+	to[NAME_SIZE - 1] = '\0';
+}
+
+/********************************************************************************
+ * CCTvCtrlPointPrintList
+ *
+ * Description: 
+ *       Print the universal device names for each device in the global device list
+ *
+ * Parameters:
+ *   None
+ *
+ ********************************************************************************/
+int CCTvCtrlPointPrintList()
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvListed {
+		char UDN[NAME_SIZE];
+		int Unverified;
+	} *listed = NULL;
+	int count;
+	int token;
+	int i;
+
+	/* copy the list, print it once the read section ended */
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	count = reg->count;
+	if (count > 0)
+		listed = (struct CCTvListed *)malloc(
+			(size_t)count * sizeof *listed);
+	for (i = 0; listed && i < count; i++) {
+		CCTvCtrlPointCopyName(listed[i].UDN,
+			reg->devices[i]->device.UDN);
+		listed[i].Unverified = reg->devices[i]->device.Unverified;
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+	if (count > 0 && !listed) {
+		SampleUtil_Print("Error in CCTvCtrlPointPrintList: "
+			"out of memory\n");
+		return CCTV_ERROR;
+	}
+
+	SampleUtil_Print("CCTvCtrlPointPrintList:\n");
+	for (i = 0; i < count; i++) {
+		SampleUtil_Print(" %3d -- %s%s\n", i + 1, listed[i].UDN,
+			listed[i].Unverified ? " (unverified)" : "");
+	}
+	SampleUtil_Print("\n");
+	free(listed);
+
+	return CCTV_SUCCESS;
+}
+
+/*! A service as CCTvCtrlPointPrintDevice() prints it. */
+struct CCTvPrintedService {
+	char ServiceId[NAME_SIZE];
+	char ServiceType[NAME_SIZE];
+	char EventURL[NAME_SIZE];
+	char ControlURL[NAME_SIZE];
+	Upnp_SID SID;
+	int SubState;
+	char Value[CCTV_MAXVARS][CCTV_MAX_VAL_LEN];
+};
+
+/*! A device as CCTvCtrlPointPrintDevice() prints it. */
+struct CCTvPrintedDevice {
+	char UDN[NAME_SIZE];
+	char DescDocURL[NAME_SIZE];
+	char FriendlyName[NAME_SIZE];
+	char PresURL[NAME_SIZE];
+	int Timeout;
+	int Unverified;
+	struct CCTvPrintedService Service[CCTV_SERVICE_SERVCOUNT];
+};
+
+/********************************************************************************
+ * CCTvCtrlPointPrintDevice
+ *
+ * Description: 
+ *       Print the identifiers and state table for a device from
+ *       the global device list.
+ *
+ * Parameters:
+ *   devnum -- The number of the device (order in the list,
+ *             starting with 1)
+ *
+ ********************************************************************************/
+int CCTvCtrlPointPrintDevice(int devnum)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *tmpdevnode;
+	struct cctv_service *s;
+	struct CCTvPrintedDevice dev;
+	struct CCTvPrintedService *ps;
+	int service, var;
+	int token;
+	int count;
+	char spacer[15];
+
+	if (devnum <= 0) {
+		SampleUtil_Print(
+			"Error in CCTvCtrlPointPrintDevice: "
+			"invalid devnum = %d\n",
+			devnum);
+		return CCTV_ERROR;
+	}
+
+	/* copy the device, print it once the read section ended */
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	count = reg->count;
+	tmpdevnode = CCTvRegistryGet(reg, devnum);
+	if (tmpdevnode) {
+		CCTvCtrlPointCopyName(dev.UDN, tmpdevnode->device.UDN);
+		CCTvCtrlPointCopyName(dev.DescDocURL,
+			tmpdevnode->device.DescDocURL);
+		CCTvCtrlPointCopyName(dev.FriendlyName,
+			tmpdevnode->device.FriendlyName);
+		CCTvCtrlPointCopyName(dev.PresURL, tmpdevnode->device.PresURL);
+		dev.Timeout = (int)(CCTvTimerRemaining(&TimerWheel,
+			&tmpdevnode->device.ExpiryTimer) / 1000);
+		dev.Unverified = tmpdevnode->device.Unverified;
+		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+			s = &tmpdevnode->device.CCTvService[service];
+			ps = &dev.Service[service];
+			CCTvCtrlPointCopyName(ps->ServiceId, s->ServiceId);
+			CCTvCtrlPointCopyName(ps->ServiceType, s->ServiceType);
+			CCTvCtrlPointCopyName(ps->EventURL, s->EventURL);
+			CCTvCtrlPointCopyName(ps->ControlURL, s->ControlURL);
+			/* events change these */
+			ithread_mutex_lock(&DeviceStateMutex);
+			strcpy(ps->SID, s->SID);
+			ps->SubState = s->SubState;
+			for (var = 0; var < CCTvVarCount[service]; var++) {
+				strcpy(ps->Value[var], s->VariableStrVal[var] ?
+					s->VariableStrVal[var] : "");
+			}
+			ithread_mutex_unlock(&DeviceStateMutex);
+		}
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	SampleUtil_Print("CCTvCtrlPointPrintDevice:\n");
+	if (!tmpdevnode) {
+		SampleUtil_Print(
+			"Error in CCTvCtrlPointPrintDevice: "
+			"invalid devnum = %d  --  actual device count = %d\n",
+			devnum, count);
+	} else {
+		SampleUtil_Print(
+			"  CCTvDevice -- %d\n"
+			"    |                  \n"
+			"    +- UDN        = %s\n"
+			"    +- DescDocURL     = %s\n"
+			"    +- FriendlyName   = %s\n"
+			"    +- PresURL        = %s\n"
+			"    +- Adver. TimeOut = %d\n"
+			"    +- Verified       = %s\n"
+			"    +- Recovery       = %s\n",
+			devnum,
+			dev.UDN,
+			dev.DescDocURL,
+			dev.FriendlyName,
+			dev.PresURL,
+			dev.Timeout,
+			dev.Unverified ?
+				"no, restored from a snapshot" : "yes",
+			CCTvRecoveryStateName(CCTvRecoveryGetState(dev.UDN)));
+		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+			ps = &dev.Service[service];
+			if (service < CCTV_SERVICE_SERVCOUNT - 1)
+				sprintf(spacer, "    |    ");
+			else
+				sprintf(spacer, "         ");
+			SampleUtil_Print(
+				"    |                  \n"
+				"    +- CCTv %s Service\n"
+				"%s+- ServiceId       = %s\n"
+				"%s+- ServiceType     = %s\n"
+				"%s+- EventURL        = %s\n"
+				"%s+- ControlURL      = %s\n"
+				"%s+- SID             = %s\n"
+				"%s+- Subscription    = %s\n"
+				"%s+- ServiceStateTable\n",
+				CCTvServiceName[service],
+				spacer,
+				ps->ServiceId,
+				spacer,
+				ps->ServiceType,
+				spacer,
+				ps->EventURL,
+				spacer,
+				ps->ControlURL,
+				spacer,
+				ps->SID,
+				spacer,
+				CCTvSubStateName(ps->SubState),
+				spacer);
+			for (var = 0; var < CCTvVarCount[service]; var++) {
+				SampleUtil_Print(
+					"%s     +- %-10s = %s\n",
+					spacer,
+					CCTvVarName[service][var],
+					ps->Value[var]);
+			}
+		}
+	}
+	SampleUtil_Print("\n");
+
+	return CCTV_SUCCESS;
+}
+
+/*! The latency of one action, summarized for printing. */
+struct CCTvLatencyRow {
+	/* device number, 0 for all devices together */
+	int devnum;
+	char UDN[NAME_SIZE];
+	char FriendlyName[NAME_SIZE];
+	int slot;
+	unsigned long count;
+	double mean;
+	unsigned long p50;
+	unsigned long p90;
+	unsigned long p99;
+	unsigned long max;
+};
+
+/********************************************************************************
+ * CCTvCtrlPointLatencyRow
+ *
+ * Description: 
+ *       Summarize a latency histogram into a row, leaving the device
+ *       fields to the caller.  Returns the number of requests.
+ *
+ * Parameters:
+ *   row -- The row
+ *   slot -- The action slot
+ *   h -- The histogram
+ *
+ ********************************************************************************/
+static unsigned long CCTvCtrlPointLatencyRow(struct CCTvLatencyRow *row,
+	int slot, const struct CCTvHistogram *h)
+{
+	struct CCTvHistogram snap;
+
+	CCTvHistogramSnapshot(h, &snap);
+	row->slot = slot;
+	row->count = snap.count;
+	row->mean = CCTvHistogramMean(&snap);
+	row->p50 = CCTvHistogramPercentile(&snap, 50);
+	row->p90 = CCTvHistogramPercentile(&snap, 90);
+	row->p99 = CCTvHistogramPercentile(&snap, 99);
+	row->max = snap.max;
+
+	return row->count;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointCopyLatency
+ *
+ * Description: 
+ *       Copy the action latency of every device out of the read section,
+ *       one row per device and action with requests.
+ *
+ * Parameters:
+ *   rows -- The rows, to be freed by the caller
+ *   nrows -- The number of rows
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointCopyLatency(struct CCTvLatencyRow **rows,
+	int *nrows)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *node;
+	const struct CCTvHistogram *h;
+	struct CCTvLatencyRow *grown;
+	struct CCTvLatencyRow row;
+	int capacity = 0;
+	int rc = CCTV_SUCCESS;
+	int token;
+	int slot;
+	int i;
+
+	*rows = NULL;
+	*nrows = 0;
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	for (i = 0; CCTV_SUCCESS == rc && i < reg->count; i++) {
+		node = reg->devices[i];
+		for (slot = 0; slot < CCTV_LATENCY_ACTIONS; slot++) {
+			h = __atomic_load_n(&node->device.Latency[slot],
+				__ATOMIC_ACQUIRE);
+			if (!h || !CCTvCtrlPointLatencyRow(&row, slot, h))
+				continue;
+			if (*nrows == capacity) {
+				capacity = capacity ? 2 * capacity : 64;
+				grown = (struct CCTvLatencyRow *)realloc(*rows,
+					(size_t)capacity * sizeof **rows);
+				if (!grown) {
+					rc = CCTV_ERROR;
+					break;
+				}
+				*rows = grown;
+			}
+			row.devnum = i + 1;
+			CCTvCtrlPointCopyName(row.UDN, node->device.UDN);
+			CCTvCtrlPointCopyName(row.FriendlyName,
+				node->device.FriendlyName);
+			(*rows)[(*nrows)++] = row;
+		}
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+	if (rc != CCTV_SUCCESS) {
+		free(*rows);
+		*rows = NULL;
+		*nrows = 0;
+	}
+
+	return rc;
+}
+
+static void CCTvCtrlPointPrintLatencyLine(const struct CCTvLatencyRow *row)
+{
+	SampleUtil_Print("    %-22s %8lu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+		CCTvCtrlPointLatencyName(row->slot), row->count,
+		row->mean / 1e3, row->p50 / 1e3, row->p90 / 1e3,
+		row->p99 / 1e3, row->max / 1e3);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointPrintLatency
+ *
+ * Description: 
+ *       Print the action latency of all devices, or of one device, per
+ *       action: count, then mean, percentiles and maximum in ms.
+ *
+ * Parameters:
+ *   devnum -- The number of the device (order in the list,
+ *             starting with 1), or 0 for all devices
+ *
+ ********************************************************************************/
+int CCTvCtrlPointPrintLatency(int devnum)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *node = NULL;
+	const struct CCTvHistogram *h;
+	struct CCTvLatencyRow rows[CCTV_LATENCY_ACTIONS];
+	char name[NAME_SIZE];
+	int nrows = 0;
+	int count = 0;
+	int token;
+	int slot;
+
+	if (devnum < 0) {
+		SampleUtil_Print("Error in CCTvCtrlPointPrintLatency: "
+			"invalid devnum = %d\n", devnum);
+		return CCTV_ERROR;
+	}
+
+	/* copy the histograms, print them once the read section ended */
+	strcpy(name, "all devices");
+	if (devnum > 0) {
+		reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+		count = reg->count;
+		node = CCTvRegistryGet(reg, devnum);
+		if (node)
+			CCTvCtrlPointCopyName(name, node->device.FriendlyName);
+	}
+	for (slot = 0; (node || devnum == 0) &&
+	     slot < CCTV_LATENCY_ACTIONS; slot++) {
+		h = node ? __atomic_load_n(&node->device.Latency[slot],
+			__ATOMIC_ACQUIRE) : &ActionLatency[slot];
+		if (h && CCTvCtrlPointLatencyRow(&rows[nrows], slot, h))
+			nrows++;
+	}
+	if (devnum > 0)
+		CCTvDeviceTableReadEnd(&DeviceTable, token);
+	if (devnum > 0 && !node) {
+		SampleUtil_Print("Error in CCTvCtrlPointPrintLatency: "
+			"invalid devnum = %d  --  actual device count = %d\n",
+			devnum, count);
+		return CCTV_ERROR;
+	}
+
+	SampleUtil_Print("Action latency of %s, in ms:\n"
+		"    %-22s %8s %9s %9s %9s %9s %9s\n", name,
+		"action", "count", "mean", "p50", "p90", "p99", "max");
+	for (slot = 0; slot < nrows; slot++)
+		CCTvCtrlPointPrintLatencyLine(&rows[slot]);
+
+	return CCTV_SUCCESS;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointPrintSlowDevices
+ *
+ * Description: 
+ *       Print the devices and actions whose 99th percentile latency is
+ *       at least a threshold.
+ *
+ * Parameters:
+ *   threshold_ms -- The threshold, in ms
+ *
+ ********************************************************************************/
+int CCTvCtrlPointPrintSlowDevices(int threshold_ms)
+{
+	struct CCTvLatencyRow *rows;
+	int nrows;
+	int found = 0;
+	int i;
+
+	if (CCTvCtrlPointCopyLatency(&rows, &nrows) != CCTV_SUCCESS) {
+		SampleUtil_Print("Error in CCTvCtrlPointPrintSlowDevices: "
+			"out of memory\n");
+		return CCTV_ERROR;
+	}
+	SampleUtil_Print("Devices with a p99 action latency of %d ms or more:\n",
+		threshold_ms);
+	for (i = 0; i < nrows; i++) {
+		if (rows[i].p99 < (unsigned long)threshold_ms * 1000)
+			continue;
+		SampleUtil_Print("  %3d -- %s (%s) %s: p99 %.1f ms, "
+			"max %.1f ms, %lu requests\n",
+			rows[i].devnum, rows[i].FriendlyName, rows[i].UDN,
+			CCTvCtrlPointLatencyName(rows[i].slot),
+			rows[i].p99 / 1e3, rows[i].max / 1e3, rows[i].count);
+		found++;
+	}
+	free(rows);
+	if (!found)
+		SampleUtil_Print("  none\n");
+
+	return CCTV_SUCCESS;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointPrintFleetHealth
+ *
+ * Description: 
+ *       Summarize the fleet from HotTable: power, temperature, recovery
+ *       state, subscriptions and advertisements about to expire, and
+ *       list the devices at or above a temperature.
+ *
+ * Parameters:
+ *   threshold -- The temperature, CCTV_HOT_THRESHOLD if negative
+ *
+ ********************************************************************************/
+int CCTvCtrlPointPrintFleetHealth(int threshold)
+{
+	struct CCTvHotSummary summary;
+	struct CCTvDeviceNode *node;
+	int slots[CCTV_HOT_LIST];
+	char names[CCTV_HOT_LIST][NAME_SIZE];
+	short temps[CCTV_HOT_LIST];
+	int found;
+	int i;
+
+	if (threshold < 0)
+		threshold = CCTV_HOT_THRESHOLD;
+	/* copy out what is printed, the lock is not held while printing */
+	ithread_mutex_lock(&DeviceStateMutex);
+	CCTvHotSummarize(&HotTable, threshold, CCTV_RESEARCH_MARGIN, &summary);
+	found = CCTvHotSelectHot(&HotTable, threshold, slots, CCTV_HOT_LIST);
+	for (i = 0; i < found && i < CCTV_HOT_LIST; i++) {
+		node = CCTV_HOT(&HotTable, slots[i], node);
+		strncpy(names[i], node->device.FriendlyName, NAME_SIZE - 1);
+		names[i][NAME_SIZE - 1] = '\0';
+		temps[i] = CCTV_HOT(&HotTable, slots[i], temperature);
+	}
+	ithread_mutex_unlock(&DeviceStateMutex);
+
+	SampleUtil_Print("Fleet: %d devices, %d on, %d off, %d not subscribed, "
+		"%d expiring within %d s\n", summary.devices,
+		summary.powered_on, summary.powered_off, summary.unsubscribed,
+		summary.expiring, CCTV_RESEARCH_MARGIN);
+	if (summary.temp_known)
+		SampleUtil_Print("Temperature: %d reported, min %d, mean %.1f, "
+			"max %d\n", summary.temp_known, summary.temp_min,
+			summary.temp_mean, summary.temp_max);
+	SampleUtil_Print("Recovery:");
+	for (i = 0; i < CCTV_RECOVERY_STATES; i++)
+		SampleUtil_Print(" %s %d", CCTvRecoveryStateName(
+			(enum CCTvRecoveryState)i), summary.health[i]);
+	SampleUtil_Print("\n");
+	SampleUtil_Print("Devices at %d degrees or more: %d\n", threshold,
+		found);
+	for (i = 0; i < found && i < CCTV_HOT_LIST; i++)
+		SampleUtil_Print("  %s: %d\n", names[i], temps[i]);
+	if (found > CCTV_HOT_LIST)
+		SampleUtil_Print("  ... and %d more\n", found - CCTV_HOT_LIST);
+
+	return CCTV_SUCCESS;
+}
+
+static void CCTvCtrlPointExportLatencyLine(FILE *fp, const char *scope,
+	const char *UDN, const struct CCTvLatencyRow *row)
+{
+	fprintf(fp, "%s,%s,%s,%lu,%.0f,%lu,%lu,%lu,%lu\n", scope, UDN,
+		CCTvCtrlPointLatencyName(row->slot), row->count, row->mean,
+		row->p50, row->p90, row->p99, row->max);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointExportLatency
+ *
+ * Description: 
+ *       Write the action latency of all devices together and of every
+ *       device to a CSV file, in microseconds.
+ *
+ * Parameters:
+ *   path -- The name of the file
+ *
+ ********************************************************************************/
+int CCTvCtrlPointExportLatency(const char *path)
+{
+	struct CCTvLatencyRow *rows;
+	struct CCTvLatencyRow row;
+	FILE *fp;
+	int nrows;
+	int slot;
+	int i;
+
+	/* the file is written once the read section ended */
+	if (CCTvCtrlPointCopyLatency(&rows, &nrows) != CCTV_SUCCESS) {
+		SampleUtil_Print("Error in CCTvCtrlPointExportLatency: "
+			"out of memory\n");
+		return CCTV_ERROR;
+	}
+	fp = fopen(path, "w");
+	if (!fp) {
+		SampleUtil_Print("Error in CCTvCtrlPointExportLatency: "
+			"cannot open %s\n", path);
+		free(rows);
+		return CCTV_ERROR;
+	}
+	fprintf(fp, "scope,udn,action,count,mean_us,p50_us,p90_us,p99_us,"
+		"max_us\n");
+	for (slot = 0; slot < CCTV_LATENCY_ACTIONS; slot++) {
+		if (CCTvCtrlPointLatencyRow(&row, slot, &ActionLatency[slot]))
+			CCTvCtrlPointExportLatencyLine(fp, "all", "", &row);
+	}
+	for (i = 0; i < nrows; i++)
+		CCTvCtrlPointExportLatencyLine(fp, "device", rows[i].UDN,
+			&rows[i]);
+	free(rows);
+	if (fclose(fp) != 0) {
+		SampleUtil_Print("Error in CCTvCtrlPointExportLatency: "
+			"cannot write %s\n", path);
+		return CCTV_ERROR;
+	}
+	SampleUtil_Print("Wrote action latency to %s\n", path);
+
+	return CCTV_SUCCESS;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointGetLatency
+ *
+ * Description:
+ *       Get the action latency of all devices together for one action,
+ *       in microseconds.
+ *
+ * Parameters:
+ *   actionName -- The name of the action
+ *   snap -- The snapshot of its histogram
+ *
+ ********************************************************************************/
+int CCTvCtrlPointGetLatency(const char *actionName, struct CCTvHistogram *snap)
+{
+	const char *name;
+	int slot;
+
+	memset(snap, 0, sizeof *snap);
+	for (slot = 0; slot < CCTV_LATENCY_ACTIONS - 1; slot++) {
+		name = __atomic_load_n(&LatencyActions[slot], __ATOMIC_ACQUIRE);
+		if (!name)
+			break;
+		if (strcmp(name, actionName) == 0) {
+			CCTvHistogramSnapshot(&ActionLatency[slot], snap);
+			return CCTV_SUCCESS;
+		}
+	}
+
+	return CCTV_WARNING;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointResetRecovery
+ *
+ * Description: 
+ *       Put a device back to healthy in the recovery engine, e.g. after
+ *       it was escalated and fixed by hand.
+ *
+ * Parameters:
+ *   devnum -- The number of the device (order in the list,
+ *             starting with 1)
+ *
+ ********************************************************************************/
+int CCTvCtrlPointResetRecovery(int devnum)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *devnode;
+	char UDN[NAME_SIZE];
+	int token;
+	int rc;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	rc = CCTvCtrlPointGetDevice(reg, devnum, &devnode);
+	if (CCTV_SUCCESS == rc)
+		strcpy(UDN, devnode->device.UDN);
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	if (CCTV_SUCCESS == rc && CCTvRecoveryReset(UDN) != CCTV_SUCCESS)
+		SampleUtil_Print("%s is not in recovery\n", UDN);
+
+	return rc;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointExpire
+ *
+ * Description: 
+ *       Timer callback run when the advertisement of a device expires.
+ *       Removes the device from the global device list, unless it was
+ *       refreshed while the callback was on its way.
+ *
+ * Parameters:
+ *   timer -- The expiry timer of the device
+ *   arg -- The device node
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointExpire(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvDeviceNode *node = (struct CCTvDeviceNode *)arg;
+	int removed = 0;
+
+	ithread_mutex_lock(&DeviceListMutex);
+	if (CCTvTimerRemaining(&TimerWheel, timer) < 0 &&
+	    CCTvRegistryFind(CCTvDeviceTableWriterView(&DeviceTable),
+		CCTV_KEY_UDN, node->device.UDN, NULL) == node) {
+		CCTvDeviceTableRemove(&DeviceTable, node);
+		removed = 1;
+	}
+	ithread_mutex_unlock(&DeviceListMutex);
+
+	/* no reader can reach the node any more */
+	if (removed && node->device.Unverified) {
+		/* gone since the snapshot, nothing to recover */
+		SampleUtil_Print("Restored device %s was not seen again\n",
+			node->device.UDN);
+		CCTvCtrlPointFreeNode(node, 1);
+	} else if (removed) {
+		SampleUtil_Print("Advertisement of %s expired\n",
+			node->device.UDN);
+		CCTvRecoveryExpired(node->device.UDN);
+		CCTvCtrlPointFreeNode(node, 1);
+	}
+}
+
+/********************************************************************************
+ * CCTvCtrlPointResearch
+ *
+ * Description: 
+ *       Timer callback run when the advertisement of a device is about to
+ *       expire.  Queues a search request for the device, to try to renew
+ *       it; the search itself is sent when the search window closes.
+ *
+ * Parameters:
+ *   timer -- The search timer of the device
+ *   arg -- The device node
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointResearch(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvDeviceNode *node = (struct CCTvDeviceNode *)arg;
+
+	if (CCTvResearchDue(node->device.UDN, CCTvDeviceType) != CCTV_SUCCESS)
+		SampleUtil_Print("Error queueing search request for Device UDN: %s\n",
+			node->device.UDN);
+	timer = timer;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointSearch
+ *
+ * Description: 
+ *       Send a search request for a UDN or device type, on behalf of the
+ *       re-search batching.
+ *
+ * Parameters:
+ *   target -- The search target
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointSearch(const char *target)
+{
+	int ret;
+
+	ret = UpnpSearchAsync(ctrlpt_handle, CCTV_RESEARCH_MX, target, NULL);
+	if (ret != UPNP_E_SUCCESS)
+		SampleUtil_Print
+		    ("Error sending search request for %s -- err = %d\n",
+		     target, ret);
+
+	return ret;
+}
+
+void CCTvCtrlPointArmTimers(struct CCTvDeviceNode *node, int expires)
+{
+	long lifetime = (long)expires * 1000L;
+
+	/* cameras that advertised together are not searched for together */
+	CCTvTimerArm(&TimerWheel, &node->device.SearchTimer,
+		CCTvResearchDelay(node->device.UDN, lifetime,
+			CCTV_RESEARCH_MARGIN * 1000L));
+	CCTvTimerArm(&TimerWheel, &node->device.ExpiryTimer, lifetime);
+	ithread_mutex_lock(&DeviceStateMutex);
+	if (node->device.Slot >= 0)
+		CCTV_HOT(&HotTable, node->device.Slot, expiry) =
+			CCTvHotNow() + expires;
+	ithread_mutex_unlock(&DeviceStateMutex);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointRefreshDevice
+ *
+ * Description: 
+ *       Update the advertisement expiration timeout of a known device.
+ *
+ * Parameters:
+ *   UDN -- The Unique Device Name of the device
+ *   expires -- The expiration time for this advertisement
+ *
+ * Returns CCTV_SUCCESS, or CCTV_ERROR if the device is not in the list or
+ * only restored from a snapshot.
+ *
+ ********************************************************************************/
+int CCTvCtrlPointRefreshDevice(const char *UDN, int expires)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *tmpdevnode;
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	tmpdevnode = CCTvRegistryFind(reg, CCTV_KEY_UDN, UDN, NULL);
+	if (tmpdevnode && tmpdevnode->device.Unverified) {
+		/* only its description verifies a restored device */
+		tmpdevnode = NULL;
+	} else if (tmpdevnode) {
+		/* the node cannot be deleted before the read section ends */
+		CCTvCtrlPointArmTimers(tmpdevnode, expires);
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+	if (tmpdevnode)
+		CCTvRecoveryAlive(UDN, 0);
+
+	return tmpdevnode ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointLoadActions
+ *
+ * Description: 
+ *       Download the SCPD of a service from a device and build the
+ *       action templates of the service from it.
+ *
+ * Parameters:
+ *   DescDoc -- The description document of the device
+ *   baseURL -- The base URL of the description document
+ *   service -- The service index
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointLoadActions(IXML_Document *DescDoc,
+	const char *baseURL, int service)
+{
+	IXML_Document *scpd = NULL;
+	char *relURL;
+	char *scpdURL = NULL;
+	int ret;
+
+	/* the device has a single service, whose SCPDURL comes first */
+	relURL = SampleUtil_GetFirstDocumentItem(DescDoc, "SCPDURL");
+	if (!relURL)
+		return;
+	ret = UpnpResolveURL2(baseURL, relURL, &scpdURL);
+	if (ret == UPNP_E_SUCCESS)
+		ret = UpnpDownloadXmlDoc(scpdURL, &scpd);
+	if (ret != UPNP_E_SUCCESS)
+		SampleUtil_Print("Error obtaining SCPD from %s -- %d\n",
+			scpdURL ? scpdURL : relURL, ret);
+	else
+		CCTvActionCacheLoad(service, CCTvServiceType[service], scpd);
+	if (scpd)
+		ixmlDocument_free(scpd);
+	free(scpdURL);
+	free(relURL);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointIntern
+ *
+ * Description: 
+ *       Return the shared copy of a string many devices have in common.
+ *       Must be called with DeviceListMutex held.
+ *
+ * Parameters:
+ *   str -- The string
+ *
+ * Returns the shared copy, or NULL if out of memory.
+ *
+ ********************************************************************************/
+static const char *CCTvCtrlPointIntern(const char *str)
+{
+	struct CCTvInterned *interned;
+
+	for (interned = Interned; interned; interned = interned->next) {
+		if (strcmp(interned->str, str) == 0)
+			return interned->str;
+	}
+	interned = (struct CCTvInterned *)malloc(sizeof *interned);
+	if (!interned)
+		return NULL;
+	interned->str = strdup(str);
+	if (!interned->str) {
+		free(interned);
+		return NULL;
+	}
+	interned->next = Interned;
+	Interned = interned;
+
+	return interned->str;
+}
+
+/*!
+ * \brief Free the shared strings, once no device is left.
+ */
+static void CCTvCtrlPointFreeInterned(void)
+{
+	struct CCTvInterned *interned;
+
+	while (Interned) {
+		interned = Interned;
+		Interned = interned->next;
+		free(interned->str);
+		free(interned);
+	}
+}
+
+/********************************************************************************
+ * CCTvCtrlPointPack
+ *
+ * Description: 
+ *       Copy a string into the space behind a device node.
+ *
+ * Parameters:
+ *   space -- Where the next string goes, moved past the copy
+ *   str -- The string
+ *
+ * Returns the copy.
+ *
+ ********************************************************************************/
+static const char *CCTvCtrlPointPack(char **space, const char *str)
+{
+	char *copy = *space;
+	size_t len = strlen(str) + 1;
+
+	memcpy(copy, str, len);
+	*space += len;
+
+	return copy;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointNewNode
+ *
+ * Description: 
+ *       Allocate a device node with its strings and the buffers of its
+ *       state variables packed behind it, so that freeing the node frees
+ *       them all, and give it a slot in HotTable.  Must be called with
+ *       DeviceListMutex held.
+ *
+ * Parameters:
+ *   UDN -- The Unique Device Name of the device
+ *   location -- The location of its description document
+ *   friendlyName -- Its friendly name
+ *   presURL -- Its presentation URL
+ *   serviceId -- The ServiceId of each service, NULL if not found
+ *   eventURL -- The EventURL of each service
+ *   controlURL -- The ControlURL of each service
+ *
+ * Returns the node, or NULL if out of memory.
+ *
+ ********************************************************************************/
+static struct CCTvDeviceNode *CCTvCtrlPointNewNode(
+	const char *UDN,
+	const char *location,
+	const char *friendlyName,
+	const char *presURL,
+	char **serviceId,
+	char **eventURL,
+	char **controlURL)
+{
+	struct CCTvDeviceNode *node;
+	struct cctv_service *s;
+	const char *sharedId[CCTV_SERVICE_SERVCOUNT];
+	size_t size;
+	char *space;
+	int service;
+	int var;
+
+	size = sizeof *node + strlen(UDN) + strlen(location) +
+		strlen(friendlyName) + strlen(presURL) + 4;
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		sharedId[service] = NULL;
+		if (!serviceId[service])
+			continue;
+		sharedId[service] = CCTvCtrlPointIntern(serviceId[service]);
+		if (!sharedId[service])
+			return NULL;
+		size += strlen(eventURL[service]) +
+			strlen(controlURL[service]) + 2 +
+			(size_t)CCTvVarCount[service] * CCTV_MAX_VAL_LEN;
+	}
+	node = (struct CCTvDeviceNode *)calloc(1, size);
+	if (!node)
+		return NULL;
+	space = (char *)(node + 1);
+
+	node->device.UDN = CCTvCtrlPointPack(&space, UDN);
+	node->device.DescDocURL = CCTvCtrlPointPack(&space, location);
+	node->device.FriendlyName = CCTvCtrlPointPack(&space, friendlyName);
+	node->device.PresURL = CCTvCtrlPointPack(&space, presURL);
+	CCTvTimerInit(&node->device.ExpiryTimer, CCTvCtrlPointExpire, node);
+	CCTvTimerInit(&node->device.SearchTimer, CCTvCtrlPointResearch, node);
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		s = &node->device.CCTvService[service];
+		if (!sharedId[service]) {
+			/* not found */
+			s->ServiceId = "";
+			s->ServiceType = "";
+			s->EventURL = "";
+			s->ControlURL = "";
+			continue;
+		}
+		s->ServiceId = sharedId[service];
+		s->ServiceType = CCTvServiceType[service];
+		s->ControlURL = CCTvCtrlPointPack(&space, controlURL[service]);
+		s->EventURL = CCTvCtrlPointPack(&space, eventURL[service]);
+		/* subscribed once the node is in the table, the SID is
+		 * filled in on SUBSCRIBE_COMPLETE */
+		s->SubState = CCTV_SUB_SUBSCRIBING;
+		for (var = 0; var < CCTvVarCount[service]; var++) {
+			/* zeroed, so empty */
+			s->VariableStrVal[var] = space;
+			space += CCTV_MAX_VAL_LEN;
 		}
 	}
-	SampleUtil_Print("\n");
-	ithread_mutex_unlock(&DeviceListMutex);
 
-	return CCTV_SUCCESS;
+	ithread_mutex_lock(&DeviceStateMutex);
+	node->device.Slot = CCTvHotAlloc(&HotTable, node);
+	ithread_mutex_unlock(&DeviceStateMutex);
+	if (node->device.Slot < 0)
+		SampleUtil_Print("No room for device %s in the hot table\n",
+			UDN);
+
+	return node;
+}
+
+/*!
+ * \brief Store the value of a state variable of a device, cut to the size
+ * of its slot, and mirror power and temperature in HotTable.
+ */
+static void CCTvStateStore(struct CCTvDeviceNode *node, int service,
+	int var, const char *value)
+{
+	char *slot = node->device.CCTvService[service].VariableStrVal[var];
+	int hot = node->device.Slot;
+
+	ithread_mutex_lock(&DeviceStateMutex);
+	strncpy(slot, value, CCTV_MAX_VAL_LEN - 1);
+	slot[CCTV_MAX_VAL_LEN - 1] = '\0';
+	if (hot >= 0 && service == CCTV_SERVICE_CONTROL) {
+		if (var == CCTV_CONTROL_POWER)
+			CCTV_HOT(&HotTable, hot, power) = atoi(value) != 0;
+		else
+			CCTV_HOT(&HotTable, hot, temperature) =
+				(short)atoi(value);
+	}
+	ithread_mutex_unlock(&DeviceStateMutex);
 }
 
 /********************************************************************************
- * CCTvCtrlPointAddDevice
+ * CCTvCtrlPointCopyValues
+ *
+ * Description: 
+ *       Copy the state variable values of a device node to the node
+ *       replacing it, until events update them.
+ *
+ * Parameters:
+ *   from -- The old node
+ *   to -- The new node
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointCopyValues(const struct CCTvDeviceNode *from,
+	struct CCTvDeviceNode *to)
+{
+	char value[CCTV_SERVICE_SERVCOUNT][CCTV_MAXVARS][CCTV_MAX_VAL_LEN];
+	int service;
+	int var;
+
+	ithread_mutex_lock(&DeviceStateMutex);
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		for (var = 0; var < CCTvVarCount[service]; var++) {
+			strcpy(value[service][var], from->device.
+				CCTvService[service].VariableStrVal[var] ?
+				from->device.CCTvService[service].
+				VariableStrVal[var] : "");
+		}
+	}
+	ithread_mutex_unlock(&DeviceStateMutex);
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		if (!to->device.CCTvService[service].VariableStrVal[0])
+			continue;
+		for (var = 0; var < CCTvVarCount[service]; var++) {
+			if (value[service][var][0])
+				CCTvStateStore(to, service, var,
+					value[service][var]);
+		}
+	}
+}
+
+/********************************************************************************
+ * CCTvCtrlPointAddOne
  *
  * Description: 
- *       If the device is not already included in the global device list,
- *       add it.  Otherwise, update its advertisement expiration timeout.
+ *       Add one device of a description document, the root device or an
+ *       embedded one, as CCTvCtrlPointAddDevice() does.
  *
  * Parameters:
- *   DescDoc -- The description document for the device
+ *   DescDoc -- The description document
+ *   device -- The device element in it
  *   location -- The location of the description document URL
+ *   base -- The URL relative URLs are resolved against
  *   expires -- The expiration time for this advertisement
  *
+ * Returns CCTV_SUCCESS if the device was added or is already known,
+ * CCTV_WARNING if it is not a CCTv device, CCTV_ERROR otherwise.
+ *
  ********************************************************************************/
-void CCTvCtrlPointAddDevice(
+static int CCTvCtrlPointAddOne(
 	IXML_Document *DescDoc,
+	IXML_Element *device,
 	const char *location,
+	const char *base,
 	int expires)
 {
 	char *deviceType = NULL;
 	char *friendlyName = NULL;
 	char *presURL = NULL;
-	char *baseURL = NULL;
 	char *relURL = NULL;
 	char *UDN = NULL;
 	char *serviceId[CCTV_SERVICE_SERVCOUNT] = { NULL, NULL };
 	char *eventURL[CCTV_SERVICE_SERVCOUNT] = { NULL, NULL };
 	char *controlURL[CCTV_SERVICE_SERVCOUNT] = { NULL, NULL };
-	Upnp_SID eventSID[CCTV_SERVICE_SERVCOUNT];
-	int TimeOut[CCTV_SERVICE_SERVCOUNT] = {
-		default_timeout,
-		default_timeout
-	};
 	struct CCTvDeviceNode *deviceNode;
-	struct CCTvDeviceNode *tmpdevnode;
-	int ret = 1;
-	int found = 0;
+	struct CCTvDeviceNode *tmpdevnode = NULL;
+	struct CCTvDeviceNode *failed = NULL;
+	struct CCTvDeviceNode *stale = NULL;
+	int result = CCTV_WARNING;
 	int service;
-	int var;
-
-	ithread_mutex_lock(&DeviceListMutex);
+	int locked = 0;
+	int added = 0;
 
 	/* Read key elements from description document */
-	UDN = SampleUtil_GetFirstDocumentItem(DescDoc, "UDN");
-	deviceType = SampleUtil_GetFirstDocumentItem(DescDoc, "deviceType");
-	friendlyName = SampleUtil_GetFirstDocumentItem(DescDoc, "friendlyName");
-	baseURL = SampleUtil_GetFirstDocumentItem(DescDoc, "URLBase");
-	relURL = SampleUtil_GetFirstDocumentItem(DescDoc, "presentationURL");
-
-	ret = UpnpResolveURL2((baseURL ? baseURL : location), relURL, &presURL);
-
-/*	if (UPNP_E_SUCCESS != ret)
-		SampleUtil_Print("Error generating presURL from %s + %s\n",
-				 baseURL, relURL);*/
-
-	if (strcmp(deviceType, CCTvDeviceType) == 0) {
-
-		/* Check if this device is already in the list */
-		tmpdevnode = GlobalDeviceList;
-		while (tmpdevnode) {
-			if (strcmp(tmpdevnode->device.UDN, UDN) == 0) {
-				found = 1;
-				break;
+	UDN = SampleUtil_GetDeviceItem(device, "UDN");
+	deviceType = SampleUtil_GetDeviceItem(device, "deviceType");
+	friendlyName = SampleUtil_GetDeviceItem(device, "friendlyName");
+	relURL = SampleUtil_GetDeviceItem(device, "presentationURL");
+
+	/* a device without a presentation page is still usable */
+	UpnpResolveURL2(base, relURL, &presURL);
+
+	/* a worker only takes the cameras of a description it was handed,
+	 * the others belong to other shards */
+	if (ShardRole == CCTV_ROLE_WORKER && UDN &&
+	    !CCTvDiscoveryWanted(location, UDN)) {
+		result = CCTV_SUCCESS;
+	} else if (deviceType && UDN &&
+		   strcmp(deviceType, CCTvDeviceType) == 0) {
+		result = CCTV_SUCCESS;
+
+		/* Check if this device is already in the list, which is by
+		 * far the common case and does not need the writer lock.
+		 * If so, just update the advertisement timeout field */
+		if (CCTvCtrlPointRefreshDevice(UDN, expires) != CCTV_SUCCESS) {
+			ithread_mutex_lock(&DeviceListMutex);
+			locked = 1;
+			/* another writer may have added it meanwhile */
+			tmpdevnode = CCTvRegistryFind(
+				CCTvDeviceTableWriterView(&DeviceTable),
+				CCTV_KEY_UDN, UDN, NULL);
+			if (tmpdevnode && tmpdevnode->device.Unverified) {
+				/* restored from a snapshot: replace it by the
+				 * device as it describes itself now */
+				CCTvDeviceTableRemove(&DeviceTable, tmpdevnode);
+				stale = tmpdevnode;
+				tmpdevnode = NULL;
 			}
-			tmpdevnode = tmpdevnode->next;
 		}
-
-		if (found) {
-			/* The device is already there, so just update  */
-			/* the advertisement timeout field */
-			tmpdevnode->device.AdvrTimeOut = expires;
-		} else {
-			
+		if (locked && !tmpdevnode) {
 			SampleUtil_Print("=========Found CCTv device=========\n");
 			for (service = 0; service < CCTV_SERVICE_SERVCOUNT;
 			     service++) {
-				if (SampleUtil_FindAndParseService
-				    (DescDoc, location, CCTvServiceType[service],
+				if (!SampleUtil_FindAndParseDeviceService
+				    (device, base, CCTvServiceType[service],
 				     &serviceId[service], &eventURL[service],
 				     &controlURL[service])) {
-					SampleUtil_Print
-					    ("Subscribing to EventURL %s...\n",
-					     eventURL[service]);
-					ret =
-					    UpnpSubscribe(ctrlpt_handle,
-							  eventURL[service],
-							  &TimeOut[service],
-							  eventSID[service]);
-					if (ret == UPNP_E_SUCCESS) {
-						SampleUtil_Print
-						    ("Subscribed to EventURL with SID=%s\n",
-						     eventSID[service]);
-					} else {
-						SampleUtil_Print
-						    ("Error Subscribing to EventURL -- %d\n",
-						     ret);
-						strcpy(eventSID[service], "");
-					}
-				} else {
 					SampleUtil_Print
 					    ("Error: Could not find Service: %s\n",
 					     CCTvServiceType[service]);
 				}
 			}
 			/* Create a new device node */
-			deviceNode =
-			    (struct CCTvDeviceNode *)
-			    malloc(sizeof(struct CCTvDeviceNode));
-			strcpy(deviceNode->device.UDN, UDN);
-			strcpy(deviceNode->device.DescDocURL, location);
-			strcpy(deviceNode->device.FriendlyName, friendlyName);
-			strcpy(deviceNode->device.PresURL, presURL);
-			deviceNode->device.AdvrTimeOut = expires;
-			for (service = 0; service < CCTV_SERVICE_SERVCOUNT;
-			     service++) {
-				if (serviceId[service] == NULL) {
-					/* not found */
-					continue;
-				}
-				strcpy(deviceNode->device.CCTvService[service].
-				       ServiceId, serviceId[service]);
-				strcpy(deviceNode->device.CCTvService[service].
-				       ServiceType, CCTvServiceType[service]);
-				strcpy(deviceNode->device.CCTvService[service].
-				       ControlURL, controlURL[service]);
-				strcpy(deviceNode->device.CCTvService[service].
-				       EventURL, eventURL[service]);
-				strcpy(deviceNode->device.CCTvService[service].
-				       SID, eventSID[service]);
-				for (var = 0; var < CCTvVarCount[service]; var++) {
-					deviceNode->device.
-					    CCTvService[service].VariableStrVal
-					    [var] =
-					    (char *)malloc(CCTV_MAX_VAL_LEN);
-					strcpy(deviceNode->device.
-					       CCTvService[service].VariableStrVal
-					       [var], "");
-				}
-			}
-			deviceNode->next = NULL;
+			deviceNode = CCTvCtrlPointNewNode(UDN, location,
+				friendlyName ? friendlyName : "",
+				presURL ? presURL : "",
+				serviceId, eventURL, controlURL);
+			if (!deviceNode) {
+				SampleUtil_Print(
+					"Error allocating device %s\n", UDN);
+				result = CCTV_ERROR;
 			/* Insert the new device node in the list */
-			if ((tmpdevnode = GlobalDeviceList)) {
-				while (tmpdevnode) {
-					if (tmpdevnode->next) {
-						tmpdevnode = tmpdevnode->next;
-					} else {
-						tmpdevnode->next = deviceNode;
-						break;
-					}
-				}
+			} else if (CCTvDeviceTableInsert(&DeviceTable,
+				deviceNode) != CCTV_SUCCESS) {
+				SampleUtil_Print(
+					"Error adding device %s to the registry\n",
+					deviceNode->device.UDN);
+				failed = deviceNode;
+				result = CCTV_ERROR;
 			} else {
-				GlobalDeviceList = deviceNode;
+				/*Notify New Device Added */
+				if (!stale)
+					SampleUtil_StateUpdate(NULL, NULL,
+						deviceNode->device.UDN,
+						DEVICE_ADDED);
+				else
+					CCTvCtrlPointCopyValues(stale,
+						deviceNode);
+				CCTvCtrlPointArmTimers(deviceNode, expires);
+				added = 1;
 			}
-			/*Notify New Device Added */
-			SampleUtil_StateUpdate(NULL, NULL,
-					       deviceNode->device.UDN,
-					       DEVICE_ADDED);
 		}
 	}
 
-	ithread_mutex_unlock(&DeviceListMutex);
+	if (locked)
+		ithread_mutex_unlock(&DeviceListMutex);
+	if (failed)
+		CCTvCtrlPointDeleteNode(failed);
+	if (stale) {
+		CCTvCtrlPointDeleteNode(stale);
+		if (added)
+			SampleUtil_StateUpdate(NULL, NULL, UDN, DEVICE_ADDED);
+	}
+	if (added) {
+		CCTvRecoveryAlive(UDN, 1);
+		/* the camera may still be in recovery from an earlier life */
+		CCTvCtrlPointRecoveryChanged(UDN);
+		if (controlURL[CCTV_SERVICE_CONTROL])
+			CCTvPollAdd(UDN, controlURL[CCTV_SERVICE_CONTROL]);
+		/* neither lock is held, and nothing waits for the camera */
+		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+			if (serviceId[service])
+				CCTvSubscribeRequest(eventURL[service]);
+		}
+		/* this runs on a fetcher thread, so the download is fine */
+		if (serviceId[CCTV_SERVICE_CONTROL] &&
+		    !CCTvActionCacheReady(CCTV_SERVICE_CONTROL))
+			CCTvCtrlPointLoadActions(DescDoc, base,
+				CCTV_SERVICE_CONTROL);
+	}
 
 	if (deviceType)
 		free(deviceType);
@@ -764,8 +2599,6 @@ void CCTvCtrlPointAddDevice(
 		free(friendlyName);
 	if (UDN)
 		free(UDN);
-	if (baseURL)
-		free(baseURL);
 	if (relURL)
 		free(relURL);
 	if (presURL)
@@ -778,72 +2611,94 @@ void CCTvCtrlPointAddDevice(
 		if (eventURL[service])
 			free(eventURL[service]);
 	}
+
+	return result;
 }
 
-void CCTvStateUpdate(char *UDN, int Service, IXML_Document *ChangedVariables,
-		   char **State)
-{
-	IXML_NodeList *properties;
-	IXML_NodeList *variables;
-	IXML_Element *property;
-	IXML_Element *variable;
-	long unsigned int length;
-	long unsigned int length1;
-	long unsigned int i;
-	int j;
-	char *tmpstate = NULL;
-
-	SampleUtil_Print("CCTv State Update (service %d):\n", Service);
-	/* Find all of the e:property tags in the document */
-	properties = ixmlDocument_getElementsByTagName(ChangedVariables,
-		"e:property");
-	if (properties) {
-		length = ixmlNodeList_length(properties);
-		for (i = 0; i < length; i++) {
-			/* Loop through each property change found */
-			property = (IXML_Element *)ixmlNodeList_item(
-				properties, i);
-			/* For each variable name in the state table,
-			 * check if this is a corresponding property change */
-			for (j = 0; j < CCTvVarCount[Service]; j++) {
-				variables = ixmlElement_getElementsByTagName(
-					property, CCTvVarName[Service][j]);
-				/* If a match is found, extract 
-				 * the value, and update the state table */
-				if (variables) {
-					length1 = ixmlNodeList_length(variables);
-					if (length1) {
-						variable = (IXML_Element *)
-							ixmlNodeList_item(variables, 0);
-						tmpstate =
-						    SampleUtil_GetElementValue(variable);
-						if (tmpstate) {
-							strcpy(State[j], tmpstate);
-							SampleUtil_Print(
-								" Variable Name: %s New Value:'%s'\n",
-								CCTvVarName[Service][j], State[j]);
-						}
-						if (tmpstate)
-							free(tmpstate);
-						tmpstate = NULL;
-					}
-					ixmlNodeList_free(variables);
-					variables = NULL;
-				}
-			}
-		}
-		ixmlNodeList_free(properties);
+/********************************************************************************
+ * CCTvCtrlPointAddDevice
+ *
+ * Description: 
+ *       If the devices of a description, the root device and those
+ *       embedded in it, are not already included in the global device
+ *       list, add them.  Otherwise, update their advertisement expiration
+ *       timeout. A device restored from a snapshot is replaced, keeping
+ *       its last known state variable values.
+ *
+ * Parameters:
+ *   DescDoc -- The description document
+ *   location -- The location of the description document URL
+ *   expires -- The expiration time for this advertisement
+ *
+ * Returns CCTV_SUCCESS if a device was added or is already known and none
+ * failed, CCTV_WARNING if none is a CCTv device, CCTV_ERROR otherwise.
+ *
+ ********************************************************************************/
+int CCTvCtrlPointAddDevice(
+	IXML_Document *DescDoc,
+	const char *location,
+	int expires)
+{
+	IXML_NodeList *devices;
+	char *baseURL;
+	unsigned long n;
+	unsigned long i;
+	int result = CCTV_WARNING;
+	int rc;
+
+	baseURL = SampleUtil_GetFirstDocumentItem(DescDoc, "URLBase");
+	devices = ixmlDocument_getElementsByTagName(DescDoc, "device");
+	n = devices ? ixmlNodeList_length(devices) : 0;
+	for (i = 0; i < n; i++) {
+		rc = CCTvCtrlPointAddOne(DescDoc,
+			(IXML_Element *)ixmlNodeList_item(devices, i),
+			location, baseURL ? baseURL : location, expires);
+		if (rc == CCTV_ERROR)
+			result = CCTV_ERROR;
+		else if (rc == CCTV_SUCCESS && result == CCTV_WARNING)
+			result = CCTV_SUCCESS;
 	}
-	return;
-	UDN = UDN;
+	if (devices)
+		ixmlNodeList_free(devices);
+	free(baseURL);
+
+	return result;
+}
+
+/*! State table being updated by CCTvStateUpdate(). */
+struct CCTvStateUpdateArg {
+	struct CCTvDeviceNode *node;
+	int Service;
+};
+
+static void CCTvStateUpdateVar(int var, const char *value, void *arg)
+{
+	struct CCTvStateUpdateArg *update = (struct CCTvStateUpdateArg *)arg;
+
+	CCTvStateStore(update->node, update->Service, var, value);
+	SAMPLE_LOG(SAMPLE_LOG_DEBUG, " Variable Name: %s New Value:'%s'\n",
+		CCTvVarName[update->Service][var], value);
+}
+
+void CCTvStateUpdate(struct CCTvDeviceNode *node, int Service,
+		   IXML_Document *ChangedVariables)
+{
+	struct CCTvStateUpdateArg update;
+
+	SAMPLE_LOG(SAMPLE_LOG_DEBUG, "CCTv State Update (service %d):\n",
+		Service);
+	update.node = node;
+	update.Service = Service;
+	CCTvPropertySetParse(ChangedVariables, CCTvVarName[Service],
+		CCTvVarCount[Service], CCTvStateUpdateVar, &update);
 }
 
 /********************************************************************************
- * CCTvCtrlPointHandleEvent
+ * CCTvCtrlPointApplyEvent
  *
  * Description: 
- *       Handle a UPnP event that was received.  Process the event and update
- *       the appropriate service state table.
+ *       Update the service state table of the subscription with the
+ *       changes of an event.  Returns CCTV_ERROR if the SID is unknown.
  *
  * Parameters:
  *   sid -- The subscription id for the event
@@ -851,36 +2706,168 @@ void CCTvStateUpdate(char *UDN, int Service, IXML_Document *ChangedVariables,
  *   changes -- The DOM document representing the changes
  *
  ********************************************************************************/
-void CCTvCtrlPointHandleEvent(
+static int CCTvCtrlPointApplyEvent(
 	const char *sid,
 	int evntkey,
 	IXML_Document *changes)
 {
+	const struct CCTvRegistry *reg;
 	struct CCTvDeviceNode *tmpdevnode;
+	char UDN[NAME_SIZE];
 	int service;
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+
+	tmpdevnode = CCTvRegistryFind(reg, CCTV_KEY_SID, sid, &service);
+	if (tmpdevnode) {
+		strcpy(UDN, tmpdevnode->device.UDN);
+		SAMPLE_LOG(SAMPLE_LOG_DEBUG,
+			"Received CCTv %s Event: %d for SID %s\n",
+			CCTvServiceName[service],
+			evntkey,
+			sid);
+		CCTvStateUpdate(tmpdevnode, service, changes);
+	}
 
-	ithread_mutex_lock(&DeviceListMutex);
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+	if (!tmpdevnode)
+		return CCTV_ERROR;
+	CCTvRecoveryReport(UDN, 1);
+	CCTvPollEvent(UDN);
 
-	tmpdevnode = GlobalDeviceList;
-	while (tmpdevnode) {
-		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; ++service) {
-			if (strcmp(tmpdevnode->device.CCTvService[service].SID, sid) ==  0) {
-				SampleUtil_Print("Received CCTv %s Event: %d for SID %s\n",
-					CCTvServiceName[service],
-					evntkey,
-					sid);
-				CCTvStateUpdate(
-					tmpdevnode->device.UDN,
-					service,
-					changes,
-					(char **)&tmpdevnode->device.CCTvService[service].VariableStrVal);
-				break;
-			}
+	return CCTV_SUCCESS;
+}
+
+/********************************************************************************
+ * CCTvCtrlPointParkEvent
+ *
+ * Description: 
+ *       Keep an event for a SID that is not indexed yet, dropping the
+ *       events that waited too long and, if still full, the oldest one.
+ *       Called with ParkedMutex held.
+ *
+ * Parameters:
+ *   sid -- The subscription id for the event
+ *   evntkey -- The event key of the event
+ *   changes -- The DOM document representing the changes
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointParkEvent(
+	const char *sid,
+	int evntkey,
+	IXML_Document *changes)
+{
+	DOMString body;
+	double now;
+	int i;
+	int kept = 0;
+
+	body = ixmlPrintNode((IXML_Node *)changes);
+	if (!body)
+		return;
+	now = CCTvCtrlPointNowUs();
+	for (i = 0; i < ParkedCount; i++) {
+		if (now - ParkedEvents[i].parked > CCTV_PARKED_EVENT_US ||
+		    (i == 0 && ParkedCount == CCTV_PARKED_EVENTS)) {
+			ixmlFreeDOMString(ParkedEvents[i].changes);
+			continue;
 		}
-		tmpdevnode = tmpdevnode->next;
+		ParkedEvents[kept++] = ParkedEvents[i];
 	}
+	ParkedCount = kept;
+	memset(ParkedEvents[kept].sid, 0, sizeof ParkedEvents[kept].sid);
+	strncpy(ParkedEvents[kept].sid, sid,
+		sizeof ParkedEvents[kept].sid - 1);
+	ParkedEvents[kept].evntkey = evntkey;
+	ParkedEvents[kept].changes = body;
+	ParkedEvents[kept].parked = now;
+	ParkedCount++;
+}
 
-	ithread_mutex_unlock(&DeviceListMutex);
+/********************************************************************************
+ * CCTvCtrlPointReplayEvents
+ *
+ * Description: 
+ *       Apply the events parked for a SID that has just been indexed.
+ *
+ * Parameters:
+ *   sid -- The subscription id
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointReplayEvents(const char *sid)
+{
+	struct CCTvParkedEvent due[CCTV_PARKED_EVENTS];
+	IXML_Document *changes;
+	int ndue = 0;
+	int kept = 0;
+	int i;
+
+	ithread_mutex_lock(&ParkedMutex);
+	for (i = 0; i < ParkedCount; i++) {
+		if (strcmp(ParkedEvents[i].sid, sid) == 0)
+			due[ndue++] = ParkedEvents[i];
+		else
+			ParkedEvents[kept++] = ParkedEvents[i];
+	}
+	ParkedCount = kept;
+	ithread_mutex_unlock(&ParkedMutex);
+
+	for (i = 0; i < ndue; i++) {
+		changes = ixmlParseBuffer(due[i].changes);
+		if (changes) {
+			CCTvCtrlPointApplyEvent(sid, due[i].evntkey, changes);
+			ixmlDocument_free(changes);
+		}
+		ixmlFreeDOMString(due[i].changes);
+	}
+}
+
+/********************************************************************************
+ * CCTvCtrlPointFreeParked
+ *
+ * Description: 
+ *       Drop the parked events of subscriptions that never completed.
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointFreeParked(void)
+{
+	int i;
+
+	ithread_mutex_lock(&ParkedMutex);
+	for (i = 0; i < ParkedCount; i++)
+		ixmlFreeDOMString(ParkedEvents[i].changes);
+	ParkedCount = 0;
+	ithread_mutex_unlock(&ParkedMutex);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointHandleEvent
+ *
+ * Description: 
+ *       Handle a UPnP event that was received.  Process the event and update
+ *       the appropriate service state table, or keep it until the
+ *       subscription it belongs to completes.
+ *
+ * Parameters:
+ *   sid -- The subscription id for the event
+ *   eventkey -- The eventkey number for the event
+ *   changes -- The DOM document representing the changes
+ *
+ ********************************************************************************/
+void CCTvCtrlPointHandleEvent(
+	const char *sid,
+	int evntkey,
+	IXML_Document *changes)
+{
+	if (CCTvCtrlPointApplyEvent(sid, evntkey, changes) == CCTV_SUCCESS)
+		return;
+	/* The SID may be indexed between the lookup and the parking; look
+	 * again under ParkedMutex, which the replay takes after indexing. */
+	ithread_mutex_lock(&ParkedMutex);
+	if (CCTvCtrlPointApplyEvent(sid, evntkey, changes) != CCTV_SUCCESS)
+		CCTvCtrlPointParkEvent(sid, evntkey, changes);
+	ithread_mutex_unlock(&ParkedMutex);
 }
 
 /********************************************************************************
@@ -903,26 +2890,34 @@ void CCTvCtrlPointHandleSubscribeUpdate(
 	int timeout)
 {
 	struct CCTvDeviceNode *tmpdevnode;
+	struct cctv_service *s;
+	Upnp_SID oldsid;
 	int service;
 
 	ithread_mutex_lock(&DeviceListMutex);
 
-	tmpdevnode = GlobalDeviceList;
-	while (tmpdevnode) {
-		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
-			if (strcmp
-			    (tmpdevnode->device.CCTvService[service].EventURL,
-			     eventURL) == 0) {
-				SampleUtil_Print
-				    ("Received CCTv %s Event Renewal for eventURL %s\n",
-				     CCTvServiceName[service], eventURL);
-				strcpy(tmpdevnode->device.CCTvService[service].
-				       SID, sid);
-				break;
-			}
-		}
-
-		tmpdevnode = tmpdevnode->next;
+	tmpdevnode = CCTvRegistryFind(CCTvDeviceTableWriterView(&DeviceTable),
+		CCTV_KEY_EVENTURL, eventURL, &service);
+	if (tmpdevnode) {
+		s = &tmpdevnode->device.CCTvService[service];
+		SAMPLE_LOG(SAMPLE_LOG_DEBUG,
+			"Received CCTv %s Event Renewal for eventURL %s\n",
+			CCTvServiceName[service], eventURL);
+		/* only writers change the SID, no need for the state lock to
+		 * read it here */
+		strcpy(oldsid, s->SID);
+		ithread_mutex_lock(&DeviceStateMutex);
+		strcpy(s->SID, sid);
+		s->SubState = CCTV_SUB_SUBSCRIBED;
+		if (tmpdevnode->device.Slot >= 0 &&
+		    service == CCTV_SERVICE_CONTROL)
+			CCTV_HOT(&HotTable, tmpdevnode->device.Slot, sid_hash) =
+				CCTvRegistryHash(sid) | 1;
+		ithread_mutex_unlock(&DeviceStateMutex);
+		if (strcmp(oldsid, sid) != 0 &&
+		    CCTvDeviceTableUpdateSID(&DeviceTable, tmpdevnode,
+			service, oldsid, sid) != CCTV_SUCCESS)
+			SampleUtil_Print("Error indexing SID %s\n", sid);
 	}
 
 	ithread_mutex_unlock(&DeviceListMutex);
@@ -931,33 +2926,197 @@ void CCTvCtrlPointHandleSubscribeUpdate(
 	timeout = timeout;
 }
 
+/********************************************************************************
+ * CCTvCtrlPointSetSubState
+ *
+ * Description: 
+ *       Record the subscription state of the service with the given
+ *       event URL, for display.
+ *
+ * Parameters:
+ *   eventURL -- The event URL for the subscription
+ *   state -- One of enum CCTvSubState
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointSetSubState(const char *eventURL, int state)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *tmpdevnode;
+	int service;
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	tmpdevnode = CCTvRegistryFind(reg, CCTV_KEY_EVENTURL, eventURL,
+		&service);
+	if (tmpdevnode) {
+		ithread_mutex_lock(&DeviceStateMutex);
+		tmpdevnode->device.CCTvService[service].SubState = state;
+		/* the SID is kept for the renewal, but no longer counts */
+		if (tmpdevnode->device.Slot >= 0 &&
+		    service == CCTV_SERVICE_CONTROL &&
+		    state != CCTV_SUB_SUBSCRIBED)
+			CCTV_HOT(&HotTable, tmpdevnode->device.Slot, sid_hash) = 0;
+		ithread_mutex_unlock(&DeviceStateMutex);
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointHandleSubscribeComplete
+ *
+ * Description: 
+ *       Handle the outcome of an asynchronous subscription request, or
+ *       the error of one that could not be sent.  On success the SID is
+ *       stored in the device node, on failure a retry is scheduled with
+ *       backoff.
+ *
+ * Parameters:
+ *   eventURL -- The event URL for the subscription
+ *   sid -- The subscription id, if errCode is UPNP_E_SUCCESS
+ *   timeout  -- The timeout for the subscription
+ *   errCode -- The outcome of the request
+ *
+ ********************************************************************************/
+void CCTvCtrlPointHandleSubscribeComplete(
+	const char *eventURL,
+	const char *sid,
+	int timeout,
+	int errCode)
+{
+	Upnp_SID orphan;
+
+	CCTvCtrlPointRecoveryReport(CCTV_KEY_EVENTURL, eventURL,
+		CCTvRecoveryAnswered(errCode));
+	if (errCode != UPNP_E_SUCCESS) {
+		if (CCTvSubscribeFailed(eventURL, errCode) >= 0)
+			CCTvCtrlPointSetSubState(eventURL, CCTV_SUB_RETRYING);
+		return;
+	}
+	if (CCTvSubscribeDone(eventURL) != CCTV_SUCCESS) {
+		/* the device went away while the request was on its way */
+		memset(orphan, 0, sizeof orphan);
+		strncpy(orphan, sid, sizeof orphan - 1);
+		UpnpUnSubscribeAsync(ctrlpt_handle, orphan,
+			CCTvCtrlPointCallbackEventHandler, NULL);
+		return;
+	}
+	SAMPLE_LOG(SAMPLE_LOG_DEBUG, "Subscribed to EventURL with SID=%s\n",
+		sid);
+	CCTvCtrlPointHandleSubscribeUpdate(eventURL, sid, timeout);
+	/* the initial event may have come first */
+	CCTvCtrlPointReplayEvents(sid);
+}
+
 void CCTvCtrlPointHandleGetVar(
 	const char *controlURL,
 	const char *varName,
 	const DOMString varValue)
 {
 
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *tmpdevnode;
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+
+	tmpdevnode = CCTvRegistryFind(reg, CCTV_KEY_CONTROLURL,
+		controlURL, NULL);
+	if (tmpdevnode) {
+		SampleUtil_StateUpdate(varName, varValue,
+				       tmpdevnode->device.UDN,
+				       GET_VAR_COMPLETE);
+	}
+
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointHandlePolledVar
+ *
+ * Description: 
+ *       Store the value of a state variable read by the poller in the
+ *       service state table, without printing it.
+ *
+ * Parameters:
+ *   controlURL -- The control URL the variable was read from
+ *   varName -- The name of the variable
+ *   varValue -- Its value
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointHandlePolledVar(
+	const char *controlURL,
+	const char *varName,
+	const DOMString varValue)
+{
+	const struct CCTvRegistry *reg;
 	struct CCTvDeviceNode *tmpdevnode;
 	int service;
+	int var;
+	int token;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	tmpdevnode = CCTvRegistryFind(reg, CCTV_KEY_CONTROLURL, controlURL,
+		&service);
+	for (var = 0; tmpdevnode && varValue && var < CCTvVarCount[service];
+	     var++) {
+		if (strcmp(CCTvVarName[service][var], varName) != 0)
+			continue;
+		CCTvStateStore(tmpdevnode, service, var, varValue);
+		break;
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+}
 
-	ithread_mutex_lock(&DeviceListMutex);
+/********************************************************************************
+ * CCTvCtrlPointPollSend
+ *
+ * Description: 
+ *       Send one state variable query of the poller.  The completion
+ *       comes back to the callback with the cookie.
+ *
+ * Parameters:
+ *   controlURL -- The control URL of the device
+ *   varName -- The name of the variable
+ *   cookie -- The cookie of the request
+ *
+ ********************************************************************************/
+static int CCTvCtrlPointPollSend(const char *controlURL, const char *varName,
+	void *cookie)
+{
+	int rc;
+
+	rc = UpnpGetServiceVarStatusAsync(ctrlpt_handle, controlURL, varName,
+		CCTvCtrlPointCallbackEventHandler, cookie);
+	if (rc == UPNP_E_SUCCESS)
+		CCTvMetricsAdd(&CtrlPointMetrics[METRIC_GETVAR_SENT], 1);
+
+	return rc;
+}
+
+/*!
+ * \brief Forget a device that said byebye, or was dropped by the front-end.
+ */
+static void CCTvCtrlPointForget(const char *UDN)
+{
+	CCTvDiscoveryForget(UDN);
+	CCTvRecoveryByebye(UDN);
+	CCTvCtrlPointRemoveDevice(UDN);
+}
+
+/*!
+ * \brief Whether a device is in the device list.
+ */
+static int CCTvCtrlPointKnown(const char *UDN)
+{
+	const struct CCTvRegistry *reg;
+	int token;
+	int known;
 
-	tmpdevnode = GlobalDeviceList;
-	while (tmpdevnode) {
-		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
-			if (strcmp
-			    (tmpdevnode->device.CCTvService[service].ControlURL,
-			     controlURL) == 0) {
-				SampleUtil_StateUpdate(varName, varValue,
-						       tmpdevnode->device.UDN,
-						       GET_VAR_COMPLETE);
-				break;
-			}
-		}
-		tmpdevnode = tmpdevnode->next;
-	}
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	known = CCTvRegistryFind(reg, CCTV_KEY_UDN, UDN, NULL) != NULL;
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
 
-	ithread_mutex_unlock(&DeviceListMutex);
+	return known;
 }
 
 /********************************************************************************
@@ -984,8 +3143,8 @@ int CCTvCtrlPointCallbackEventHandler(Upnp_EventType EventType, const void *Even
 	case UPNP_DISCOVERY_ADVERTISEMENT_ALIVE:
 	case UPNP_DISCOVERY_SEARCH_RESULT: {
 		const UpnpDiscovery *d_event = (UpnpDiscovery *)Event;
-		IXML_Document *DescDoc = NULL;
 		const char *location = NULL;
+		const char *deviceId = NULL;
 		int errCode = UpnpDiscovery_get_ErrCode(d_event);
 
 		if (errCode != UPNP_E_SUCCESS) {
@@ -993,18 +3152,33 @@ int CCTvCtrlPointCallbackEventHandler(Upnp_EventType EventType, const void *Even
 				"Error in Discovery Callback -- %d\n", errCode);
 		}
 
+		CCTvMetricsAdd(&CtrlPointMetrics[
+			EventType == UPNP_DISCOVERY_SEARCH_RESULT ?
+			METRIC_SSDP_SEARCH : METRIC_SSDP_ALIVE], 1);
 		location = UpnpString_get_String(UpnpDiscovery_get_Location(d_event));
-		errCode = UpnpDownloadXmlDoc(location, &DescDoc);
-		if (errCode != UPNP_E_SUCCESS) {
-			SampleUtil_Print(
-				"Error obtaining device description from %s -- error = %d\n",
-				location, errCode);
-		} else {
-			CCTvCtrlPointAddDevice(
-				DescDoc, location, UpnpDiscovery_get_Expires(d_event));
+		deviceId = UpnpString_get_String(
+			UpnpDiscovery_get_DeviceID(d_event));
+		if (ShardRole == CCTV_ROLE_FRONTEND) {
+			/* the worker owning the camera fetches its description */
+			if (strcmp(UpnpString_get_String(
+				UpnpDiscovery_get_DeviceType(d_event)),
+				CCTvDeviceType) == 0)
+				CCTvRouterNotify(deviceId, location,
+					UpnpDiscovery_get_Expires(d_event));
+			break;
 		}
-		if (DescDoc) {
-			ixmlDocument_free(DescDoc);
+		/* a worker only gets its cameras from the front-end, and the
+		 * answers to its own searches for them */
+		if (ShardRole == CCTV_ROLE_WORKER &&
+		    (EventType != UPNP_DISCOVERY_SEARCH_RESULT ||
+		     !CCTvCtrlPointKnown(deviceId)))
+			break;
+		/* The description is downloaded by the discovery pool, do not
+		 * hold up the SDK thread for an HTTP round trip */
+		if (CCTvDiscoveryEnqueue(deviceId, location,
+			UpnpDiscovery_get_Expires(d_event)) == CCTV_WARNING) {
+			SAMPLE_LOG(SAMPLE_LOG_WARNING,
+				"Discovery queue full, dropped %s\n", location);
 		}
 		//CCTvCtrlPointPrintList();
 		break;
@@ -1022,17 +3196,34 @@ int CCTvCtrlPointCallbackEventHandler(Upnp_EventType EventType, const void *Even
 			SampleUtil_Print(
 				"Error in Discovery ByeBye Callback -- %d\n", errCode);
 		}
-		SampleUtil_Print("Received ByeBye for Device: %s\n", deviceId);
-		CCTvCtrlPointRemoveDevice(deviceId);
-		SampleUtil_Print("After byebye:\n");
-		CCTvCtrlPointPrintList();
+		CCTvMetricsAdd(&CtrlPointMetrics[METRIC_SSDP_BYEBYE], 1);
+		if (ShardRole == CCTV_ROLE_FRONTEND) {
+			CCTvRouterByebye(deviceId);
+			break;
+		}
+		if (ShardRole == CCTV_ROLE_WORKER)
+			break;
+		SAMPLE_LOG(SAMPLE_LOG_DEBUG, "Received ByeBye for Device: %s\n",
+			deviceId);
+		CCTvCtrlPointForget(deviceId);
+		if (SAMPLE_LOG_ENABLED(SAMPLE_LOG_DEBUG)) {
+			SampleUtil_Print("After byebye:\n");
+			CCTvCtrlPointPrintList();
+		}
 		break;
 	}
 	/* SOAP Stuff */
 	case UPNP_CONTROL_ACTION_COMPLETE: {
 		UpnpActionComplete *a_event = (UpnpActionComplete *)Event;
 		int errCode = UpnpActionComplete_get_ErrCode(a_event);
-		if (errCode != UPNP_E_SUCCESS) {
+
+		CCTvMetricsAdd(&CtrlPointMetrics[METRIC_ACTIONS_OK +
+			CCTvCtrlPointOutcome(errCode)], 1);
+		if (Cookie) {
+			CCTvCtrlPointHandleActionComplete(
+				(struct CCTvActionCookie *)Cookie, errCode,
+				UpnpActionComplete_get_ActionResult(a_event));
+		} else if (errCode != UPNP_E_SUCCESS) {
 			SampleUtil_Print("Error in  Action Complete Callback -- %d\n",
 				errCode);
 		}
@@ -1043,7 +3234,21 @@ int CCTvCtrlPointCallbackEventHandler(Upnp_EventType EventType, const void *Even
 	case UPNP_CONTROL_GET_VAR_COMPLETE: {
 		UpnpStateVarComplete *sv_event = (UpnpStateVarComplete *)Event;
 		int errCode = UpnpStateVarComplete_get_ErrCode(sv_event);
-		if (errCode != UPNP_E_SUCCESS) {
+
+		CCTvMetricsAdd(&CtrlPointMetrics[METRIC_GETVAR_OK +
+			CCTvCtrlPointOutcome(errCode)], 1);
+		CCTvCtrlPointRecoveryReport(CCTV_KEY_CONTROLURL,
+			UpnpString_get_String(UpnpStateVarComplete_get_CtrlUrl(sv_event)),
+			CCTvRecoveryAnswered(errCode));
+		if (Cookie) {
+			/* a background poll, kept quiet */
+			if (errCode == UPNP_E_SUCCESS)
+				CCTvCtrlPointHandlePolledVar(
+					UpnpString_get_String(UpnpStateVarComplete_get_CtrlUrl(sv_event)),
+					UpnpString_get_String(UpnpStateVarComplete_get_StateVarName(sv_event)),
+					UpnpStateVarComplete_get_CurrentVal(sv_event));
+			CCTvPollComplete(Cookie, errCode);
+		} else if (errCode != UPNP_E_SUCCESS) {
 			SampleUtil_Print(
 				"Error in Get Var Complete Callback -- %d\n", errCode);
 		} else {
@@ -1057,18 +3262,43 @@ int CCTvCtrlPointCallbackEventHandler(Upnp_EventType EventType, const void *Even
 	/* GENA Stuff */
 	case UPNP_EVENT_RECEIVED: {
 		UpnpEvent *e_event = (UpnpEvent *)Event;
+
+		CCTvMetricsAdd(&CtrlPointMetrics[METRIC_EVENTS], 1);
 		CCTvCtrlPointHandleEvent(
 			UpnpEvent_get_SID_cstr(e_event),
 			UpnpEvent_get_EventKey(e_event),
 			UpnpEvent_get_ChangedVariables(e_event));
 		break;
 	}
-	case UPNP_EVENT_SUBSCRIBE_COMPLETE:
-	case UPNP_EVENT_UNSUBSCRIBE_COMPLETE:
+	case UPNP_EVENT_SUBSCRIBE_COMPLETE: {
+		UpnpEventSubscribe *es_event = (UpnpEventSubscribe *)Event;
+
+		CCTvMetricsAdd(&CtrlPointMetrics[
+			UpnpEventSubscribe_get_ErrCode(es_event) == UPNP_E_SUCCESS ?
+			METRIC_SUBSCRIBE_OK : METRIC_SUBSCRIBE_ERROR], 1);
+		CCTvCtrlPointHandleSubscribeComplete(
+			UpnpString_get_String(UpnpEventSubscribe_get_PublisherUrl(es_event)),
+			UpnpString_get_String(UpnpEventSubscribe_get_SID(es_event)),
+			UpnpEventSubscribe_get_TimeOut(es_event),
+			UpnpEventSubscribe_get_ErrCode(es_event));
+		break;
+	}
+	case UPNP_EVENT_UNSUBSCRIBE_COMPLETE: {
+		UpnpEventSubscribe *es_event = (UpnpEventSubscribe *)Event;
+
+		errCode = UpnpEventSubscribe_get_ErrCode(es_event);
+		if (errCode != UPNP_E_SUCCESS) {
+			SampleUtil_Print(
+				"Error in Event Unsubscribe Callback -- %d\n", errCode);
+		}
+		break;
+	}
 	case UPNP_EVENT_RENEWAL_COMPLETE: {
 		UpnpEventSubscribe *es_event = (UpnpEventSubscribe *)Event;
 
 		errCode = UpnpEventSubscribe_get_ErrCode(es_event);
+		CCTvMetricsAdd(&CtrlPointMetrics[errCode == UPNP_E_SUCCESS ?
+			METRIC_RENEW_OK : METRIC_RENEW_ERROR], 1);
 		if (errCode != UPNP_E_SUCCESS) {
 			SampleUtil_Print(
 				"Error in Event Subscribe Callback -- %d\n", errCode);
@@ -1083,23 +3313,18 @@ int CCTvCtrlPointCallbackEventHandler(Upnp_EventType EventType, const void *Even
 	case UPNP_EVENT_AUTORENEWAL_FAILED:
 	case UPNP_EVENT_SUBSCRIPTION_EXPIRED: {
 		UpnpEventSubscribe *es_event = (UpnpEventSubscribe *)Event;
-		int TimeOut = default_timeout;
-		Upnp_SID newSID;
-
-		errCode = UpnpSubscribe(
-			ctrlpt_handle,
-			UpnpString_get_String(UpnpEventSubscribe_get_PublisherUrl(es_event)),
-			&TimeOut,
-			newSID);
-		if (errCode == UPNP_E_SUCCESS) {
-			SampleUtil_Print("Subscribed to EventURL with SID=%s\n", newSID);
-			CCTvCtrlPointHandleSubscribeUpdate(
-				UpnpString_get_String(UpnpEventSubscribe_get_PublisherUrl(es_event)),
-				newSID,
-				TimeOut);
-		} else {
-			SampleUtil_Print("Error Subscribing to EventURL -- %d\n", errCode);
-		}
+		const char *eventURL = UpnpString_get_String(
+			UpnpEventSubscribe_get_PublisherUrl(es_event));
+
+		CCTvMetricsAdd(&CtrlPointMetrics[
+			EventType == UPNP_EVENT_AUTORENEWAL_FAILED ?
+			METRIC_SUBSCRIPTION_LOST_RENEWAL :
+			METRIC_SUBSCRIPTION_LOST_EXPIRED], 1);
+		/* subscribe again through the same non-blocking path */
+		CCTvCtrlPointSetSubState(eventURL, CCTV_SUB_SUBSCRIBING);
+		if (CCTvSubscribeRequest(eventURL) != CCTV_SUCCESS)
+			SampleUtil_Print("Error Subscribing to EventURL %s\n",
+				eventURL);
 		break;
 	}
 	/* ignore these cases, since this is not a device */
@@ -1113,81 +3338,284 @@ int CCTvCtrlPointCallbackEventHandler(Upnp_EventType EventType, const void *Even
 	Cookie = Cookie;
 }
 
-void CCTvCtrlPointVerifyTimeouts(int incr)
+/********************************************************************************
+ * CCTvCtrlPointCollect
+ *
+ * Description: 
+ *       Add every device of the global device list to a snapshot.
+ *
+ * Parameters:
+ *   writer -- The snapshot
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointCollect(struct CCTvSnapshotWriter *writer)
 {
-	struct CCTvDeviceNode *prevdevnode;
-	struct CCTvDeviceNode *curdevnode;
-	int ret;
-
-	ithread_mutex_lock(&DeviceListMutex);
+	const struct CCTvRegistry *reg;
+	const struct CCTvDevice *dev;
+	struct CCTvSnapshotRecord record;
+	char value[CCTV_SERVICE_SERVCOUNT][CCTV_MAXVARS][CCTV_MAX_VAL_LEN];
+	int service;
+	int var;
+	int token;
+	int i;
 
-	prevdevnode = NULL;
-	curdevnode = GlobalDeviceList;
-	while (curdevnode) {
-		curdevnode->device.AdvrTimeOut -= incr;
-		/*SampleUtil_Print("Advertisement Timeout: %d\n", curdevnode->device.AdvrTimeOut); */
-		if (curdevnode->device.AdvrTimeOut <= 0) {
-			/* This advertisement has expired, so we should remove the device
-			 * from the list */
-			if (GlobalDeviceList == curdevnode)
-				GlobalDeviceList = curdevnode->next;
-			else
-				prevdevnode->next = curdevnode->next;
-			CCTvCtrlPointDeleteNode(curdevnode);
-			if (prevdevnode)
-				curdevnode = prevdevnode->next;
-			else
-				curdevnode = GlobalDeviceList;
-		} else {
-			if (curdevnode->device.AdvrTimeOut < 2 * incr) {
-				/* This advertisement is about to expire, so
-				 * send out a search request for this device
-				 * UDN to try to renew */
-				ret = UpnpSearchAsync(ctrlpt_handle, incr,
-						      curdevnode->device.UDN,
-						      NULL);
-				if (ret != UPNP_E_SUCCESS)
-					SampleUtil_Print
-					    ("Error sending search request for Device UDN: %s -- err = %d\n",
-					     curdevnode->device.UDN, ret);
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	for (i = 0; i < reg->count; i++) {
+		dev = &reg->devices[i]->device;
+		record.UDN = dev->UDN;
+		record.location = dev->DescDocURL;
+		record.friendlyName = dev->FriendlyName;
+		record.presURL = dev->PresURL;
+		ithread_mutex_lock(&DeviceStateMutex);
+		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+			for (var = 0; var < CCTV_MAXVARS; var++) {
+				strcpy(value[service][var],
+					var < CCTvVarCount[service] &&
+					dev->CCTvService[service].
+					VariableStrVal[var] ?
+					dev->CCTvService[service].
+					VariableStrVal[var] : "");
 			}
-			prevdevnode = curdevnode;
-			curdevnode = curdevnode->next;
 		}
+		ithread_mutex_unlock(&DeviceStateMutex);
+		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+			record.serviceId[service] =
+				dev->CCTvService[service].ServiceId;
+			record.eventURL[service] =
+				dev->CCTvService[service].EventURL;
+			record.controlURL[service] =
+				dev->CCTvService[service].ControlURL;
+			for (var = 0; var < CCTV_MAXVARS; var++)
+				record.values[service][var] =
+					value[service][var];
+		}
+		if (CCTvSnapshotAdd(writer, &record) != CCTV_SUCCESS)
+			break;
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+}
+
+/********************************************************************************
+ * CCTvCtrlPointRestoreDevice
+ *
+ * Description: 
+ *       List a device of a snapshot as unverified, unless it is known
+ *       already, and remember it for CCTvCtrlPointVerify().  It is removed
+ *       like any other device if it is not seen within
+ *       CCTV_SNAPSHOT_VERIFY_S seconds.
+ *
+ * Parameters:
+ *   record -- The device
+ *   arg -- Counter of the devices restored
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointRestoreDevice(const struct CCTvSnapshotRecord *record,
+	void *arg)
+{
+	char *serviceId[CCTV_SERVICE_SERVCOUNT];
+	char *eventURL[CCTV_SERVICE_SERVCOUNT];
+	char *controlURL[CCTV_SERVICE_SERVCOUNT];
+	struct CCTvDeviceNode *node = NULL;
+	struct CCTvDeviceNode *failed = NULL;
+	struct CCTvVerifyItem *item;
+	struct CCTvVerifyItem *grown;
+	int capacity;
+	int service;
+	int var;
+
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		/* only read by CCTvCtrlPointNewNode() */
+		serviceId[service] = *record->serviceId[service] ?
+			(char *)record->serviceId[service] : NULL;
+		eventURL[service] = (char *)record->eventURL[service];
+		controlURL[service] = (char *)record->controlURL[service];
 	}
 
+	ithread_mutex_lock(&DeviceListMutex);
+	/* search responses may be in already */
+	if (!CCTvRegistryFind(CCTvDeviceTableWriterView(&DeviceTable),
+		CCTV_KEY_UDN, record->UDN, NULL)) {
+		node = CCTvCtrlPointNewNode(record->UDN, record->location,
+			record->friendlyName, record->presURL,
+			serviceId, eventURL, controlURL);
+		if (node) {
+			node->device.Unverified = 1;
+			for (service = 0; service < CCTV_SERVICE_SERVCOUNT;
+			     service++) {
+				/* not subscribed until verified */
+				node->device.CCTvService[service].SubState =
+					CCTV_SUB_NONE;
+				if (!serviceId[service])
+					continue;
+				for (var = 0; var < CCTvVarCount[service];
+				     var++) {
+					if (*record->values[service][var])
+						CCTvStateStore(node, service,
+							var, record->
+							values[service][var]);
+				}
+			}
+			if (CCTvDeviceTableInsert(&DeviceTable, node) !=
+			    CCTV_SUCCESS) {
+				failed = node;
+				node = NULL;
+			} else {
+				SampleUtil_StateUpdate(NULL, NULL,
+					node->device.UDN, DEVICE_ADDED);
+				CCTvCtrlPointArmTimers(node,
+					CCTV_SNAPSHOT_VERIFY_S);
+			}
+		}
+	}
 	ithread_mutex_unlock(&DeviceListMutex);
+
+	if (failed)
+		CCTvCtrlPointDeleteNode(failed);
+	if (!node)
+		return;
+	(*(int *)arg)++;
+	if (VerifyCount == VerifyCapacity) {
+		capacity = VerifyCapacity ? VerifyCapacity * 2 : 256;
+		grown = (struct CCTvVerifyItem *)realloc(VerifyItems,
+			(size_t)capacity * sizeof *grown);
+		/* the search before the window closes verifies it too */
+		if (!grown)
+			return;
+		VerifyItems = grown;
+		VerifyCapacity = capacity;
+	}
+	item = &VerifyItems[VerifyCount];
+	item->UDN = strdup(record->UDN);
+	item->location = strdup(record->location);
+	if (item->UDN && item->location) {
+		VerifyCount++;
+	} else {
+		free(item->UDN);
+		free(item->location);
+	}
 }
 
-/*!
- * \brief Function that runs in its own thread and monitors advertisement
- * and subscription timeouts for devices in the global device list.
- */
-static int CCTvCtrlPointTimerLoopRun = 1;
-void *CCTvCtrlPointTimerLoop(void *args)
+/********************************************************************************
+ * CCTvCtrlPointVerify
+ *
+ * Description: 
+ *       Timer callback queueing the descriptions of restored devices for
+ *       download, as many as the discovery queue takes, and re-arming
+ *       itself until all are queued.  Devices seen meanwhile are skipped.
+ *
+ * Parameters:
+ *   timer -- VerifyTimer
+ *   arg -- Unused
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointVerify(struct CCTvTimer *timer, void *arg)
 {
-	/* how often to verify the timeouts, in seconds */
-	int incr = 30;
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *node;
+	struct CCTvVerifyItem *item;
+	int unverified;
+	int token;
+	int rc;
 
-	while (CCTvCtrlPointTimerLoopRun) {
-		isleep((unsigned int)incr);
-		CCTvCtrlPointVerifyTimeouts(incr);
+	for (; VerifyNext < VerifyCount; VerifyNext++) {
+		item = &VerifyItems[VerifyNext];
+		reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+		node = CCTvRegistryFind(reg, CCTV_KEY_UDN, item->UDN, NULL);
+		unverified = node && node->device.Unverified;
+		CCTvDeviceTableReadEnd(&DeviceTable, token);
+		if (!unverified)
+			continue;
+		rc = CCTvDiscoveryEnqueue(item->UDN, item->location,
+			CCTV_SNAPSHOT_VERIFY_S);
+		if (rc == CCTV_WARNING) {
+			CCTvTimerArm(&TimerWheel, timer, CCTV_VERIFY_RETRY_MS);
+			return;
+		}
+		/* stopped */
+		if (rc == CCTV_ERROR)
+			return;
 	}
+	arg = arg;
+}
 
-	return NULL;
-	args = args;
+/********************************************************************************
+ * CCTvCtrlPointVerifyStop
+ *
+ * Description: 
+ *       Stop queueing restored devices and forget them.  Called once the
+ *       discovery pool is stopped, so that the timer no longer re-arms.
+ *
+ ********************************************************************************/
+static void CCTvCtrlPointVerifyStop(void)
+{
+	int i;
+
+	if (!Restored)
+		return;
+	CCTvTimerCancel(&TimerWheel, &VerifyTimer);
+	for (i = 0; i < VerifyCount; i++) {
+		free(VerifyItems[i].UDN);
+		free(VerifyItems[i].location);
+	}
+	free(VerifyItems);
+	VerifyItems = NULL;
+	VerifyCount = 0;
+	VerifyCapacity = 0;
+	VerifyNext = 0;
+	Restored = 0;
+}
+
+int CCTvCtrlPointRestore(const char *path)
+{
+	int restored = 0;
+
+	if (Restored)
+		return CCTV_ERROR;
+	Restored = 1;
+	if (CCTvSnapshotLoad(path, CCTvCtrlPointRestoreDevice, &restored) >= 0)
+		SampleUtil_Print("Restored %d devices from %s, verifying\n",
+			restored, path);
+	/* fetched by the discovery pool, in parallel */
+	CCTvTimerInit(&VerifyTimer, CCTvCtrlPointVerify, NULL);
+	CCTvTimerArm(&TimerWheel, &VerifyTimer, 0);
+	if (CCTvSnapshotStart(path, CCTV_SNAPSHOT_PERIOD_MS,
+		CCTvCtrlPointCollect) != CCTV_SUCCESS) {
+		SampleUtil_Print("Error keeping the snapshot %s\n", path);
+		return CCTV_ERROR;
+	}
+
+	return restored;
+}
+
+int CCTvCtrlPointFrontEnd(const char *exe, int nshards, const char *dir)
+{
+	if (CCTvRouterStart(exe, nshards, dir) != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	ShardRole = CCTV_ROLE_FRONTEND;
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvCtrlPointWorker(void)
+{
+	ShardRole = CCTV_ROLE_WORKER;
 }
 
 /*!
  * \brief Call this function to initialize the UPnP library and start the CCTV
- * Control Point.  This function creates a timer thread and provides a
+ * Control Point.  This function starts the timer wheel and provides a
  * callback handler to process any UPnP events that are received.
  *
  * \return CCTV_SUCCESS if everything went well, else CCTV_ERROR.
  */
 int CCTvCtrlPointStart(print_string printFunctionPtr, state_update updateFunctionPtr, int combo)
 {
-	ithread_t timer_thread;
+	struct CCTvRecoveryOps recoveryOps = {
+		CCTvCtrlPointRecoveryProbe,
+		CCTvCtrlPointRecoveryReboot,
+		NULL,
+		CCTvCtrlPointRecoveryChanged
+	};
 	int rc;
 	unsigned short port = 0;
 	char *ip_address = NULL;
@@ -1195,7 +3623,53 @@ int CCTvCtrlPointStart(print_string printFunctionPtr, state_update updateFunctio
 	SampleUtil_Initialize(printFunctionPtr);
 	SampleUtil_RegisterUpdateFunction(updateFunctionPtr);
 
+	CCTvMetricsRegister(CtrlPointMetrics,
+		(int)(sizeof CtrlPointMetrics / sizeof CtrlPointMetrics[0]));
 	ithread_mutex_init(&DeviceListMutex, 0);
+	ithread_mutex_init(&DeviceStateMutex, 0);
+	ithread_mutex_init(&ParkedMutex, 0);
+	if (CCTvDeviceTableInit(&DeviceTable) != CCTV_SUCCESS) {
+		SampleUtil_Print("Error allocating the device registry\n");
+		return CCTV_ERROR;
+	}
+	CCTvHotInit(&HotTable);
+	if (CCTvTimerWheelStart(&TimerWheel, CCTV_TIMER_TICK_MS) !=
+	    CCTV_SUCCESS) {
+		SampleUtil_Print("Error starting the timer wheel\n");
+		return CCTV_ERROR;
+	}
+	CCTvResearchStart(&TimerWheel, CCTV_RESEARCH_WINDOW_MS,
+		CCTV_RESEARCH_TYPE_MIN, CCTvCtrlPointSearch);
+	CCTvRecoveryStart(&TimerWheel, NULL, &recoveryOps);
+	CCTvPollStart(&TimerWheel, NULL, CCTvVarName[CCTV_SERVICE_CONTROL],
+		CCTvVarCount[CCTV_SERVICE_CONTROL], CCTvCtrlPointPollSend);
+	CCTvFanoutStart(CCTvCtrlPointFanoutSend);
+	/* descriptions are fetched off the SDK callback threads, so the pool
+	 * must be up before the first SSDP callback can arrive */
+	rc = CCTvDiscoveryStart(CCTV_DISCOVERY_WORKERS,
+		CCTV_DISCOVERY_MAX_PENDING, NULL, CCTvCtrlPointAddDevice,
+		CCTvCtrlPointRefreshDevice);
+	if (rc != CCTV_SUCCESS) {
+		SampleUtil_Print("Error starting the discovery pool\n");
+		CCTvPollStop();
+		CCTvRecoveryStop();
+		CCTvResearchStop();
+		CCTvTimerWheelStop(&TimerWheel);
+		return CCTV_ERROR;
+	}
+	rc = CCTvSubscribeStart(&TimerWheel, &ctrlpt_handle,
+		CCTvCtrlPointCallbackEventHandler,
+		CCTvCtrlPointHandleSubscribeComplete, default_timeout);
+	if (rc != CCTV_SUCCESS) {
+		SampleUtil_Print("Error starting the subscriptions\n");
+		CCTvDiscoveryStop();
+		CCTvDiscoveryDestroy();
+		CCTvPollStop();
+		CCTvRecoveryStop();
+		CCTvResearchStop();
+		CCTvTimerWheelStop(&TimerWheel);
+		return CCTV_ERROR;
+	}
 
 	SampleUtil_Print("Initializing UPnP Sdk with\n"
 			 "\tipaddress = %s port = %u\n",
@@ -1205,6 +3679,14 @@ int CCTvCtrlPointStart(print_string printFunctionPtr, state_update updateFunctio
 	if (rc != UPNP_E_SUCCESS) {
 		SampleUtil_Print("WinCEStart: UpnpInit2() Error: %d\n", rc);
 		if (!combo) {
+			CCTvDiscoveryStop();
+			CCTvDiscoveryDestroy();
+		CCTvDiscoveryDestroy();
+			CCTvSubscribeStop();
+			CCTvPollStop();
+			CCTvRecoveryStop();
+			CCTvResearchStop();
+			CCTvTimerWheelStop(&TimerWheel);
 			UpnpFinish();
 
 			return CCTV_ERROR;
@@ -1225,6 +3707,13 @@ int CCTvCtrlPointStart(print_string printFunctionPtr, state_update updateFunctio
 				&ctrlpt_handle, &ctrlpt_handle);
 	if (rc != UPNP_E_SUCCESS) {
 		SampleUtil_Print("Error registering CP: %d\n", rc);
+		CCTvDiscoveryStop();
+		CCTvDiscoveryDestroy();
+		CCTvSubscribeStop();
+		CCTvPollStop();
+		CCTvRecoveryStop();
+		CCTvResearchStop();
+		CCTvTimerWheelStop(&TimerWheel);
 		UpnpFinish();
 
 		return CCTV_ERROR;
@@ -1232,21 +3721,45 @@ int CCTvCtrlPointStart(print_string printFunctionPtr, state_update updateFunctio
 
 	SampleUtil_Print("Control Point Registered\n");
 
-	CCTvCtrlPointRefresh();
-
-	/* start a timer thread */
-	ithread_create(&timer_thread, NULL, CCTvCtrlPointTimerLoop, NULL);
-	ithread_detach(timer_thread);
+	if (ShardRole == CCTV_ROLE_WORKER)
+		SampleUtil_Print("Waiting for cameras from the front-end\n");
+	else
+		CCTvCtrlPointRefresh();
 
 	return CCTV_SUCCESS;
 }
 
 int CCTvCtrlPointStop(void)
 {
-	CCTvCtrlPointTimerLoopRun = 0;
+	/* a scrape reads the modules stopped below */
+	CCTvMetricsStop();
+	/* results arriving from now on are dropped */
+	CCTvCtlSockStop();
+	/* no command is waiting for a worker any more */
+	CCTvRouterStop();
+	/* the last snapshot still has every device */
+	CCTvSnapshotStop();
+	CCTvFanoutStop();
+	CCTvPollStop();
+	CCTvRecoveryStop();
+	CCTvDiscoveryStop();
+	CCTvCtrlPointVerifyStop();
 	CCTvCtrlPointRemoveAll();
+	CCTvSubscribeStop();
+	CCTvResearchStop();
+	CCTvTimerWheelStop(&TimerWheel);
 	UpnpUnRegisterClient( ctrlpt_handle );
 	UpnpFinish();
+	/* no SDK callback can look a device up any more */
+	CCTvCtlSockDestroy();
+	CCTvRouterDestroy();
+	CCTvFanoutDestroy();
+	CCTvDiscoveryDestroy();
+	CCTvDeviceTableDestroy(&DeviceTable);
+	CCTvHotDestroy(&HotTable);
+	CCTvCtrlPointFreeInterned();
+	CCTvCtrlPointFreeParked();
+	CCTvActionCacheClear();
 	SampleUtil_Finish();
 
 	return CCTV_SUCCESS;
@@ -1274,7 +3787,26 @@ void CCTvCtrlPointPrintShortHelp(void)
 		"  PictAction        <devnum> <action>\n"
 		"  CtrlGetVar        <devnum> <varname>\n"
 		"  PictGetVar        <devnum> <action>\n"
-		"  Exit\n");
+		"  FleetAction       <action> <devices> [<inflight>]\n"
+		"  FleetStatus\n"
+		"  Latency\n"
+		"  LatencyDev        <devnum>\n"
+		"  LatencySlow       <ms>\n"
+		"  LatencyExport     <file>\n"
+		"  Recovery\n"
+		"  RecoveryReset     <devnum>\n"
+		"  RecoverySet       <name> <value>\n"
+		"  Poll\n"
+		"  PollSet           <name> <value>\n"
+		"  FleetHealth       <temperature>\n"
+		"  Stats\n"
+		"  Metrics\n"
+		"  LogLevel          <level>\n"
+		"  Shards\n"
+		"  Adopt             <UDN> <location> <expires>\n"
+		"  Drop              <UDN>\n"
+		"  Exit\n"
+		"A UDN can be given wherever a <devnum> is.\n");
 }
 
 void CCTvCtrlPointPrintLongHelp(void)
@@ -1329,8 +3861,87 @@ void CCTvCtrlPointPrintLongHelp(void)
 		"       Requests the value of a variable specified by the string <varname>\n"
 		"         from the Picture Service of device <devnum>.\n"
 		"         (e.g., \"PictGetVar 1 Tint\")\n"
+		"  FleetAction    <action> <devices> [<inflight>]\n"
+		"       Sends the action specified by the string <action> to the\n"
+		"         Control Service of a set of devices, at most <inflight>\n"
+		"         at a time (default 32), and prints a summary once all\n"
+		"         have answered.  <devices> is 'all', 'name=<text>' for\n"
+		"         the devices whose friendly name contains <text>, or a\n"
+		"         comma separated list of UDNs, devnums and devnum ranges.\n"
+		"         (e.g., \"FleetAction Reboot 1-300\")\n"
+		"  FleetStatus\n"
+		"       Print the progress of the FleetAction commands running.\n"
+		"  Latency\n"
+		"       Print the count, mean, 50th, 90th and 99th percentile and\n"
+		"         maximum latency in ms of every action sent, over all\n"
+		"         devices.\n"
+		"  LatencyDev     <devnum>\n"
+		"       Print the same for the actions sent to device <devnum>.\n"
+		"  LatencySlow    <ms>\n"
+		"       List the devices whose 99th percentile latency of some\n"
+		"         action is <ms> or more.\n"
+		"         (e.g., \"LatencySlow 2000\")\n"
+		"  LatencyExport  <file>\n"
+		"       Write the latency of every action, over all devices and\n"
+		"         per device, in microseconds to the CSV file <file>.\n"
+		"  Recovery\n"
+		"       Print the cameras being recovered automatically: a camera\n"
+		"         failing suspect_failures requests in a row is probed,\n"
+		"         rebooted if the probe fails, and watched until it comes\n"
+		"         back, or escalated after max_reboots reboots.\n"
+		"  RecoveryReset  <devnum>\n"
+		"       Put device <devnum> back to healthy, e.g. once an\n"
+		"         escalated camera was fixed by hand.\n"
+		"  RecoverySet    <name> <value>\n"
+		"       Change a recovery threshold: enabled (0 only tracks the\n"
+		"         cameras), suspect_failures, probe_ms, reboot_ms,\n"
+		"         boot_ms, verify_ms or max_reboots.\n"
+		"         (e.g., \"RecoverySet max_reboots 3\")\n"
+		"  Poll\n"
+		"       Print the background polling of Power and Temperature:\n"
+		"         cameras sending events are polled every up to max_ms,\n"
+		"         quiet ones every min_ms, at most rate requests a\n"
+		"         second and max_inflight at a time for the whole fleet.\n"
+		"  PollSet        <name> <value>\n"
+		"       Change a polling threshold: enabled, min_ms, max_ms,\n"
+		"         quiet_ms, rate or max_inflight.\n"
+		"         (e.g., \"PollSet rate 50\")\n"
+		"  FleetHealth    <temperature>\n"
+		"       Print how many devices are on, off, not subscribed,\n"
+		"         about to expire and in each recovery state, the range\n"
+		"         of their temperatures, and the devices at or above\n"
+		"         <temperature>.  Stats prints the same from 70.\n"
+		"         (e.g., \"FleetHealth 60\")\n"
+		"  Stats\n"
+		"       Print the control point counters, e.g. how long the last\n"
+		"         Refresh took to discover the fleet.\n"
+		"  Metrics\n"
+		"       Print the counters, gauges and histograms also served to\n"
+		"         Prometheus with -m, e.g. events received, actions sent\n"
+		"         and their latency, queue depths and recovery times.\n"
+		"  LogLevel       <level>\n"
+		"       Print only the messages up to <level>: error, warning,\n"
+		"         info or debug, which adds a line per event and\n"
+		"         subscription renewal.  Debug messages are only\n"
+		"         compiled into a debug build, where they are printed\n"
+		"         by default.\n"
+		"  Shards\n"
+		"       Print the workers of a sharded control point, whether\n"
+		"         they are up and how many cameras each owns.  The\n"
+		"         front-end sends a command naming a device by UDN to\n"
+		"         the worker owning it, and the other commands to all\n"
+		"         workers; device numbers are those of each worker.\n"
+		"  Adopt          <UDN> <location> <expires>\n"
+		"       Fetch the description of a camera and add it, as if it\n"
+		"         had advertised itself.  The front-end of a sharded\n"
+		"         control point sends these to its workers.\n"
+		"  Drop           <UDN>\n"
+		"       Remove a camera, as if it had said byebye.\n"
 		"  Exit\n"
-		"       Exits the control point application.\n");
+		"       Exits the control point application.\n"
+		"\n"
+		"A device can also be given by its UDN wherever a <devnum> is\n"
+		"  expected (e.g., \"PowerOn uuid:cctv-0001\").\n");
 }
 
 /*! Tags for valid commands issued at the command prompt. */
@@ -1351,6 +3962,24 @@ enum cmdloop_cctvcmds {
 	PRTDEV,
 	LSTDEV,
 	REFRESH,
+	PRTSTATS,
+	FLEETACTION,
+	FLEETSTATUS,
+	LATENCY,
+	LATENCYDEV,
+	LATENCYSLOW,
+	LATENCYEXPORT,
+	RECOVERY,
+	RECOVERYRESET,
+	RECOVERYSET,
+	POLL,
+	POLLSET,
+	FLEETHEALTH,
+	METRICS,
+	LOGLEVEL,
+	SHARDS,
+	ADOPT,
+	DROP,
 	EXITCMD
 };
 
@@ -1386,6 +4015,24 @@ static struct cmdloop_commands cmdloop_cmdlist[] = {
 	{"TopMountMiddle",      TOPMNTMID,   2, "<devnum>"},
 	{"CtrlAction",    CTRLACTION,  2, "<devnum> <action (string)>"},
 	{"CtrlGetVar",    CTRLGETVAR,  2, "<devnum> <varname (string)>"},
+	{"FleetAction",   FLEETACTION, 1, "<action> <devices> [<inflight>]"},
+	{"FleetStatus",   FLEETSTATUS, 1, ""},
+	{"Latency",       LATENCY,     1, ""},
+	{"LatencyDev",    LATENCYDEV,  2, "<devnum>"},
+	{"LatencySlow",   LATENCYSLOW, 2, "<ms>"},
+	{"LatencyExport", LATENCYEXPORT, 1, "<file>"},
+	{"Recovery",      RECOVERY,    1, ""},
+	{"RecoveryReset", RECOVERYRESET, 2, "<devnum>"},
+	{"RecoverySet",   RECOVERYSET, 1, "<name> <value>"},
+	{"Poll",          POLL,        1, ""},
+	{"PollSet",       POLLSET,     1, "<name> <value>"},
+	{"FleetHealth",   FLEETHEALTH, 2, "<temperature>"},
+	{"Stats",         PRTSTATS,    1, ""},
+	{"Metrics",       METRICS,     1, ""},
+	{"LogLevel",      LOGLEVEL,    1, "<level>"},
+	{"Shards",        SHARDS,      1, ""},
+	{"Adopt",         ADOPT,       1, "<UDN> <location> <expires>"},
+	{"Drop",          DROP,        1, "<UDN>"},
 	{"Exit", EXITCMD, 1, ""}
 };
 
@@ -1404,11 +4051,13 @@ void CCTvCtrlPointPrintCommands(void)
 
 void *CCTvCtrlPointCommandLoop(void *args)
 {
-	char cmdline[100];
+	char cmdline[CCTV_MAX_CMDLINE];
 
+	/* the output of a command is never dropped */
+	SampleUtil_SetLogWait(1);
 	while (1) {
 		SampleUtil_Print("\n>> ");
-		char *s = fgets(cmdline, 100, stdin);
+		char *s = fgets(cmdline, CCTV_MAX_CMDLINE, stdin);
 		if (!s)
 			break;
 		CCTvCtrlPointProcessCommand(cmdline);
@@ -1418,16 +4067,136 @@ void *CCTvCtrlPointCommandLoop(void *args)
 	args = args;
 }
 
+/*!
+ * \brief Number of a device in the device list.
+ *
+ * \return The devnum, or 0 if the device is not in the list.
+ */
+static int CCTvCtrlPointDevnum(const char *UDN)
+{
+	const struct CCTvRegistry *reg;
+	struct CCTvDeviceNode *node;
+	int devnum = 0;
+	int token;
+	int i;
+
+	reg = CCTvDeviceTableReadBegin(&DeviceTable, &token);
+	node = CCTvRegistryFind(reg, CCTV_KEY_UDN, UDN, NULL);
+	for (i = 0; node && i < reg->count; i++) {
+		if (reg->devices[i] == node) {
+			devnum = i + 1;
+			break;
+		}
+	}
+	CCTvDeviceTableReadEnd(&DeviceTable, token);
+
+	return devnum;
+}
+
+/*!
+ * \brief Hand a camera to the discovery pool, as its advertisement would.
+ * This runs on the command socket thread, which the front-end's SDK
+ * threads write to, so it never waits: when the queue is full the
+ * adoption is dropped and counted with the dropped notifications. The
+ * front-end routes the next advertisement of the camera here again.
+ */
+static int CCTvCtrlPointAdopt(const char *UDN, const char *location,
+	int expires)
+{
+	int rc;
+
+	rc = CCTvDiscoveryEnqueue(UDN, location, expires);
+	if (rc == CCTV_ERROR)
+		SampleUtil_Print("Cannot adopt %s\n", UDN);
+
+	return rc == CCTV_SUCCESS ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+/*!
+ * \brief Whether the front-end of a sharded control point sends a command
+ * to its workers rather than running it.
+ */
+static int CCTvCtrlPointRouted(int cmdnum)
+{
+	switch (cmdnum) {
+	case PRTHELP:
+	case PRTFULLHELP:
+	case REFRESH:
+	case PRTSTATS:
+	case LOGLEVEL:
+	case SHARDS:
+	case ADOPT:
+	case DROP:
+	case EXITCMD:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/*!
+ * \brief Send a command of the front-end to the worker owning the device
+ * it names, or to all workers.
+ */
+static int CCTvCtrlPointRouteCommand(int cmdnum, int bydevice,
+	const char *cmdline)
+{
+	struct CCTvRouterStats stats;
+	char cmd[CCTV_MAX_CMDLINE];
+	char strarg[CCTV_MAX_CMDLINE];
+	char line[CCTV_MAX_CMDLINE + 16];
+	int rc = CCTV_SUCCESS;
+	int shard;
+	int i;
+
+	if (bydevice) {
+		if (sscanf(cmdline, "%s %s", cmd, strarg) != 2 ||
+		    strncmp(strarg, "uuid:", 5) != 0) {
+			SampleUtil_Print("Give the UDN of the device; device "
+				"numbers are those of each worker\n");
+			return CCTV_ERROR;
+		}
+		shard = CCTvRouterOwner(strarg);
+		if (shard < 0) {
+			SampleUtil_Print("No worker is up\n");
+			return CCTV_ERROR;
+		}
+		return CCTvRouterCommand(shard, cmdline);
+	}
+	if (cmdnum == LATENCYEXPORT) {
+		/* a file of its own for every worker */
+		if (sscanf(cmdline, "%s %s", cmd, strarg) != 2) {
+			SampleUtil_Print("Invalid args in command; see 'Help'\n");
+			return CCTV_ERROR;
+		}
+		CCTvRouterGetStats(&stats);
+		for (i = 0; i < stats.shards; i++) {
+			snprintf(line, sizeof line, "%s %s.%d", cmd, strarg, i);
+			if (CCTvRouterCommand(i, line) != CCTV_SUCCESS)
+				rc = CCTV_ERROR;
+		}
+		return rc;
+	}
+
+	return CCTvRouterCommand(-1, cmdline);
+}
+
 int CCTvCtrlPointProcessCommand(char *cmdline)
 {
-	char cmd[100];
-	char strarg[100];
+	char cmd[CCTV_MAX_CMDLINE];
+	char strarg[CCTV_MAX_CMDLINE];
+	char selector[CCTV_MAX_CMDLINE];
+	char resolved[CCTV_MAX_CMDLINE + 16];
+	const char *rest;
+	sample_log_stats logstats;
 	int arg_val_err = -99999;
 	int arg1 = arg_val_err;
 	int arg2 = arg_val_err;
 	int cmdnum = -1;
 	int numofcmds = (sizeof cmdloop_cmdlist) / sizeof (cmdloop_commands);
 	int cmdfound = 0;
+	int bydevice;
+	int devnum;
 	int i;
 	int rc;
 	int invalidargs = 0;
@@ -1438,18 +4207,35 @@ int CCTvCtrlPointProcessCommand(char *cmdline)
 		if (strcasecmp(cmd, cmdloop_cmdlist[i].str ) == 0) {
 			cmdnum = cmdloop_cmdlist[i].cmdnum;
 			cmdfound++;
-			if (validargs != cmdloop_cmdlist[i].numargs)
-				invalidargs++;
 			break;
 		}
 	}
 	if (!cmdfound) {
 		SampleUtil_Print("Command not found; try 'Help'\n");
-		return CCTV_SUCCESS;
+		return CCTV_ERROR;
+	}
+	bydevice = strncmp(cmdloop_cmdlist[i].args, "<devnum", 7) == 0;
+	if (ShardRole == CCTV_ROLE_FRONTEND && CCTvCtrlPointRouted(cmdnum))
+		return CCTvCtrlPointRouteCommand(cmdnum, bydevice, cmdline);
+	if (bydevice && sscanf(cmdline, "%s %s", cmd, strarg) == 2 &&
+	    strncmp(strarg, "uuid:", 5) == 0) {
+		/* the same command with the device number of that UDN */
+		devnum = CCTvCtrlPointDevnum(strarg);
+		if (!devnum) {
+			SampleUtil_Print("No device %s\n", strarg);
+			return CCTV_ERROR;
+		}
+		rest = strstr(cmdline, strarg) + strlen(strarg);
+		snprintf(resolved, sizeof resolved, "%s %d%s", cmd, devnum,
+			rest);
+		cmdline = resolved;
+		validargs = sscanf(cmdline, "%s %d %d", cmd, &arg1, &arg2);
 	}
+	if (validargs != cmdloop_cmdlist[i].numargs)
+		invalidargs++;
 	if (invalidargs) {
 		SampleUtil_Print("Invalid arguments; try 'Help'\n");
-		return CCTV_SUCCESS;
+		return CCTV_ERROR;
 	}
 	switch (cmdnum) {
 	case PRTHELP:
@@ -1509,8 +4295,142 @@ int CCTvCtrlPointProcessCommand(char *cmdline)
 		CCTvCtrlPointPrintList();
 		break;
 	case REFRESH:
+		if (ShardRole == CCTV_ROLE_WORKER) {
+			SampleUtil_Print("The front-end searches for the "
+				"cameras\n");
+			return CCTV_ERROR;
+		}
 		CCTvCtrlPointRefresh();
 		break;
+	case FLEETACTION:
+		/* re-parse commandline since the args are strings. */
+		arg2 = 0;
+		validargs = sscanf(cmdline, "%s %s %s %d", cmd, strarg,
+			selector, &arg2);
+		if (validargs >= 3)
+			CCTvCtrlPointFleetAction(strarg, selector, arg2);
+		else
+			invalidargs++;
+		break;
+	case FLEETSTATUS:
+		CCTvFanoutPrintStatus();
+		break;
+	case LATENCY:
+		CCTvCtrlPointPrintLatency(0);
+		break;
+	case LATENCYDEV:
+		CCTvCtrlPointPrintLatency(arg1);
+		break;
+	case LATENCYSLOW:
+		CCTvCtrlPointPrintSlowDevices(arg1);
+		break;
+	case LATENCYEXPORT:
+		/* re-parse commandline since the arg is a string. */
+		validargs = sscanf(cmdline, "%s %s", cmd, strarg);
+		if (validargs == 2)
+			CCTvCtrlPointExportLatency(strarg);
+		else
+			invalidargs++;
+		break;
+	case RECOVERY:
+		CCTvRecoveryPrint();
+		CCTvRecoveryPrintStats();
+		break;
+	case RECOVERYRESET:
+		CCTvCtrlPointResetRecovery(arg1);
+		break;
+	case RECOVERYSET:
+		/* re-parse commandline since the first arg is a string. */
+		validargs = sscanf(cmdline, "%s %s %d", cmd, strarg, &arg2);
+		if (validargs != 3)
+			invalidargs++;
+		else if (CCTvRecoverySet(strarg, arg2) != CCTV_SUCCESS)
+			SampleUtil_Print("Unknown threshold or bad value; "
+				"see 'HelpFull'\n");
+		break;
+	case POLL:
+		CCTvPollPrintStats();
+		break;
+	case POLLSET:
+		/* re-parse commandline since the first arg is a string. */
+		validargs = sscanf(cmdline, "%s %s %d", cmd, strarg, &arg2);
+		if (validargs != 3)
+			invalidargs++;
+		else if (CCTvPollSet(strarg, arg2) != CCTV_SUCCESS)
+			SampleUtil_Print("Unknown threshold or bad value; "
+				"see 'HelpFull'\n");
+		break;
+	case FLEETHEALTH:
+		CCTvCtrlPointPrintFleetHealth(arg1);
+		break;
+	case PRTSTATS:
+		if (ShardRole == CCTV_ROLE_FRONTEND) {
+			CCTvCtlSockPrintStats();
+			CCTvRouterPrintStats();
+			if (CCTvRouterCommand(-1, cmdline) != CCTV_SUCCESS)
+				return CCTV_ERROR;
+			break;
+		}
+		CCTvDiscoveryPrintStats();
+		CCTvResearchPrintStats();
+		CCTvRecoveryPrintStats();
+		CCTvPollPrintStats();
+		CCTvCtlSockPrintStats();
+		CCTvSnapshotPrintStats();
+		SampleUtil_GetLogStats(&logstats);
+		SampleUtil_Print("Console:\n"
+			"  printed %lu messages, dropped %lu\n",
+			logstats.printed, logstats.dropped);
+		CCTvCtrlPointPrintFleetHealth(-1);
+		break;
+	case METRICS:
+		CCTvMetricsPrint();
+		break;
+	case LOGLEVEL:
+		/* re-parse commandline since the arg is a string. */
+		validargs = sscanf(cmdline, "%s %s", cmd, strarg);
+		if (validargs != 2 ||
+		    (i = SampleUtil_ParseLogLevel(strarg)) < 0) {
+			invalidargs++;
+			break;
+		}
+		SampleUtil_SetLogLevel((sample_log_level)i);
+		if (ShardRole == CCTV_ROLE_FRONTEND &&
+		    CCTvRouterCommand(-1, cmdline) != CCTV_SUCCESS)
+			return CCTV_ERROR;
+		break;
+	case SHARDS:
+		if (ShardRole != CCTV_ROLE_FRONTEND) {
+			SampleUtil_Print("Not the front-end of a sharded "
+				"control point\n");
+			return CCTV_ERROR;
+		}
+		CCTvRouterPrintStats();
+		break;
+	case ADOPT:
+		/* re-parse commandline since the args are strings. */
+		validargs = sscanf(cmdline, "%s %s %s %d", cmd, strarg,
+			selector, &arg2);
+		if (validargs != 4)
+			invalidargs++;
+		else if (ShardRole == CCTV_ROLE_FRONTEND) {
+			if (CCTvRouterNotify(strarg, selector, arg2) !=
+			    CCTV_SUCCESS)
+				return CCTV_ERROR;
+		} else if (CCTvCtrlPointAdopt(strarg, selector, arg2) !=
+			   CCTV_SUCCESS)
+			return CCTV_ERROR;
+		break;
+	case DROP:
+		/* re-parse commandline since the arg is a string. */
+		validargs = sscanf(cmdline, "%s %s", cmd, strarg);
+		if (validargs != 2)
+			invalidargs++;
+		else if (ShardRole == CCTV_ROLE_FRONTEND)
+			CCTvRouterByebye(strarg);
+		else
+			CCTvCtrlPointForget(strarg);
+		break;
 	case EXITCMD:
 		rc = CCTvCtrlPointStop();
 		exit(rc);
@@ -1519,12 +4439,40 @@ int CCTvCtrlPointProcessCommand(char *cmdline)
 		SampleUtil_Print("Command not implemented; see 'Help'\n");
 		break;
 	}
-	if(invalidargs)
+	if(invalidargs) {
 		SampleUtil_Print("Invalid args in command; see 'Help'\n");
+		return CCTV_ERROR;
+	}
 
 	return CCTV_SUCCESS;
 }
 
+/*!
+ * \brief Run a command received on the command socket. Exit is refused, as
+ * stopping the control point waits for the socket connections.
+ */
+static int CCTvCtrlPointSocketCommand(char *cmdline)
+{
+	char cmd[CCTV_MAX_CMDLINE];
+
+	if (sscanf(cmdline, "%s", cmd) == 1 && strcasecmp(cmd, "Exit") == 0) {
+		SampleUtil_Print("Exit is not available on the command socket\n");
+		return CCTV_ERROR;
+	}
+
+	return CCTvCtrlPointProcessCommand(cmdline);
+}
+
+int CCTvCtrlPointListen(const char *path)
+{
+	return CCTvCtlSockStart(path, CCTvCtrlPointSocketCommand);
+}
+
+int CCTvCtrlPointServeMetrics(const char *address, unsigned short port)
+{
+	return CCTvMetricsStart(address, port);
+}
+
 /*! @} Control Point Sample Module */
 
 /*! @} UpnpSamples */
@@ -49,6 +49,11 @@ extern "C" {
 #endif
 
 #include "sample_util.h"
+#include "cctv_histogram.h"
+#include "cctv_hot.h"
+#include "cctv_registry.h"
+#include "cctv_subscribe.h"
+#include "cctv_timer.h"
 
 #include "upnp.h"
 #include "UpnpString.h"
@@ -74,37 +79,91 @@ extern "C" {
 /* This should be the maximum VARCOUNT from above */
 #define CCTV_MAXVARS		CCTV_CONTROL_VARCOUNT
 
+/* Search for a device between this many seconds and half as many before
+ * its advertisement expires, or from half its lifetime if that is shorter */
+#define CCTV_RESEARCH_MARGIN	30
+/* MX of those searches */
+#define CCTV_RESEARCH_MX	5
+
+/* Action names with their own latency histograms; the last slot collects
+ * all further names */
+#define CCTV_LATENCY_ACTIONS	16
+
+/* Temperature from which FleetHealth lists a device, and how many it lists */
+#define CCTV_HOT_THRESHOLD	70
+#define CCTV_HOT_LIST		32
+
+/* Seconds a device restored from a snapshot is kept without being seen */
+#define CCTV_SNAPSHOT_VERIFY_S	120
+
+/* Longest UDN and description URL a camera is taken with */
+#define CCTV_MAX_UDN		NAME_SIZE
+#define CCTV_MAX_LOCATION	1024
+
+/* Longest command line: an Adopt of the longest UDN and location */
+#define CCTV_MAX_CMDLINE	(CCTV_MAX_UDN + CCTV_MAX_LOCATION + 32)
+
 extern const char *CCTvServiceName[];
 extern const char *CCTvVarName[CCTV_SERVICE_SERVCOUNT][CCTV_MAXVARS];
 extern char CCTvVarCount[];
 
+/* The strings of a device never change once it is added, and are packed
+ * behind its node in the same allocation; ServiceId and ServiceType are
+ * shared by all devices. What sweeps over the fleet look at is kept in
+ * HotTable rather than here. */
 struct cctv_service {
-    char ServiceId[NAME_SIZE];
-    char ServiceType[NAME_SIZE];
+    const char *ServiceId;
+    const char *ServiceType;
+    /* CCTV_MAX_VAL_LEN bytes each */
     char *VariableStrVal[CCTV_MAXVARS];
-    char EventURL[NAME_SIZE];
-    char ControlURL[NAME_SIZE];
-    char SID[NAME_SIZE];
+    const char *EventURL;
+    const char *ControlURL;
+    Upnp_SID SID;
+    /* enum CCTvSubState */
+    int  SubState;
 };
 
-extern struct CCTvDeviceNode *GlobalDeviceList;
-
 struct CCTvDevice {
-    char UDN[250];
-    char DescDocURL[250];
-    char FriendlyName[250];
-    char PresURL[250];
-    int  AdvrTimeOut;
+    const char *UDN;
+    const char *DescDocURL;
+    const char *FriendlyName;
+    const char *PresURL;
+    /* slot in HotTable */
+    int  Slot;
+    /* loaded from a snapshot and not seen since; such a node is replaced
+     * once its description is fetched again */
+    int  Unverified;
     struct cctv_service CCTvService[CCTV_SERVICE_SERVCOUNT];
+    /* fires when the advertisement expires */
+    struct CCTvTimer ExpiryTimer;
+    /* fires shortly before, to search for the device */
+    struct CCTvTimer SearchTimer;
+    /* action latency in microseconds by action slot, allocated on the
+     * first completion */
+    struct CCTvHistogram *Latency[CCTV_LATENCY_ACTIONS];
 };
 
 struct CCTvDeviceNode {
     struct CCTvDevice device;
-    struct CCTvDeviceNode *next;
 };
 
+/*! Fires the advertisement timers of the devices. */
+extern struct CCTvTimerWheel TimerWheel;
+
+/*! Index of all known devices, in discovery order. */
+extern struct CCTvDeviceTable DeviceTable;
+
+/*! Writer lock of DeviceTable. */
 extern ithread_mutex_t DeviceListMutex;
 
+/*! Guards the device node fields that change after the node is published:
+ * service SIDs and state variable values, and HotTable. */
+extern ithread_mutex_t DeviceStateMutex;
+
+/*! Expiry, power, temperature, recovery state and subscription of every
+ * device, by the Slot of its node. */
+extern struct CCTvHotTable HotTable;
+
 extern UpnpClient_Handle ctrlpt_handle;
 
 void	CCTvCtrlPointPrintHelp(void);
@@ -125,48 +184,118 @@ int		CCTvCtrlPointSendTopMountUp(int devnum);
 int		CCTvCtrlPointSendTopMountDown(int devnum);
 int		CCTvCtrlPointSendTopMountMiddle(int devnum);
 
+/*!
+ * \brief Send an action without arguments to the Control Service of a set of
+ * devices, a bounded number at a time. A summary is printed once every
+ * device has answered.
+ *
+ * \return The fan-out id, or CCTV_ERROR if no device matches.
+ */
+int CCTvCtrlPointFleetAction(
+	/*! [in] Action name, e.g. "Reboot". */
+	const char *actionname,
+	/*! [in] "all", "name=<substring of the friendly name>", or a comma
+	 * separated list of UDNs, device numbers and ranges like "3-40". */
+	const char *selector,
+	/*! [in] Limit of requests in flight, 0 for the default. */
+	int maxinflight);
 
 int		CCTvCtrlPointGetVar(int, int, const char *);
 int		CCTvCtrlPointGetPower(int devnum);
 
-int		CCTvCtrlPointGetDevice(int, struct CCTvDeviceNode **);
+int		CCTvCtrlPointGetDevice(const struct CCTvRegistry *, int, struct CCTvDeviceNode **);
+
+/*!
+ * \brief Print the action latency percentiles of all devices together, per
+ * action, or of one device if devnum is positive.
+ */
+int CCTvCtrlPointPrintLatency(
+	/*! [in] Device number, 0 for all devices. */
+	int devnum);
+
+/*!
+ * \brief Print the devices whose 99th percentile latency of any action is
+ * at least threshold_ms.
+ */
+int CCTvCtrlPointPrintSlowDevices(
+	/*! [in] Threshold, in milliseconds. */
+	int threshold_ms);
+
+/*!
+ * \brief Print a summary of the fleet and the devices at or above a
+ * temperature, from HotTable.
+ */
+int CCTvCtrlPointPrintFleetHealth(
+	/*! [in] Temperature, CCTV_HOT_THRESHOLD if negative. */
+	int threshold);
+
+/*!
+ * \brief Write the action latency histograms to a CSV file: one line per
+ * action for all devices, then one per device and action, with count,
+ * mean, percentiles and maximum in microseconds.
+ */
+int CCTvCtrlPointExportLatency(
+	/*! [in] File name. */
+	const char *path);
+
+/*!
+ * \brief Get the action latency of all devices together for one action, in
+ * microseconds, failed requests included.
+ *
+ * \return CCTV_SUCCESS, or CCTV_WARNING if no such action completed yet or
+ * it has no slot of its own, snap then being empty.
+ */
+int CCTvCtrlPointGetLatency(
+	/*! [in] Action name. */
+	const char *actionName,
+	/*! [out] Snapshot of the histogram. */
+	struct CCTvHistogram *snap);
+
+/*!
+ * \brief Put a device back to healthy in the recovery engine.
+ */
+int CCTvCtrlPointResetRecovery(
+	/*! [in] Device number. */
+	int devnum);
 int		CCTvCtrlPointPrintList(void);
 int		CCTvCtrlPointPrintDevice(int);
-void	CCTvCtrlPointAddDevice(IXML_Document *, const char *, int); 
+int		CCTvCtrlPointAddDevice(IXML_Document *, const char *, int);
+int		CCTvCtrlPointRefreshDevice(const char *, int);
 void    CCTvCtrlPointHandleGetVar(const char *, const char *, const DOMString);
 
 /*!
  * \brief Update a CCTv state table. Called when an event is received.
  *
- * Note: this function is NOT thread save. It must be called from another
- * function that has locked the global device list.
+ * Note: this function must be called from within a DeviceTable read
+ * section (or with the writer lock held) so that the node stays valid. The
+ * values are updated under DeviceStateMutex.
  **/
 void CCTvStateUpdate(
-	/*! [in] The UDN of the parent device. */
-	char *UDN,
+	/*! [in] The device the event is from. */
+	struct CCTvDeviceNode *node,
 	/*! [in] The service state table to update. */
 	int Service,
-	/*! [out] DOM document representing the XML received with the event. */
-	IXML_Document *ChangedVariables,
-	/*! [out] pointer to the state table for the CCTv  service to update. */
-	char **State);
+	/*! [in] DOM document representing the XML received with the event. */
+	IXML_Document *ChangedVariables);
 
 void	CCTvCtrlPointHandleEvent(const char *, int, IXML_Document *); 
-void	CCTvCtrlPointHandleSubscribeUpdate(const char *, const Upnp_SID, int); 
+void	CCTvCtrlPointHandleSubscribeUpdate(const char *, const Upnp_SID, int);
+void	CCTvCtrlPointHandleSubscribeComplete(const char *, const char *, int, int); 
 int		CCTvCtrlPointCallbackEventHandler(Upnp_EventType, const void *, void *);
 
 /*!
- * \brief Checks the advertisement each device in the global device list.
+ * \brief Arm the advertisement timers of a device node.
  *
- * If an advertisement expires, the device is removed from the list.
+ * When the advertisement expires, the device is removed from the list.
  *
- * If an advertisement is about to expire, a search request is sent for that
- * device.
+ * Shortly before it expires, a search for that device is queued with
+ * CCTvResearchDue(), so that a camera that is still there renews it.
  */
-void CCTvCtrlPointVerifyTimeouts(
-	/*! [in] The increment to subtract from the timeouts each time the
-	 * function is called. */
-	int incr);
+void CCTvCtrlPointArmTimers(
+	/*! [in] The device node. */
+	struct CCTvDeviceNode *node,
+	/*! [in] The expiration time of the advertisement, in seconds. */
+	int expires);
 
 void	CCTvCtrlPointPrintCommands(void);
 void*	CCTvCtrlPointCommandLoop(void *);
@@ -197,10 +326,71 @@ void CCTvCtrlPointPrintCommands(void);
 void *CCTvCtrlPointCommandLoop(void *args);
 
 /*!
- * \brief
+ * \brief Run one command line, as typed at the command prompt.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the command is unknown or its
+ * arguments are wrong.
  */
 int CCTvCtrlPointProcessCommand(char *cmdline);
 
+/*!
+ * \brief Also take commands from scripts, on a Unix domain socket; see
+ * cctv_ctlsock.h for the protocol. Stopped by CCTvCtrlPointStop().
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvCtrlPointListen(
+	/*! [in] File name of the socket. */
+	const char *path);
+
+/*!
+ * \brief Serve the metrics (see cctv_metrics.h) over HTTP until
+ * CCTvCtrlPointStop(). Call after CCTvCtrlPointStart().
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the port cannot be listened on.
+ */
+int CCTvCtrlPointServeMetrics(
+	/*! [in] Address to listen on, or NULL for all. */
+	const char *address,
+	/*! [in] TCP port. */
+	unsigned short port);
+
+/*!
+ * \brief List the devices of a snapshot as unverified and fetch their
+ * descriptions again, then keep the snapshot up to date until
+ * CCTvCtrlPointStop(). Call after CCTvCtrlPointStart(), whose search
+ * starts from an empty list.
+ *
+ * \return The number of devices restored, 0 if there is no usable
+ * snapshot yet, or CCTV_ERROR if it cannot be written.
+ */
+int CCTvCtrlPointRestore(
+	/*! [in] File name of the snapshot. */
+	const char *path);
+
+/*!
+ * \brief Make this control point the front-end of a sharded one: start
+ * the workers (see cctv_router.h), hand them the cameras found, and send
+ * them the commands for their cameras. Call before CCTvCtrlPointStart(),
+ * while no thread is running.
+ *
+ * \return CCTV_SUCCESS if at least one worker is up, else CCTV_ERROR.
+ */
+int CCTvCtrlPointFrontEnd(
+	/*! [in] Executable of the workers. */
+	const char *exe,
+	/*! [in] Number of workers. */
+	int nshards,
+	/*! [in] Directory of the worker sockets and logs. */
+	const char *dir);
+
+/*!
+ * \brief Make this control point a worker of a sharded one: it does not
+ * search for cameras, only takes those its front-end sends with Adopt
+ * commands. Call before CCTvCtrlPointStart().
+ */
+void CCTvCtrlPointWorker(void);
+
 #ifdef __cplusplus
 };
 #endif
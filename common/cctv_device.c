@@ -42,8 +42,8 @@
  */
 
 #include "cctv_device.h"
-#include <wiringPi.h>
-#include <softPwm.h>
+#include "cctv_hal.h"
+#include "cctv_metrics.h"
 //iron
 #include <sys/ioctl.h>
 #include <signal.h>
@@ -51,6 +51,7 @@
 #include <fcntl.h>
 
 #include <assert.h>
+#include <time.h>
 
 #define DEFAULT_WEB_DIR "/home/pi/upnp/libupnp-1.10.0/upnp/sample/web"
 
@@ -93,10 +94,112 @@ ithread_mutex_t CCTVDevMutex;
 
 /*	Watch dog Timer */
 static int running = 1;
-extern int fd;
 static int left_time;
 
 void* event_temp_thread(void*);
+
+/*! Metrics of the device, see DeviceMetrics. */
+enum CCTvDeviceMetricId {
+	METRIC_ACTIONS_OK = 0,
+	METRIC_ACTIONS_ERROR,
+	METRIC_ACTIONS_INVALID,
+	METRIC_ACTION_SECONDS,
+	METRIC_GETVAR_OK,
+	METRIC_GETVAR_ERROR,
+	METRIC_SUBSCRIPTIONS,
+	METRIC_NOTIFIES,
+	METRIC_TEMPERATURE,
+	METRIC_LOCK_CONTENDED,
+	METRIC_LOCK_WAIT_SECONDS,
+	METRIC_TEMP_CHANGE,
+	METRIC_TEMP_HEARTBEAT,
+	METRIC_TEMP_BAND,
+	METRIC_TEMP_INTERVAL
+};
+
+/*! Time spent in the action handlers. */
+static struct CCTvHistogram MetricActionTime;
+
+/*! Time spent waiting for CCTVDevMutex, when it was taken. */
+static struct CCTvHistogram MetricLockWait;
+
+static struct CCTvMetric DeviceMetrics[] = {
+	CCTV_METRIC_COUNTER_INIT("cctv_device_actions_total{result=\"ok\"}",
+		"Action requests, by outcome."),
+	CCTV_METRIC_COUNTER_INIT("cctv_device_actions_total{result=\"error\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_device_actions_total{result=\"invalid\"}", NULL),
+	CCTV_METRIC_HISTOGRAM_INIT("cctv_device_action_seconds",
+		"Time to dispatch and run an action request.",
+		&MetricActionTime),
+	CCTV_METRIC_COUNTER_INIT("cctv_device_getvar_total{result=\"ok\"}",
+		"GetVar requests, by outcome."),
+	CCTV_METRIC_COUNTER_INIT("cctv_device_getvar_total{result=\"error\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_device_subscriptions_total",
+		"Subscription requests accepted."),
+	CCTV_METRIC_COUNTER_INIT("cctv_device_notifies_total",
+		"State variable changes sent to the subscribers."),
+	{ "cctv_device_temperature", "Last temperature read, in degrees C.",
+	  CCTV_METRIC_GAUGE, 0, NULL, NULL, 0 },
+	CCTV_METRIC_COUNTER_INIT("cctv_device_lock_contended_total",
+		"State table lock acquisitions that found it taken."),
+	CCTV_METRIC_HISTOGRAM_INIT("cctv_device_lock_wait_seconds",
+		"Time waited for the state table lock, when it was taken.",
+		&MetricLockWait),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_device_temperature_events_total{reason=\"change\"}",
+		"Temperature readings published, by reason."),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_device_temperature_events_total{reason=\"heartbeat\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_device_temperature_suppressed_total{reason=\"band\"}",
+		"Temperature readings not published, by reason."),
+	CCTV_METRIC_COUNTER_INIT(
+		"cctv_device_temperature_suppressed_total{reason=\"interval\"}",
+		NULL)
+};
+
+/*!
+ * \brief Moderation of the temperature events, set by device_main().
+ *
+ * A reading is published when it is more than TempBand degrees away from
+ * the last one published, but not sooner than TempMinInterval seconds
+ * after it; and after TempMaxInterval seconds whatever it is, as a
+ * heartbeat. -tempband 0 -tempmax 10 gives back one event per reading.
+ */
+static int TempSample = 10;
+static int TempBand = 1;
+static int TempMinInterval = 10;
+static int TempMaxInterval = 300;
+
+static double CCTvDeviceNowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+/*!
+ * \brief Lock CCTVDevMutex, counting the times it was taken and the wait.
+ */
+static void CCTvDeviceLock(void)
+{
+	double start;
+
+	if (ithread_mutex_trylock(&CCTVDevMutex) == 0)
+		return;
+	start = CCTvDeviceNowUs();
+	ithread_mutex_lock(&CCTVDevMutex);
+	CCTvMetricsAdd(&DeviceMetrics[METRIC_LOCK_CONTENDED], 1);
+	CCTvMetricsObserve(&DeviceMetrics[METRIC_LOCK_WAIT_SECONDS],
+		(unsigned long)(CCTvDeviceNowUs() - start));
+}
+
 /*!
  * \brief Initializes the service table for the specified service.
  */
@@ -227,6 +330,17 @@ error_handler:
 	return (ret);
 }
 
+int CCTvDeviceStateTableInitLocal(const char *UDN, const char *serviceId)
+{
+	ithread_mutex_init(&CCTVDevMutex, NULL);
+	CCTvMetricsRegister(DeviceMetrics,
+		(int)(sizeof DeviceMetrics / sizeof DeviceMetrics[0]));
+
+	return SetServiceTable(CCTV_SERVICE_CONTROL, UDN, serviceId,
+			CCTvServiceType[CCTV_SERVICE_CONTROL],
+			&cctv_service_table[CCTV_SERVICE_CONTROL]);
+}
+
 int CCTvDeviceHandleSubscriptionRequest(const UpnpSubscriptionRequest *sr_event)
 {
 	unsigned int i = 0;
@@ -237,7 +351,7 @@ int CCTvDeviceHandleSubscriptionRequest(const UpnpSubscriptionRequest *sr_event)
 	const char *l_sid = NULL;
 
 	/* lock state mutex */
-	ithread_mutex_lock(&CCTVDevMutex);
+	CCTvDeviceLock();
 
 	l_serviceId = UpnpString_get_String(UpnpSubscriptionRequest_get_ServiceId(sr_event));
 	l_udn = UpnpSubscriptionRequest_get_UDN_cstr(sr_event);
@@ -276,6 +390,7 @@ int CCTvDeviceHandleSubscriptionRequest(const UpnpSubscriptionRequest *sr_event)
 					       [i].VariableStrVal,
 					       cctv_service_table[i].
 					       VariableCount, l_sid);
+			CCTvMetricsAdd(&DeviceMetrics[METRIC_SUBSCRIPTIONS], 1);
 		}
 	}
 
@@ -292,7 +407,7 @@ int CCTvDeviceHandleGetVarRequest(UpnpStateVarRequest *cgv_event)
 
 	UpnpStateVarRequest_set_CurrentVal(cgv_event, NULL);
 
-	ithread_mutex_lock(&CCTVDevMutex);
+	CCTvDeviceLock();
 
 	for (i = 0; i < CCTV_SERVICE_SERVCOUNT; i++) {
 		/* check udn and service id */
@@ -316,6 +431,8 @@ int CCTvDeviceHandleGetVarRequest(UpnpStateVarRequest *cgv_event)
 			}
 		}
 	}
+	CCTvMetricsAdd(&DeviceMetrics[gecctvar_succeeded ?
+		METRIC_GETVAR_OK : METRIC_GETVAR_ERROR], 1);
 	if (gecctvar_succeeded) {
 		UpnpStateVarRequest_set_ErrCode(cgv_event, UPNP_E_SUCCESS);
 	} else {
@@ -343,6 +460,7 @@ int CCTvDeviceHandleActionRequest(UpnpActionRequest *ca_event)
 	const char *serviceID = NULL;
 	const char *actionName = NULL;
 	IXML_Document *actionResult = NULL;
+	double start = CCTvDeviceNowUs();
 
 	UpnpActionRequest_set_ErrCode(ca_event, 0);
 	UpnpActionRequest_set_ActionResult(ca_event, NULL);
@@ -416,10 +534,39 @@ int CCTvDeviceHandleActionRequest(UpnpActionRequest *ca_event)
 			}
 		}
 	}
+	CCTvMetricsAdd(&DeviceMetrics[!action_found ? METRIC_ACTIONS_INVALID :
+		retCode == UPNP_E_SUCCESS ? METRIC_ACTIONS_OK :
+		METRIC_ACTIONS_ERROR], 1);
+	CCTvMetricsObserve(&DeviceMetrics[METRIC_ACTION_SECONDS],
+		(unsigned long)(CCTvDeviceNowUs() - start));
 
 	return UpnpActionRequest_get_ErrCode(ca_event);
 }
 
+/*!
+ * \brief Update a variable of the state table, for GetVar requests and new
+ * subscriptions, without notifying the subscribers.
+ */
+static int CCTvDeviceStoreServiceTableVar(
+	/*! [in] The service number. */
+	unsigned int service,
+	/*! [in] The variable number. */
+	int variable,
+	/*! [in] The string representation of the new value. */
+	const char *value)
+{
+	if (service >= CCTV_SERVICE_SERVCOUNT ||
+	    variable >= cctv_service_table[service].VariableCount ||
+	    strlen(value) >= CCTV_MAX_VAL_LEN)
+		return 0;
+
+	CCTvDeviceLock();
+	strcpy(cctv_service_table[service].VariableStrVal[variable], value);
+	ithread_mutex_unlock(&CCTVDevMutex);
+
+	return 1;
+}
+
 int CCTvDeviceSetServiceTableVar(unsigned int service, int variable, char *value)
 {
 	/* IXML_Document  *PropSet= NULL; */
@@ -428,7 +575,7 @@ int CCTvDeviceSetServiceTableVar(unsigned int service, int variable, char *value
 	    strlen(value) >= CCTV_MAX_VAL_LEN)
 		return (0);
 
-	ithread_mutex_lock(&CCTVDevMutex);
+	CCTvDeviceLock();
 
 	strcpy(cctv_service_table[service].VariableStrVal[variable], value);
 #if 0
@@ -446,6 +593,7 @@ int CCTvDeviceSetServiceTableVar(unsigned int service, int variable, char *value
 		cctv_service_table[service].ServiceId,
 		(const char **)&cctv_service_table[service].VariableName[variable],
 		(const char **)&cctv_service_table[service].VariableStrVal[variable], 1);
+	CCTvMetricsAdd(&DeviceMetrics[METRIC_NOTIFIES], 1);
 
 	ithread_mutex_unlock(&CCTVDevMutex);
 
@@ -489,7 +637,7 @@ int CCTvDeviceBottomMountLeft(IXML_Document* in, IXML_Document ** out, const cha
 		(*errorString) = "Internal Error";
 		return UPNP_E_INTERNAL_ERROR;
 	}
-	softPwmWrite(BOTTOM_MOUNT,21);
+	CCTvHalServoWrite(BOTTOM_MOUNT, 21);
 	return UPNP_E_SUCCESS;
 	in = in;
 
@@ -506,7 +654,7 @@ int CCTvDeviceBottomMountRight(IXML_Document* in, IXML_Document ** out, const ch
 		(*errorString) = "Internal Error";
 		return UPNP_E_INTERNAL_ERROR;
 	}
-	softPwmWrite(BOTTOM_MOUNT,8);
+	CCTvHalServoWrite(BOTTOM_MOUNT, 8);
 	return UPNP_E_SUCCESS;
 	in = in;
 
@@ -523,7 +671,7 @@ int CCTvDeviceBottomMountMiddle(IXML_Document* in, IXML_Document ** out, const c
 		(*errorString) = "Internal Error";
 		return UPNP_E_INTERNAL_ERROR;
 	}
-	softPwmWrite(BOTTOM_MOUNT,13);
+	CCTvHalServoWrite(BOTTOM_MOUNT, 13);
 	return UPNP_E_SUCCESS;
 	in = in;
 }
@@ -539,7 +687,7 @@ int CCTvDeviceTopMountUp(IXML_Document* in, IXML_Document ** out, const char **
 		(*errorString) = "Internal Error";
 		return UPNP_E_INTERNAL_ERROR;
 	}
-	softPwmWrite(TOP_MOUNT,7);
+	CCTvHalServoWrite(TOP_MOUNT, 7);
 	return UPNP_E_SUCCESS;
 	in = in;
 }
@@ -555,7 +703,7 @@ int CCTvDeviceTopMountDown(IXML_Document* in, IXML_Document ** out, const char *
 		(*errorString) = "Internal Error";
 		return UPNP_E_INTERNAL_ERROR;
 	}
-	softPwmWrite(TOP_MOUNT,15);
+	CCTvHalServoWrite(TOP_MOUNT, 15);
 	return UPNP_E_SUCCESS;
 	in = in;
 }
@@ -571,7 +719,7 @@ int CCTvDeviceTopMountMiddle(IXML_Document* in, IXML_Document ** out, const char
 		(*errorString) = "Internal Error";
 		return UPNP_E_INTERNAL_ERROR;
 	}
-	softPwmWrite(TOP_MOUNT,10);
+	CCTvHalServoWrite(TOP_MOUNT, 10);
 	return UPNP_E_SUCCESS;
 	in = in;
 }
@@ -675,8 +823,8 @@ int CCTvDeviceCallbackEventHandler(Upnp_EventType EventType, const void *Event,
 		    ("Error in CCTvDeviceCallbackEventHandler: unknown event type %d\n",
 		     EventType);
 	}
-	/* Print a summary of the event received */
-	SampleUtil_PrintEvent(EventType, Event);
+	/* Print a summary of the event received, in a debug build */
+	SAMPLE_PRINT_EVENT(EventType, Event);
 
 	return 0;
 	Cookie = Cookie;
@@ -690,6 +838,8 @@ int CCTvDeviceStart(char *ip_address, unsigned short port,
 	char desc_doc_url[DESC_URL_SIZE];
 	ithread_t thr;
 	ithread_mutex_init(&CCTVDevMutex, NULL);
+	CCTvMetricsRegister(DeviceMetrics,
+		(int)(sizeof DeviceMetrics / sizeof DeviceMetrics[0]));
 
 	SampleUtil_Initialize(pfun);
 	SampleUtil_Print("Initializing UPnP Sdk with\n"
@@ -768,6 +918,7 @@ int CCTvDeviceStart(char *ip_address, unsigned short port,
 
 int CCTvDeviceStop(void)
 {
+	CCTvMetricsStop();
 	UpnpUnRegisterRootDevice(device_handle);
 	UpnpFinish();
 	SampleUtil_Finish();
@@ -824,25 +975,13 @@ int device_main(int argc, char *argv[])
 	char *desc_doc_name = NULL;
 	char *web_dir_path = NULL;
 	unsigned short port = 0;
+	char metrics_address[64] = "127.0.0.1";
+	unsigned short metrics_port = 0;
+	int level;
+	int ret;
+	char *hal_name = NULL;
 	int i = 0;
-	
-	if(wiringPiSetup() ==-1)
-	{	
-		printf("wiringPiSetup() Error \n");
-		exit(0);
-	}
-	pinMode(TOP_MOUNT,OUTPUT);
-	pinMode(BOTTOM_MOUNT,OUTPUT);
 
-	softPwmCreate(TOP_MOUNT,0,200);
-	softPwmCreate(BOTTOM_MOUNT,0,200);
-	
-	softPwmWrite(TOP_MOUNT,10);
-	softPwmWrite(BOTTOM_MOUNT,13);
-#ifdef WATCH_DOG_RUN				
-	init_watchdog();
-#endif
-	
 	SampleUtil_Initialize(linux_print);
 	/* Parse options */
 	for (i = 1; i < argc; i++) {
@@ -854,9 +993,35 @@ int device_main(int argc, char *argv[])
 			desc_doc_name = argv[++i];
 		} else if (strcmp(argv[i], "-webdir") == 0) {
 			web_dir_path = argv[++i];
+		} else if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc) {
+			if (SampleUtil_ParseAddressPort(argv[++i],
+				metrics_address, sizeof metrics_address,
+				&metrics_port) != 0) {
+				SampleUtil_Print("Bad metrics address %s\n",
+					argv[i]);
+				return UPNP_E_INVALID_PARAM;
+			}
+		} else if (strcmp(argv[i], "-loglevel") == 0 && i + 1 < argc) {
+			level = SampleUtil_ParseLogLevel(argv[++i]);
+			if (level >= 0)
+				SampleUtil_SetLogLevel((sample_log_level)level);
+		} else if (strcmp(argv[i], "-hal") == 0 && i + 1 < argc) {
+			hal_name = argv[++i];
+		} else if (strcmp(argv[i], "-tempsample") == 0 && i + 1 < argc) {
+			TempSample = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-tempband") == 0 && i + 1 < argc) {
+			TempBand = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-tempmin") == 0 && i + 1 < argc) {
+			TempMinInterval = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-tempmax") == 0 && i + 1 < argc) {
+			TempMaxInterval = atoi(argv[++i]);
 		} else if (strcmp(argv[i], "-help") == 0) {
 			SampleUtil_Print("Usage: %s -ip ipaddress -port port"
 					 " -desc desc_doc_name -webdir web_dir_path"
+					 " -metrics [address:]port"
+					 " -loglevel level -hal backend"
+					 " -tempsample s -tempband degrees"
+					 " -tempmin s -tempmax s"
 					 " -help (this message)\n", argv[0]);
 			SampleUtil_Print
 			    ("\tipaddress:     IP address of the device"
@@ -868,28 +1033,73 @@ int device_main(int argc, char *argv[])
 			     "\t\te.g.: tvdevicedesc.xml\n"
 			     "\tweb_dir_path: Filesystem path where web files"
 			     " related to the device are stored\n"
-			     "\t\te.g.: /upnp/sample/tvdevice/web\n");
+			     "\t\te.g.: /upnp/sample/tvdevice/web\n"
+			     "\tmetrics:      Serve the metrics over HTTP at"
+			     " /metrics, on 127.0.0.1 unless given\n"
+			     "\t\te.g.: 0.0.0.0:9101\n"
+			     "\tlevel:        error, warning, info or debug;"
+			     " debug (the event dumps) needs a debug build\n"
+			     "\t\te.g.: warning\n"
+			     "\tbackend:      hardware, pi or mock (in memory,"
+			     " for any Linux box); pi unless given\n"
+			     "\ts:            seconds between temperature"
+			     " readings (10), least and most seconds\n"
+			     "\t\t      between two Temperature events"
+			     " (10 and 300)\n"
+			     "\tdegrees:      change published at once, if"
+			     " above (1); 0 for any change\n");
 			return 1;
 		}
 	}
+	if (TempSample < 1 || TempBand < 0 || TempMinInterval < 0 ||
+	    TempMaxInterval < 1) {
+		SampleUtil_Print("Bad temperature event moderation: sample %d"
+			" band %d min %d max %d\n", TempSample, TempBand,
+			TempMinInterval, TempMaxInterval);
+		return UPNP_E_INVALID_PARAM;
+	}
+	if (CCTvHalSelect(hal_name) != 0) {
+		SampleUtil_Print("No %s hardware backend in this build\n",
+			hal_name);
+		return UPNP_E_INVALID_PARAM;
+	}
+	if (CCTvHalInit() != 0 ||
+	    CCTvHalServoSetup(TOP_MOUNT, 200) != 0 ||
+	    CCTvHalServoSetup(BOTTOM_MOUNT, 200) != 0) {
+		SampleUtil_Print("Error setting up the %s hardware\n",
+			CCTvHalName());
+		return UPNP_E_INTERNAL_ERROR;
+	}
+	CCTvHalServoWrite(TOP_MOUNT, 10);
+	CCTvHalServoWrite(BOTTOM_MOUNT, 13);
+#ifdef WATCH_DOG_RUN
+	init_watchdog();
+#endif
 	port = (unsigned short)portTemp;
-	return CCTvDeviceStart(ip_address, port, desc_doc_name, web_dir_path,
+	ret = CCTvDeviceStart(ip_address, port, desc_doc_name, web_dir_path,
 			     linux_print, 0);
+	if (ret == UPNP_E_SUCCESS && metrics_port &&
+	    CCTvMetricsStart(metrics_address,
+		metrics_port) != 0)
+		SampleUtil_Print("Error serving the metrics on %s:%u\n",
+			metrics_address, metrics_port);
+
+	return ret;
 }
 
 void exit_intr(int sig)
 {
 		running = 0;
 
-		write(fd,"V",1);
-		close(fd);
+		CCTvHalWatchdogClose();
 }
 
 void init_watchdog(void)
 {
 		pthread_t watchdog_thread_t;
 
-		fd = open("/dev/watchdog0",O_RDWR);
+		if (CCTvHalWatchdogOpen() != 0)
+			SampleUtil_Print("Error opening the watchdog\n");
 		signal(SIGINT,exit_intr);
 
 		pthread_create(&watchdog_thread_t, NULL, watchdog_thread, NULL);
@@ -907,13 +1117,13 @@ void set_watchdog_timer(void)
 
 	if(interval)
 	{
-			ioctl(fd,WDIOC_SETTIMEOUT,&interval);
+			CCTvHalWatchdogSetTimeout(interval);
 	}
 }
 
 void expire_watchdog_timer(int time)
 {
-	ioctl(fd, WDIOC_SETTIMEOUT, &time);
+	CCTvHalWatchdogSetTimeout(time);
 	
 	running = 0;
 }
@@ -921,33 +1131,72 @@ void* watchdog_thread(void* unused)
 {
 			while (running)
 			{
-				ioctl(fd, WDIOC_GETTIMELEFT, &left_time);
+				CCTvHalWatchdogTimeLeft(&left_time);
 				if (left_time == 0)
 				{
-					ioctl(fd, WDIOC_KEEPALIVE, NULL);
+					CCTvHalWatchdogKeepalive();
 				}
 				usleep(1000);
 			}												
 }
+
+/*!
+ * \brief Decide whether to publish a temperature reading, see TempBand.
+ * Called by the temperature thread only.
+ *
+ * \return METRIC_TEMP_CHANGE or METRIC_TEMP_HEARTBEAT to publish it,
+ * METRIC_TEMP_BAND or METRIC_TEMP_INTERVAL to keep it quiet.
+ */
+static int CCTvDeviceTempModerate(
+	/*! [in] The reading, in degrees C. */
+	int temp,
+	/*! [in] CLOCK_MONOTONIC time of the reading, in seconds. */
+	double now)
+{
+	/* last published, and when; none yet if TempPublishedAt < 0 */
+	static int TempPublished;
+	static double TempPublishedAt = -1;
+	double since = now - TempPublishedAt;
+	int changed = abs(temp - TempPublished) > TempBand;
+	int reason;
+
+	if (TempPublishedAt < 0 || (changed && since >= TempMinInterval))
+		reason = METRIC_TEMP_CHANGE;
+	else if (since >= TempMaxInterval)
+		reason = METRIC_TEMP_HEARTBEAT;
+	else
+		return changed ? METRIC_TEMP_INTERVAL : METRIC_TEMP_BAND;
+	TempPublished = temp;
+	TempPublishedAt = now;
+
+	return reason;
+}
+
 void *event_temp_thread(void* unused){
 	int temp;
-	char str_temp[6];
-	FILE * tempfp;
+	char str_temp[12];
+	int reason;
 
 	SampleUtil_Print("temperature checking thread start\n");
 
 	while(1){
-		tempfp = fopen("/sys/class/thermal/thermal_zone0/temp","r");
-		if(tempfp != NULL)
-			printf("tempfp is not NULL\n");
-		fscanf(tempfp,"%d",&temp);
-		temp = temp /1000;
-		sprintf(str_temp,"%d",temp);
-		CCTvDeviceSetServiceTableVar(CCTV_SERVICE_CONTROL, CCTV_CONTROL_TEMP,str_temp);
-		sleep(10);
-		
-
-
-
+		if (CCTvHalReadTemp(&temp) != 0) {
+			SampleUtil_Print("Error reading the temperature\n");
+			sleep((unsigned int)TempSample);
+			continue;
+		}
+		CCTvMetricsSet(&DeviceMetrics[METRIC_TEMPERATURE], temp);
+		snprintf(str_temp, sizeof str_temp, "%d", temp);
+		reason = CCTvDeviceTempModerate(temp, CCTvDeviceNowUs() / 1e6);
+		CCTvMetricsAdd(&DeviceMetrics[reason], 1);
+		if (reason == METRIC_TEMP_CHANGE ||
+		    reason == METRIC_TEMP_HEARTBEAT)
+			CCTvDeviceSetServiceTableVar(CCTV_SERVICE_CONTROL,
+				CCTV_CONTROL_TEMP, str_temp);
+		else
+			/* still current for GetVar and new subscribers */
+			CCTvDeviceStoreServiceTableVar(CCTV_SERVICE_CONTROL,
+				CCTV_CONTROL_TEMP, str_temp);
+		sleep((unsigned int)TempSample);
 	}
 }
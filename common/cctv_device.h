@@ -62,9 +62,6 @@ extern "C" {
 #include <unistd.h>
 #include <fcntl.h>
 
-#include <sys/ioctl.h>
-#include <linux/watchdog.h>
-
 #include <pthread.h>
 
 /*! Power constants */
@@ -111,9 +108,6 @@ extern "C" {
  */
 
 
-int fd;
-
-
 typedef int (*upnp_action)(
 	/*! [in] Document of action request. */
 	IXML_Document *request,
@@ -178,6 +172,21 @@ int CCTvDeviceStateTableInit(
 	/*! [in] The description document URL. */
 	char *DescDocURL);
 
+/*!
+ * \brief Initialize the state table and its mutex with given identifiers
+ * instead of those of the description document, without the SDK.
+ *
+ * This lets the request handlers be called in-process, as the handlers
+ * benchmark of cctv_bench does. Not for use with CCTvDeviceStart().
+ *
+ * \return 1 on success.
+ */
+int CCTvDeviceStateTableInitLocal(
+	/*! [in] UDN the requests are to be addressed to. */
+	const char *UDN,
+	/*! [in] serviceId of the control service. */
+	const char *serviceId);
+
 /*!
  * \brief Called during a subscription request callback.
  *
@@ -373,6 +382,11 @@ void *CCTvDeviceCommandLoop(void *args);
  *	\li \c -port port
  *	\li \c -desc desc_doc_name
  *	\li \c -webdir web_dir_path
+ *	\li \c -hal pi|mock
+ *	\li \c -tempsample seconds between temperature readings
+ *	\li \c -tempband degrees of change published at once
+ *	\li \c -tempmin least seconds between two Temperature events
+ *	\li \c -tempmax most seconds between two, the heartbeat
  *	\li \c -help
  */
 int device_main(int argc, char *argv[]);
@@ -0,0 +1,596 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Discovery Pipeline
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_discovery.h"
+
+#include "cctv_ctrlpt.h"
+#include "cctv_registry.h"
+#include "sample_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*! Initial number of description cache buckets, a power of two. */
+#define CCTV_DISCOVERY_CACHE_BUCKETS 256
+
+/*! A UDN a location was queued for. */
+struct CCTvDiscoveryUDN {
+	char *UDN;
+	struct CCTvDiscoveryUDN *next;
+};
+
+/*! One location queued or being fetched. */
+struct CCTvDiscoveryJob {
+	char *location;
+	/*! UDNs of the notifications for the location, several when it
+	 * describes embedded devices too; at most CCTV_DISCOVERY_MAX_UDNS. */
+	struct CCTvDiscoveryUDN *UDNs;
+	int nUDNs;
+	unsigned int hash;
+	/*! Latest expiry advertised for the location. */
+	int expires;
+	/*! Next job in the FIFO. */
+	struct CCTvDiscoveryJob *next;
+	/*! Next job in the same hash bucket. */
+	struct CCTvDiscoveryJob *chain;
+};
+
+/*! Where a device's description was last fetched from. */
+struct CCTvDiscoveryCacheEntry {
+	char *UDN;
+	char *location;
+	/*! Hash of UDN. */
+	unsigned int hash;
+	/*! Not a device the control point handles. */
+	int foreign;
+	struct CCTvDiscoveryCacheEntry *next;
+};
+
+/*! Guards everything below. */
+static ithread_mutex_t DiscoveryMutex;
+/*! Signalled when a job is queued or the pool stops. */
+static ithread_cond_t DiscoveryCond;
+static ithread_t *DiscoveryWorkers;
+static int DiscoveryNumWorkers;
+static int DiscoveryRunning;
+static int DiscoveryMaxPending;
+static CCTvDiscoveryFetchFn DiscoveryFetch;
+static CCTvDiscoveryAddFn DiscoveryAdd;
+static CCTvDiscoveryRefreshFn DiscoveryRefresh;
+/*! FIFO of jobs waiting for a fetcher. */
+static struct CCTvDiscoveryJob *DiscoveryHead;
+static struct CCTvDiscoveryJob *DiscoveryTail;
+/*! Queued and in flight jobs by location, for de-duplication. */
+static struct CCTvDiscoveryJob **DiscoveryBuckets;
+static unsigned int DiscoveryNumBuckets;
+/*! Description cache by UDN. */
+static struct CCTvDiscoveryCacheEntry **DiscoveryCache;
+static unsigned int DiscoveryCacheBuckets;
+static struct CCTvDiscoveryStats DiscoveryStats;
+/*! Start of the current round, CLOCK_MONOTONIC milliseconds. */
+static double DiscoveryRoundStart;
+
+static double CCTvDiscoveryNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static struct CCTvDiscoveryJob **CCTvDiscoveryLookup(const char *location,
+	unsigned int hash)
+{
+	struct CCTvDiscoveryJob **pjob;
+
+	pjob = &DiscoveryBuckets[hash & (DiscoveryNumBuckets - 1)];
+	while (*pjob && ((*pjob)->hash != hash ||
+		strcmp((*pjob)->location, location) != 0))
+		pjob = &(*pjob)->chain;
+
+	return pjob;
+}
+
+/*!
+ * \brief Add UDN to the UDNs of a job, unless there already.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if out of memory.
+ */
+static int CCTvDiscoveryAddUDN(struct CCTvDiscoveryJob *job, const char *UDN)
+{
+	struct CCTvDiscoveryUDN *u;
+	size_t len;
+
+	if (!UDN)
+		return CCTV_SUCCESS;
+	for (u = job->UDNs; u; u = u->next) {
+		if (strcmp(u->UDN, UDN) == 0)
+			return CCTV_SUCCESS;
+	}
+	if (job->nUDNs >= CCTV_DISCOVERY_MAX_UDNS)
+		/* fetched again on a later notification */
+		return CCTV_SUCCESS;
+	len = strlen(UDN);
+	u = (struct CCTvDiscoveryUDN *)malloc(sizeof *u + len + 1);
+	if (!u)
+		return CCTV_ERROR;
+	u->UDN = (char *)(u + 1);
+	memcpy(u->UDN, UDN, len + 1);
+	u->next = job->UDNs;
+	job->UDNs = u;
+	job->nUDNs++;
+
+	return CCTV_SUCCESS;
+}
+
+static void CCTvDiscoveryFreeJob(struct CCTvDiscoveryJob *job)
+{
+	struct CCTvDiscoveryUDN *u;
+
+	while ((u = job->UDNs)) {
+		job->UDNs = u->next;
+		free(u);
+	}
+	free(job->location);
+	free(job);
+}
+
+static struct CCTvDiscoveryCacheEntry **CCTvDiscoveryCacheLookup(
+	const char *UDN, unsigned int hash)
+{
+	struct CCTvDiscoveryCacheEntry **pentry;
+
+	pentry = &DiscoveryCache[hash & (DiscoveryCacheBuckets - 1)];
+	while (*pentry && ((*pentry)->hash != hash ||
+		strcmp((*pentry)->UDN, UDN) != 0))
+		pentry = &(*pentry)->next;
+
+	return pentry;
+}
+
+static void CCTvDiscoveryCacheFree(struct CCTvDiscoveryCacheEntry *entry)
+{
+	free(entry->UDN);
+	free(entry->location);
+	free(entry);
+}
+
+static void CCTvDiscoveryCacheDel(const char *UDN)
+{
+	struct CCTvDiscoveryCacheEntry **pentry;
+	struct CCTvDiscoveryCacheEntry *entry;
+
+	pentry = CCTvDiscoveryCacheLookup(UDN, CCTvRegistryHash(UDN));
+	entry = *pentry;
+	if (entry) {
+		*pentry = entry->next;
+		CCTvDiscoveryCacheFree(entry);
+		DiscoveryStats.cache_entries--;
+	}
+}
+
+static void CCTvDiscoveryCacheGrow(void)
+{
+	struct CCTvDiscoveryCacheEntry **buckets;
+	struct CCTvDiscoveryCacheEntry *entry;
+	struct CCTvDiscoveryCacheEntry *next;
+	unsigned int nbuckets = DiscoveryCacheBuckets * 2;
+	unsigned int i;
+
+	buckets = (struct CCTvDiscoveryCacheEntry **)calloc(nbuckets,
+		sizeof (struct CCTvDiscoveryCacheEntry *));
+	if (!buckets)
+		/* keep the longer chains */
+		return;
+	for (i = 0; i < DiscoveryCacheBuckets; i++) {
+		for (entry = DiscoveryCache[i]; entry; entry = next) {
+			next = entry->next;
+			entry->next = buckets[entry->hash & (nbuckets - 1)];
+			buckets[entry->hash & (nbuckets - 1)] = entry;
+		}
+	}
+	free(DiscoveryCache);
+	DiscoveryCache = buckets;
+	DiscoveryCacheBuckets = nbuckets;
+}
+
+/*!
+ * \brief Remember where the description of UDN came from. Out of memory
+ * only means the next notification fetches it again.
+ */
+static void CCTvDiscoveryCacheSet(const char *UDN, const char *location,
+	int foreign)
+{
+	struct CCTvDiscoveryCacheEntry **pentry;
+	struct CCTvDiscoveryCacheEntry *entry;
+	unsigned int hash = CCTvRegistryHash(UDN);
+	char *copy;
+
+	pentry = CCTvDiscoveryCacheLookup(UDN, hash);
+	entry = *pentry;
+	if (entry) {
+		if (strcmp(entry->location, location) != 0) {
+			copy = strdup(location);
+			if (!copy)
+				return;
+			free(entry->location);
+			entry->location = copy;
+		}
+		entry->foreign = foreign;
+		return;
+	}
+	entry = (struct CCTvDiscoveryCacheEntry *)calloc(1, sizeof *entry);
+	if (!entry)
+		return;
+	entry->UDN = strdup(UDN);
+	entry->location = strdup(location);
+	if (!entry->UDN || !entry->location) {
+		CCTvDiscoveryCacheFree(entry);
+		return;
+	}
+	entry->hash = hash;
+	entry->foreign = foreign;
+	*pentry = entry;
+	DiscoveryStats.cache_entries++;
+	if (DiscoveryStats.cache_entries > DiscoveryCacheBuckets)
+		CCTvDiscoveryCacheGrow();
+}
+
+static void *CCTvDiscoveryWorker(void *args)
+{
+	struct CCTvDiscoveryJob *job;
+	struct CCTvDiscoveryJob **pjob;
+	struct CCTvDiscoveryUDN *u;
+	IXML_Document *DescDoc;
+	int expires;
+	int added;
+	int ret;
+
+	ithread_mutex_lock(&DiscoveryMutex);
+	while (1) {
+		while (DiscoveryRunning && !DiscoveryHead)
+			ithread_cond_wait(&DiscoveryCond, &DiscoveryMutex);
+		if (!DiscoveryRunning)
+			break;
+		job = DiscoveryHead;
+		DiscoveryHead = job->next;
+		if (!DiscoveryHead)
+			DiscoveryTail = NULL;
+		ithread_mutex_unlock(&DiscoveryMutex);
+
+		DescDoc = NULL;
+		added = CCTV_ERROR;
+		ret = DiscoveryFetch(job->location, &DescDoc);
+		if (ret != UPNP_E_SUCCESS) {
+			SampleUtil_Print(
+				"Error obtaining device description from %s -- error = %d\n",
+				job->location, ret);
+		} else {
+			/* notifications that came in during the download
+			 * only refreshed the expiry */
+			ithread_mutex_lock(&DiscoveryMutex);
+			expires = job->expires;
+			ithread_mutex_unlock(&DiscoveryMutex);
+			added = DiscoveryAdd(DescDoc, job->location, expires);
+		}
+		if (DescDoc)
+			ixmlDocument_free(DescDoc);
+
+		/* the location stays de-duplicated until the device is in
+		 * the table */
+		ithread_mutex_lock(&DiscoveryMutex);
+		pjob = CCTvDiscoveryLookup(job->location, job->hash);
+		*pjob = job->chain;
+		for (u = job->UDNs; DiscoveryRefresh && u &&
+		     ret == UPNP_E_SUCCESS &&
+		     (added == CCTV_SUCCESS || added == CCTV_WARNING);
+		     u = u->next)
+			CCTvDiscoveryCacheSet(u->UDN, job->location,
+				added == CCTV_WARNING);
+		DiscoveryStats.pending--;
+		if (ret == UPNP_E_SUCCESS) {
+			DiscoveryStats.fetched++;
+			DiscoveryStats.round_fetched++;
+		} else {
+			DiscoveryStats.failed++;
+		}
+		if (DiscoveryStats.pending == 0)
+			DiscoveryStats.round_ms =
+				CCTvDiscoveryNow() - DiscoveryRoundStart;
+		CCTvDiscoveryFreeJob(job);
+	}
+	ithread_mutex_unlock(&DiscoveryMutex);
+
+	return NULL;
+	args = args;
+}
+
+int CCTvDiscoveryStart(int nworkers, int maxpending,
+	CCTvDiscoveryFetchFn fetch, CCTvDiscoveryAddFn add,
+	CCTvDiscoveryRefreshFn refresh)
+{
+	int i;
+
+	if (nworkers <= 0 || maxpending <= 0 || !add)
+		return CCTV_ERROR;
+	DiscoveryNumBuckets = 64;
+	while (DiscoveryNumBuckets < (unsigned int)maxpending)
+		DiscoveryNumBuckets <<= 1;
+	DiscoveryBuckets = (struct CCTvDiscoveryJob **)calloc(
+		DiscoveryNumBuckets, sizeof (struct CCTvDiscoveryJob *));
+	DiscoveryWorkers = (ithread_t *)calloc((size_t)nworkers,
+		sizeof (ithread_t));
+	DiscoveryCacheBuckets = CCTV_DISCOVERY_CACHE_BUCKETS;
+	DiscoveryCache = (struct CCTvDiscoveryCacheEntry **)calloc(
+		DiscoveryCacheBuckets,
+		sizeof (struct CCTvDiscoveryCacheEntry *));
+	if (!DiscoveryBuckets || !DiscoveryWorkers || !DiscoveryCache) {
+		free(DiscoveryBuckets);
+		free(DiscoveryWorkers);
+		free(DiscoveryCache);
+		DiscoveryBuckets = NULL;
+		DiscoveryWorkers = NULL;
+		DiscoveryCache = NULL;
+		return CCTV_ERROR;
+	}
+	ithread_mutex_init(&DiscoveryMutex, 0);
+	ithread_cond_init(&DiscoveryCond, 0);
+	DiscoveryMaxPending = maxpending;
+	DiscoveryFetch = fetch ? fetch : UpnpDownloadXmlDoc;
+	DiscoveryAdd = add;
+	DiscoveryRefresh = refresh;
+	DiscoveryHead = NULL;
+	DiscoveryTail = NULL;
+	memset(&DiscoveryStats, 0, sizeof DiscoveryStats);
+	DiscoveryStats.round_ms = -1;
+	DiscoveryRoundStart = CCTvDiscoveryNow();
+	DiscoveryRunning = 1;
+	for (i = 0; i < nworkers; i++) {
+		if (ithread_create(&DiscoveryWorkers[i], NULL,
+			CCTvDiscoveryWorker, NULL) != 0)
+			break;
+	}
+	DiscoveryNumWorkers = i;
+	if (DiscoveryNumWorkers == 0) {
+		CCTvDiscoveryStop();
+		CCTvDiscoveryDestroy();
+		return CCTV_ERROR;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvDiscoveryStop(void)
+{
+	struct CCTvDiscoveryJob *job;
+	struct CCTvDiscoveryJob **pjob;
+	int i;
+
+	if (!DiscoveryWorkers)
+		return;
+	ithread_mutex_lock(&DiscoveryMutex);
+	DiscoveryRunning = 0;
+	ithread_cond_broadcast(&DiscoveryCond);
+	ithread_mutex_unlock(&DiscoveryMutex);
+	for (i = 0; i < DiscoveryNumWorkers; i++)
+		ithread_join(DiscoveryWorkers[i], NULL);
+	free(DiscoveryWorkers);
+	DiscoveryWorkers = NULL;
+	DiscoveryNumWorkers = 0;
+	/* the add function may still ask for a job being freed here */
+	ithread_mutex_lock(&DiscoveryMutex);
+	while (DiscoveryHead) {
+		job = DiscoveryHead;
+		DiscoveryHead = job->next;
+		pjob = CCTvDiscoveryLookup(job->location, job->hash);
+		*pjob = job->chain;
+		DiscoveryStats.pending--;
+		CCTvDiscoveryFreeJob(job);
+	}
+	DiscoveryTail = NULL;
+	ithread_mutex_unlock(&DiscoveryMutex);
+}
+
+void CCTvDiscoveryDestroy(void)
+{
+	struct CCTvDiscoveryCacheEntry *entry;
+	unsigned int b;
+
+	if (!DiscoveryBuckets)
+		return;
+	/* late SSDP callbacks are refused, but may still be in here */
+	ithread_mutex_lock(&DiscoveryMutex);
+	for (b = 0; b < DiscoveryCacheBuckets; b++) {
+		while ((entry = DiscoveryCache[b])) {
+			DiscoveryCache[b] = entry->next;
+			CCTvDiscoveryCacheFree(entry);
+		}
+	}
+	free(DiscoveryCache);
+	DiscoveryCache = NULL;
+	DiscoveryStats.cache_entries = 0;
+	free(DiscoveryBuckets);
+	DiscoveryBuckets = NULL;
+	ithread_mutex_unlock(&DiscoveryMutex);
+	/* the mutex stays usable: later callbacks find nothing to do */
+}
+
+int CCTvDiscoveryEnqueue(const char *UDN, const char *location, int expires)
+{
+	struct CCTvDiscoveryCacheEntry *entry;
+	struct CCTvDiscoveryJob *job;
+	struct CCTvDiscoveryJob **pjob;
+	unsigned int hash;
+	int ret = CCTV_SUCCESS;
+	int known;
+
+	if (!location || !*location)
+		return CCTV_ERROR;
+	if (UDN && !*UDN)
+		UDN = NULL;
+	hash = CCTvRegistryHash(location);
+	ithread_mutex_lock(&DiscoveryMutex);
+	if (!DiscoveryRunning) {
+		ret = CCTV_ERROR;
+		goto done;
+	}
+	if (DiscoveryRefresh && UDN) {
+		entry = *CCTvDiscoveryCacheLookup(UDN, CCTvRegistryHash(UDN));
+		if (entry && strcmp(entry->location, location) == 0) {
+			if (entry->foreign) {
+				DiscoveryStats.cache_hits++;
+				DiscoveryStats.cache_ignored++;
+				goto done;
+			}
+			/* the refresh takes the device table locks */
+			ithread_mutex_unlock(&DiscoveryMutex);
+			known = DiscoveryRefresh(UDN, expires) == CCTV_SUCCESS;
+			ithread_mutex_lock(&DiscoveryMutex);
+			if (!DiscoveryRunning) {
+				ret = CCTV_ERROR;
+				goto done;
+			}
+			if (known) {
+				DiscoveryStats.cache_hits++;
+				goto done;
+			}
+			/* expired or removed meanwhile, fetch it again */
+			CCTvDiscoveryCacheDel(UDN);
+		}
+		DiscoveryStats.cache_misses++;
+	}
+	pjob = CCTvDiscoveryLookup(location, hash);
+	if (*pjob) {
+		if (expires > (*pjob)->expires)
+			(*pjob)->expires = expires;
+		/* out of memory only loses the cache entry of the UDN */
+		CCTvDiscoveryAddUDN(*pjob, UDN);
+		DiscoveryStats.coalesced++;
+		goto done;
+	}
+	if (DiscoveryStats.pending >= DiscoveryMaxPending) {
+		DiscoveryStats.dropped++;
+		ret = CCTV_WARNING;
+		goto done;
+	}
+	job = (struct CCTvDiscoveryJob *)calloc(1, sizeof *job);
+	if (job)
+		job->location = strdup(location);
+	if (!job || !job->location ||
+	    CCTvDiscoveryAddUDN(job, UDN) != CCTV_SUCCESS) {
+		if (job)
+			CCTvDiscoveryFreeJob(job);
+		ret = CCTV_ERROR;
+		goto done;
+	}
+	job->hash = hash;
+	job->expires = expires;
+	*pjob = job;
+	if (DiscoveryTail)
+		DiscoveryTail->next = job;
+	else
+		DiscoveryHead = job;
+	DiscoveryTail = job;
+	DiscoveryStats.pending++;
+	DiscoveryStats.enqueued++;
+	ithread_cond_signal(&DiscoveryCond);
+done:
+	ithread_mutex_unlock(&DiscoveryMutex);
+
+	return ret;
+}
+
+void CCTvDiscoveryForget(const char *UDN)
+{
+	if (!UDN || !*UDN)
+		return;
+	ithread_mutex_lock(&DiscoveryMutex);
+	if (DiscoveryCache)
+		CCTvDiscoveryCacheDel(UDN);
+	ithread_mutex_unlock(&DiscoveryMutex);
+}
+
+int CCTvDiscoveryWanted(const char *location, const char *UDN)
+{
+	struct CCTvDiscoveryJob *job;
+	struct CCTvDiscoveryUDN *u;
+	int wanted = 0;
+
+	if (!location || !UDN)
+		return 0;
+	ithread_mutex_lock(&DiscoveryMutex);
+	job = DiscoveryBuckets ? *CCTvDiscoveryLookup(location,
+		CCTvRegistryHash(location)) : NULL;
+	for (u = job ? job->UDNs : NULL; u && !wanted; u = u->next)
+		wanted = strcmp(u->UDN, UDN) == 0;
+	ithread_mutex_unlock(&DiscoveryMutex);
+
+	return wanted;
+}
+
+void CCTvDiscoveryStartRound(void)
+{
+	ithread_mutex_lock(&DiscoveryMutex);
+	DiscoveryRoundStart = CCTvDiscoveryNow();
+	DiscoveryStats.round_fetched = 0;
+	DiscoveryStats.round_ms = -1;
+	ithread_mutex_unlock(&DiscoveryMutex);
+}
+
+void CCTvDiscoveryGetStats(struct CCTvDiscoveryStats *stats)
+{
+	ithread_mutex_lock(&DiscoveryMutex);
+	*stats = DiscoveryStats;
+	ithread_mutex_unlock(&DiscoveryMutex);
+}
+
+void CCTvDiscoveryPrintStats(void)
+{
+	struct CCTvDiscoveryStats stats;
+
+	CCTvDiscoveryGetStats(&stats);
+	SampleUtil_Print(
+		"Discovery:\n"
+		"    +- Queued         = %lu\n"
+		"    +- Coalesced      = %lu\n"
+		"    +- Dropped        = %lu\n"
+		"    +- Fetched        = %lu\n"
+		"    +- Failed         = %lu\n"
+		"    +- Cache hits     = %lu\n"
+		"    +- Cache misses   = %lu\n"
+		"    +- Cache ignored  = %lu\n"
+		"    +- Cache entries  = %u\n"
+		"    +- Pending        = %d\n"
+		"    +- Round fetched  = %lu\n",
+		stats.enqueued,
+		stats.coalesced,
+		stats.dropped,
+		stats.fetched,
+		stats.failed,
+		stats.cache_hits,
+		stats.cache_misses,
+		stats.cache_ignored,
+		stats.cache_entries,
+		stats.pending,
+		stats.round_fetched);
+	if (stats.round_ms < 0)
+		SampleUtil_Print("    +- Round time     = (in progress)\n");
+	else
+		SampleUtil_Print("    +- Round time     = %.1f ms\n",
+			stats.round_ms);
+}
+
+/*! @} Control Point Discovery Pipeline */
+
+/*! @} UpnpSamples */
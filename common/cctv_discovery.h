@@ -0,0 +1,211 @@
+#ifndef UPNP_CCTV_DISCOVERY_H
+#define UPNP_CCTV_DISCOVERY_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Discovery Pipeline
+ *
+ * @{
+ *
+ * \file
+ *
+ * SSDP callbacks only hand the advertised description location to
+ * CCTvDiscoveryEnqueue(), which returns right away. A bounded pool of
+ * fetcher threads downloads and parses the description documents and
+ * passes them on to the control point. A location that is already queued
+ * or being fetched is not queued again, so the several notifications a
+ * camera sends per advertisement cost a single download.
+ *
+ * Once a description has been handled, the location it came from is
+ * remembered per UDN. Later ALIVEs and search results for the same UDN and
+ * location only refresh the device's expiry, without any HTTP traffic.
+ * Devices that turned out not to be cameras are remembered as well and
+ * ignored. A description is fetched again when the device advertises a new
+ * location, sends a byebye, or is no longer in the device table.
+ *
+ * A description may also describe embedded devices, each advertising on its
+ * own; all the UDNs notified for a location while it is pending get the
+ * single download, and are remembered with it.
+ */
+
+#include "upnp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Default number of fetcher threads. */
+#define CCTV_DISCOVERY_WORKERS 8
+
+/*! Default limit of locations queued or in flight. */
+#define CCTV_DISCOVERY_MAX_PENDING 1024
+
+/*! Most UDNs remembered per location queued or in flight. */
+#define CCTV_DISCOVERY_MAX_UDNS 256
+
+/*!
+ * \brief Download and parse the description document at location.
+ * UpnpDownloadXmlDoc() has this signature.
+ */
+typedef int (*CCTvDiscoveryFetchFn)(
+	/*! [in] Description document URL. */
+	const char *location,
+	/*! [out] Parsed document. */
+	IXML_Document **DescDoc);
+
+/*!
+ * \brief Called from a fetcher thread with each downloaded description.
+ * The document is freed once this returns.
+ *
+ * \return CCTV_SUCCESS if the device was added or already known,
+ * CCTV_WARNING if it is not a device the control point handles, CCTV_ERROR
+ * otherwise. Only the first two are cached.
+ */
+typedef int (*CCTvDiscoveryAddFn)(
+	/*! [in] Description document. */
+	IXML_Document *DescDoc,
+	/*! [in] Its location. */
+	const char *location,
+	/*! [in] Advertisement expiry, in seconds. */
+	int expires);
+
+/*!
+ * \brief Refresh the expiry of a device found in the description cache.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the device is no longer known and
+ * its description has to be fetched again.
+ */
+typedef int (*CCTvDiscoveryRefreshFn)(
+	/*! [in] Device UDN. */
+	const char *UDN,
+	/*! [in] Advertisement expiry, in seconds. */
+	int expires);
+
+/*! Counters of the discovery pipeline. */
+struct CCTvDiscoveryStats {
+	/*! Locations queued. */
+	unsigned long enqueued;
+	/*! Notifications for a location already queued or in flight. */
+	unsigned long coalesced;
+	/*! Notifications dropped because the queue was full. */
+	unsigned long dropped;
+	/*! Descriptions downloaded. */
+	unsigned long fetched;
+	/*! Downloads that failed. */
+	unsigned long failed;
+	/*! Notifications answered from the description cache. */
+	unsigned long cache_hits;
+	/*! Notifications the cache could not answer. */
+	unsigned long cache_misses;
+	/*! Cache hits for devices the control point does not handle. */
+	unsigned long cache_ignored;
+	/*! Devices in the description cache. */
+	unsigned int cache_entries;
+	/*! Locations queued or in flight right now. */
+	int pending;
+	/*! Descriptions downloaded since the current round started. */
+	unsigned long round_fetched;
+	/*! Milliseconds from the start of the current round until the queue
+	 * last drained, i.e. the time to discover the fleet; -1 while the
+	 * first batch of the round is still pending. */
+	double round_ms;
+};
+
+/*!
+ * \brief Start the fetcher threads.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvDiscoveryStart(
+	/*! [in] Number of fetcher threads. */
+	int nworkers,
+	/*! [in] Maximum number of locations queued or in flight. */
+	int maxpending,
+	/*! [in] Fetch function, NULL for UpnpDownloadXmlDoc(). */
+	CCTvDiscoveryFetchFn fetch,
+	/*! [in] Where the downloaded descriptions go. */
+	CCTvDiscoveryAddFn add,
+	/*! [in] Expiry refresh for cached devices, NULL to disable the
+	 * description cache. */
+	CCTvDiscoveryRefreshFn refresh);
+
+/*!
+ * \brief Stop and join the fetcher threads, dropping whatever is queued.
+ * Notifications are refused from then on.
+ */
+void CCTvDiscoveryStop(void);
+
+/*!
+ * \brief Free the description cache. Call after CCTvDiscoveryStop(), once
+ * the SDK client is unregistered, as SSDP callbacks use the cache until
+ * then.
+ */
+void CCTvDiscoveryDestroy(void);
+
+/*!
+ * \brief Handle an SSDP notification: refresh the device from the cache or
+ * queue its description location for download. Never blocks on the
+ * network, so it is safe to call from the SSDP callback.
+ *
+ * \return CCTV_SUCCESS if the device was refreshed, or the location was
+ * queued or is already pending, CCTV_WARNING if the queue is full,
+ * CCTV_ERROR otherwise.
+ */
+int CCTvDiscoveryEnqueue(
+	/*! [in] UDN the notification is for, may be NULL. */
+	const char *UDN,
+	/*! [in] Description document URL. */
+	const char *location,
+	/*! [in] Advertisement expiry, in seconds. */
+	int expires);
+
+/*!
+ * \brief Drop a device from the description cache, e.g. on byebye.
+ */
+void CCTvDiscoveryForget(
+	/*! [in] Device UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Whether a notification for UDN queued the location being
+ * handled. Meant for the add function, to tell the devices of a
+ * description that were asked for from those that only came along.
+ *
+ * \return 1 if so, else 0.
+ */
+int CCTvDiscoveryWanted(
+	/*! [in] Description document URL. */
+	const char *location,
+	/*! [in] Device UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Start a new discovery round, e.g. right before an M-SEARCH.
+ * Resets the time-to-discover measurement.
+ */
+void CCTvDiscoveryStartRound(void);
+
+/*!
+ * \brief Copy the pipeline counters.
+ */
+void CCTvDiscoveryGetStats(
+	/*! [out] Counters. */
+	struct CCTvDiscoveryStats *stats);
+
+/*!
+ * \brief Print the pipeline counters with SampleUtil_Print().
+ */
+void CCTvDiscoveryPrintStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Discovery Pipeline */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_DISCOVERY_H */
@@ -0,0 +1,361 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Action Fan-out
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_fanout.h"
+
+#include "cctv_ctrlpt.h"
+#include "sample_util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*! errCode of a device the action was never sent to. */
+#define CCTV_FANOUT_SKIPPED 1
+
+struct CCTvFanoutJob;
+
+/*! One device of a fan-out; its address is the request cookie. */
+struct CCTvFanoutTarget {
+	struct CCTvFanoutJob *job;
+	char *controlURL;
+	/*! Index in the result array. */
+	int index;
+};
+
+/*! One fan-out. */
+struct CCTvFanoutJob {
+	int id;
+	char *actionName;
+	char *serviceType;
+	IXML_Document *action;
+	/*! Whether action is freed with the job. */
+	int owned;
+	struct CCTvFanoutTarget *targets;
+	struct CCTvFanoutTargetResult *results;
+	int n;
+	int maxinflight;
+	/*! Next target to send to. */
+	int next;
+	int inflight;
+	int completed;
+	int ok;
+	int failed;
+	int skipped;
+	/*! Threads inside CCTvFanoutPump() for this job. */
+	int pumps;
+	double start;
+	CCTvFanoutDoneFn done;
+	void *arg;
+	/*! Fan-outs in progress. */
+	struct CCTvFanoutJob *prev;
+	struct CCTvFanoutJob *nextjob;
+};
+
+/*! Guards everything below and all jobs. */
+static ithread_mutex_t FanoutMutex;
+/*! Signalled when a fan-out has been reported and freed. */
+static ithread_cond_t FanoutCond;
+static int FanoutInitialized;
+static int FanoutRunning;
+static CCTvFanoutSendFn FanoutSend;
+static struct CCTvFanoutJob *FanoutJobs;
+static int FanoutNextId = 1;
+/*! Finished fan-outs, off the list, whose report is still running. */
+static int FanoutReporting;
+
+static double CCTvFanoutNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void CCTvFanoutFree(struct CCTvFanoutJob *job)
+{
+	int i;
+
+	for (i = 0; i < job->n; i++) {
+		free(job->targets[i].controlURL);
+		free((char *)job->results[i].UDN);
+	}
+	free(job->targets);
+	free(job->results);
+	free(job->actionName);
+	free(job->serviceType);
+	if (job->action && job->owned)
+		ixmlDocument_free(job->action);
+	free(job);
+}
+
+static void CCTvFanoutPrintResult(const struct CCTvFanoutResult *result,
+	void *arg)
+{
+	int i;
+
+	SampleUtil_Print(
+		"Fan-out %d %s: %d devices, %d ok, %d failed, %d skipped "
+		"in %.1f ms\n",
+		result->id, result->actionName, result->total, result->ok,
+		result->failed, result->skipped, result->elapsed_ms);
+	for (i = 0; i < result->total; i++) {
+		if (result->targets[i].errCode != UPNP_E_SUCCESS &&
+		    result->targets[i].errCode != CCTV_FANOUT_SKIPPED)
+			SampleUtil_Print("    +- %s -- %d\n",
+				result->targets[i].UDN,
+				result->targets[i].errCode);
+	}
+	arg = arg;
+}
+
+/*! Count the outcome of one request. Lock held. */
+static void CCTvFanoutRecord(struct CCTvFanoutTarget *t, int errCode)
+{
+	struct CCTvFanoutJob *job = t->job;
+
+	job->results[t->index].errCode = errCode;
+	if (errCode == UPNP_E_SUCCESS)
+		job->ok++;
+	else
+		job->failed++;
+	job->inflight--;
+	job->completed++;
+}
+
+/*!
+ * \brief Record a completion, if any, and send as many requests as the
+ * in-flight limit allows. The last thread to leave a finished job reports
+ * and frees it.
+ */
+static void CCTvFanoutPump(struct CCTvFanoutJob *job,
+	struct CCTvFanoutTarget *done, int errCode)
+{
+	struct CCTvFanoutResult result;
+	struct CCTvFanoutTarget *t;
+	int finished;
+	int rc;
+
+	ithread_mutex_lock(&FanoutMutex);
+	if (done)
+		CCTvFanoutRecord(done, errCode);
+	job->pumps++;
+	for (;;) {
+		if (!FanoutRunning && job->next < job->n) {
+			job->skipped += job->n - job->next;
+			job->next = job->n;
+		}
+		if (job->next >= job->n || job->inflight >= job->maxinflight)
+			break;
+		t = &job->targets[job->next++];
+		job->inflight++;
+		/* the completion may arrive before the send returns */
+		ithread_mutex_unlock(&FanoutMutex);
+		rc = FanoutSend(t->controlURL, job->serviceType,
+			job->actionName, job->action, t);
+		ithread_mutex_lock(&FanoutMutex);
+		if (rc != UPNP_E_SUCCESS)
+			CCTvFanoutRecord(t, rc);
+	}
+	job->pumps--;
+	finished = job->pumps == 0 &&
+		job->completed + job->skipped == job->n;
+	if (finished) {
+		if (job->prev)
+			job->prev->nextjob = job->nextjob;
+		else
+			FanoutJobs = job->nextjob;
+		if (job->nextjob)
+			job->nextjob->prev = job->prev;
+		FanoutReporting++;
+	}
+	ithread_mutex_unlock(&FanoutMutex);
+
+	if (!finished)
+		return;
+	result.id = job->id;
+	result.actionName = job->actionName;
+	result.total = job->n;
+	result.ok = job->ok;
+	result.failed = job->failed;
+	result.skipped = job->skipped;
+	result.elapsed_ms = CCTvFanoutNow() - job->start;
+	result.targets = job->results;
+	if (job->done)
+		job->done(&result, job->arg);
+	else
+		CCTvFanoutPrintResult(&result, NULL);
+	CCTvFanoutFree(job);
+
+	ithread_mutex_lock(&FanoutMutex);
+	FanoutReporting--;
+	ithread_cond_broadcast(&FanoutCond);
+	ithread_mutex_unlock(&FanoutMutex);
+}
+
+int CCTvFanoutStart(CCTvFanoutSendFn send)
+{
+	if (!send)
+		return CCTV_ERROR;
+	ithread_mutex_init(&FanoutMutex, 0);
+	ithread_cond_init(&FanoutCond, 0);
+	FanoutSend = send;
+	FanoutJobs = NULL;
+	FanoutReporting = 0;
+	FanoutRunning = 1;
+	FanoutInitialized = 1;
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvFanoutStop(void)
+{
+	struct CCTvFanoutJob *job;
+	struct timespec deadline;
+
+	if (!FanoutInitialized)
+		return;
+	ithread_mutex_lock(&FanoutMutex);
+	/* the next completion of each job skips the devices left */
+	FanoutRunning = 0;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += CCTV_FANOUT_STOP_MS / 1000;
+	while ((FanoutJobs || FanoutReporting) &&
+	       ithread_cond_timedwait(&FanoutCond, &FanoutMutex,
+		       &deadline) != ETIMEDOUT)
+		;
+	for (job = FanoutJobs; job; job = job->nextjob)
+		SampleUtil_Print("Fan-out %d %s: cancelled with %d requests "
+			"in flight\n", job->id, job->actionName,
+			job->inflight);
+	ithread_mutex_unlock(&FanoutMutex);
+}
+
+void CCTvFanoutDestroy(void)
+{
+	struct CCTvFanoutJob *job;
+
+	if (!FanoutInitialized)
+		return;
+	FanoutInitialized = 0;
+	/* their completions will never come */
+	while (FanoutJobs) {
+		job = FanoutJobs;
+		FanoutJobs = job->nextjob;
+		CCTvFanoutFree(job);
+	}
+	ithread_cond_destroy(&FanoutCond);
+	ithread_mutex_destroy(&FanoutMutex);
+}
+
+int CCTvFanoutSubmit(const char *actionName, const char *serviceType,
+	IXML_Document *action, int owned, const char **UDNs,
+	const char **controlURLs, int n, int maxinflight,
+	CCTvFanoutDoneFn done, void *arg)
+{
+	struct CCTvFanoutJob *job = NULL;
+	int id;
+	int i;
+
+	if (n > 0)
+		job = (struct CCTvFanoutJob *)calloc(1, sizeof *job);
+	if (job) {
+		job->targets = (struct CCTvFanoutTarget *)calloc((size_t)n,
+			sizeof *job->targets);
+		job->results = (struct CCTvFanoutTargetResult *)calloc(
+			(size_t)n, sizeof *job->results);
+		job->actionName = strdup(actionName);
+		job->serviceType = strdup(serviceType);
+		job->action = action;
+		job->owned = owned;
+		action = NULL;
+		job->n = n;
+	}
+	if (!job || !job->targets || !job->results || !job->actionName ||
+	    !job->serviceType)
+		goto error_handler;
+	for (i = 0; i < n; i++) {
+		job->targets[i].job = job;
+		job->targets[i].index = i;
+		job->targets[i].controlURL = strdup(controlURLs[i]);
+		job->results[i].UDN = strdup(UDNs[i]);
+		job->results[i].errCode = CCTV_FANOUT_SKIPPED;
+		if (!job->targets[i].controlURL || !job->results[i].UDN)
+			goto error_handler;
+	}
+	job->maxinflight = maxinflight > 0 ? maxinflight :
+		CCTV_FANOUT_MAX_INFLIGHT;
+	job->done = done;
+	job->arg = arg;
+	job->start = CCTvFanoutNow();
+
+	ithread_mutex_lock(&FanoutMutex);
+	if (!FanoutRunning) {
+		ithread_mutex_unlock(&FanoutMutex);
+		goto error_handler;
+	}
+	id = job->id = FanoutNextId++;
+	job->nextjob = FanoutJobs;
+	if (FanoutJobs)
+		FanoutJobs->prev = job;
+	FanoutJobs = job;
+	ithread_mutex_unlock(&FanoutMutex);
+
+	SampleUtil_Print("Fan-out %d: sending %s to %d devices, %d at a time\n",
+		id, actionName, n, job->maxinflight);
+	/* the job may be gone once this returns */
+	CCTvFanoutPump(job, NULL, UPNP_E_SUCCESS);
+
+	return id;
+
+error_handler:
+	if (job) {
+		/* entries not filled in yet are NULL */
+		if (!job->targets || !job->results)
+			job->n = 0;
+		CCTvFanoutFree(job);
+	}
+	if (action && owned)
+		ixmlDocument_free(action);
+
+	return CCTV_ERROR;
+}
+
+void CCTvFanoutComplete(void *cookie, int errCode)
+{
+	struct CCTvFanoutTarget *t = (struct CCTvFanoutTarget *)cookie;
+
+	CCTvFanoutPump(t->job, t, errCode);
+}
+
+void CCTvFanoutPrintStatus(void)
+{
+	struct CCTvFanoutJob *job;
+
+	ithread_mutex_lock(&FanoutMutex);
+	if (!FanoutJobs)
+		SampleUtil_Print("No fan-out in progress\n");
+	for (job = FanoutJobs; job; job = job->nextjob) {
+		SampleUtil_Print(
+			"Fan-out %d %s: %d of %d done, %d in flight, "
+			"%d ok, %d failed\n",
+			job->id, job->actionName, job->completed, job->n,
+			job->inflight, job->ok, job->failed);
+	}
+	ithread_mutex_unlock(&FanoutMutex);
+}
+
+/*! @} Control Point Action Fan-out */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,158 @@
+#ifndef UPNP_CCTV_FANOUT_H
+#define UPNP_CCTV_FANOUT_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Action Fan-out
+ *
+ * @{
+ *
+ * \file
+ *
+ * Sends one action to a set of devices with at most a given number of
+ * requests in flight. Each request carries a cookie; the control point
+ * callback hands UPNP_CONTROL_ACTION_COMPLETE events with a cookie to
+ * CCTvFanoutComplete(), which sends the next request. Once every device has
+ * answered, the outcome is reported in a single summary.
+ */
+
+#include "upnp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Default limit of requests in flight per fan-out. */
+#define CCTV_FANOUT_MAX_INFLIGHT 32
+
+/*! Milliseconds CCTvFanoutStop() waits for the requests in flight. */
+#define CCTV_FANOUT_STOP_MS 5000
+
+/*!
+ * \brief Send one action request asynchronously. Its completion must be
+ * reported with CCTvFanoutComplete(), passing cookie.
+ *
+ * \return UPNP_E_SUCCESS, or an UPnP error code if the request was not sent
+ * and no completion will follow.
+ */
+typedef int (*CCTvFanoutSendFn)(
+	/*! [in] Control URL of the device. */
+	const char *controlURL,
+	/*! [in] Service type. */
+	const char *serviceType,
+	/*! [in] Action name. */
+	const char *actionName,
+	/*! [in] Action request, still owned by the fan-out. */
+	IXML_Document *action,
+	/*! [in] Cookie to complete the request with. */
+	void *cookie);
+
+/*! Outcome for one device of a fan-out. */
+struct CCTvFanoutTargetResult {
+	const char *UDN;
+	/*! UPNP_E_SUCCESS, an UPnP error code, or 1 if never sent. */
+	int errCode;
+};
+
+/*! Outcome of a fan-out. */
+struct CCTvFanoutResult {
+	int id;
+	const char *actionName;
+	int total;
+	int ok;
+	int failed;
+	/*! Not sent because the module was stopped. */
+	int skipped;
+	/*! From submission to the last completion. */
+	double elapsed_ms;
+	/*! One per device, in submission order. */
+	const struct CCTvFanoutTargetResult *targets;
+};
+
+/*!
+ * \brief Called once a fan-out is complete, from the thread that reported
+ * the last completion. The result is only valid during the call.
+ */
+typedef void (*CCTvFanoutDoneFn)(
+	/*! [in] Outcome. */
+	const struct CCTvFanoutResult *result,
+	/*! [in] Argument given to CCTvFanoutSubmit(). */
+	void *arg);
+
+/*!
+ * \brief Start the module.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvFanoutStart(
+	/*! [in] Sends the requests. */
+	CCTvFanoutSendFn send);
+
+/*!
+ * \brief Stop sending and wait up to CCTV_FANOUT_STOP_MS for the requests
+ * in flight. Fan-outs finish with the devices not yet sent to counted as
+ * skipped; those still waiting at the deadline are reported as cancelled.
+ */
+void CCTvFanoutStop(void);
+
+/*!
+ * \brief Free the fan-outs cancelled by CCTvFanoutStop(). Call once no
+ * completion can arrive any more, i.e. after UpnpFinish().
+ */
+void CCTvFanoutDestroy(void);
+
+/*!
+ * \brief Send an action to a set of devices.
+ *
+ * \return The fan-out id, or CCTV_ERROR if stopped, out of memory or n is
+ * not positive. On error an owned action is freed as well.
+ */
+int CCTvFanoutSubmit(
+	/*! [in] Action name, for the summary. */
+	const char *actionName,
+	/*! [in] Service type of the action. */
+	const char *serviceType,
+	/*! [in] Action request, sent unmodified to every device. */
+	IXML_Document *action,
+	/*! [in] Whether the fan-out takes ownership of action; 0 for a
+	 * template, which must outlive the fan-out. */
+	int owned,
+	/*! [in] UDNs of the devices. */
+	const char **UDNs,
+	/*! [in] Control URLs of the devices. */
+	const char **controlURLs,
+	/*! [in] Number of devices. */
+	int n,
+	/*! [in] Limit of requests in flight, 0 for the default. */
+	int maxinflight,
+	/*! [in] Receives the outcome, NULL to print a summary. */
+	CCTvFanoutDoneFn done,
+	/*! [in] Argument of done. */
+	void *arg);
+
+/*!
+ * \brief Report the completion of a request sent by a fan-out.
+ */
+void CCTvFanoutComplete(
+	/*! [in] Cookie the request was sent with. */
+	void *cookie,
+	/*! [in] UPnP error code of the request. */
+	int errCode);
+
+/*!
+ * \brief Print the fan-outs in progress with SampleUtil_Print().
+ */
+void CCTvFanoutPrintStatus(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Action Fan-out */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_FANOUT_H */
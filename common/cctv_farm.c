@@ -0,0 +1,1223 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Device Emulator Farm
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_farm.h"
+
+#include "cctv_ctrlpt.h"
+#include "cctv_device.h"
+#include "cctv_metrics.h"
+#include "cctv_timer.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_WEB_DIR "./web"
+#define DEFAULT_FARM_DIR "/tmp/cctv_farm"
+
+#define DESC_URL_SIZE 200
+
+/*! An emulated camera. */
+struct CCTvFarmCamera {
+	/*! UDN, service identifiers, state table and action table. */
+	struct CCTvService service;
+	/*! Storage of the state table values. */
+	char values[CCTV_CONTROL_VARCOUNT][CCTV_MAX_VAL_LEN];
+	struct CCTvFarmRack *rack;
+	int number;
+	int temperature;
+	/*! Last position set on the servos, as a PWM duty. */
+	int top;
+	int bottom;
+	/*! Fails every request but Reboot. */
+	int hung;
+	/*! Rebooting: 1 while still registered, 2 once its rack is
+	 * unregistered, else 0. */
+	int down;
+	/*! rand_r() state. */
+	unsigned int rand;
+	struct CCTvTimer TempTimer;
+	struct CCTvTimer BootTimer;
+	/*! UDN hash chain. */
+	unsigned int hash;
+	struct CCTvFarmCamera *chain;
+};
+
+/*! A root device with its embedded cameras. */
+struct CCTvFarmRack {
+	/*! Guards the state of the cameras of the rack and handle. */
+	ithread_mutex_t mutex;
+	/*! -1 while unregistered. */
+	UpnpDevice_Handle handle;
+	char url[DESC_URL_SIZE];
+	int first;
+	int count;
+};
+
+static const char *FarmVarName[] = { "Power", "Temperature" };
+
+static struct CCTvFarmConfig FarmConfig;
+static struct CCTvFarmCamera *FarmCameras;
+static struct CCTvFarmRack *FarmRacks;
+static int FarmNumRacks;
+/*! Cameras by UDN; never changes once started. */
+static struct CCTvFarmCamera **FarmBuckets;
+static unsigned int FarmNumBuckets;
+static struct CCTvTimerWheel FarmWheel;
+
+/*! Camera whose action is running on this thread. */
+static __thread struct CCTvFarmCamera *FarmCurrent;
+
+#define CCTV_FARM_CONF(field) \
+	__atomic_load_n(&FarmConfig.field, __ATOMIC_RELAXED)
+
+/*! A setting of CCTvFarmSet(). */
+struct CCTvFarmSetting {
+	const char *name;
+	size_t offset;
+	int min;
+	int max;
+	/*! Can be changed once started. */
+	int live;
+};
+
+static const struct CCTvFarmSetting FarmSettings[] = {
+	{ "cameras", offsetof(struct CCTvFarmConfig, cameras),
+	  1, CCTV_FARM_MAX_CAMERAS, 0 },
+	{ "rack", offsetof(struct CCTvFarmConfig, rack),
+	  1, CCTV_FARM_MAX_CAMERAS, 0 },
+	{ "expires", offsetof(struct CCTvFarmConfig, expires), 30, 86400, 1 },
+	{ "temp_ms", offsetof(struct CCTvFarmConfig, temp_ms), 0, 3600000, 1 },
+	{ "temp_start", offsetof(struct CCTvFarmConfig, temp_start),
+	  MIN_TEMP, MAX_TEMP, 1 },
+	{ "temp_step", offsetof(struct CCTvFarmConfig, temp_step),
+	  0, MAX_TEMP, 1 },
+	{ "temp_loss", offsetof(struct CCTvFarmConfig, temp_loss), 0, 1000, 1 },
+	{ "reboot_ms", offsetof(struct CCTvFarmConfig, reboot_ms),
+	  0, 3600000, 1 },
+	{ "error_rate", offsetof(struct CCTvFarmConfig, error_rate),
+	  0, 1000, 1 },
+	{ "hang_rate", offsetof(struct CCTvFarmConfig, hang_rate), 0, 1000, 1 },
+	{ "hang_ms", offsetof(struct CCTvFarmConfig, hang_ms), 0, 600000, 1 },
+	{ "latency_ms", offsetof(struct CCTvFarmConfig, latency_ms),
+	  0, 600000, 1 },
+	{ "hung_rate", offsetof(struct CCTvFarmConfig, hung_rate), 0, 1000, 0 },
+	{ "seed", offsetof(struct CCTvFarmConfig, seed), 0, INT_MAX, 0 }
+};
+
+#define CCTV_FARM_SETTINGS \
+	((int)(sizeof FarmSettings / sizeof FarmSettings[0]))
+
+/*! Metrics of the farm, see FarmMetrics. */
+enum CCTvFarmMetricId {
+	METRIC_ACTIONS_OK = 0,
+	METRIC_ACTIONS_FAILED,
+	METRIC_ACTIONS_HANG,
+	METRIC_GETVARS,
+	METRIC_SUBSCRIPTIONS,
+	METRIC_REBOOTS,
+	METRIC_EVENTS_SENT,
+	METRIC_EVENTS_LOST,
+	METRIC_CAMERAS,
+	METRIC_DOWN,
+	METRIC_HUNG
+};
+
+static struct CCTvMetric FarmMetrics[] = {
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_actions_total{result=\"ok\"}",
+		"Action requests to the emulated cameras, by outcome."),
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_actions_total{result=\"failed\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_actions_total{result=\"hang\"}",
+		NULL),
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_getvar_total",
+		"GetVar requests to the emulated cameras."),
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_subscriptions_total",
+		"Subscriptions accepted by the emulated cameras."),
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_reboots_total",
+		"Reboots of the emulated cameras."),
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_temperature_events_total{result=\"sent\"}",
+		"Temperature events of the emulated cameras."),
+	CCTV_METRIC_COUNTER_INIT("cctv_farm_temperature_events_total{result=\"lost\"}",
+		NULL),
+	{ "cctv_farm_cameras", "Emulated cameras.",
+	  CCTV_METRIC_GAUGE, 0, NULL, NULL, 0 },
+	{ "cctv_farm_cameras_down", "Emulated cameras rebooting.",
+	  CCTV_METRIC_GAUGE, 0, NULL, NULL, 0 },
+	{ "cctv_farm_cameras_hung", "Emulated cameras hung.",
+	  CCTV_METRIC_GAUGE, 0, NULL, NULL, 0 }
+};
+
+static long CCTvFarmMetric(int id)
+{
+	return __atomic_load_n(&FarmMetrics[id].value, __ATOMIC_RELAXED);
+}
+
+static unsigned int CCTvFarmHash(const char *str)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*str)
+		hash = (hash ^ (unsigned char)*str++) * 16777619u;
+
+	return hash;
+}
+
+static struct CCTvFarmCamera *CCTvFarmFind(const char *UDN)
+{
+	struct CCTvFarmCamera *cam;
+	unsigned int hash = CCTvFarmHash(UDN);
+
+	for (cam = FarmBuckets[hash & (FarmNumBuckets - 1)]; cam;
+	     cam = cam->chain) {
+		if (cam->hash == hash && strcmp(cam->service.UDN, UDN) == 0)
+			return cam;
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Whether something with a chance of rate per mille happens.
+ * Call with the rack mutex held.
+ */
+static int CCTvFarmRoll(struct CCTvFarmCamera *cam, int rate)
+{
+	return rate > 0 && rand_r(&cam->rand) % 1000 < rate;
+}
+
+/*!
+ * \brief Store a state variable of a camera and send it to the
+ * subscribers. Call with the rack mutex held.
+ */
+static void CCTvFarmSetVar(struct CCTvFarmCamera *cam, int var,
+	const char *value)
+{
+	snprintf(cam->values[var], CCTV_MAX_VAL_LEN, "%s", value);
+	if (cam->rack->handle < 0)
+		return;
+	UpnpNotify(cam->rack->handle, cam->service.UDN,
+		cam->service.ServiceId,
+		(const char **)&cam->service.VariableName[var],
+		(const char **)&cam->service.VariableStrVal[var], 1);
+}
+
+/* Control Service Actions, run with the rack mutex held. */
+
+static int CCTvFarmRespond(const char *action, const char *arg,
+	const char *value, IXML_Document **out, const char **errorString)
+{
+	(*out) = NULL;
+	(*errorString) = NULL;
+	if (UpnpAddToActionResponse(out, action,
+		CCTvServiceType[CCTV_SERVICE_CONTROL], arg, value) !=
+	    UPNP_E_SUCCESS) {
+		(*out) = NULL;
+		(*errorString) = "Internal Error";
+		return UPNP_E_INTERNAL_ERROR;
+	}
+
+	return UPNP_E_SUCCESS;
+}
+
+static int CCTvFarmPowerOn(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	CCTvFarmSetVar(FarmCurrent, CCTV_CONTROL_POWER, "1");
+
+	return CCTvFarmRespond("PowerOn", "Power", "1", out, errorString);
+	in = in;
+}
+
+static int CCTvFarmPowerOff(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	CCTvFarmSetVar(FarmCurrent, CCTV_CONTROL_POWER, "0");
+
+	return CCTvFarmRespond("PowerOff", "Power", "0", out, errorString);
+	in = in;
+}
+
+static int CCTvFarmReboot(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	/* taken down by the handler once answered */
+	return CCTvFarmRespond("Reboot", NULL, NULL, out, errorString);
+	in = in;
+}
+
+/*!
+ * \brief Move a servo, remembering the duty cctv_device would write.
+ */
+static int CCTvFarmMount(const char *action, int *servo, int duty,
+	IXML_Document **out, const char **errorString)
+{
+	*servo = duty;
+
+	return CCTvFarmRespond(action, NULL, NULL, out, errorString);
+}
+
+static int CCTvFarmBottomMountLeft(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	return CCTvFarmMount("BottomMountLeft", &FarmCurrent->bottom, 21,
+		out, errorString);
+	in = in;
+}
+
+static int CCTvFarmBottomMountRight(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	return CCTvFarmMount("BottomMountRight", &FarmCurrent->bottom, 8,
+		out, errorString);
+	in = in;
+}
+
+static int CCTvFarmBottomMountMiddle(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	return CCTvFarmMount("BottomMountMiddle", &FarmCurrent->bottom, 13,
+		out, errorString);
+	in = in;
+}
+
+static int CCTvFarmTopMountUp(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	return CCTvFarmMount("TopMountUp", &FarmCurrent->top, 7,
+		out, errorString);
+	in = in;
+}
+
+static int CCTvFarmTopMountDown(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	return CCTvFarmMount("TopMountDown", &FarmCurrent->top, 15,
+		out, errorString);
+	in = in;
+}
+
+static int CCTvFarmTopMountMiddle(IXML_Document *in, IXML_Document **out,
+	const char **errorString)
+{
+	return CCTvFarmMount("TopMountMiddle", &FarmCurrent->top, 10,
+		out, errorString);
+	in = in;
+}
+
+/*!
+ * \brief Fill in the action table of a camera, as SetActionTable() does
+ * for the real one.
+ */
+static void CCTvFarmSetActionTable(struct CCTvService *out)
+{
+	out->ActionNames[0] = "PowerOn";
+	out->actions[0] = CCTvFarmPowerOn;
+	out->ActionNames[1] = "PowerOff";
+	out->actions[1] = CCTvFarmPowerOff;
+	out->ActionNames[2] = "Reboot";
+	out->actions[2] = CCTvFarmReboot;
+	out->ActionNames[3] = "BottomMountLeft";
+	out->actions[3] = CCTvFarmBottomMountLeft;
+	out->ActionNames[4] = "BottomMountRight";
+	out->actions[4] = CCTvFarmBottomMountRight;
+	out->ActionNames[5] = "BottomMountMiddle";
+	out->actions[5] = CCTvFarmBottomMountMiddle;
+	out->ActionNames[6] = "TopMountUp";
+	out->actions[6] = CCTvFarmTopMountUp;
+	out->ActionNames[7] = "TopMountDown";
+	out->actions[7] = CCTvFarmTopMountDown;
+	out->ActionNames[8] = "TopMountMiddle";
+	out->actions[8] = CCTvFarmTopMountMiddle;
+}
+
+/*!
+ * \brief Put a camera in its power-on state and tell the subscribers.
+ * Call with the rack mutex held.
+ */
+static void CCTvFarmReset(struct CCTvFarmCamera *cam)
+{
+	char value[CCTV_MAX_VAL_LEN];
+
+	cam->temperature = CCTV_FARM_CONF(temp_start);
+	cam->top = 10;
+	cam->bottom = 13;
+	snprintf(value, sizeof value, "%d", cam->temperature);
+	CCTvFarmSetVar(cam, CCTV_CONTROL_POWER, "1");
+	CCTvFarmSetVar(cam, CCTV_CONTROL_TEMP, value);
+}
+
+/*!
+ * \brief Move the temperature of a camera one random step and send it,
+ * unless the event is to be lost. Call with the rack mutex held.
+ *
+ * \return 1 if sent, else 0.
+ */
+static int CCTvFarmPublish(struct CCTvFarmCamera *cam)
+{
+	char value[CCTV_MAX_VAL_LEN];
+	int step = CCTV_FARM_CONF(temp_step);
+
+	/* neither a rebooting nor a hung camera publishes anything */
+	if (cam->down || cam->hung)
+		return 0;
+	if (step > 0)
+		cam->temperature += (int)(rand_r(&cam->rand) %
+			(unsigned int)(2 * step + 1)) - step;
+	if (cam->temperature < MIN_TEMP)
+		cam->temperature = MIN_TEMP;
+	if (cam->temperature > MAX_TEMP)
+		cam->temperature = MAX_TEMP;
+	if (CCTvFarmRoll(cam, CCTV_FARM_CONF(temp_loss))) {
+		CCTvMetricsAdd(&FarmMetrics[METRIC_EVENTS_LOST], 1);
+		return 0;
+	}
+	snprintf(value, sizeof value, "%d", cam->temperature);
+	CCTvFarmSetVar(cam, CCTV_CONTROL_TEMP, value);
+	CCTvMetricsAdd(&FarmMetrics[METRIC_EVENTS_SENT], 1);
+
+	return 1;
+}
+
+static void CCTvFarmTemperature(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvFarmCamera *cam = (struct CCTvFarmCamera *)arg;
+	int period = CCTV_FARM_CONF(temp_ms);
+
+	ithread_mutex_lock(&cam->rack->mutex);
+	CCTvFarmPublish(cam);
+	ithread_mutex_unlock(&cam->rack->mutex);
+	if (period > 0)
+		CCTvTimerArm(&FarmWheel, timer, period);
+}
+
+static int CCTvFarmHandleSubscriptionRequest(const UpnpSubscriptionRequest *sr_event)
+{
+	struct CCTvFarmCamera *cam;
+	const char *l_serviceId;
+	const char *l_udn;
+	const char *l_sid;
+
+	l_serviceId = UpnpString_get_String(
+		UpnpSubscriptionRequest_get_ServiceId(sr_event));
+	l_udn = UpnpSubscriptionRequest_get_UDN_cstr(sr_event);
+	l_sid = UpnpSubscriptionRequest_get_SID_cstr(sr_event);
+	cam = CCTvFarmFind(l_udn);
+	if (!cam || strcmp(l_serviceId, cam->service.ServiceId) != 0)
+		return 1;
+	ithread_mutex_lock(&cam->rack->mutex);
+	if (!cam->down && !cam->hung) {
+		UpnpAcceptSubscription(cam->rack->handle, l_udn, l_serviceId,
+			(const char **)cam->service.VariableName,
+			(const char **)cam->service.VariableStrVal,
+			cam->service.VariableCount, l_sid);
+		CCTvMetricsAdd(&FarmMetrics[METRIC_SUBSCRIPTIONS], 1);
+	}
+	ithread_mutex_unlock(&cam->rack->mutex);
+
+	return 1;
+}
+
+static int CCTvFarmHandleGetVarRequest(UpnpStateVarRequest *cgv_event)
+{
+	struct CCTvFarmCamera *cam;
+	const char *stateVarName;
+	const char *errorString = "Invalid Variable";
+	int errCode = 404;
+	int latency = CCTV_FARM_CONF(latency_ms);
+	int j;
+
+	UpnpStateVarRequest_set_CurrentVal(cgv_event, NULL);
+	CCTvMetricsAdd(&FarmMetrics[METRIC_GETVARS], 1);
+	if (latency > 0)
+		usleep((useconds_t)latency * 1000);
+	cam = CCTvFarmFind(UpnpString_get_String(
+		UpnpStateVarRequest_get_DevUDN(cgv_event)));
+	stateVarName = UpnpString_get_String(
+		UpnpStateVarRequest_get_StateVarName(cgv_event));
+	if (cam && strcmp(UpnpString_get_String(
+		UpnpStateVarRequest_get_ServiceID(cgv_event)),
+		cam->service.ServiceId) == 0) {
+		ithread_mutex_lock(&cam->rack->mutex);
+		if (cam->down || cam->hung) {
+			errorString = cam->down ? "Rebooting" : "Hung";
+			errCode = 501;
+		} else {
+			for (j = 0; j < cam->service.VariableCount; j++) {
+				if (strcmp(stateVarName,
+					cam->service.VariableName[j]) == 0) {
+					UpnpStateVarRequest_set_CurrentVal(
+						cgv_event,
+						cam->service.VariableStrVal[j]);
+					errCode = UPNP_E_SUCCESS;
+					break;
+				}
+			}
+		}
+		ithread_mutex_unlock(&cam->rack->mutex);
+	}
+	UpnpStateVarRequest_set_ErrCode(cgv_event, errCode);
+	if (errCode != UPNP_E_SUCCESS)
+		UpnpStateVarRequest_strcpy_ErrStr(cgv_event, errorString);
+
+	return errCode == UPNP_E_SUCCESS;
+}
+
+static int CCTvFarmHandleActionRequest(UpnpActionRequest *ca_event)
+{
+	struct CCTvFarmCamera *cam;
+	struct CCTvFarmRack *rack;
+	const char *errorString = NULL;
+	const char *actionName;
+	IXML_Document *actionResult = NULL;
+	int latency = CCTV_FARM_CONF(latency_ms);
+	int retCode = UPNP_E_INTERNAL_ERROR;
+	int reboot = 0;
+	int hang = 0;
+	int i;
+
+	UpnpActionRequest_set_ErrCode(ca_event, 0);
+	UpnpActionRequest_set_ActionResult(ca_event, NULL);
+	cam = CCTvFarmFind(UpnpString_get_String(
+		UpnpActionRequest_get_DevUDN(ca_event)));
+	actionName = UpnpString_get_String(
+		UpnpActionRequest_get_ActionName(ca_event));
+	for (i = 0; cam && i < CCTV_MAXACTIONS &&
+	     cam->service.ActionNames[i] != NULL; i++) {
+		if (strcmp(actionName, cam->service.ActionNames[i]) == 0)
+			break;
+	}
+	if (!cam || strcmp(UpnpString_get_String(
+		UpnpActionRequest_get_ServiceID(ca_event)),
+		cam->service.ServiceId) != 0 ||
+	    i == CCTV_MAXACTIONS || !cam->service.ActionNames[i]) {
+		UpnpActionRequest_strcpy_ErrStr(ca_event, "Invalid Action");
+		UpnpActionRequest_set_ErrCode(ca_event, 401);
+		CCTvMetricsAdd(&FarmMetrics[METRIC_ACTIONS_FAILED], 1);
+		return 401;
+	}
+	if (latency > 0)
+		usleep((useconds_t)latency * 1000);
+
+	rack = cam->rack;
+	reboot = strcmp(actionName, "Reboot") == 0;
+	ithread_mutex_lock(&rack->mutex);
+	if (cam->down) {
+		errorString = "Rebooting";
+	} else if (cam->hung && !reboot) {
+		errorString = "Hung";
+	} else if (CCTvFarmRoll(cam, CCTV_FARM_CONF(error_rate))) {
+		errorString = "Emulated failure";
+	} else if (CCTvFarmRoll(cam, CCTV_FARM_CONF(hang_rate))) {
+		errorString = "Emulated hang";
+		hang = 1;
+	} else if (strcmp(cam->values[CCTV_CONTROL_POWER], "1") != 0 &&
+		   strcmp(actionName, "PowerOn") != 0 && !reboot) {
+		errorString = "Power is Off";
+	} else {
+		FarmCurrent = cam;
+		retCode = cam->service.actions[i](
+			UpnpActionRequest_get_ActionRequest(ca_event),
+			&actionResult, &errorString);
+		FarmCurrent = NULL;
+		UpnpActionRequest_set_ActionResult(ca_event, actionResult);
+		if (retCode == UPNP_E_SUCCESS && reboot) {
+			cam->down = 1;
+			/* alone in its rack, it says byebye on the next tick */
+			CCTvTimerArm(&FarmWheel, &cam->BootTimer,
+				rack->count == 1 ? 0 :
+				CCTV_FARM_CONF(reboot_ms));
+		}
+	}
+	ithread_mutex_unlock(&rack->mutex);
+	if (hang) {
+		CCTvMetricsAdd(&FarmMetrics[METRIC_ACTIONS_HANG], 1);
+		/* holds up an SDK thread, as a stuck camera holds a connection */
+		usleep((useconds_t)CCTV_FARM_CONF(hang_ms) * 1000);
+	}
+
+	if (retCode == UPNP_E_SUCCESS) {
+		UpnpActionRequest_set_ErrCode(ca_event, UPNP_E_SUCCESS);
+		CCTvMetricsAdd(&FarmMetrics[METRIC_ACTIONS_OK], 1);
+		if (reboot) {
+			CCTvMetricsAdd(&FarmMetrics[METRIC_REBOOTS], 1);
+			CCTvMetricsAdd(&FarmMetrics[METRIC_DOWN], 1);
+		}
+	} else {
+		UpnpActionRequest_strcpy_ErrStr(ca_event, errorString);
+		UpnpActionRequest_set_ErrCode(ca_event, 501);
+		CCTvMetricsAdd(&FarmMetrics[METRIC_ACTIONS_FAILED], 1);
+	}
+
+	return UpnpActionRequest_get_ErrCode(ca_event);
+}
+
+static int CCTvFarmCallbackEventHandler(Upnp_EventType EventType, const void *Event, void *Cookie)
+{
+	switch (EventType) {
+	case UPNP_EVENT_SUBSCRIPTION_REQUEST:
+		CCTvFarmHandleSubscriptionRequest((UpnpSubscriptionRequest *)Event);
+		break;
+	case UPNP_CONTROL_GET_VAR_REQUEST:
+		CCTvFarmHandleGetVarRequest((UpnpStateVarRequest *)Event);
+		break;
+	case UPNP_CONTROL_ACTION_REQUEST:
+		CCTvFarmHandleActionRequest((UpnpActionRequest *)Event);
+		break;
+	default:
+		/* not a control point */
+		break;
+	}
+	SAMPLE_PRINT_EVENT(EventType, Event);
+
+	return 0;
+	Cookie = Cookie;
+}
+
+/*!
+ * \brief Bring a camera back from a reboot. A camera alone in its rack
+ * goes through a byebye first, as cctv_device unregisters on Reboot; the
+ * others of a rack cannot, they only stop answering.
+ */
+static void CCTvFarmBoot(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvFarmCamera *cam = (struct CCTvFarmCamera *)arg;
+	struct CCTvFarmRack *rack = cam->rack;
+	UpnpDevice_Handle handle;
+	int ret;
+
+	ithread_mutex_lock(&rack->mutex);
+	if (cam->down == 1 && rack->count == 1) {
+		handle = rack->handle;
+		rack->handle = -1;
+		cam->down = 2;
+		ithread_mutex_unlock(&rack->mutex);
+		UpnpUnRegisterRootDevice(handle);
+		CCTvTimerArm(&FarmWheel, timer, CCTV_FARM_CONF(reboot_ms));
+		return;
+	}
+	if (cam->down == 2) {
+		ithread_mutex_unlock(&rack->mutex);
+		ret = UpnpRegisterRootDevice(rack->url,
+			CCTvFarmCallbackEventHandler, rack, &handle);
+		if (ret != UPNP_E_SUCCESS) {
+			SampleUtil_Print("Error registering %s again: %d\n",
+				rack->url, ret);
+			CCTvTimerArm(&FarmWheel, timer,
+				CCTV_FARM_CONF(reboot_ms));
+			return;
+		}
+		ithread_mutex_lock(&rack->mutex);
+		rack->handle = handle;
+	}
+	cam->down = 0;
+	if (cam->hung) {
+		cam->hung = 0;
+		CCTvMetricsAdd(&FarmMetrics[METRIC_HUNG], -1);
+	}
+	CCTvFarmReset(cam);
+	handle = rack->handle;
+	ithread_mutex_unlock(&rack->mutex);
+	CCTvMetricsAdd(&FarmMetrics[METRIC_DOWN], -1);
+	/* what the control point waits for to verify the reboot */
+	UpnpSendAdvertisement(handle, CCTV_FARM_CONF(expires));
+}
+
+void CCTvFarmDefaults(struct CCTvFarmConfig *config)
+{
+	memset(config, 0, sizeof *config);
+	config->cameras = 100;
+	config->rack = CCTV_FARM_RACK;
+	config->expires = 100;
+	config->temp_ms = 10000;
+	config->temp_start = 45;
+	config->temp_step = 2;
+	config->reboot_ms = 5000;
+	config->hang_ms = 30000;
+	config->seed = 1;
+}
+
+/*!
+ * \brief Set a field of a configuration by name.
+ */
+static int CCTvFarmConfigure(struct CCTvFarmConfig *config, const char *name,
+	int value, int started)
+{
+	int i;
+
+	for (i = 0; i < CCTV_FARM_SETTINGS; i++) {
+		if (strcmp(FarmSettings[i].name, name) != 0)
+			continue;
+		if (value < FarmSettings[i].min ||
+		    value > FarmSettings[i].max ||
+		    (started && !FarmSettings[i].live))
+			return CCTV_ERROR;
+		__atomic_store_n((int *)((char *)config +
+			FarmSettings[i].offset), value, __ATOMIC_RELAXED);
+		return CCTV_SUCCESS;
+	}
+
+	return CCTV_ERROR;
+}
+
+/*!
+ * \brief Start the temperature events of every camera, spread over a
+ * period.
+ */
+static void CCTvFarmArmTemperature(void)
+{
+	struct CCTvFarmCamera *cam;
+	int period = CCTV_FARM_CONF(temp_ms);
+	int c;
+
+	for (c = 0; period > 0 && c < FarmConfig.cameras; c++) {
+		cam = &FarmCameras[c];
+		ithread_mutex_lock(&cam->rack->mutex);
+		CCTvTimerArm(&FarmWheel, &cam->TempTimer,
+			(long)(rand_r(&cam->rand) % (unsigned int)period));
+		ithread_mutex_unlock(&cam->rack->mutex);
+	}
+}
+
+int CCTvFarmSet(const char *name, int value)
+{
+	int was = CCTV_FARM_CONF(temp_ms);
+
+	if (CCTvFarmConfigure(&FarmConfig, name, value, 1) != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	/* the timers stop re-arming at 0 */
+	if (strcmp(name, "temp_ms") == 0 && was == 0)
+		CCTvFarmArmTemperature();
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvFarmHang(int camera)
+{
+	struct CCTvFarmCamera *cam;
+	int c;
+
+	if (camera < -1 || camera >= FarmConfig.cameras || !FarmCameras)
+		return CCTV_ERROR;
+	for (c = camera < 0 ? 0 : camera;
+	     c < (camera < 0 ? FarmConfig.cameras : camera + 1); c++) {
+		cam = &FarmCameras[c];
+		ithread_mutex_lock(&cam->rack->mutex);
+		if (!cam->hung) {
+			cam->hung = 1;
+			CCTvMetricsAdd(&FarmMetrics[METRIC_HUNG], 1);
+		}
+		ithread_mutex_unlock(&cam->rack->mutex);
+	}
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvFarmNotify(int camera, int count)
+{
+	struct CCTvFarmCamera *cam;
+	int sent = 0;
+	int c;
+	int i;
+
+	if (camera < -1 || camera >= FarmConfig.cameras || !FarmCameras)
+		return -1;
+	for (i = 0; i < count; i++) {
+		for (c = camera < 0 ? 0 : camera;
+		     c < (camera < 0 ? FarmConfig.cameras : camera + 1); c++) {
+			cam = &FarmCameras[c];
+			ithread_mutex_lock(&cam->rack->mutex);
+			sent += CCTvFarmPublish(cam);
+			ithread_mutex_unlock(&cam->rack->mutex);
+		}
+	}
+
+	return sent;
+}
+
+/*!
+ * \brief Write the description of a rack: its first camera is the root
+ * device, the others are embedded in it.
+ */
+static int CCTvFarmWriteRack(const char *path, const char *prefix,
+	const struct CCTvFarmRack *rack)
+{
+	const struct CCTvFarmCamera *cam;
+	FILE *fp;
+	int c;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return CCTV_ERROR;
+	fprintf(fp, "<?xml version=\"1.0\"?>\n"
+		"<root xmlns=\"urn:schemas-upnp-org:device-1-0\">\n"
+		"<specVersion><major>1</major><minor>0</minor></specVersion>\n");
+	for (c = 0; c < rack->count; c++) {
+		cam = &FarmCameras[rack->first + c];
+		fprintf(fp, "%s<device>\n"
+			"<deviceType>%s</deviceType>\n"
+			"<friendlyName>CCTV Farm %s %d</friendlyName>\n"
+			"<manufacturer>CCtv Manufacturer Name</manufacturer>\n"
+			"<modelName>CCTVEmulator</modelName>\n"
+			"<modelNumber>1.0</modelNumber>\n"
+			"<serialNumber>%d</serialNumber>\n"
+			"<UDN>%s</UDN>\n"
+			"<serviceList><service>\n"
+			"<serviceType>%s</serviceType>\n"
+			"<serviceId>%s</serviceId>\n"
+			"<controlURL>/upnp/control/cctvfarm%d</controlURL>\n"
+			"<eventSubURL>/upnp/event/cctvfarm%d</eventSubURL>\n"
+			"<SCPDURL>/cctvcontrolSCPD.xml</SCPDURL>\n"
+			"</service></serviceList>\n",
+			c == 1 ? "<deviceList>\n" : "",
+			CCTV_FARM_DEVICE_TYPE, prefix, cam->number,
+			cam->number, cam->service.UDN,
+			CCTvServiceType[CCTV_SERVICE_CONTROL],
+			cam->service.ServiceId, cam->number, cam->number);
+		/* the root device is closed after the embedded ones */
+		if (c > 0)
+			fprintf(fp, "</device>\n");
+	}
+	fprintf(fp, "%s</device>\n</root>\n",
+		rack->count > 1 ? "</deviceList>\n" : "");
+
+	return fclose(fp) == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+/*!
+ * \brief Copy a file of the web directory into the farm directory.
+ */
+static int CCTvFarmCopy(const char *from_dir, const char *to_dir,
+	const char *name)
+{
+	char path[DESC_URL_SIZE];
+	char buf[4096];
+	FILE *in;
+	FILE *out;
+	size_t n;
+	int ret = CCTV_SUCCESS;
+
+	snprintf(path, sizeof path, "%s/%s", from_dir, name);
+	in = fopen(path, "r");
+	if (!in)
+		return CCTV_ERROR;
+	snprintf(path, sizeof path, "%s/%s", to_dir, name);
+	out = fopen(path, "w");
+	if (!out) {
+		fclose(in);
+		return CCTV_ERROR;
+	}
+	while ((n = fread(buf, 1, sizeof buf, in)) > 0) {
+		if (fwrite(buf, 1, n, out) != n)
+			ret = CCTV_ERROR;
+	}
+	fclose(in);
+	if (fclose(out) != 0)
+		ret = CCTV_ERROR;
+
+	return ret;
+}
+
+/*!
+ * \brief Allocate and set up the cameras and racks.
+ */
+static int CCTvFarmCreate(const char *prefix)
+{
+	struct CCTvFarmCamera *cam;
+	struct CCTvService *s;
+	unsigned int b;
+	int c;
+	int r;
+	int var;
+
+	FarmNumRacks = (FarmConfig.cameras + FarmConfig.rack - 1) /
+		FarmConfig.rack;
+	FarmNumBuckets = 64;
+	while (FarmNumBuckets < (unsigned int)FarmConfig.cameras)
+		FarmNumBuckets <<= 1;
+	FarmCameras = (struct CCTvFarmCamera *)calloc(
+		(size_t)FarmConfig.cameras, sizeof *FarmCameras);
+	FarmRacks = (struct CCTvFarmRack *)calloc((size_t)FarmNumRacks,
+		sizeof *FarmRacks);
+	FarmBuckets = (struct CCTvFarmCamera **)calloc(FarmNumBuckets,
+		sizeof *FarmBuckets);
+	if (!FarmCameras || !FarmRacks || !FarmBuckets)
+		return CCTV_ERROR;
+	for (r = 0; r < FarmNumRacks; r++) {
+		ithread_mutex_init(&FarmRacks[r].mutex, NULL);
+		FarmRacks[r].handle = -1;
+		FarmRacks[r].first = r * FarmConfig.rack;
+		FarmRacks[r].count = FarmConfig.cameras - FarmRacks[r].first;
+		if (FarmRacks[r].count > FarmConfig.rack)
+			FarmRacks[r].count = FarmConfig.rack;
+	}
+	for (c = 0; c < FarmConfig.cameras; c++) {
+		cam = &FarmCameras[c];
+		s = &cam->service;
+		cam->number = c;
+		cam->rack = &FarmRacks[c / FarmConfig.rack];
+		cam->rand = (unsigned int)FarmConfig.seed ^
+			((unsigned int)c * 2654435761u);
+		snprintf(s->UDN, sizeof s->UDN, "uuid:CCTvFarm-%s-%05d",
+			prefix, c);
+		snprintf(s->ServiceId, sizeof s->ServiceId, "%s",
+			CCTV_FARM_SERVICE_ID);
+		snprintf(s->ServiceType, sizeof s->ServiceType, "%s",
+			CCTvServiceType[CCTV_SERVICE_CONTROL]);
+		s->VariableCount = CCTV_CONTROL_VARCOUNT;
+		for (var = 0; var < CCTV_CONTROL_VARCOUNT; var++) {
+			s->VariableName[var] = FarmVarName[var];
+			s->VariableStrVal[var] = cam->values[var];
+		}
+		CCTvFarmSetActionTable(s);
+		/* not registered yet, so nothing is sent */
+		CCTvFarmReset(cam);
+		if (CCTvFarmRoll(cam, FarmConfig.hung_rate)) {
+			cam->hung = 1;
+			CCTvMetricsAdd(&FarmMetrics[METRIC_HUNG], 1);
+		}
+		CCTvTimerInit(&cam->TempTimer, CCTvFarmTemperature, cam);
+		CCTvTimerInit(&cam->BootTimer, CCTvFarmBoot, cam);
+		cam->hash = CCTvFarmHash(s->UDN);
+		b = cam->hash & (FarmNumBuckets - 1);
+		cam->chain = FarmBuckets[b];
+		FarmBuckets[b] = cam;
+	}
+	CCTvMetricsSet(&FarmMetrics[METRIC_CAMERAS], FarmConfig.cameras);
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvFarmStop(void)
+{
+	int r;
+
+	/* pending reboots and events are dropped */
+	CCTvTimerWheelStop(&FarmWheel);
+	for (r = 0; r < FarmNumRacks; r++) {
+		if (FarmRacks[r].handle >= 0)
+			UpnpUnRegisterRootDevice(FarmRacks[r].handle);
+	}
+	CCTvMetricsStop();
+	UpnpFinish();
+	SampleUtil_Finish();
+	for (r = 0; r < FarmNumRacks; r++)
+		ithread_mutex_destroy(&FarmRacks[r].mutex);
+	free(FarmBuckets);
+	free(FarmRacks);
+	free(FarmCameras);
+	FarmBuckets = NULL;
+	FarmRacks = NULL;
+	FarmCameras = NULL;
+	FarmNumRacks = 0;
+
+	return UPNP_E_SUCCESS;
+}
+
+int CCTvFarmStart(char *ip_address, unsigned short port,
+	const char *web_dir_path, const char *farm_dir_path,
+	const char *prefix, const struct CCTvFarmConfig *config,
+	print_string pfun)
+{
+	char path[DESC_URL_SIZE];
+	struct CCTvFarmRack *rack;
+	int ret = UPNP_E_SUCCESS;
+	int r;
+
+	SampleUtil_Initialize(pfun);
+	CCTvMetricsRegister(FarmMetrics,
+		(int)(sizeof FarmMetrics / sizeof FarmMetrics[0]));
+	FarmConfig = *config;
+	if ((FarmConfig.cameras + FarmConfig.rack - 1) / FarmConfig.rack >
+	    CCTV_FARM_MAX_RACKS) {
+		FarmConfig.rack = (FarmConfig.cameras + CCTV_FARM_MAX_RACKS -
+			1) / CCTV_FARM_MAX_RACKS;
+		SampleUtil_Print("%d cameras need racks of %d\n",
+			FarmConfig.cameras, FarmConfig.rack);
+	}
+	if (!web_dir_path)
+		web_dir_path = DEFAULT_WEB_DIR;
+	if (!farm_dir_path)
+		farm_dir_path = DEFAULT_FARM_DIR;
+	if (CCTvFarmCreate(prefix) != CCTV_SUCCESS) {
+		SampleUtil_Print("Error allocating %d cameras\n",
+			FarmConfig.cameras);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	SampleUtil_Print("Initializing UPnP Sdk with\n"
+			 "\tipaddress = %s port = %u\n",
+			 ip_address ? ip_address : "{NULL}", port);
+	ret = UpnpInit2(ip_address, port);
+	if (ret != UPNP_E_SUCCESS) {
+		SampleUtil_Print("Error with UpnpInit2 -- %d\n", ret);
+		UpnpFinish();
+
+		return ret;
+	}
+	ip_address = UpnpGetServerIpAddress();
+	port = UpnpGetServerPort();
+	SampleUtil_Print("UPnP Initialized\n"
+			 "\tipaddress = %s port = %u\n",
+			 ip_address ? ip_address : "{NULL}", port);
+
+	if (CCTvFarmCopy(web_dir_path, farm_dir_path,
+		"cctvcontrolSCPD.xml") != CCTV_SUCCESS)
+		SampleUtil_Print("Cannot copy cctvcontrolSCPD.xml from %s to %s,"
+			" the control points will not get it\n",
+			web_dir_path, farm_dir_path);
+	for (r = 0; r < FarmNumRacks; r++) {
+		rack = &FarmRacks[r];
+		snprintf(path, sizeof path, "%s/cctvfarm%d.xml",
+			farm_dir_path, r);
+		if (CCTvFarmWriteRack(path, prefix, rack) != CCTV_SUCCESS) {
+			SampleUtil_Print("Error writing %s\n", path);
+			UpnpFinish();
+
+			return UPNP_E_FILE_NOT_FOUND;
+		}
+		snprintf(rack->url, sizeof rack->url,
+			"http://%s:%d/cctvfarm%d.xml", ip_address, port, r);
+	}
+	ret = UpnpSetWebServerRootDir(farm_dir_path);
+	if (ret != UPNP_E_SUCCESS) {
+		SampleUtil_Print
+		    ("Error specifying webserver root directory -- %s: %d\n",
+		     farm_dir_path, ret);
+		UpnpFinish();
+
+		return ret;
+	}
+	if (CCTvTimerWheelStart(&FarmWheel, CCTV_FARM_TICK_MS) !=
+	    CCTV_SUCCESS) {
+		UpnpFinish();
+
+		return UPNP_E_INTERNAL_ERROR;
+	}
+	for (r = 0; r < FarmNumRacks; r++) {
+		rack = &FarmRacks[r];
+		ret = UpnpRegisterRootDevice(rack->url,
+			CCTvFarmCallbackEventHandler, rack, &rack->handle);
+		if (ret == UPNP_E_SUCCESS)
+			ret = UpnpSendAdvertisement(rack->handle,
+				FarmConfig.expires);
+		if (ret != UPNP_E_SUCCESS) {
+			SampleUtil_Print("Error registering %s: %d\n",
+				rack->url, ret);
+			CCTvFarmStop();
+
+			return ret;
+		}
+	}
+	CCTvFarmArmTemperature();
+	SampleUtil_Print("%d cameras in %d racks advertised\n",
+		FarmConfig.cameras, FarmNumRacks);
+
+	return UPNP_E_SUCCESS;
+}
+
+void CCTvFarmGetStats(struct CCTvFarmStats *stats)
+{
+	stats->cameras = FarmConfig.cameras;
+	stats->racks = FarmNumRacks;
+	stats->down = (int)CCTvFarmMetric(METRIC_DOWN);
+	stats->hung = (int)CCTvFarmMetric(METRIC_HUNG);
+	stats->actions = (unsigned long)(CCTvFarmMetric(METRIC_ACTIONS_OK) +
+		CCTvFarmMetric(METRIC_ACTIONS_FAILED));
+	stats->failed = (unsigned long)CCTvFarmMetric(METRIC_ACTIONS_FAILED);
+	stats->hangs = (unsigned long)CCTvFarmMetric(METRIC_ACTIONS_HANG);
+	stats->getvars = (unsigned long)CCTvFarmMetric(METRIC_GETVARS);
+	stats->subscriptions =
+		(unsigned long)CCTvFarmMetric(METRIC_SUBSCRIPTIONS);
+	stats->reboots = (unsigned long)CCTvFarmMetric(METRIC_REBOOTS);
+	stats->events = (unsigned long)CCTvFarmMetric(METRIC_EVENTS_SENT);
+	stats->lost = (unsigned long)CCTvFarmMetric(METRIC_EVENTS_LOST);
+}
+
+void CCTvFarmPrintStats(void)
+{
+	struct CCTvFarmStats stats;
+	int i;
+
+	CCTvFarmGetStats(&stats);
+	SampleUtil_Print("Farm: %d cameras in %d racks, %d down, %d hung\n"
+		"  actions %lu (%lu failed, %lu hung up), getvars %lu,"
+		" subscriptions %lu, reboots %lu\n"
+		"  temperature events %lu sent, %lu lost\n",
+		stats.cameras, stats.racks, stats.down, stats.hung,
+		stats.actions, stats.failed, stats.hangs, stats.getvars,
+		stats.subscriptions, stats.reboots, stats.events, stats.lost);
+	SampleUtil_Print("Settings:");
+	for (i = 0; i < CCTV_FARM_SETTINGS; i++)
+		SampleUtil_Print(" %s=%d", FarmSettings[i].name,
+			__atomic_load_n((int *)((char *)&FarmConfig +
+			FarmSettings[i].offset), __ATOMIC_RELAXED));
+	SampleUtil_Print("\n");
+}
+
+void *CCTvFarmCommandLoop(void *args)
+{
+	char cmdline[100];
+	char cmd[100];
+	char arg[100];
+	int value;
+	int n;
+
+	while (1) {
+		SampleUtil_Print("\n>> ");
+		if (!fgets(cmdline, sizeof cmdline, stdin))
+			break;
+		n = sscanf(cmdline, "%99s %99s %d", cmd, arg, &value);
+		if (n < 1)
+			continue;
+		if (strcasecmp(cmd, "exit") == 0) {
+			SampleUtil_Print("Shutting down...\n");
+			CCTvFarmStop();
+			exit(0);
+		} else if (strcasecmp(cmd, "stats") == 0) {
+			CCTvFarmPrintStats();
+		} else if (strcasecmp(cmd, "set") == 0 && n == 3) {
+			if (CCTvFarmSet(arg, value) != CCTV_SUCCESS)
+				SampleUtil_Print("Cannot set %s to %d\n",
+					arg, value);
+		} else if (strcasecmp(cmd, "hang") == 0 && n >= 2) {
+			if (CCTvFarmHang(strcasecmp(arg, "all") == 0 ? -1 :
+				atoi(arg)) != CCTV_SUCCESS)
+				SampleUtil_Print("No camera %s\n", arg);
+		} else {
+			SampleUtil_Print("\n   Unknown command: %s\n\n", cmd);
+			SampleUtil_Print("   Valid Commands:\n"
+					 "     Stats\n"
+					 "     Set <setting> <value>\n"
+					 "     Hang <camera>|all\n"
+					 "     Exit\n\n");
+		}
+	}
+
+	return NULL;
+	args = args;
+}
+
+int farm_main(int argc, char *argv[])
+{
+	struct CCTvFarmConfig config;
+	unsigned int portTemp = 0;
+	char *ip_address = NULL;
+	char *web_dir_path = NULL;
+	char *farm_dir_path = NULL;
+	char prefix[64];
+	char metrics_address[64] = "127.0.0.1";
+	unsigned short metrics_port = 0;
+	char *eq;
+	int level;
+	int ret;
+	int i;
+
+	SampleUtil_Initialize(linux_print);
+	CCTvFarmDefaults(&config);
+	if (gethostname(prefix, sizeof prefix) != 0)
+		strcpy(prefix, "localhost");
+	prefix[sizeof prefix - 1] = '\0';
+	/* Parse options */
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc) {
+			ip_address = argv[++i];
+		} else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+			sscanf(argv[++i], "%u", &portTemp);
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			if (CCTvFarmConfigure(&config, "cameras",
+				atoi(argv[++i]), 0) != CCTV_SUCCESS)
+				SampleUtil_Print("Bad number of cameras %s\n",
+					argv[i]);
+		} else if (strcmp(argv[i], "-rack") == 0 && i + 1 < argc) {
+			if (CCTvFarmConfigure(&config, "rack",
+				atoi(argv[++i]), 0) != CCTV_SUCCESS)
+				SampleUtil_Print("Bad rack size %s\n", argv[i]);
+		} else if (strcmp(argv[i], "-webdir") == 0 && i + 1 < argc) {
+			web_dir_path = argv[++i];
+		} else if (strcmp(argv[i], "-farmdir") == 0 && i + 1 < argc) {
+			farm_dir_path = argv[++i];
+		} else if (strcmp(argv[i], "-prefix") == 0 && i + 1 < argc) {
+			snprintf(prefix, sizeof prefix, "%s", argv[++i]);
+		} else if (strcmp(argv[i], "-set") == 0 && i + 1 < argc) {
+			eq = strchr(argv[++i], '=');
+			if (eq)
+				*eq = '\0';
+			if (!eq || CCTvFarmConfigure(&config, argv[i],
+				atoi(eq + 1), 0) != CCTV_SUCCESS)
+				SampleUtil_Print("Bad setting %s\n", argv[i]);
+		} else if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc) {
+			if (SampleUtil_ParseAddressPort(argv[++i],
+				metrics_address, sizeof metrics_address,
+				&metrics_port) != 0) {
+				SampleUtil_Print("Bad metrics address %s\n",
+					argv[i]);
+				return UPNP_E_INVALID_PARAM;
+			}
+		} else if (strcmp(argv[i], "-loglevel") == 0 && i + 1 < argc) {
+			level = SampleUtil_ParseLogLevel(argv[++i]);
+			if (level >= 0)
+				SampleUtil_SetLogLevel((sample_log_level)level);
+		} else if (strcmp(argv[i], "-help") == 0) {
+			SampleUtil_Print("Usage: %s -ip ipaddress -port port"
+					 " -n cameras -rack cameras"
+					 " -webdir web_dir_path"
+					 " -farmdir farm_dir_path"
+					 " -prefix prefix -set setting=value"
+					 " -metrics [address:]port"
+					 " -loglevel level"
+					 " -help (this message)\n", argv[0]);
+			SampleUtil_Print
+			    ("\tipaddress:     IP address of the cameras\n"
+			     "\tport:          Port number to use for"
+			     " receiving UPnP messages\n"
+			     "\tcameras:       Number of cameras, and cameras"
+			     " per root device (rack)\n"
+			     "\t\te.g.: -n 2000 -rack 32\n"
+			     "\tweb_dir_path:  Where cctvcontrolSCPD.xml is\n"
+			     "\t\te.g.: ./web\n"
+			     "\tfarm_dir_path: Existing directory the rack"
+			     " descriptions are written to and served from\n"
+			     "\t\te.g.: /tmp/cctv_farm\n"
+			     "\tprefix:        In the camera UDNs,"
+			     " uuid:CCTvFarm-<prefix>-<number>; the host name"
+			     " unless given\n"
+			     "\tsetting:       expires, temp_ms, temp_start,"
+			     " temp_step, temp_loss, reboot_ms, error_rate,"
+			     " hang_rate, hang_ms, latency_ms, hung_rate or"
+			     " seed; rates are per mille\n"
+			     "\t\te.g.: -set error_rate=10 -set hung_rate=5\n"
+			     "\tmetrics:       Serve the metrics over HTTP at"
+			     " /metrics, on 127.0.0.1 unless given\n"
+			     "\t\te.g.: 0.0.0.0:9102\n"
+			     "\tlevel:         error, warning, info or debug\n");
+			return 1;
+		}
+	}
+	ret = CCTvFarmStart(ip_address, (unsigned short)portTemp,
+		web_dir_path, farm_dir_path, prefix, &config, linux_print);
+	if (ret == UPNP_E_SUCCESS && metrics_port &&
+	    CCTvMetricsStart(metrics_address,
+		metrics_port) != 0)
+		SampleUtil_Print("Error serving the metrics on %s:%u\n",
+			metrics_address, metrics_port);
+
+	return ret;
+}
+
+/*! @} Device Emulator Farm */
+
+/*! @} UpnpSamples */
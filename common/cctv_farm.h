@@ -0,0 +1,226 @@
+#ifndef UPNP_CCTV_FARM_H
+#define UPNP_CCTV_FARM_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Device Emulator Farm
+ *
+ * @{
+ *
+ * \file
+ *
+ * Hundreds to thousands of emulated cameras in one process, to load the
+ * control point with a fleet. Each camera has its own UDN, control service
+ * and state table, answers the actions of the cctvcontrol service from a
+ * CCTvService action table without touching any hardware, and publishes
+ * its temperature.
+ *
+ * The SDK takes a limited number of root devices per process, so the
+ * cameras are grouped in racks: a rack is one root device, itself a
+ * camera, with the others of the rack as its embedded devices. Every
+ * camera still advertises, is described and is controlled on its own; the
+ * rack only shares the description document.
+ *
+ * How the cameras behave is set in a CCTvFarmConfig, most of it changeable
+ * at run time:
+ *	\li temperature events: period, starting value and random walk step;
+ *	\li reboot: how long a camera stays down after Reboot, failing
+ *	everything, before it comes back with its state reset and advertises;
+ *	\li failures: actions failing or hanging at random, added latency,
+ *	temperature events lost, and hung cameras that fail every request
+ *	until rebooted.
+ *
+ * The timers run on a CCTvTimerWheel of the farm.
+ */
+
+#include "sample_util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Device type of the emulated cameras. */
+#define CCTV_FARM_DEVICE_TYPE "urn:schemas-upnp-org:device:cctvdevice:1"
+
+/*! Service id of the control service of every camera. */
+#define CCTV_FARM_SERVICE_ID "urn:upnp-org:serviceId:cctvcontrol1"
+
+/*! Most cameras of a farm. */
+#define CCTV_FARM_MAX_CAMERAS 65536
+
+/*! Most racks, kept below the root devices the SDK takes per process. */
+#define CCTV_FARM_MAX_RACKS 150
+
+/*! Default cameras per rack. */
+#define CCTV_FARM_RACK 32
+
+/*! Tick of the farm timer wheel, in milliseconds. */
+#define CCTV_FARM_TICK_MS 50
+
+/*! Behaviour of the cameras. Rates are per mille. */
+struct CCTvFarmConfig {
+	/*! Number of cameras, fixed once started. */
+	int cameras;
+	/*! Cameras per rack, fixed once started. */
+	int rack;
+	/*! Advertisement expiry, in seconds. */
+	int expires;
+	/*! Temperature event period, in milliseconds; 0 for none. */
+	int temp_ms;
+	/*! Temperature a camera starts at, in degrees C. */
+	int temp_start;
+	/*! Largest change of the temperature per period. */
+	int temp_step;
+	/*! Temperature events lost. */
+	int temp_loss;
+	/*! How long a camera is down after Reboot, in milliseconds. */
+	int reboot_ms;
+	/*! Actions answered with an error. */
+	int error_rate;
+	/*! Actions that hang for hang_ms before failing. */
+	int hang_rate;
+	int hang_ms;
+	/*! Added to every action and GetVar, in milliseconds. */
+	int latency_ms;
+	/*! Cameras that start hung. */
+	int hung_rate;
+	/*! Seed of the random choices. */
+	int seed;
+};
+
+/*! Counters of the farm. */
+struct CCTvFarmStats {
+	int cameras;
+	int racks;
+	/*! Cameras down for a reboot. */
+	int down;
+	/*! Cameras hung. */
+	int hung;
+	unsigned long actions;
+	/*! Actions failed on purpose: errors, hangs, hung or down cameras. */
+	unsigned long failed;
+	unsigned long hangs;
+	unsigned long getvars;
+	unsigned long subscriptions;
+	unsigned long reboots;
+	/*! Temperature events sent, and lost on purpose. */
+	unsigned long events;
+	unsigned long lost;
+};
+
+/*!
+ * \brief Fill in the default configuration: CCTV_FARM_RACK cameras per
+ * rack, a temperature event every 10 s as cctv_device sends, 5 s reboots
+ * and no failures.
+ */
+void CCTvFarmDefaults(
+	/*! [out] Configuration. */
+	struct CCTvFarmConfig *config);
+
+/*!
+ * \brief Initialize the SDK, write the rack descriptions and register and
+ * advertise the racks.
+ *
+ * \return UPNP_E_SUCCESS or an SDK error.
+ */
+int CCTvFarmStart(
+	/*! [in] IP address to initialize the SDK with, may be NULL. */
+	char *ip_address,
+	/*! [in] Port to initialize the SDK with, may be 0. */
+	unsigned short port,
+	/*! [in] Directory holding cctvcontrolSCPD.xml. */
+	const char *web_dir_path,
+	/*! [in] Directory the rack descriptions are written to, served as
+	 * the web server root. */
+	const char *farm_dir_path,
+	/*! [in] Prefix of the camera UDNs, e.g. the host name. */
+	const char *prefix,
+	/*! [in] Configuration. */
+	const struct CCTvFarmConfig *config,
+	/*! [in] Print function to use. */
+	print_string pfun);
+
+/*!
+ * \brief Unregister the racks, sending byebyes, and finish the SDK.
+ */
+int CCTvFarmStop(void);
+
+/*!
+ * \brief Change a setting at run time. cameras and rack cannot be changed.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the name is unknown or the value
+ * out of range.
+ */
+int CCTvFarmSet(
+	/*! [in] Name of a CCTvFarmConfig field. */
+	const char *name,
+	/*! [in] Value. */
+	int value);
+
+/*!
+ * \brief Hang a camera, as if its software got stuck: it fails every
+ * request but Reboot.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if there is no such camera.
+ */
+int CCTvFarmHang(
+	/*! [in] Camera number, from 0, or -1 for all. */
+	int camera);
+
+/*!
+ * \brief Send temperature events right away, as the timers would, e.g. to
+ * load the control point with events.
+ *
+ * \return The number of events sent, or -1 if there is no such camera.
+ */
+int CCTvFarmNotify(
+	/*! [in] Camera number, from 0, or -1 for all. */
+	int camera,
+	/*! [in] Events per camera. */
+	int count);
+
+/*!
+ * \brief Get the counters.
+ */
+void CCTvFarmGetStats(
+	/*! [out] Counters. */
+	struct CCTvFarmStats *stats);
+
+/*!
+ * \brief Print the configuration and the counters with SampleUtil_Print().
+ */
+void CCTvFarmPrintStats(void);
+
+/*!
+ * \brief Read commands from stdin until exit.
+ */
+void *CCTvFarmCommandLoop(void *args);
+
+/*!
+ * \brief Main entry point of the farm application. Accepts
+ *	\li \c -ip ipaddress
+ *	\li \c -port port
+ *	\li \c -n cameras
+ *	\li \c -rack cameras per rack
+ *	\li \c -webdir web_dir_path
+ *	\li \c -farmdir farm_dir_path
+ *	\li \c -prefix UDN prefix
+ *	\li \c -set name=value, any CCTvFarmConfig field
+ *	\li \c -metrics [address:]port
+ *	\li \c -loglevel level
+ *	\li \c -help
+ */
+int farm_main(int argc, char *argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*! @} Device Emulator Farm */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_FARM_H */
@@ -0,0 +1,406 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Device Hardware Abstraction
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_hal.h"
+
+#include "cctv_ctrlpt.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef CCTV_HAL_MOCK_ONLY
+#define CCTV_HAL_DEFAULT CCTvHalMock
+#else
+#define CCTV_HAL_DEFAULT CCTvHalPi
+#endif
+
+static const struct CCTvHalOps *const HalBackends[] = {
+#ifndef CCTV_HAL_MOCK_ONLY
+	&CCTvHalPi,
+#endif
+	&CCTvHalMock
+};
+
+/*! Selected backend. */
+static const struct CCTvHalOps *Hal = &CCTV_HAL_DEFAULT;
+
+int CCTvHalSelect(const char *name)
+{
+	size_t i;
+
+	if (!name) {
+		Hal = &CCTV_HAL_DEFAULT;
+		return CCTV_SUCCESS;
+	}
+	for (i = 0; i < sizeof HalBackends / sizeof HalBackends[0]; i++) {
+		if (strcmp(HalBackends[i]->name, name) == 0) {
+			Hal = HalBackends[i];
+			return CCTV_SUCCESS;
+		}
+	}
+
+	return CCTV_ERROR;
+}
+
+const char *CCTvHalName(void)
+{
+	return Hal->name;
+}
+
+int CCTvHalInit(void)
+{
+	return Hal->init() == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+int CCTvHalServoSetup(int pin, int range)
+{
+	return Hal->servo_setup(pin, range) == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+int CCTvHalServoWrite(int pin, int duty)
+{
+	return Hal->servo_write(pin, duty) == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+int CCTvHalReadTemp(int *celsius)
+{
+	int millicelsius;
+
+	if (Hal->read_temp(&millicelsius) != 0)
+		return CCTV_ERROR;
+	*celsius = millicelsius / 1000;
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvHalWatchdogOpen(void)
+{
+	return Hal->wdt_open() == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+int CCTvHalWatchdogSetTimeout(int seconds)
+{
+	return Hal->wdt_set_timeout(seconds) == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+int CCTvHalWatchdogTimeLeft(int *seconds)
+{
+	return Hal->wdt_time_left(seconds) == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+int CCTvHalWatchdogKeepalive(void)
+{
+	return Hal->wdt_keepalive() == 0 ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+void CCTvHalWatchdogClose(void)
+{
+	Hal->wdt_close();
+}
+
+/* Mock backend. */
+
+static pthread_mutex_t MockMutex = PTHREAD_MUTEX_INITIALIZER;
+/*! MockStats.duty is set up. */
+static int MockReady;
+static struct CCTvHalMockStats MockStats;
+static struct CCTvHalRecord MockRing[CCTV_HAL_MOCK_RECORDS];
+static int MockTemp;
+static long MockDelay[CCTV_HAL_OPS];
+static int MockFailEvery[CCTV_HAL_OPS];
+static int MockWdtTimeout;
+static long long MockWdtDeadline;
+/*! The expiry of the current countdown was counted. */
+static int MockWdtFired;
+
+static long long CCTvHalMockNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*! Back to a fresh mock. Mock lock held. */
+static void CCTvHalMockClear(void)
+{
+	int i;
+
+	memset(&MockStats, 0, sizeof MockStats);
+	for (i = 0; i < CCTV_HAL_PINS; i++)
+		MockStats.duty[i] = -1;
+	memset(MockDelay, 0, sizeof MockDelay);
+	memset(MockFailEvery, 0, sizeof MockFailEvery);
+	MockTemp = 45000;
+	MockWdtTimeout = CCTV_HAL_MOCK_WDT_TIMEOUT;
+	MockWdtFired = 0;
+	MockReady = 1;
+}
+
+/*! Count the watchdog firing, once per countdown. Mock lock held. */
+static void CCTvHalMockWatchdog(long long now)
+{
+	if (MockStats.wdt_open && !MockWdtFired && now >= MockWdtDeadline) {
+		MockStats.wdt_expired++;
+		MockWdtFired = 1;
+	}
+}
+
+/*!
+ * \brief Run an operation of the mock: wait its delay, apply it, count
+ * and record it.
+ *
+ * \return 0, or -1 if it failed.
+ */
+static int CCTvHalMockOp(int op, int pin, int *value)
+{
+	struct CCTvHalRecord *rec;
+	long long start = CCTvHalMockNow();
+	long long now;
+	long delay;
+	int ret = 0;
+
+	pthread_mutex_lock(&MockMutex);
+	if (!MockReady)
+		CCTvHalMockClear();
+	delay = MockDelay[op];
+	pthread_mutex_unlock(&MockMutex);
+	/* not holding the lock, as a slow device does not stop the others */
+	if (delay > 0)
+		usleep((useconds_t)delay);
+
+	pthread_mutex_lock(&MockMutex);
+	now = CCTvHalMockNow();
+	CCTvHalMockWatchdog(now);
+	MockStats.calls[op]++;
+	if (MockFailEvery[op] > 0 &&
+	    MockStats.calls[op] % (unsigned long)MockFailEvery[op] == 0) {
+		MockStats.failed[op]++;
+		ret = -1;
+	} else {
+		switch (op) {
+		case CCTV_HAL_SERVO_SETUP:
+			if (pin < 0 || pin >= CCTV_HAL_PINS || *value <= 0)
+				ret = -1;
+			else
+				MockStats.duty[pin] = 0;
+			break;
+		case CCTV_HAL_SERVO_WRITE:
+			if (pin < 0 || pin >= CCTV_HAL_PINS ||
+			    MockStats.duty[pin] < 0)
+				ret = -1;
+			else
+				MockStats.duty[pin] = *value;
+			break;
+		case CCTV_HAL_READ_TEMP:
+			*value = MockTemp;
+			break;
+		case CCTV_HAL_WDT_OPEN:
+			if (MockStats.wdt_open) {
+				ret = -1;
+				break;
+			}
+			MockStats.wdt_open = 1;
+			MockWdtDeadline = now +
+				(long long)MockWdtTimeout * 1000000000LL;
+			MockWdtFired = 0;
+			break;
+		case CCTV_HAL_WDT_TIMEOUT:
+			if (!MockStats.wdt_open || *value <= 0) {
+				ret = -1;
+				break;
+			}
+			/* a new timeout restarts the countdown */
+			MockWdtTimeout = *value;
+			/* fall through */
+		case CCTV_HAL_WDT_KEEPALIVE:
+			if (!MockStats.wdt_open) {
+				ret = -1;
+				break;
+			}
+			MockWdtDeadline = now +
+				(long long)MockWdtTimeout * 1000000000LL;
+			MockWdtFired = 0;
+			break;
+		case CCTV_HAL_WDT_TIME_LEFT:
+			if (!MockStats.wdt_open)
+				ret = -1;
+			else
+				*value = now >= MockWdtDeadline ? 0 :
+					(int)((MockWdtDeadline - now) /
+					1000000000LL);
+			break;
+		case CCTV_HAL_WDT_CLOSE:
+			MockStats.wdt_open = 0;
+			break;
+		}
+	}
+	rec = &MockRing[MockStats.records++ % CCTV_HAL_MOCK_RECORDS];
+	rec->op = op;
+	rec->pin = pin;
+	rec->value = *value;
+	rec->result = ret;
+	rec->ns = start;
+	MockStats.ns[op] += CCTvHalMockNow() - start;
+	pthread_mutex_unlock(&MockMutex);
+
+	return ret;
+}
+
+static int CCTvHalMockInit(void)
+{
+	return 0;
+}
+
+static int CCTvHalMockServoSetup(int pin, int range)
+{
+	return CCTvHalMockOp(CCTV_HAL_SERVO_SETUP, pin, &range);
+}
+
+static int CCTvHalMockServoWrite(int pin, int duty)
+{
+	return CCTvHalMockOp(CCTV_HAL_SERVO_WRITE, pin, &duty);
+}
+
+static int CCTvHalMockReadTemp(int *millicelsius)
+{
+	int value = 0;
+
+	if (CCTvHalMockOp(CCTV_HAL_READ_TEMP, -1, &value) != 0)
+		return -1;
+	*millicelsius = value;
+
+	return 0;
+}
+
+static int CCTvHalMockWdtOpen(void)
+{
+	int value = 0;
+
+	return CCTvHalMockOp(CCTV_HAL_WDT_OPEN, -1, &value);
+}
+
+static int CCTvHalMockWdtSetTimeout(int seconds)
+{
+	return CCTvHalMockOp(CCTV_HAL_WDT_TIMEOUT, -1, &seconds);
+}
+
+static int CCTvHalMockWdtTimeLeft(int *seconds)
+{
+	int value = 0;
+
+	if (CCTvHalMockOp(CCTV_HAL_WDT_TIME_LEFT, -1, &value) != 0)
+		return -1;
+	*seconds = value;
+
+	return 0;
+}
+
+static int CCTvHalMockWdtKeepalive(void)
+{
+	int value = 0;
+
+	return CCTvHalMockOp(CCTV_HAL_WDT_KEEPALIVE, -1, &value);
+}
+
+static void CCTvHalMockWdtClose(void)
+{
+	int value = 0;
+
+	CCTvHalMockOp(CCTV_HAL_WDT_CLOSE, -1, &value);
+}
+
+const struct CCTvHalOps CCTvHalMock = {
+	"mock",
+	CCTvHalMockInit,
+	CCTvHalMockServoSetup,
+	CCTvHalMockServoWrite,
+	CCTvHalMockReadTemp,
+	CCTvHalMockWdtOpen,
+	CCTvHalMockWdtSetTimeout,
+	CCTvHalMockWdtTimeLeft,
+	CCTvHalMockWdtKeepalive,
+	CCTvHalMockWdtClose
+};
+
+void CCTvHalMockReset(void)
+{
+	pthread_mutex_lock(&MockMutex);
+	CCTvHalMockClear();
+	pthread_mutex_unlock(&MockMutex);
+}
+
+void CCTvHalMockSetTemp(int millicelsius)
+{
+	pthread_mutex_lock(&MockMutex);
+	if (!MockReady)
+		CCTvHalMockClear();
+	MockTemp = millicelsius;
+	pthread_mutex_unlock(&MockMutex);
+}
+
+void CCTvHalMockSetDelay(int op, long us)
+{
+	if (op < 0 || op >= CCTV_HAL_OPS)
+		return;
+	pthread_mutex_lock(&MockMutex);
+	if (!MockReady)
+		CCTvHalMockClear();
+	MockDelay[op] = us;
+	pthread_mutex_unlock(&MockMutex);
+}
+
+void CCTvHalMockFail(int op, int every)
+{
+	if (op < 0 || op >= CCTV_HAL_OPS)
+		return;
+	pthread_mutex_lock(&MockMutex);
+	if (!MockReady)
+		CCTvHalMockClear();
+	MockFailEvery[op] = every;
+	pthread_mutex_unlock(&MockMutex);
+}
+
+void CCTvHalMockGetStats(struct CCTvHalMockStats *stats)
+{
+	pthread_mutex_lock(&MockMutex);
+	if (!MockReady)
+		CCTvHalMockClear();
+	CCTvHalMockWatchdog(CCTvHalMockNow());
+	*stats = MockStats;
+	pthread_mutex_unlock(&MockMutex);
+}
+
+int CCTvHalMockRecords(struct CCTvHalRecord *records, int max)
+{
+	unsigned long first;
+	unsigned long i;
+	int n = 0;
+
+	pthread_mutex_lock(&MockMutex);
+	first = MockStats.records > CCTV_HAL_MOCK_RECORDS ?
+		MockStats.records - CCTV_HAL_MOCK_RECORDS : 0;
+	if (max >= 0 && MockStats.records - first > (unsigned long)max)
+		first = MockStats.records - (unsigned long)max;
+	for (i = first; i < MockStats.records; i++)
+		records[n++] = MockRing[i % CCTV_HAL_MOCK_RECORDS];
+	pthread_mutex_unlock(&MockMutex);
+
+	return n;
+}
+
+/*! @} Device Hardware Abstraction */
+
+/*! @} UpnpSamples */
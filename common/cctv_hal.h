@@ -0,0 +1,261 @@
+#ifndef UPNP_CCTV_HAL_H
+#define UPNP_CCTV_HAL_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Device Hardware Abstraction
+ *
+ * @{
+ *
+ * \file
+ *
+ * What the device needs of the hardware: the servos of the mounts, the
+ * temperature sensor and the watchdog, behind a table of operations with
+ * two backends.
+ *	\li \c pi drives a Raspberry Pi: wiringPi soft PWM for the servos,
+ *	the first sysfs thermal zone and /dev/watchdog0. It is in
+ *	cctv_hal_pi.c, left out of builds defining CCTV_HAL_MOCK_ONLY.
+ *	\li \c mock keeps everything in memory, so the device runs on any
+ *	Linux box. It records every call with its CLOCK_MONOTONIC time,
+ *	emulates the watchdog countdown, returns a set temperature, and can
+ *	be made slow or failing per operation.
+ *
+ * One backend is selected before CCTvHalInit() and used process-wide.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Pins the servos can be on, wiringPi numbering. */
+#define CCTV_HAL_PINS 32
+
+/*! Calls the mock remembers, the latest ones. */
+#define CCTV_HAL_MOCK_RECORDS 4096
+
+/*! Watchdog timeout the mock starts with, in seconds, as the Pi's. */
+#define CCTV_HAL_MOCK_WDT_TIMEOUT 15
+
+/*! Operations, as recorded by the mock. */
+enum CCTvHalOp {
+	CCTV_HAL_SERVO_SETUP = 0,
+	CCTV_HAL_SERVO_WRITE,
+	CCTV_HAL_READ_TEMP,
+	CCTV_HAL_WDT_OPEN,
+	CCTV_HAL_WDT_TIMEOUT,
+	CCTV_HAL_WDT_TIME_LEFT,
+	CCTV_HAL_WDT_KEEPALIVE,
+	CCTV_HAL_WDT_CLOSE,
+	CCTV_HAL_OPS
+};
+
+/*! A backend. The operations return 0 on success, -1 on failure. */
+struct CCTvHalOps {
+	/*! Name to select it by. */
+	const char *name;
+	/*! Set up the hardware. */
+	int (*init)(void);
+	/*! Make a pin a PWM output of range steps. */
+	int (*servo_setup)(int pin, int range);
+	/*! Set the duty of a PWM output, in steps. */
+	int (*servo_write)(int pin, int duty);
+	/*! Read the temperature, in millidegrees C. */
+	int (*read_temp)(int *millicelsius);
+	int (*wdt_open)(void);
+	int (*wdt_set_timeout)(int seconds);
+	/*! Seconds left before the watchdog fires. */
+	int (*wdt_time_left)(int *seconds);
+	int (*wdt_keepalive)(void);
+	/*! Stop the watchdog and close it; nothing if not open. */
+	void (*wdt_close)(void);
+};
+
+#ifndef CCTV_HAL_MOCK_ONLY
+/*! Raspberry Pi backend. */
+extern const struct CCTvHalOps CCTvHalPi;
+#endif
+
+/*! In-memory backend. */
+extern const struct CCTvHalOps CCTvHalMock;
+
+/*! A call recorded by the mock. */
+struct CCTvHalRecord {
+	/*! A CCTvHalOp. */
+	int op;
+	/*! Pin of the servo operations, else -1. */
+	int pin;
+	/*! Duty, range, temperature, timeout or time left. */
+	int value;
+	/*! Result of the call. */
+	int result;
+	/*! CLOCK_MONOTONIC time of the call, in nanoseconds. */
+	long long ns;
+};
+
+/*! Counters of the mock since the last CCTvHalMockReset(). */
+struct CCTvHalMockStats {
+	unsigned long calls[CCTV_HAL_OPS];
+	/*! Calls failed on purpose. */
+	unsigned long failed[CCTV_HAL_OPS];
+	/*! Time spent in the calls, delays included, in nanoseconds. */
+	long long ns[CCTV_HAL_OPS];
+	/*! Last duty written to each pin, -1 if not set up. */
+	int duty[CCTV_HAL_PINS];
+	/*! Watchdog open, and how many times it was let expire. */
+	int wdt_open;
+	unsigned long wdt_expired;
+	/*! Calls recorded, including those the ring no longer holds. */
+	unsigned long records;
+};
+
+/*!
+ * \brief Select a backend by name.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if there is no such backend in this
+ * build.
+ */
+int CCTvHalSelect(
+	/*! [in] "pi" or "mock", NULL for the default: pi if built in. */
+	const char *name);
+
+/*!
+ * \brief Name of the selected backend.
+ */
+const char *CCTvHalName(void);
+
+/*!
+ * \brief Set up the hardware of the selected backend.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvHalInit(void);
+
+/*!
+ * \brief Make a pin a PWM output for a servo.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvHalServoSetup(
+	/*! [in] Pin, wiringPi numbering. */
+	int pin,
+	/*! [in] Steps of a PWM period. */
+	int range);
+
+/*!
+ * \brief Move a servo.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvHalServoWrite(
+	/*! [in] Pin, wiringPi numbering. */
+	int pin,
+	/*! [in] Duty, in steps. */
+	int duty);
+
+/*!
+ * \brief Read the temperature.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the sensor cannot be read.
+ */
+int CCTvHalReadTemp(
+	/*! [out] Degrees C. */
+	int *celsius);
+
+/*!
+ * \brief Open and start the watchdog.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvHalWatchdogOpen(void);
+
+/*!
+ * \brief Set the watchdog timeout, restarting the countdown.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if not open.
+ */
+int CCTvHalWatchdogSetTimeout(
+	/*! [in] Seconds. */
+	int seconds);
+
+/*!
+ * \brief Time left before the watchdog fires.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if not open.
+ */
+int CCTvHalWatchdogTimeLeft(
+	/*! [out] Seconds. */
+	int *seconds);
+
+/*!
+ * \brief Restart the watchdog countdown.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if not open.
+ */
+int CCTvHalWatchdogKeepalive(void);
+
+/*!
+ * \brief Stop and close the watchdog. Does nothing if not open.
+ */
+void CCTvHalWatchdogClose(void);
+
+/*!
+ * \brief Forget the calls and counters of the mock, close its watchdog and
+ * undo CCTvHalMockSetTemp(), CCTvHalMockSetDelay() and CCTvHalMockFail().
+ */
+void CCTvHalMockReset(void);
+
+/*!
+ * \brief Set the temperature the mock reads.
+ */
+void CCTvHalMockSetTemp(
+	/*! [in] Millidegrees C. */
+	int millicelsius);
+
+/*!
+ * \brief Make an operation of the mock take time, as the hardware would.
+ */
+void CCTvHalMockSetDelay(
+	/*! [in] A CCTvHalOp. */
+	int op,
+	/*! [in] Microseconds, spent sleeping. */
+	long us);
+
+/*!
+ * \brief Make an operation of the mock fail.
+ */
+void CCTvHalMockFail(
+	/*! [in] A CCTvHalOp. */
+	int op,
+	/*! [in] Every how many calls it fails: 1 always, 0 never. */
+	int every);
+
+/*!
+ * \brief Get the counters of the mock.
+ */
+void CCTvHalMockGetStats(
+	/*! [out] Counters. */
+	struct CCTvHalMockStats *stats);
+
+/*!
+ * \brief Get the latest calls recorded by the mock, oldest first.
+ *
+ * \return The number of records copied.
+ */
+int CCTvHalMockRecords(
+	/*! [out] Records. */
+	struct CCTvHalRecord *records,
+	/*! [in] Room in records. */
+	int max);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Device Hardware Abstraction */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_HAL_H */
@@ -0,0 +1,122 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Device Hardware Abstraction
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_hal.h"
+
+#include <wiringPi.h>
+#include <softPwm.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/watchdog.h>
+
+#define CCTV_HAL_PI_THERMAL "/sys/class/thermal/thermal_zone0/temp"
+#define CCTV_HAL_PI_WATCHDOG "/dev/watchdog0"
+
+static int WatchdogFd = -1;
+
+static int CCTvHalPiInit(void)
+{
+	return wiringPiSetup() == -1 ? -1 : 0;
+}
+
+static int CCTvHalPiServoSetup(int pin, int range)
+{
+	pinMode(pin, OUTPUT);
+
+	return softPwmCreate(pin, 0, range) == 0 ? 0 : -1;
+}
+
+static int CCTvHalPiServoWrite(int pin, int duty)
+{
+	softPwmWrite(pin, duty);
+
+	return 0;
+}
+
+static int CCTvHalPiReadTemp(int *millicelsius)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(CCTV_HAL_PI_THERMAL, "r");
+	if (!fp)
+		return -1;
+	ret = fscanf(fp, "%d", millicelsius) == 1 ? 0 : -1;
+	fclose(fp);
+
+	return ret;
+}
+
+static int CCTvHalPiWdtOpen(void)
+{
+	if (WatchdogFd >= 0)
+		return -1;
+	WatchdogFd = open(CCTV_HAL_PI_WATCHDOG, O_RDWR);
+
+	return WatchdogFd >= 0 ? 0 : -1;
+}
+
+static int CCTvHalPiWdtSetTimeout(int seconds)
+{
+	if (WatchdogFd < 0)
+		return -1;
+
+	return ioctl(WatchdogFd, WDIOC_SETTIMEOUT, &seconds) == 0 ? 0 : -1;
+}
+
+static int CCTvHalPiWdtTimeLeft(int *seconds)
+{
+	if (WatchdogFd < 0)
+		return -1;
+
+	return ioctl(WatchdogFd, WDIOC_GETTIMELEFT, seconds) == 0 ? 0 : -1;
+}
+
+static int CCTvHalPiWdtKeepalive(void)
+{
+	if (WatchdogFd < 0)
+		return -1;
+
+	return ioctl(WatchdogFd, WDIOC_KEEPALIVE, NULL) == 0 ? 0 : -1;
+}
+
+static void CCTvHalPiWdtClose(void)
+{
+	if (WatchdogFd < 0)
+		return;
+	/* the magic close, else the watchdog keeps counting */
+	if (write(WatchdogFd, "V", 1) != 1)
+		perror(CCTV_HAL_PI_WATCHDOG);
+	close(WatchdogFd);
+	WatchdogFd = -1;
+}
+
+const struct CCTvHalOps CCTvHalPi = {
+	"pi",
+	CCTvHalPiInit,
+	CCTvHalPiServoSetup,
+	CCTvHalPiServoWrite,
+	CCTvHalPiReadTemp,
+	CCTvHalPiWdtOpen,
+	CCTvHalPiWdtSetTimeout,
+	CCTvHalPiWdtTimeLeft,
+	CCTvHalPiWdtKeepalive,
+	CCTvHalPiWdtClose
+};
+
+/*! @} Device Hardware Abstraction */
+
+/*! @} UpnpSamples */
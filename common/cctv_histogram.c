@@ -0,0 +1,142 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Latency Histograms
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_histogram.h"
+
+#include <string.h>
+
+/* 64 bits wide, so the shift below is defined where long has 32 */
+static int CCTvHistogramIndex(unsigned long long value)
+{
+	int msb;
+
+	if (value < CCTV_HISTOGRAM_SUB_COUNT)
+		return (int)value;
+	if (value >> CCTV_HISTOGRAM_MAX_BITS)
+		return CCTV_HISTOGRAM_BUCKETS - 1;
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - CCTV_HISTOGRAM_SUB_BITS + 1) * CCTV_HISTOGRAM_SUB_COUNT +
+		(int)((value >> (msb - CCTV_HISTOGRAM_SUB_BITS)) &
+		      (CCTV_HISTOGRAM_SUB_COUNT - 1));
+}
+
+unsigned long CCTvHistogramBucketLow(int bucket)
+{
+	int shift;
+
+	if (bucket < CCTV_HISTOGRAM_SUB_COUNT)
+		return (unsigned long)bucket;
+	shift = bucket / CCTV_HISTOGRAM_SUB_COUNT - 1;
+
+	return (unsigned long)(CCTV_HISTOGRAM_SUB_COUNT +
+		bucket % CCTV_HISTOGRAM_SUB_COUNT) << shift;
+}
+
+unsigned long CCTvHistogramBucketHigh(int bucket)
+{
+	int shift;
+
+	if (bucket < CCTV_HISTOGRAM_SUB_COUNT)
+		return (unsigned long)bucket;
+	shift = bucket / CCTV_HISTOGRAM_SUB_COUNT - 1;
+
+	return CCTvHistogramBucketLow(bucket) + (1UL << shift) - 1;
+}
+
+void CCTvHistogramRecord(struct CCTvHistogram *h, unsigned long value)
+{
+	unsigned long max;
+
+	__atomic_fetch_add(&h->counts[CCTvHistogramIndex(
+		(unsigned long long)value)], 1,
+		__ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, (unsigned long long)value,
+		__ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n(&h->max, &max,
+		value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	/* last, so a snapshot never has more values than buckets hold */
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELEASE);
+}
+
+void CCTvHistogramSnapshot(const struct CCTvHistogram *h,
+	struct CCTvHistogram *snap)
+{
+	unsigned long total = 0;
+	int i;
+
+	snap->count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+	snap->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+	snap->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	for (i = 0; i < CCTV_HISTOGRAM_BUCKETS; i++) {
+		snap->counts[i] = __atomic_load_n(&h->counts[i],
+			__ATOMIC_RELAXED);
+		total += snap->counts[i];
+	}
+	/* values recorded while copying are in the buckets only */
+	if (total > snap->count)
+		snap->count = total;
+}
+
+void CCTvHistogramMerge(struct CCTvHistogram *dst,
+	const struct CCTvHistogram *src)
+{
+	int i;
+
+	for (i = 0; i < CCTV_HISTOGRAM_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+unsigned long CCTvHistogramPercentile(const struct CCTvHistogram *h,
+	double percentile)
+{
+	unsigned long total = 0;
+	unsigned long seen = 0;
+	unsigned long rank;
+	unsigned long high;
+	int i;
+
+	for (i = 0; i < CCTV_HISTOGRAM_BUCKETS; i++)
+		total += h->counts[i];
+	if (!total)
+		return 0;
+	if (percentile < 0)
+		percentile = 0;
+	if (percentile > 100)
+		percentile = 100;
+	rank = (unsigned long)(percentile / 100.0 * (double)total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < CCTV_HISTOGRAM_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank)
+			break;
+	}
+	high = CCTvHistogramBucketHigh(i);
+
+	return h->max && high > h->max ? h->max : high;
+}
+
+double CCTvHistogramMean(const struct CCTvHistogram *h)
+{
+	return h->count ? (double)h->sum / (double)h->count : 0.0;
+}
+
+/*! @} Control Point Latency Histograms */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,122 @@
+#ifndef UPNP_CCTV_HISTOGRAM_H
+#define UPNP_CCTV_HISTOGRAM_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Latency Histograms
+ *
+ * @{
+ *
+ * \file
+ *
+ * Log-linear histograms in the style of HdrHistogram: values below 16 have a
+ * bucket each, above that every power of two is split into 16 buckets, so a
+ * recorded value is off by at most 1/16. With microsecond values the range
+ * goes up to about 71 minutes; larger values land in the last bucket.
+ *
+ * Recording is lock-free, a handful of relaxed atomic adds, so any number of
+ * threads may record into one histogram while another reads it. A reader
+ * takes a snapshot first; the counters of a snapshot are consistent enough
+ * for percentiles, though one taken during recording may be a few values
+ * behind.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Buckets per power of two, as a power of two. */
+#define CCTV_HISTOGRAM_SUB_BITS 4
+
+/*! Largest value recorded exactly, as a power of two. */
+#define CCTV_HISTOGRAM_MAX_BITS 32
+
+#define CCTV_HISTOGRAM_SUB_COUNT (1 << CCTV_HISTOGRAM_SUB_BITS)
+
+#define CCTV_HISTOGRAM_BUCKETS \
+	(CCTV_HISTOGRAM_SUB_COUNT + \
+	 (CCTV_HISTOGRAM_MAX_BITS - CCTV_HISTOGRAM_SUB_BITS) * \
+	 CCTV_HISTOGRAM_SUB_COUNT)
+
+/*! A histogram. All zero is empty. */
+struct CCTvHistogram {
+	unsigned long counts[CCTV_HISTOGRAM_BUCKETS];
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long max;
+};
+
+/*!
+ * \brief Record a value. Lock-free.
+ */
+void CCTvHistogramRecord(
+	/*! [in,out] Histogram. */
+	struct CCTvHistogram *h,
+	/*! [in] Value. */
+	unsigned long value);
+
+/*!
+ * \brief Copy a histogram that may be recorded into meanwhile.
+ */
+void CCTvHistogramSnapshot(
+	/*! [in] Histogram. */
+	const struct CCTvHistogram *h,
+	/*! [out] Copy. */
+	struct CCTvHistogram *snap);
+
+/*!
+ * \brief Add the counts of src to those of dst. Neither may be recorded
+ * into meanwhile, so pass snapshots.
+ */
+void CCTvHistogramMerge(
+	/*! [in,out] Histogram. */
+	struct CCTvHistogram *dst,
+	/*! [in] Histogram to add. */
+	const struct CCTvHistogram *src);
+
+/*!
+ * \brief Value below which a share of the recorded values are, at the
+ * histogram's precision.
+ *
+ * \return The highest value of the bucket the percentile falls in, capped
+ * at the largest value recorded, or 0 if the histogram is empty.
+ */
+unsigned long CCTvHistogramPercentile(
+	/*! [in] Snapshot. */
+	const struct CCTvHistogram *h,
+	/*! [in] Percentile, 0 to 100. */
+	double percentile);
+
+/*!
+ * \brief Mean of the recorded values, 0 if there are none.
+ */
+double CCTvHistogramMean(
+	/*! [in] Snapshot. */
+	const struct CCTvHistogram *h);
+
+/*!
+ * \brief Lowest value of a bucket.
+ */
+unsigned long CCTvHistogramBucketLow(
+	/*! [in] Bucket index. */
+	int bucket);
+
+/*!
+ * \brief Highest value of a bucket.
+ */
+unsigned long CCTvHistogramBucketHigh(
+	/*! [in] Bucket index. */
+	int bucket);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Latency Histograms */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_HISTOGRAM_H */
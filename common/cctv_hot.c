@@ -0,0 +1,176 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Hot Device State
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_hot.h"
+
+#include "cctv_ctrlpt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int CCTvHotNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int)ts.tv_sec;
+}
+
+void CCTvHotInit(struct CCTvHotTable *table)
+{
+	memset(table, 0, sizeof *table);
+}
+
+void CCTvHotDestroy(struct CCTvHotTable *table)
+{
+	int c;
+
+	for (c = 0; c < table->nchunks; c++)
+		free(table->chunks[c]);
+	free(table->free);
+	memset(table, 0, sizeof *table);
+}
+
+int CCTvHotAlloc(struct CCTvHotTable *table, struct CCTvDeviceNode *node)
+{
+	struct CCTvHotChunk *chunk;
+	int slot;
+	int k;
+
+	if (table->nfree > 0) {
+		slot = table->free[--table->nfree];
+	} else {
+		if (table->high == table->nchunks * CCTV_HOT_CHUNK) {
+			if (table->nchunks == CCTV_HOT_MAX_CHUNKS)
+				return CCTV_ERROR;
+			chunk = (struct CCTvHotChunk *)calloc(1, sizeof *chunk);
+			if (!chunk)
+				return CCTV_ERROR;
+			table->chunks[table->nchunks++] = chunk;
+		}
+		slot = table->high++;
+	}
+	chunk = table->chunks[slot / CCTV_HOT_CHUNK];
+	k = slot % CCTV_HOT_CHUNK;
+	chunk->expiry[k] = 0;
+	chunk->sid_hash[k] = 0;
+	chunk->temperature[k] = CCTV_HOT_NO_TEMP;
+	chunk->power[k] = -1;
+	chunk->health[k] = CCTV_RECOVERY_HEALTHY;
+	chunk->used[k] = 1;
+	chunk->node[k] = node;
+	table->count++;
+
+	return slot;
+}
+
+void CCTvHotFree(struct CCTvHotTable *table, int slot)
+{
+	int *grown;
+	int capacity;
+
+	if (slot < 0 || slot >= table->high || !CCTV_HOT(table, slot, used))
+		return;
+	CCTV_HOT(table, slot, used) = 0;
+	CCTV_HOT(table, slot, node) = NULL;
+	table->count--;
+	if (table->nfree == table->free_capacity) {
+		capacity = table->free_capacity ? table->free_capacity * 2 : 64;
+		grown = (int *)realloc(table->free,
+			(size_t)capacity * sizeof *grown);
+		/* the slot is only lost for reuse */
+		if (!grown)
+			return;
+		table->free = grown;
+		table->free_capacity = capacity;
+	}
+	table->free[table->nfree++] = slot;
+}
+
+void CCTvHotSummarize(const struct CCTvHotTable *table, int hot_threshold,
+	int horizon, struct CCTvHotSummary *summary)
+{
+	const struct CCTvHotChunk *chunk;
+	int deadline = CCTvHotNow() + horizon;
+	double temp_sum = 0.0;
+	int n;
+	int c;
+	int k;
+
+	memset(summary, 0, sizeof *summary);
+	summary->temp_min = CCTV_HOT_NO_TEMP;
+	summary->temp_max = CCTV_HOT_NO_TEMP;
+	for (c = 0; c < table->nchunks; c++) {
+		chunk = table->chunks[c];
+		n = table->high - c * CCTV_HOT_CHUNK;
+		if (n > CCTV_HOT_CHUNK)
+			n = CCTV_HOT_CHUNK;
+		for (k = 0; k < n; k++) {
+			if (!chunk->used[k])
+				continue;
+			summary->devices++;
+			summary->powered_on += chunk->power[k] == 1;
+			summary->powered_off += chunk->power[k] == 0;
+			summary->unsubscribed += chunk->sid_hash[k] == 0;
+			summary->expiring += chunk->expiry[k] != 0 &&
+				chunk->expiry[k] <= deadline;
+			summary->health[chunk->health[k]]++;
+			if (chunk->temperature[k] == CCTV_HOT_NO_TEMP)
+				continue;
+			if (!summary->temp_known ||
+			    chunk->temperature[k] < summary->temp_min)
+				summary->temp_min = chunk->temperature[k];
+			if (!summary->temp_known ||
+			    chunk->temperature[k] > summary->temp_max)
+				summary->temp_max = chunk->temperature[k];
+			summary->temp_known++;
+			temp_sum += chunk->temperature[k];
+			summary->hot += chunk->temperature[k] >= hot_threshold;
+		}
+	}
+	if (summary->temp_known)
+		summary->temp_mean = temp_sum / summary->temp_known;
+}
+
+int CCTvHotSelectHot(const struct CCTvHotTable *table, int hot_threshold,
+	int *slots, int max)
+{
+	const struct CCTvHotChunk *chunk;
+	int found = 0;
+	int n;
+	int c;
+	int k;
+
+	for (c = 0; c < table->nchunks; c++) {
+		chunk = table->chunks[c];
+		n = table->high - c * CCTV_HOT_CHUNK;
+		if (n > CCTV_HOT_CHUNK)
+			n = CCTV_HOT_CHUNK;
+		for (k = 0; k < n; k++) {
+			if (!chunk->used[k] ||
+			    chunk->temperature[k] == CCTV_HOT_NO_TEMP ||
+			    chunk->temperature[k] < hot_threshold)
+				continue;
+			if (found < max)
+				slots[found] = c * CCTV_HOT_CHUNK + k;
+			found++;
+		}
+	}
+
+	return found;
+}
+
+/*! @} Control Point Hot Device State */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,173 @@
+#ifndef UPNP_CCTV_HOT_H
+#define UPNP_CCTV_HOT_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Hot Device State
+ *
+ * @{
+ *
+ * \file
+ *
+ * The few fields of a device that fleet-wide sweeps look at, kept apart
+ * from the device nodes: expiry deadline, power, temperature, recovery
+ * state and SID hash. Each device has a slot; the slots are stored a
+ * chunk at a time, one array per field, so a sweep over one field reads
+ * consecutive memory instead of a few bytes from every device node.
+ *
+ * Chunks are allocated as the fleet grows and never move. Like the
+ * registry, the table does not lock; the control point guards it with
+ * DeviceStateMutex.
+ */
+
+#include "cctv_recovery.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Slots per chunk, a power of two. */
+#define CCTV_HOT_CHUNK 1024
+
+/*! Chunks at most, so the table holds this many times CCTV_HOT_CHUNK
+ * devices. */
+#define CCTV_HOT_MAX_CHUNKS 256
+
+/*! Temperature of a device that has not reported one. */
+#define CCTV_HOT_NO_TEMP (-32768)
+
+struct CCTvDeviceNode;
+
+/*! CCTV_HOT_CHUNK slots, one array per field. */
+struct CCTvHotChunk {
+	/*! When the advertisement expires, on the CCTvHotNow() clock. */
+	int expiry[CCTV_HOT_CHUNK];
+	/*! Hash of the control service SID, 0 while not subscribed. */
+	unsigned int sid_hash[CCTV_HOT_CHUNK];
+	/*! Temperature in degrees, or CCTV_HOT_NO_TEMP. */
+	short temperature[CCTV_HOT_CHUNK];
+	/*! Power 1 or 0, -1 if not known. */
+	signed char power[CCTV_HOT_CHUNK];
+	/*! enum CCTvRecoveryState. */
+	unsigned char health[CCTV_HOT_CHUNK];
+	/*! Whether the slot belongs to a device. */
+	unsigned char used[CCTV_HOT_CHUNK];
+	/*! Device of the slot, to report it by name. */
+	struct CCTvDeviceNode *node[CCTV_HOT_CHUNK];
+};
+
+struct CCTvHotTable {
+	struct CCTvHotChunk *chunks[CCTV_HOT_MAX_CHUNKS];
+	int nchunks;
+	/*! Slots in use, and slots ever handed out. */
+	int count;
+	int high;
+	/*! Freed slots, reused first. */
+	int *free;
+	int nfree;
+	int free_capacity;
+};
+
+/*! Field of a slot, e.g. CCTV_HOT(&HotTable, slot, power) = 1. */
+#define CCTV_HOT(table, slot, field) \
+	((table)->chunks[(slot) / CCTV_HOT_CHUNK]->field[(slot) % CCTV_HOT_CHUNK])
+
+/*! What a sweep of the table found. */
+struct CCTvHotSummary {
+	int devices;
+	int powered_on;
+	int powered_off;
+	/*! Temperatures reported, their range and mean. */
+	int temp_known;
+	int temp_min;
+	int temp_max;
+	double temp_mean;
+	/*! Devices at or above the temperature threshold. */
+	int hot;
+	/*! Devices without a subscription. */
+	int unsubscribed;
+	/*! Devices whose advertisement expires within the horizon. */
+	int expiring;
+	/*! Devices per recovery state. */
+	int health[CCTV_RECOVERY_STATES];
+};
+
+/*!
+ * \brief Seconds on a monotonic clock, for expiry deadlines.
+ */
+int CCTvHotNow(void);
+
+/*!
+ * \brief Initialize an empty table.
+ */
+void CCTvHotInit(
+	/*! [out] Table. */
+	struct CCTvHotTable *table);
+
+/*!
+ * \brief Release the table and all of its chunks.
+ */
+void CCTvHotDestroy(
+	/*! [in,out] Table. */
+	struct CCTvHotTable *table);
+
+/*!
+ * \brief Give a device a slot, with nothing known about it yet.
+ *
+ * \return The slot, or CCTV_ERROR if out of memory or full.
+ */
+int CCTvHotAlloc(
+	/*! [in,out] Table. */
+	struct CCTvHotTable *table,
+	/*! [in] Device of the slot. */
+	struct CCTvDeviceNode *node);
+
+/*!
+ * \brief Give a slot back.
+ */
+void CCTvHotFree(
+	/*! [in,out] Table. */
+	struct CCTvHotTable *table,
+	/*! [in] Slot returned by CCTvHotAlloc(). */
+	int slot);
+
+/*!
+ * \brief Sweep the whole table.
+ */
+void CCTvHotSummarize(
+	/*! [in] Table. */
+	const struct CCTvHotTable *table,
+	/*! [in] Temperature from which a device counts as hot. */
+	int hot_threshold,
+	/*! [in] Seconds from now within which an expiry counts. */
+	int horizon,
+	/*! [out] Findings. */
+	struct CCTvHotSummary *summary);
+
+/*!
+ * \brief Find the devices at or above a temperature.
+ *
+ * \return The number of devices found, of which at most max are stored.
+ */
+int CCTvHotSelectHot(
+	/*! [in] Table. */
+	const struct CCTvHotTable *table,
+	/*! [in] Temperature from which a device counts as hot. */
+	int hot_threshold,
+	/*! [out] Slots of the devices found. */
+	int *slots,
+	/*! [in] Room in slots. */
+	int max);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Hot Device State */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_HOT_H */
@@ -0,0 +1,351 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Metrics
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_metrics.h"
+
+#include "cctv_ctrlpt.h"
+#include "sample_util.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/*! Upper bounds of the exported histogram buckets, in seconds. */
+static const double MetricsBuckets[] = {
+	0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300
+};
+
+#define CCTV_METRICS_BUCKETS \
+	((int)(sizeof MetricsBuckets / sizeof MetricsBuckets[0]))
+
+/*!
+ * Registered arrays. A slot is claimed first, then its size is set and
+ * the array published, so a reader seeing the array also sees its size.
+ */
+static int MetricsClaimed[CCTV_METRICS_MAX_SETS];
+static int MetricsSizes[CCTV_METRICS_MAX_SETS];
+static struct CCTvMetric *MetricsSets[CCTV_METRICS_MAX_SETS];
+
+static int MetricsFd = -1;
+static int MetricsRunning;
+static ithread_t MetricsThread;
+
+enum {
+	METRICS_SCRAPES,
+	METRICS_BAD_REQUESTS
+};
+
+static struct CCTvMetric MetricsOwn[] = {
+	CCTV_METRIC_COUNTER_INIT("cctv_metrics_requests_total{result=\"ok\"}",
+		"HTTP requests to the metrics endpoint."),
+	CCTV_METRIC_COUNTER_INIT("cctv_metrics_requests_total{result=\"error\"}",
+		NULL)
+};
+
+int CCTvMetricsRegister(struct CCTvMetric *metrics, int n)
+{
+	struct CCTvMetric *set;
+	int expected;
+	int i;
+
+	for (i = 0; i < CCTV_METRICS_MAX_SETS; i++) {
+		set = __atomic_load_n(&MetricsSets[i], __ATOMIC_ACQUIRE);
+		if (set == metrics)
+			return CCTV_SUCCESS;
+		expected = 0;
+		if (!set && __atomic_compare_exchange_n(&MetricsClaimed[i],
+			&expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			MetricsSizes[i] = n;
+			__atomic_store_n(&MetricsSets[i], metrics,
+				__ATOMIC_RELEASE);
+			return CCTV_SUCCESS;
+		}
+	}
+
+	return CCTV_ERROR;
+}
+
+void CCTvMetricsAdd(struct CCTvMetric *metric, long n)
+{
+	__atomic_fetch_add(&metric->value, n, __ATOMIC_RELAXED);
+}
+
+void CCTvMetricsSet(struct CCTvMetric *metric, long value)
+{
+	__atomic_store_n(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+void CCTvMetricsObserve(struct CCTvMetric *metric, unsigned long us)
+{
+	CCTvHistogramRecord(metric->histogram, us);
+}
+
+/*!
+ * \brief Length of the family name of a metric, i.e. without its labels.
+ */
+static size_t CCTvMetricsFamilyLen(const char *name)
+{
+	const char *brace = strchr(name, '{');
+
+	return brace ? (size_t)(brace - name) : strlen(name);
+}
+
+static void CCTvMetricsWriteHistogram(FILE *out, const struct CCTvMetric *m)
+{
+	struct CCTvHistogram snap;
+	unsigned long count = 0;
+	int b = 0;
+	int i;
+
+	CCTvHistogramSnapshot(m->histogram, &snap);
+	for (i = 0; i < CCTV_METRICS_BUCKETS; i++) {
+		/* at the precision of the histogram */
+		while (b < CCTV_HISTOGRAM_BUCKETS &&
+		       CCTvHistogramBucketHigh(b) <= MetricsBuckets[i] * 1e6)
+			count += snap.counts[b++];
+		fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", m->name,
+			MetricsBuckets[i], count);
+	}
+	fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n"
+		"%s_sum %.6f\n"
+		"%s_count %lu\n",
+		m->name, snap.count,
+		m->name, (double)snap.sum / 1e6,
+		m->name, snap.count);
+}
+
+char *CCTvMetricsFormat(size_t *len)
+{
+	static const char *types[] = { "counter", "gauge", "histogram" };
+	const struct CCTvMetric *prev = NULL;
+	const struct CCTvMetric *m;
+	struct CCTvMetric *set;
+	char *text = NULL;
+	FILE *out;
+	long value;
+	int i;
+	int j;
+
+	out = open_memstream(&text, len);
+	if (!out)
+		return NULL;
+	for (i = 0; i < CCTV_METRICS_MAX_SETS; i++) {
+		set = __atomic_load_n(&MetricsSets[i], __ATOMIC_ACQUIRE);
+		if (!set)
+			continue;
+		for (j = 0; j < MetricsSizes[i]; j++) {
+			m = &set[j];
+			if (!prev ||
+			    CCTvMetricsFamilyLen(prev->name) !=
+			    CCTvMetricsFamilyLen(m->name) ||
+			    strncmp(prev->name, m->name,
+				CCTvMetricsFamilyLen(m->name)) != 0)
+				fprintf(out, "# HELP %.*s %s\n# TYPE %.*s %s\n",
+					(int)CCTvMetricsFamilyLen(m->name),
+					m->name, m->help ? m->help : "",
+					(int)CCTvMetricsFamilyLen(m->name),
+					m->name, types[m->type]);
+			prev = m;
+			if (m->type == CCTV_METRIC_HISTOGRAM) {
+				CCTvMetricsWriteHistogram(out, m);
+				continue;
+			}
+			value = m->read ? m->read(m->which) :
+				__atomic_load_n(&m->value, __ATOMIC_RELAXED);
+			fprintf(out, "%s %ld\n", m->name, value);
+		}
+	}
+	if (fclose(out) != 0) {
+		free(text);
+		return NULL;
+	}
+
+	return text;
+}
+
+void CCTvMetricsPrint(void)
+{
+	char *text;
+	size_t len;
+
+	text = CCTvMetricsFormat(&len);
+	if (!text) {
+		SampleUtil_Print("Out of memory\n");
+		return;
+	}
+	SampleUtil_Print("%s", text);
+	free(text);
+}
+
+static int CCTvMetricsSend(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return CCTV_ERROR;
+		data += n;
+		len -= (size_t)n;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Answer one HTTP request; only GET /metrics is served.
+ */
+static void CCTvMetricsServe(int fd)
+{
+	static const char notfound[] =
+		"HTTP/1.0 404 Not Found\r\n"
+		"Content-Type: text/plain\r\n"
+		"Content-Length: 10\r\n"
+		"Connection: close\r\n"
+		"\r\n"
+		"Not found\n";
+	char request[CCTV_METRICS_MAX_REQUEST];
+	char header[160];
+	struct timeval tv;
+	size_t len = 0;
+	ssize_t n;
+	char *text;
+	size_t textlen;
+
+	tv.tv_sec = CCTV_METRICS_TIMEOUT_MS / 1000;
+	tv.tv_usec = (CCTV_METRICS_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+	request[0] = '\0';
+	while (len < sizeof request - 1 && !strstr(request, "\r\n\r\n") &&
+	       !strstr(request, "\n\n")) {
+		n = recv(fd, request + len, sizeof request - 1 - len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += (size_t)n;
+		request[len] = '\0';
+	}
+	if (strncmp(request, "GET /metrics ", 13) != 0 &&
+	    strncmp(request, "GET /metrics?", 13) != 0) {
+		CCTvMetricsAdd(&MetricsOwn[METRICS_BAD_REQUESTS], 1);
+		CCTvMetricsSend(fd, notfound, sizeof notfound - 1);
+		return;
+	}
+	CCTvMetricsAdd(&MetricsOwn[METRICS_SCRAPES], 1);
+	text = CCTvMetricsFormat(&textlen);
+	if (!text)
+		return;
+	snprintf(header, sizeof header,
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %lu\r\n"
+		"Connection: close\r\n"
+		"\r\n", (unsigned long)textlen);
+	if (CCTvMetricsSend(fd, header, strlen(header)) == CCTV_SUCCESS)
+		CCTvMetricsSend(fd, text, textlen);
+	free(text);
+}
+
+static void *CCTvMetricsAccept(void *arg)
+{
+	int fd;
+
+	while (1) {
+		fd = accept(MetricsFd, NULL, NULL);
+		if (!__atomic_load_n(&MetricsRunning, __ATOMIC_ACQUIRE)) {
+			if (fd >= 0)
+				close(fd);
+			break;
+		}
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				SampleUtil_Print("Metrics: accept failed -- %d\n",
+					errno);
+			continue;
+		}
+		/* scrapes are rare and short, one at a time */
+		CCTvMetricsServe(fd);
+		close(fd);
+	}
+
+	return NULL;
+	arg = arg;
+}
+
+int CCTvMetricsStart(const char *address, unsigned short port)
+{
+	struct sockaddr_in addr;
+	int on = 1;
+	int fd;
+
+	if (MetricsFd >= 0)
+		return CCTV_ERROR;
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (!address)
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	else if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+		return CCTV_ERROR;
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return CCTV_ERROR;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+	    listen(fd, 8) != 0) {
+		SampleUtil_Print("Metrics: cannot listen on %s:%u -- %d\n",
+			address ? address : "*", port, errno);
+		close(fd);
+		return CCTV_ERROR;
+	}
+	CCTvMetricsRegister(MetricsOwn,
+		(int)(sizeof MetricsOwn / sizeof MetricsOwn[0]));
+	MetricsFd = fd;
+	MetricsRunning = 1;
+	if (ithread_create(&MetricsThread, NULL, CCTvMetricsAccept, NULL) !=
+	    0) {
+		MetricsRunning = 0;
+		MetricsFd = -1;
+		close(fd);
+		return CCTV_ERROR;
+	}
+	SampleUtil_Print("Metrics served on http://%s:%u/metrics\n",
+		address ? address : "*", port);
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvMetricsStop(void)
+{
+	if (MetricsFd < 0)
+		return;
+	__atomic_store_n(&MetricsRunning, 0, __ATOMIC_RELEASE);
+	/* wakes up the accept */
+	shutdown(MetricsFd, SHUT_RDWR);
+	ithread_join(MetricsThread, NULL);
+	close(MetricsFd);
+	MetricsFd = -1;
+}
+
+/*! @} Metrics */
+
+/*! @} UpnpSamples */
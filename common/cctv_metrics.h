@@ -0,0 +1,150 @@
+#ifndef UPNP_CCTV_METRICS_H
+#define UPNP_CCTV_METRICS_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Metrics
+ *
+ * @{
+ *
+ * \file
+ *
+ * Counters, gauges and histograms of the control point and the device,
+ * served over HTTP in the Prometheus text format.
+ *
+ * A module keeps its metrics in a static array and registers it once;
+ * the metrics of an array are exported in its order, so the metrics of a
+ * family (same name, different labels) must be next to each other.
+ * Updating a metric is lock-free, a relaxed atomic add or store, so it is
+ * cheap enough for the SDK callbacks. Values a module already counts under
+ * its own lock are read at scrape time through a read function instead.
+ */
+
+#include "cctv_histogram.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Most metric arrays registered. */
+#define CCTV_METRICS_MAX_SETS 32
+
+/*! Longest HTTP request read, and how long a client has to send it. */
+#define CCTV_METRICS_MAX_REQUEST 4096
+#define CCTV_METRICS_TIMEOUT_MS 2000
+
+enum CCTvMetricType {
+	CCTV_METRIC_COUNTER,
+	CCTV_METRIC_GAUGE,
+	CCTV_METRIC_HISTOGRAM
+};
+
+/*! A metric. */
+struct CCTvMetric {
+	/*! Name with its labels, e.g. cctv_ctrlpt_actions_total{result="ok"}.
+	 * Histograms take no labels. */
+	const char *name;
+	/*! Help text of the family, taken from its first metric. */
+	const char *help;
+	enum CCTvMetricType type;
+	/*! Value of a counter or gauge without read function. */
+	long value;
+	/*! Values of a histogram, in microseconds; exported in seconds. */
+	struct CCTvHistogram *histogram;
+	/*! Returns the value at scrape time, may be NULL. */
+	long (*read)(int which);
+	/*! Argument of read. */
+	int which;
+};
+
+#define CCTV_METRIC_COUNTER_INIT(name, help) \
+	{ name, help, CCTV_METRIC_COUNTER, 0, NULL, NULL, 0 }
+#define CCTV_METRIC_HISTOGRAM_INIT(name, help, histogram) \
+	{ name, help, CCTV_METRIC_HISTOGRAM, 0, histogram, NULL, 0 }
+#define CCTV_METRIC_READ_INIT(name, help, type, read, which) \
+	{ name, help, type, 0, NULL, read, which }
+
+/*!
+ * \brief Export an array of metrics. Registering it again does nothing.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if CCTV_METRICS_MAX_SETS arrays are
+ * registered already.
+ */
+int CCTvMetricsRegister(
+	/*! [in] Metrics; must stay valid until the program exits. */
+	struct CCTvMetric *metrics,
+	/*! [in] Number of metrics. */
+	int n);
+
+/*!
+ * \brief Add to a counter or gauge. Lock-free.
+ */
+void CCTvMetricsAdd(
+	/*! [in,out] Metric. */
+	struct CCTvMetric *metric,
+	/*! [in] Amount, negative to decrease a gauge. */
+	long n);
+
+/*!
+ * \brief Set a gauge. Lock-free.
+ */
+void CCTvMetricsSet(
+	/*! [in,out] Metric. */
+	struct CCTvMetric *metric,
+	/*! [in] Value. */
+	long value);
+
+/*!
+ * \brief Record a value into a histogram. Lock-free.
+ */
+void CCTvMetricsObserve(
+	/*! [in,out] Metric. */
+	struct CCTvMetric *metric,
+	/*! [in] Value, in microseconds. */
+	unsigned long us);
+
+/*!
+ * \brief All registered metrics in the Prometheus text format.
+ *
+ * \return The text, to be freed by the caller, or NULL if out of memory.
+ */
+char *CCTvMetricsFormat(
+	/*! [out] Length of the text. */
+	size_t *len);
+
+/*!
+ * \brief Print all registered metrics with SampleUtil_Print().
+ */
+void CCTvMetricsPrint(void);
+
+/*!
+ * \brief Serve the metrics at http://<address>:<port>/metrics.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if already started or the socket
+ * cannot be set up.
+ */
+int CCTvMetricsStart(
+	/*! [in] Address to listen on, e.g. 127.0.0.1, or NULL for all. */
+	const char *address,
+	/*! [in] TCP port. */
+	unsigned short port);
+
+/*!
+ * \brief Stop serving. Does nothing if not started.
+ */
+void CCTvMetricsStop(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Metrics */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_METRICS_H */
@@ -0,0 +1,624 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Fleet Polling
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_poll.h"
+
+#include "cctv_ctrlpt.h"
+#include "cctv_registry.h"
+#include "sample_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*! Number of hash buckets, a power of two. */
+#define CCTV_POLL_BUCKETS 1024
+
+/*! Requests sent per pacer run at most. */
+#define CCTV_POLL_BATCH 256
+
+/*! Due queues, served in this order. */
+enum CCTvPollQueue {
+	/*! Quiet cameras. */
+	CCTV_POLL_URGENT = 0,
+	/*! Cameras whose last poll failed. */
+	CCTV_POLL_FAILING,
+	/*! Cameras sending events. */
+	CCTV_POLL_ROUTINE,
+	CCTV_POLL_QUEUES
+};
+
+/*! A polled camera. */
+struct CCTvPollCamera {
+	char *UDN;
+	char *controlURL;
+	unsigned int hash;
+	/*! Current poll interval, in ms. */
+	long interval;
+	/*! When the last event arrived, 0 if none did. */
+	double last_event;
+	/*! When the last poll completed, 0 if none did. */
+	double last_poll;
+	/*! Requests of the current poll outstanding, and whether one of
+	 * them failed. */
+	int pending;
+	int failed;
+	/*! The current poll was taken from the quiet or the failing queue. */
+	int urgent;
+	/*! Held by the camera table and by each outstanding request. */
+	int refs;
+	/*! Due queue it waits in plus one, 0 if none. */
+	int queued;
+	int removed;
+	/*! Fires when the next poll is due. */
+	struct CCTvTimer timer;
+	/*! Next camera in the same bucket. */
+	struct CCTvPollCamera *next;
+	/*! Due queue links. */
+	struct CCTvPollCamera *qnext;
+	struct CCTvPollCamera *qprev;
+};
+
+/*! A request picked by the pacer, sent once the lock is released. */
+struct CCTvPollSend {
+	struct CCTvPollCamera *camera;
+	const char *varName;
+};
+
+/*! Guards everything below. */
+static ithread_mutex_t PollMutex;
+static int PollRunning;
+static struct CCTvTimerWheel *PollWheel;
+static struct CCTvPollConfig PollConfig = {
+	1,
+	CCTV_POLL_MIN_MS,
+	CCTV_POLL_MAX_MS,
+	CCTV_POLL_QUIET_MS,
+	CCTV_POLL_RATE,
+	CCTV_POLL_MAX_INFLIGHT
+};
+static const char **PollVars;
+static int PollVarCount;
+static CCTvPollSendFn PollSend;
+static struct CCTvPollCamera *PollBuckets[CCTV_POLL_BUCKETS];
+/*! Due queues, oldest first. */
+static struct CCTvPollCamera *PollHead[CCTV_POLL_QUEUES];
+static struct CCTvPollCamera *PollTail[CCTV_POLL_QUEUES];
+/*! Requests outstanding to quiet or failing cameras. A hung camera keeps
+ * them until they time out, so they may take only half of the in-flight
+ * limit, and the polls of the other cameras go on. */
+static int PollUrgentInflight;
+/*! Drains the due queue, pending while it is not empty. */
+static struct CCTvTimer PollPacer;
+/*! Token bucket of the rate limit. */
+static double PollTokens;
+static double PollRefilled;
+static struct CCTvPollStats PollStats;
+
+static double CCTvPollNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static struct CCTvPollCamera **CCTvPollLookup(const char *UDN)
+{
+	struct CCTvPollCamera **pcam;
+	unsigned int hash = CCTvRegistryHash(UDN);
+
+	pcam = &PollBuckets[hash & (CCTV_POLL_BUCKETS - 1)];
+	while (*pcam && ((*pcam)->hash != hash ||
+		strcmp((*pcam)->UDN, UDN) != 0))
+		pcam = &(*pcam)->next;
+
+	return pcam;
+}
+
+static void CCTvPollFree(struct CCTvPollCamera *camera)
+{
+	free(camera->UDN);
+	free(camera->controlURL);
+	free(camera);
+}
+
+static long CCTvPollClamp(long interval)
+{
+	if (interval > PollConfig.max_ms)
+		interval = PollConfig.max_ms;
+	if (interval < PollConfig.min_ms)
+		interval = PollConfig.min_ms;
+
+	return interval;
+}
+
+static void CCTvPollEnqueue(struct CCTvPollCamera *camera,
+	enum CCTvPollQueue q)
+{
+	camera->qprev = PollTail[q];
+	if (PollTail[q])
+		PollTail[q]->qnext = camera;
+	else
+		PollHead[q] = camera;
+	PollTail[q] = camera;
+	camera->queued = (int)q + 1;
+	if (++PollStats.queued > PollStats.queued_peak)
+		PollStats.queued_peak = PollStats.queued;
+}
+
+static void CCTvPollDequeue(struct CCTvPollCamera *camera)
+{
+	int q = camera->queued - 1;
+
+	if (!camera->queued)
+		return;
+	if (camera->qprev)
+		camera->qprev->qnext = camera->qnext;
+	else
+		PollHead[q] = camera->qnext;
+	if (camera->qnext)
+		camera->qnext->qprev = camera->qprev;
+	else
+		PollTail[q] = camera->qprev;
+	camera->qnext = camera->qprev = NULL;
+	camera->queued = 0;
+	PollStats.queued--;
+}
+
+/*!
+ * \brief Next camera to poll, NULL if none is due or may be polled now.
+ * Called with the lock held.
+ */
+static struct CCTvPollCamera *CCTvPollFirst(void)
+{
+	if (PollStats.inflight + PollVarCount > PollConfig.max_inflight)
+		return NULL;
+	if (PollUrgentInflight + PollVarCount <=
+	    (PollConfig.max_inflight + 1) / 2) {
+		if (PollHead[CCTV_POLL_URGENT])
+			return PollHead[CCTV_POLL_URGENT];
+		if (PollHead[CCTV_POLL_FAILING])
+			return PollHead[CCTV_POLL_FAILING];
+	}
+
+	return PollHead[CCTV_POLL_ROUTINE];
+}
+
+/*!
+ * \brief Arm the pacer unless it is pending or has nothing to do. Called
+ * with the lock held.
+ */
+static void CCTvPollKick(void)
+{
+	if (CCTvPollFirst() && CCTvTimerRemaining(PollWheel, &PollPacer) < 0)
+		CCTvTimerArm(PollWheel, &PollPacer, PollWheel->tick_ms);
+}
+
+/*!
+ * \brief Camera timer callback: the next poll is due, or the camera may
+ * have gone quiet. The camera is not freed while this runs,
+ * CCTvPollRemove() waits for it.
+ */
+static void CCTvPollDue(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvPollCamera *camera = (struct CCTvPollCamera *)arg;
+	double now;
+	double quiet_in;
+	double poll_in;
+	int active;
+
+	ithread_mutex_lock(&PollMutex);
+	if (!PollRunning || camera->removed || camera->pending ||
+	    camera->queued == CCTV_POLL_URGENT + 1 ||
+	    camera->queued == CCTV_POLL_FAILING + 1) {
+		ithread_mutex_unlock(&PollMutex);
+		return;
+	}
+	if (!PollConfig.enabled) {
+		/* keep the schedule, to pick it up when enabled again */
+		CCTvTimerArm(PollWheel, &camera->timer, camera->interval);
+		ithread_mutex_unlock(&PollMutex);
+		return;
+	}
+	now = CCTvPollNow();
+	quiet_in = camera->last_event + PollConfig.quiet_ms - now;
+	poll_in = camera->last_poll + camera->interval - now;
+	active = camera->last_event > 0 && quiet_in > 0;
+	if (camera->queued) {
+		/* waiting behind others, which is fine until it turns quiet */
+		if (active) {
+			CCTvTimerArm(PollWheel, &camera->timer,
+				(long)quiet_in + 1);
+		} else {
+			CCTvPollDequeue(camera);
+			CCTvPollEnqueue(camera, CCTV_POLL_URGENT);
+			CCTvPollKick();
+		}
+	} else if (active && !camera->failed && poll_in >= 1) {
+		/* not due yet, look again when it would turn quiet */
+		CCTvTimerArm(PollWheel, &camera->timer,
+			(long)(poll_in < quiet_in ? poll_in : quiet_in) + 1);
+	} else {
+		if (camera->failed) {
+			CCTvPollEnqueue(camera, CCTV_POLL_FAILING);
+		} else if (active) {
+			CCTvPollEnqueue(camera, CCTV_POLL_ROUTINE);
+			CCTvTimerArm(PollWheel, &camera->timer,
+				(long)quiet_in + 1);
+		} else {
+			CCTvPollEnqueue(camera, CCTV_POLL_URGENT);
+		}
+		CCTvPollKick();
+	}
+	ithread_mutex_unlock(&PollMutex);
+	timer = timer;
+}
+
+/*!
+ * \brief Account for the completion of a request. Called with the lock
+ * held.
+ *
+ * \return The camera if it must be freed by the caller, NULL otherwise.
+ */
+static struct CCTvPollCamera *CCTvPollDone(struct CCTvPollCamera *camera,
+	int ok)
+{
+	double now;
+	double quiet_in;
+	int active;
+
+	PollStats.inflight--;
+	if (camera->urgent)
+		PollUrgentInflight--;
+	if (!ok) {
+		PollStats.failed++;
+		camera->failed = 1;
+	}
+	if (--camera->pending == 0 && !camera->removed && PollRunning) {
+		now = CCTvPollNow();
+		camera->last_poll = now;
+		active = camera->last_event > 0 &&
+			now - camera->last_event < PollConfig.quiet_ms;
+		/*
+		 * A camera that keeps talking needs no watching, and one that
+		 * does not answer is left to the recovery engine, which hears
+		 * of the failure from the control point.
+		 */
+		if (active || camera->failed)
+			camera->interval = CCTvPollClamp(camera->interval * 2);
+		else
+			camera->interval = CCTvPollClamp(camera->interval / 2);
+		quiet_in = camera->last_event + PollConfig.quiet_ms - now;
+		/* look again when it would turn quiet, see CCTvPollDue() */
+		CCTvTimerArm(PollWheel, &camera->timer, active &&
+			quiet_in < camera->interval ? (long)quiet_in + 1 :
+			camera->interval);
+	}
+	CCTvPollKick();
+
+	return --camera->refs == 0 ? camera : NULL;
+}
+
+/*!
+ * \brief Pacer callback: send due polls as far as the rate and the
+ * in-flight limit allow.
+ */
+static void CCTvPollPace(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvPollSend sends[CCTV_POLL_BATCH];
+	struct CCTvPollCamera *camera;
+	struct CCTvPollCamera *dead;
+	double now;
+	double burst;
+	int n = 0;
+	int rc;
+	int v;
+	int i;
+
+	ithread_mutex_lock(&PollMutex);
+	if (!PollRunning) {
+		ithread_mutex_unlock(&PollMutex);
+		return;
+	}
+	now = CCTvPollNow();
+	/*
+	 * At most a couple of ticks' worth at once, so the load stays smooth;
+	 * the pacer runs every tick or a little later.
+	 */
+	burst = (double)PollConfig.rate * 2 * PollWheel->tick_ms / 1000.0;
+	if (burst < PollVarCount)
+		burst = PollVarCount;
+	PollTokens += (now - PollRefilled) * PollConfig.rate / 1000.0;
+	if (PollTokens > burst)
+		PollTokens = burst;
+	PollRefilled = now;
+	while ((camera = CCTvPollFirst()) && PollTokens >= PollVarCount &&
+	       n + PollVarCount <= CCTV_POLL_BATCH) {
+		camera->urgent = camera->queued != CCTV_POLL_ROUTINE + 1;
+		CCTvPollDequeue(camera);
+		PollTokens -= PollVarCount;
+		PollStats.polls++;
+		camera->failed = 0;
+		for (v = 0; v < PollVarCount; v++) {
+			camera->pending++;
+			camera->refs++;
+			PollStats.inflight++;
+			if (camera->urgent)
+				PollUrgentInflight++;
+			sends[n].camera = camera;
+			sends[n].varName = PollVars[v];
+			n++;
+		}
+		if (PollStats.inflight > PollStats.inflight_peak)
+			PollStats.inflight_peak = PollStats.inflight;
+	}
+	PollStats.requests += (unsigned long)n;
+	CCTvPollKick();
+	ithread_mutex_unlock(&PollMutex);
+
+	for (i = 0; i < n; i++) {
+		/* the request holds a reference, so the URL stays valid */
+		rc = PollSend(sends[i].camera->controlURL, sends[i].varName,
+			sends[i].camera);
+		if (rc != UPNP_E_SUCCESS) {
+			ithread_mutex_lock(&PollMutex);
+			dead = CCTvPollDone(sends[i].camera, 0);
+			ithread_mutex_unlock(&PollMutex);
+			if (dead)
+				CCTvPollFree(dead);
+		}
+	}
+	timer = timer;
+	arg = arg;
+}
+
+int CCTvPollStart(struct CCTvTimerWheel *wheel,
+	const struct CCTvPollConfig *config, const char **varNames, int nvars,
+	CCTvPollSendFn send)
+{
+	if (nvars <= 0 || nvars > CCTV_POLL_MAX_VARS)
+		return CCTV_ERROR;
+	if (config && config->min_ms > config->max_ms)
+		return CCTV_ERROR;
+	ithread_mutex_init(&PollMutex, 0);
+	PollWheel = wheel;
+	if (config)
+		PollConfig = *config;
+	PollVars = varNames;
+	PollVarCount = nvars;
+	PollSend = send;
+	memset(&PollStats, 0, sizeof PollStats);
+	PollUrgentInflight = 0;
+	PollTokens = 0;
+	PollRefilled = CCTvPollNow();
+	CCTvTimerInit(&PollPacer, CCTvPollPace, NULL);
+	PollRunning = 1;
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvPollStop(void)
+{
+	struct CCTvPollCamera *list = NULL;
+	struct CCTvPollCamera *camera;
+	int free_it;
+	int i;
+
+	ithread_mutex_lock(&PollMutex);
+	if (!PollRunning) {
+		ithread_mutex_unlock(&PollMutex);
+		return;
+	}
+	PollRunning = 0;
+	for (i = 0; i < CCTV_POLL_BUCKETS; i++) {
+		while ((camera = PollBuckets[i])) {
+			PollBuckets[i] = camera->next;
+			CCTvPollDequeue(camera);
+			camera->removed = 1;
+			camera->next = list;
+			list = camera;
+		}
+	}
+	PollStats.cameras = 0;
+	ithread_mutex_unlock(&PollMutex);
+
+	CCTvTimerCancel(PollWheel, &PollPacer);
+	while ((camera = list)) {
+		list = camera->next;
+		CCTvTimerCancel(PollWheel, &camera->timer);
+		ithread_mutex_lock(&PollMutex);
+		free_it = --camera->refs == 0;
+		ithread_mutex_unlock(&PollMutex);
+		if (free_it)
+			CCTvPollFree(camera);
+	}
+}
+
+int CCTvPollAdd(const char *UDN, const char *controlURL)
+{
+	struct CCTvPollCamera **pcam;
+	struct CCTvPollCamera *camera;
+
+	ithread_mutex_lock(&PollMutex);
+	if (!PollRunning) {
+		ithread_mutex_unlock(&PollMutex);
+		return CCTV_ERROR;
+	}
+	pcam = CCTvPollLookup(UDN);
+	if (*pcam) {
+		ithread_mutex_unlock(&PollMutex);
+		return CCTV_SUCCESS;
+	}
+	camera = (struct CCTvPollCamera *)calloc(1, sizeof *camera);
+	if (camera) {
+		camera->UDN = strdup(UDN);
+		camera->controlURL = strdup(controlURL);
+	}
+	if (!camera || !camera->UDN || !camera->controlURL) {
+		ithread_mutex_unlock(&PollMutex);
+		if (camera)
+			CCTvPollFree(camera);
+		return CCTV_ERROR;
+	}
+	camera->hash = CCTvRegistryHash(UDN);
+	camera->refs = 1;
+	/* nothing heard from it yet, so watch it closely */
+	camera->interval = PollConfig.min_ms;
+	CCTvTimerInit(&camera->timer, CCTvPollDue, camera);
+	*pcam = camera;
+	PollStats.cameras++;
+	CCTvTimerArm(PollWheel, &camera->timer,
+		(long)(camera->hash % (unsigned int)(camera->interval + 1)));
+	ithread_mutex_unlock(&PollMutex);
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvPollRemove(const char *UDN)
+{
+	struct CCTvPollCamera **pcam;
+	struct CCTvPollCamera *camera;
+	int free_it;
+
+	ithread_mutex_lock(&PollMutex);
+	pcam = PollRunning ? CCTvPollLookup(UDN) : NULL;
+	camera = pcam ? *pcam : NULL;
+	if (camera) {
+		*pcam = camera->next;
+		CCTvPollDequeue(camera);
+		camera->removed = 1;
+		PollStats.cameras--;
+	}
+	ithread_mutex_unlock(&PollMutex);
+	if (!camera)
+		return;
+
+	/* outstanding requests keep it alive until they complete */
+	CCTvTimerCancel(PollWheel, &camera->timer);
+	ithread_mutex_lock(&PollMutex);
+	free_it = --camera->refs == 0;
+	ithread_mutex_unlock(&PollMutex);
+	if (free_it)
+		CCTvPollFree(camera);
+}
+
+void CCTvPollEvent(const char *UDN)
+{
+	struct CCTvPollCamera **pcam;
+
+	ithread_mutex_lock(&PollMutex);
+	if (PollRunning) {
+		pcam = CCTvPollLookup(UDN);
+		if (*pcam)
+			(*pcam)->last_event = CCTvPollNow();
+	}
+	ithread_mutex_unlock(&PollMutex);
+}
+
+void CCTvPollComplete(void *cookie, int errCode)
+{
+	struct CCTvPollCamera *dead;
+
+	ithread_mutex_lock(&PollMutex);
+	dead = CCTvPollDone((struct CCTvPollCamera *)cookie,
+		errCode == UPNP_E_SUCCESS);
+	ithread_mutex_unlock(&PollMutex);
+	if (dead)
+		CCTvPollFree(dead);
+}
+
+int CCTvPollSet(const char *name, int value)
+{
+	int *field = NULL;
+
+	if (value < 0)
+		return CCTV_ERROR;
+	ithread_mutex_lock(&PollMutex);
+	if (strcmp(name, "enabled") == 0)
+		field = &PollConfig.enabled;
+	else if (strcmp(name, "min_ms") == 0 && value > 0 &&
+		 value <= PollConfig.max_ms)
+		field = &PollConfig.min_ms;
+	else if (strcmp(name, "max_ms") == 0 && value > 0 &&
+		 value >= PollConfig.min_ms)
+		field = &PollConfig.max_ms;
+	else if (strcmp(name, "quiet_ms") == 0)
+		field = &PollConfig.quiet_ms;
+	else if (strcmp(name, "rate") == 0 && value > 0)
+		field = &PollConfig.rate;
+	else if (strcmp(name, "max_inflight") == 0 && value >= PollVarCount)
+		field = &PollConfig.max_inflight;
+	if (field)
+		*field = value;
+	/* the queue may be drained faster now */
+	if (PollRunning)
+		CCTvPollKick();
+	ithread_mutex_unlock(&PollMutex);
+
+	return field ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+void CCTvPollGetStats(struct CCTvPollStats *stats)
+{
+	struct CCTvPollCamera *camera;
+	int i;
+
+	ithread_mutex_lock(&PollMutex);
+	*stats = PollStats;
+	stats->at_min = 0;
+	stats->at_max = 0;
+	for (i = 0; i < CCTV_POLL_BUCKETS; i++) {
+		for (camera = PollBuckets[i]; camera; camera = camera->next) {
+			if (camera->interval <= PollConfig.min_ms)
+				stats->at_min++;
+			else if (camera->interval >= PollConfig.max_ms)
+				stats->at_max++;
+		}
+	}
+	ithread_mutex_unlock(&PollMutex);
+}
+
+void CCTvPollPrintStats(void)
+{
+	struct CCTvPollStats stats;
+	struct CCTvPollConfig config;
+
+	CCTvPollGetStats(&stats);
+	ithread_mutex_lock(&PollMutex);
+	config = PollConfig;
+	ithread_mutex_unlock(&PollMutex);
+	SampleUtil_Print(
+		"Polling (%s):\n"
+		"    +- Cameras        = %lu, %lu at %d ms, %lu at %d ms\n"
+		"    +- Polls          = %lu\n"
+		"    +- Requests       = %lu, %lu failed\n"
+		"    +- In flight      = %d, at most %d\n"
+		"    +- Queued         = %lu, at most %lu\n"
+		"    +- Thresholds     = min_ms %d, max_ms %d, quiet_ms %d, "
+		"rate %d, max_inflight %d\n",
+		config.enabled ? "enabled" : "disabled",
+		stats.cameras,
+		stats.at_min, config.min_ms,
+		stats.at_max, config.max_ms,
+		stats.polls,
+		stats.requests, stats.failed,
+		stats.inflight, stats.inflight_peak,
+		stats.queued, stats.queued_peak,
+		config.min_ms, config.max_ms, config.quiet_ms,
+		config.rate, config.max_inflight);
+}
+
+/*! @} Control Point Fleet Polling */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,205 @@
+#ifndef UPNP_CCTV_POLL_H
+#define UPNP_CCTV_POLL_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Fleet Polling
+ *
+ * @{
+ *
+ * \file
+ *
+ * Queries the state variables of every camera in the background, so that a
+ * camera that stopped working without a word is noticed even if nobody
+ * sends it anything.
+ *
+ * Each camera has its own poll interval. A camera whose events keep coming
+ * is evidently alive, and its interval doubles up to max_ms; a camera that
+ * has sent no event for quiet_ms has it halved down to min_ms, and is
+ * polled at once when it turns quiet rather than at the end of its
+ * interval. A camera whose poll failed backs off like a talking one: the
+ * control point reports the failure to the recovery engine, which takes
+ * it from there.
+ *
+ * Due polls wait in queues, quiet cameras first, then failing ones, then
+ * the others, which are drained at no more than rate requests per second
+ * with no more than max_inflight requests outstanding, so the load on the
+ * network stays flat however large the fleet grows. Quiet and failing
+ * cameras may take only half of max_inflight, since a hung one holds its
+ * requests until they time out. With too many cameras for the rate, the polls of
+ * cameras sending events simply come later.
+ *
+ * Requests carry a cookie, which the control point callback hands back to
+ * CCTvPollComplete() with the outcome.
+ */
+
+#include "cctv_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Shortest poll interval, for quiet or failing cameras, in ms. */
+#define CCTV_POLL_MIN_MS 15000
+
+/*! Longest poll interval, for cameras sending events, in ms. */
+#define CCTV_POLL_MAX_MS 300000
+
+/*! Time without an event after which a camera is quiet, in ms. */
+#define CCTV_POLL_QUIET_MS 120000
+
+/*! Requests per second, over the whole fleet. */
+#define CCTV_POLL_RATE 20
+
+/*! Requests outstanding at most, over the whole fleet. */
+#define CCTV_POLL_MAX_INFLIGHT 32
+
+/*! Most variables polled per camera. */
+#define CCTV_POLL_MAX_VARS 4
+
+/*!
+ * \brief Send one state variable query asynchronously. Its completion must
+ * be reported with CCTvPollComplete(), passing cookie.
+ *
+ * \return UPNP_E_SUCCESS, or an UPnP error code if the request was not sent
+ * and no completion will follow.
+ */
+typedef int (*CCTvPollSendFn)(
+	/*! [in] Control URL of the camera. */
+	const char *controlURL,
+	/*! [in] Variable name. */
+	const char *varName,
+	/*! [in] Cookie to complete the request with. */
+	void *cookie);
+
+/*! Thresholds, all changeable at run time. */
+struct CCTvPollConfig {
+	/*! Poll at all. */
+	int enabled;
+	int min_ms;
+	int max_ms;
+	int quiet_ms;
+	int rate;
+	int max_inflight;
+};
+
+/*! Counters of the poller. */
+struct CCTvPollStats {
+	/*! Cameras polled. */
+	unsigned long cameras;
+	/*! Polls made, one per camera and round. */
+	unsigned long polls;
+	/*! Requests sent and failed. */
+	unsigned long requests;
+	unsigned long failed;
+	/*! Requests outstanding now and at most. */
+	int inflight;
+	int inflight_peak;
+	/*! Polls due but waiting for the rate or the in-flight limit, now
+	 * and at most. */
+	unsigned long queued;
+	unsigned long queued_peak;
+	/*! Cameras at the shortest and the longest interval. */
+	unsigned long at_min;
+	unsigned long at_max;
+};
+
+/*!
+ * \brief Start the module.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if nvars is out of range or
+ * min_ms is above max_ms.
+ */
+int CCTvPollStart(
+	/*! [in] Running timer wheel the polls are scheduled on. It must
+	 * outlive the module. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in] Thresholds, NULL for the defaults above. */
+	const struct CCTvPollConfig *config,
+	/*! [in] Variables polled on every camera, at most
+	 * CCTV_POLL_MAX_VARS. Not copied. */
+	const char **varNames,
+	/*! [in] Number of variables. */
+	int nvars,
+	/*! [in] Sends the requests, from the timer wheel thread. */
+	CCTvPollSendFn send);
+
+/*!
+ * \brief Stop polling and forget all cameras. Requests in flight still
+ * complete, and are ignored.
+ */
+void CCTvPollStop(void);
+
+/*!
+ * \brief Start polling a camera. Its first poll comes at a point within
+ * one interval that depends on the UDN only, so cameras added together are
+ * not polled together.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if out of memory or stopped.
+ */
+int CCTvPollAdd(
+	/*! [in] Camera UDN. */
+	const char *UDN,
+	/*! [in] Control URL the variables are queried at. */
+	const char *controlURL);
+
+/*!
+ * \brief Stop polling a camera.
+ */
+void CCTvPollRemove(
+	/*! [in] Camera UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Note that an event of a camera was received.
+ */
+void CCTvPollEvent(
+	/*! [in] Camera UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Report the completion of a request sent by the poller.
+ */
+void CCTvPollComplete(
+	/*! [in] Cookie the request was sent with. */
+	void *cookie,
+	/*! [in] UPnP error code of the request. */
+	int errCode);
+
+/*!
+ * \brief Change a threshold by the name of its field in
+ * struct CCTvPollConfig. Applies from the next poll of each camera.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the name is unknown or the value
+ * out of range, including a min_ms above max_ms or a max_ms below min_ms.
+ */
+int CCTvPollSet(
+	/*! [in] Field name. */
+	const char *name,
+	/*! [in] Value. */
+	int value);
+
+/*!
+ * \brief Copy the counters.
+ */
+void CCTvPollGetStats(
+	/*! [out] Counters. */
+	struct CCTvPollStats *stats);
+
+/*!
+ * \brief Print the counters and thresholds with SampleUtil_Print().
+ */
+void CCTvPollPrintStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Fleet Polling */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_POLL_H */
@@ -0,0 +1,93 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Event Parsing
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_propset.h"
+
+#include <string.h>
+
+/*!
+ * \brief Name of an element without its namespace prefix.
+ */
+static const char *CCTvPropertyLocalName(IXML_Node *node)
+{
+	const char *name = ixmlNode_getNodeName(node);
+	const char *colon;
+
+	if (!name)
+		return "";
+	colon = strchr(name, ':');
+
+	return colon ? colon + 1 : name;
+}
+
+/*!
+ * \brief First element among a node and its following siblings, skipping
+ * the whitespace between elements.
+ */
+static IXML_Node *CCTvPropertyElement(IXML_Node *node)
+{
+	while (node && ixmlNode_getNodeType(node) != eELEMENT_NODE)
+		node = ixmlNode_getNextSibling(node);
+
+	return node;
+}
+
+int CCTvPropertySetParse(IXML_Document *changes, const char **varNames,
+	int nvars, CCTvPropertyFn found, void *arg)
+{
+	IXML_Node *propertyset;
+	IXML_Node *property;
+	IXML_Node *variable;
+	IXML_Node *text;
+	const char *name;
+	const char *value;
+	int count = 0;
+	int j;
+
+	propertyset = CCTvPropertyElement(
+		ixmlNode_getFirstChild((IXML_Node *)changes));
+	if (!propertyset)
+		return 0;
+	for (property = CCTvPropertyElement(
+		ixmlNode_getFirstChild(propertyset));
+	     property;
+	     property = CCTvPropertyElement(
+		ixmlNode_getNextSibling(property))) {
+		if (strcmp(CCTvPropertyLocalName(property), "property") != 0)
+			continue;
+		for (variable = CCTvPropertyElement(
+			ixmlNode_getFirstChild(property));
+		     variable;
+		     variable = CCTvPropertyElement(
+			ixmlNode_getNextSibling(variable))) {
+			name = CCTvPropertyLocalName(variable);
+			for (j = 0; j < nvars; j++)
+				if (strcmp(varNames[j], name) == 0)
+					break;
+			text = ixmlNode_getFirstChild(variable);
+			if (j == nvars || !text ||
+			    ixmlNode_getNodeType(text) != eTEXT_NODE)
+				continue;
+			value = ixmlNode_getNodeValue(text);
+			if (!value)
+				continue;
+			found(j, value, arg);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/*! @} Control Point Event Parsing */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,72 @@
+#ifndef UPNP_CCTV_PROPSET_H
+#define UPNP_CCTV_PROPSET_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Event Parsing
+ *
+ * @{
+ *
+ * \file
+ *
+ * Pulls the variables out of the property set of a GENA NOTIFY:
+ *
+ *     <e:propertyset xmlns:e="urn:schemas-upnp-org:event-1-0">
+ *       <e:property><Temperature>41</Temperature></e:property>
+ *       ...
+ *     </e:propertyset>
+ *
+ * libupnp hands the control point the body already parsed, so this walks
+ * the tree once along its child and sibling links: no node lists are
+ * built, and values are passed on in place rather than copied.
+ */
+
+#include "ixml.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * \brief Called for each known variable in a property set.
+ */
+typedef void (*CCTvPropertyFn)(
+	/*! [in] Index of the variable in the names given to
+	 * CCTvPropertySetParse(). */
+	int var,
+	/*! [in] Its value, only valid during the call. */
+	const char *value,
+	/*! [in] Argument given to CCTvPropertySetParse(). */
+	void *arg);
+
+/*!
+ * \brief Report the known variables of a property set, in document order.
+ * Unknown variables and variables without a value are skipped. Allocates
+ * nothing.
+ *
+ * \return The number of variables reported.
+ */
+int CCTvPropertySetParse(
+	/*! [in] Property set received with the event. */
+	IXML_Document *changes,
+	/*! [in] Names of the known variables. */
+	const char **varNames,
+	/*! [in] Number of names. */
+	int nvars,
+	/*! [in] Receives the variables. */
+	CCTvPropertyFn found,
+	/*! [in] Argument of found. */
+	void *arg);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Event Parsing */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_PROPSET_H */
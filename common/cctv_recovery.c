@@ -0,0 +1,743 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Camera Recovery
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_recovery.h"
+
+#include "cctv_ctrlpt.h"
+#include "cctv_metrics.h"
+#include "cctv_registry.h"
+#include "sample_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*! Number of hash buckets, a power of two. */
+#define CCTV_RECOVERY_BUCKETS 1024
+
+/*! A camera that has been seen failing. */
+struct CCTvRecovery {
+	char *UDN;
+	unsigned int hash;
+	enum CCTvRecoveryState state;
+	/*! Failed requests in a row. */
+	int failures;
+	/*! Reboots sent in the current incident. */
+	int reboots;
+	/*! When the current incident began, the state was entered. */
+	double since;
+	double entered;
+	/*! Fires when the current state times out. */
+	struct CCTvTimer timer;
+	/*! Next camera in the same bucket. */
+	struct CCTvRecovery *next;
+};
+
+/*! What to do once the lock is released. */
+enum CCTvRecoveryAction {
+	CCTV_RECOVERY_NOTHING = 0,
+	CCTV_RECOVERY_PROBE,
+	CCTV_RECOVERY_REBOOT,
+	CCTV_RECOVERY_ESCALATE
+};
+
+/*! A transition, copied out of the lock to be acted on and printed. */
+struct CCTvRecoveryStep {
+	enum CCTvRecoveryAction action;
+	enum CCTvRecoveryState from;
+	enum CCTvRecoveryState to;
+	int reboots;
+	char UDN[NAME_SIZE];
+};
+
+static const char *CCTvRecoveryStateNames[CCTV_RECOVERY_STATES] = {
+	"healthy",
+	"suspect",
+	"rebooting",
+	"awaiting",
+	"verified",
+	"escalated"
+};
+
+/*! Guards everything below. */
+static ithread_mutex_t RecoveryMutex;
+static int RecoveryRunning;
+static struct CCTvTimerWheel *RecoveryWheel;
+static struct CCTvRecoveryConfig RecoveryConfig = {
+	1,
+	CCTV_RECOVERY_SUSPECT_FAILURES,
+	CCTV_RECOVERY_PROBE_MS,
+	CCTV_RECOVERY_REBOOT_MS,
+	CCTV_RECOVERY_BOOT_MS,
+	CCTV_RECOVERY_VERIFY_MS,
+	CCTV_RECOVERY_MAX_REBOOTS
+};
+static struct CCTvRecoveryOps RecoveryOps;
+static struct CCTvRecoveryStats RecoveryStats;
+static struct CCTvRecovery *RecoveryBuckets[CCTV_RECOVERY_BUCKETS];
+
+/*! Time to recover, lock-free and kept across restarts of the module. */
+static struct CCTvHistogram RecoveryLatency;
+static struct CCTvMetric RecoveryMetrics[] = {
+	CCTV_METRIC_HISTOGRAM_INIT("cctv_ctrlpt_recovery_seconds",
+		"Time from a camera turning suspect until it was verified back.",
+		&RecoveryLatency)
+};
+
+static double CCTvRecoveryNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static struct CCTvRecovery *CCTvRecoveryLookup(const char *UDN)
+{
+	struct CCTvRecovery *rec;
+	unsigned int hash = CCTvRegistryHash(UDN);
+
+	rec = RecoveryBuckets[hash & (CCTV_RECOVERY_BUCKETS - 1)];
+	while (rec && (rec->hash != hash || strcmp(rec->UDN, UDN) != 0))
+		rec = rec->next;
+
+	return rec;
+}
+
+static void CCTvRecoveryTimeout(struct CCTvTimer *timer, void *arg);
+
+static struct CCTvRecovery *CCTvRecoveryCreate(const char *UDN)
+{
+	struct CCTvRecovery *rec;
+	unsigned int bucket;
+
+	rec = (struct CCTvRecovery *)calloc(1, sizeof *rec);
+	if (!rec)
+		return NULL;
+	rec->UDN = strdup(UDN);
+	if (!rec->UDN) {
+		free(rec);
+		return NULL;
+	}
+	rec->hash = CCTvRegistryHash(UDN);
+	rec->state = CCTV_RECOVERY_HEALTHY;
+	rec->entered = CCTvRecoveryNow();
+	CCTvTimerInit(&rec->timer, CCTvRecoveryTimeout, rec);
+	bucket = rec->hash & (CCTV_RECOVERY_BUCKETS - 1);
+	rec->next = RecoveryBuckets[bucket];
+	RecoveryBuckets[bucket] = rec;
+	RecoveryStats.state[CCTV_RECOVERY_HEALTHY]++;
+
+	return rec;
+}
+
+/*!
+ * \brief Move a camera to a state, timing out after timeout_ms unless
+ * negative. Called with the lock held.
+ */
+static void CCTvRecoveryEnter(struct CCTvRecovery *rec,
+	enum CCTvRecoveryState state, long timeout_ms,
+	enum CCTvRecoveryAction action, struct CCTvRecoveryStep *step)
+{
+	step->action = action;
+	step->from = rec->state;
+	step->to = state;
+	step->reboots = rec->reboots;
+	strncpy(step->UDN, rec->UDN, sizeof step->UDN - 1);
+	step->UDN[sizeof step->UDN - 1] = '\0';
+
+	RecoveryStats.state[rec->state]--;
+	RecoveryStats.state[state]++;
+	rec->state = state;
+	rec->entered = CCTvRecoveryNow();
+	if (timeout_ms >= 0)
+		CCTvTimerArm(RecoveryWheel, &rec->timer, timeout_ms);
+	else
+		CCTvTimerDel(RecoveryWheel, &rec->timer);
+}
+
+/*!
+ * \brief Reboot a camera again, or give up on it. Called with the lock
+ * held.
+ */
+static void CCTvRecoveryRetry(struct CCTvRecovery *rec,
+	struct CCTvRecoveryStep *step)
+{
+	if (RecoveryConfig.enabled && rec->reboots < RecoveryConfig.max_reboots) {
+		rec->reboots++;
+		RecoveryStats.reboots++;
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_REBOOTING,
+			RecoveryConfig.reboot_ms, CCTV_RECOVERY_REBOOT, step);
+	} else {
+		RecoveryStats.escalations++;
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_ESCALATED, -1,
+			CCTV_RECOVERY_ESCALATE, step);
+	}
+}
+
+/*!
+ * \brief Mark a camera as back. Called with the lock held.
+ */
+static void CCTvRecoveryVerify(struct CCTvRecovery *rec,
+	struct CCTvRecoveryStep *step)
+{
+	double elapsed = CCTvRecoveryNow() - rec->since;
+
+	if (rec->state != CCTV_RECOVERY_ESCALATED) {
+		RecoveryStats.recoveries++;
+		RecoveryStats.recovery_ms += elapsed;
+		if (elapsed > RecoveryStats.recovery_max_ms)
+			RecoveryStats.recovery_max_ms = elapsed;
+		CCTvMetricsObserve(&RecoveryMetrics[0],
+			(unsigned long)(elapsed * 1e3));
+	}
+	rec->failures = 0;
+	CCTvRecoveryEnter(rec, CCTV_RECOVERY_VERIFIED,
+		RecoveryConfig.verify_ms, CCTV_RECOVERY_NOTHING, step);
+}
+
+/*!
+ * \brief Act on a transition and print it. Called without the lock, so
+ * the record may be gone by now; the step holds all it needs.
+ */
+static void CCTvRecoveryAct(const struct CCTvRecoveryStep *step)
+{
+	struct CCTvRecovery *rec;
+	int rc;
+
+	if (step->from == step->to && step->action == CCTV_RECOVERY_NOTHING)
+		return;
+	SampleUtil_Print("Recovery: %s %s -> %s\n", step->UDN,
+		CCTvRecoveryStateNames[step->from],
+		CCTvRecoveryStateNames[step->to]);
+	if (step->from != step->to && RecoveryOps.changed)
+		RecoveryOps.changed(step->UDN);
+	switch (step->action) {
+	case CCTV_RECOVERY_PROBE:
+		if (RecoveryOps.probe)
+			RecoveryOps.probe(step->UDN);
+		break;
+	case CCTV_RECOVERY_REBOOT:
+		SampleUtil_Print("Recovery: sending %s to %s, attempt %d\n",
+			CCTV_RECOVERY_ACTION, step->UDN, step->reboots);
+		rc = RecoveryOps.reboot ? RecoveryOps.reboot(step->UDN) :
+			CCTV_ERROR;
+		if (rc != CCTV_SUCCESS) {
+			/* try again soon rather than wait for a boot */
+			ithread_mutex_lock(&RecoveryMutex);
+			rec = RecoveryRunning ?
+				CCTvRecoveryLookup(step->UDN) : NULL;
+			if (rec && rec->state == CCTV_RECOVERY_REBOOTING)
+				CCTvTimerArm(RecoveryWheel, &rec->timer,
+					RecoveryConfig.probe_ms);
+			ithread_mutex_unlock(&RecoveryMutex);
+		}
+		break;
+	case CCTV_RECOVERY_ESCALATE:
+		SampleUtil_Print("Recovery: %s not recovered after %d "
+			"reboots, needs an operator\n", step->UDN,
+			step->reboots);
+		if (RecoveryOps.escalate)
+			RecoveryOps.escalate(step->UDN, step->reboots);
+		break;
+	default:
+		break;
+	}
+}
+
+/*!
+ * \brief State timer callback. Records are only freed by
+ * CCTvRecoveryRemove() and CCTvRecoveryStop(), which unlink them first
+ * and wait for it.
+ */
+static void CCTvRecoveryTimeout(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvRecovery *rec = (struct CCTvRecovery *)arg;
+	struct CCTvRecoveryStep step;
+
+	memset(&step, 0, sizeof step);
+	ithread_mutex_lock(&RecoveryMutex);
+	/* re-armed by a transition while on its way, or being removed */
+	if (!RecoveryRunning ||
+	    CCTvTimerRemaining(RecoveryWheel, timer) >= 0 ||
+	    CCTvRecoveryLookup(rec->UDN) != rec) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	switch (rec->state) {
+	case CCTV_RECOVERY_SUSPECT:
+	case CCTV_RECOVERY_REBOOTING:
+	case CCTV_RECOVERY_AWAITING:
+		CCTvRecoveryRetry(rec, &step);
+		break;
+	case CCTV_RECOVERY_VERIFIED:
+		rec->failures = 0;
+		rec->reboots = 0;
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_HEALTHY, -1,
+			CCTV_RECOVERY_NOTHING, &step);
+		break;
+	default:
+		break;
+	}
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvRecoveryAct(&step);
+}
+
+int CCTvRecoveryStart(struct CCTvTimerWheel *wheel,
+	const struct CCTvRecoveryConfig *config,
+	const struct CCTvRecoveryOps *ops)
+{
+	ithread_mutex_init(&RecoveryMutex, 0);
+	CCTvMetricsRegister(RecoveryMetrics,
+		(int)(sizeof RecoveryMetrics / sizeof RecoveryMetrics[0]));
+	RecoveryWheel = wheel;
+	if (config)
+		RecoveryConfig = *config;
+	RecoveryOps = *ops;
+	memset(&RecoveryStats, 0, sizeof RecoveryStats);
+	RecoveryRunning = 1;
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvRecoveryStop(void)
+{
+	struct CCTvRecovery *list = NULL;
+	struct CCTvRecovery *rec;
+	int i;
+
+	ithread_mutex_lock(&RecoveryMutex);
+	if (!RecoveryRunning) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	RecoveryRunning = 0;
+	for (i = 0; i < CCTV_RECOVERY_BUCKETS; i++) {
+		while ((rec = RecoveryBuckets[i])) {
+			RecoveryBuckets[i] = rec->next;
+			rec->next = list;
+			list = rec;
+		}
+	}
+	memset(RecoveryStats.state, 0, sizeof RecoveryStats.state);
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	while ((rec = list)) {
+		list = rec->next;
+		CCTvTimerCancel(RecoveryWheel, &rec->timer);
+		free(rec->UDN);
+		free(rec);
+	}
+}
+
+void CCTvRecoveryRemove(const char *UDN)
+{
+	struct CCTvRecovery **prec;
+	struct CCTvRecovery *rec;
+	unsigned int hash = CCTvRegistryHash(UDN);
+
+	ithread_mutex_lock(&RecoveryMutex);
+	prec = &RecoveryBuckets[hash & (CCTV_RECOVERY_BUCKETS - 1)];
+	while (*prec && ((*prec)->hash != hash ||
+		strcmp((*prec)->UDN, UDN) != 0))
+		prec = &(*prec)->next;
+	rec = *prec;
+	/* a camera being rebooted is expected back */
+	if (!RecoveryRunning || !rec ||
+	    rec->state == CCTV_RECOVERY_REBOOTING ||
+	    rec->state == CCTV_RECOVERY_AWAITING) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	*prec = rec->next;
+	RecoveryStats.state[rec->state]--;
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvTimerCancel(RecoveryWheel, &rec->timer);
+	free(rec->UDN);
+	free(rec);
+}
+
+int CCTvRecoverySet(const char *name, int value)
+{
+	int *field = NULL;
+
+	if (value < 0)
+		return CCTV_ERROR;
+	ithread_mutex_lock(&RecoveryMutex);
+	if (strcmp(name, "enabled") == 0)
+		field = &RecoveryConfig.enabled;
+	else if (strcmp(name, "suspect_failures") == 0)
+		field = &RecoveryConfig.suspect_failures;
+	else if (strcmp(name, "probe_ms") == 0)
+		field = &RecoveryConfig.probe_ms;
+	else if (strcmp(name, "reboot_ms") == 0)
+		field = &RecoveryConfig.reboot_ms;
+	else if (strcmp(name, "boot_ms") == 0)
+		field = &RecoveryConfig.boot_ms;
+	else if (strcmp(name, "verify_ms") == 0)
+		field = &RecoveryConfig.verify_ms;
+	else if (strcmp(name, "max_reboots") == 0)
+		field = &RecoveryConfig.max_reboots;
+	if (field)
+		*field = value;
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	return field ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+void CCTvRecoveryGetConfig(struct CCTvRecoveryConfig *config)
+{
+	ithread_mutex_lock(&RecoveryMutex);
+	*config = RecoveryConfig;
+	ithread_mutex_unlock(&RecoveryMutex);
+}
+
+void CCTvRecoveryReport(const char *UDN, int ok)
+{
+	struct CCTvRecovery *rec;
+	struct CCTvRecoveryStep step;
+
+	memset(&step, 0, sizeof step);
+	ithread_mutex_lock(&RecoveryMutex);
+	if (!RecoveryRunning) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	rec = CCTvRecoveryLookup(UDN);
+	/* cameras never seen failing are not tracked */
+	if (!rec && !ok)
+		rec = CCTvRecoveryCreate(UDN);
+	if (!rec) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	step.from = step.to = rec->state;
+	if (ok) {
+		rec->failures = 0;
+		switch (rec->state) {
+		case CCTV_RECOVERY_SUSPECT:
+			RecoveryStats.false_alarms++;
+			/* fall through */
+		case CCTV_RECOVERY_ESCALATED:
+			rec->reboots = 0;
+			CCTvRecoveryEnter(rec, CCTV_RECOVERY_HEALTHY, -1,
+				CCTV_RECOVERY_NOTHING, &step);
+			break;
+		case CCTV_RECOVERY_AWAITING:
+			/* answering at all once booted is as good as an
+			 * advertisement */
+			if (CCTvRecoveryNow() - rec->entered >=
+			    RecoveryConfig.boot_ms)
+				CCTvRecoveryVerify(rec, &step);
+			break;
+		default:
+			break;
+		}
+	} else if (++rec->failures >= RecoveryConfig.suspect_failures &&
+		   (rec->state == CCTV_RECOVERY_HEALTHY ||
+		    rec->state == CCTV_RECOVERY_VERIFIED)) {
+		/* failing again right after a reboot continues the incident */
+		if (rec->state == CCTV_RECOVERY_HEALTHY) {
+			rec->since = CCTvRecoveryNow();
+			rec->reboots = 0;
+		}
+		RecoveryStats.suspects++;
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_SUSPECT,
+			RecoveryConfig.probe_ms,
+			RecoveryConfig.enabled ? CCTV_RECOVERY_PROBE :
+			CCTV_RECOVERY_NOTHING, &step);
+	}
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvRecoveryAct(&step);
+}
+
+int CCTvRecoveryAnswered(int errCode)
+{
+	return errCode >= UPNP_E_SUCCESS;
+}
+
+void CCTvRecoveryRebootAnswered(const char *UDN, int errCode)
+{
+	struct CCTvRecovery *rec;
+	struct CCTvRecoveryStep step;
+
+	memset(&step, 0, sizeof step);
+	ithread_mutex_lock(&RecoveryMutex);
+	rec = RecoveryRunning ? CCTvRecoveryLookup(UDN) : NULL;
+	if (!rec) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	step.from = step.to = rec->state;
+	/* an unanswered reboot is sent again when the state times out */
+	if (rec->state == CCTV_RECOVERY_REBOOTING && errCode == UPNP_E_SUCCESS)
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_AWAITING,
+			RecoveryConfig.reboot_ms, CCTV_RECOVERY_NOTHING, &step);
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvRecoveryAct(&step);
+}
+
+void CCTvRecoveryAlive(const char *UDN, int added)
+{
+	struct CCTvRecovery *rec;
+	struct CCTvRecoveryStep step;
+
+	memset(&step, 0, sizeof step);
+	ithread_mutex_lock(&RecoveryMutex);
+	rec = RecoveryRunning ? CCTvRecoveryLookup(UDN) : NULL;
+	if (!rec) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	step.from = step.to = rec->state;
+	switch (rec->state) {
+	case CCTV_RECOVERY_AWAITING:
+		/* a periodic advertisement sent just before the reboot does
+		 * not count */
+		if (added || CCTvRecoveryNow() - rec->entered >=
+		    RecoveryConfig.boot_ms)
+			CCTvRecoveryVerify(rec, &step);
+		break;
+	case CCTV_RECOVERY_REBOOTING:
+	case CCTV_RECOVERY_ESCALATED:
+		/* gone and back, without an answer to the reboot */
+		if (added)
+			CCTvRecoveryVerify(rec, &step);
+		break;
+	case CCTV_RECOVERY_SUSPECT:
+		if (added) {
+			rec->failures = 0;
+			RecoveryStats.false_alarms++;
+			CCTvRecoveryEnter(rec, CCTV_RECOVERY_HEALTHY, -1,
+				CCTV_RECOVERY_NOTHING, &step);
+		}
+		break;
+	default:
+		break;
+	}
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvRecoveryAct(&step);
+}
+
+void CCTvRecoveryByebye(const char *UDN)
+{
+	struct CCTvRecovery *rec;
+	struct CCTvRecoveryStep step;
+
+	memset(&step, 0, sizeof step);
+	ithread_mutex_lock(&RecoveryMutex);
+	rec = RecoveryRunning ? CCTvRecoveryLookup(UDN) : NULL;
+	if (!rec) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	step.from = step.to = rec->state;
+	/* a camera leaving on its own is not a failure */
+	if (rec->state == CCTV_RECOVERY_REBOOTING)
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_AWAITING,
+			RecoveryConfig.reboot_ms, CCTV_RECOVERY_NOTHING, &step);
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvRecoveryAct(&step);
+}
+
+void CCTvRecoveryExpired(const char *UDN)
+{
+	struct CCTvRecovery *rec;
+	struct CCTvRecoveryStep step;
+
+	memset(&step, 0, sizeof step);
+	ithread_mutex_lock(&RecoveryMutex);
+	rec = NULL;
+	if (RecoveryRunning) {
+		rec = CCTvRecoveryLookup(UDN);
+		if (!rec)
+			rec = CCTvRecoveryCreate(UDN);
+	}
+	if (!rec) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return;
+	}
+	step.from = step.to = rec->state;
+	switch (rec->state) {
+	case CCTV_RECOVERY_REBOOTING:
+		/* quiet while booting, as expected */
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_AWAITING,
+			RecoveryConfig.reboot_ms, CCTV_RECOVERY_NOTHING, &step);
+		break;
+	case CCTV_RECOVERY_AWAITING:
+	case CCTV_RECOVERY_ESCALATED:
+		break;
+	default:
+		/* out of the device list, nothing to send a reboot to */
+		if (rec->state == CCTV_RECOVERY_HEALTHY)
+			rec->since = CCTvRecoveryNow();
+		RecoveryStats.escalations++;
+		CCTvRecoveryEnter(rec, CCTV_RECOVERY_ESCALATED, -1,
+			CCTV_RECOVERY_ESCALATE, &step);
+		break;
+	}
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvRecoveryAct(&step);
+}
+
+int CCTvRecoveryReset(const char *UDN)
+{
+	struct CCTvRecovery *rec;
+	struct CCTvRecoveryStep step;
+
+	memset(&step, 0, sizeof step);
+	ithread_mutex_lock(&RecoveryMutex);
+	rec = RecoveryRunning ? CCTvRecoveryLookup(UDN) : NULL;
+	if (!rec) {
+		ithread_mutex_unlock(&RecoveryMutex);
+		return CCTV_ERROR;
+	}
+	rec->failures = 0;
+	rec->reboots = 0;
+	CCTvRecoveryEnter(rec, CCTV_RECOVERY_HEALTHY, -1, CCTV_RECOVERY_NOTHING,
+		&step);
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	CCTvRecoveryAct(&step);
+
+	return CCTV_SUCCESS;
+}
+
+enum CCTvRecoveryState CCTvRecoveryGetState(const char *UDN)
+{
+	struct CCTvRecovery *rec;
+	enum CCTvRecoveryState state = CCTV_RECOVERY_HEALTHY;
+
+	ithread_mutex_lock(&RecoveryMutex);
+	rec = RecoveryRunning ? CCTvRecoveryLookup(UDN) : NULL;
+	if (rec)
+		state = rec->state;
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	return state;
+}
+
+const char *CCTvRecoveryStateName(enum CCTvRecoveryState state)
+{
+	if ((int)state < 0 || state >= CCTV_RECOVERY_STATES)
+		return "unknown";
+
+	return CCTvRecoveryStateNames[state];
+}
+
+void CCTvRecoveryGetStats(struct CCTvRecoveryStats *stats)
+{
+	ithread_mutex_lock(&RecoveryMutex);
+	*stats = RecoveryStats;
+	ithread_mutex_unlock(&RecoveryMutex);
+}
+
+void CCTvRecoveryPrint(void)
+{
+	struct CCTvRecoveryStep *steps = NULL;
+	struct CCTvRecovery *rec;
+	double *age = NULL;
+	double now;
+	unsigned long n = 0;
+	unsigned long max;
+	unsigned long i;
+	int b;
+
+	ithread_mutex_lock(&RecoveryMutex);
+	max = RecoveryRunning ? RecoveryStats.state[CCTV_RECOVERY_SUSPECT] +
+		RecoveryStats.state[CCTV_RECOVERY_REBOOTING] +
+		RecoveryStats.state[CCTV_RECOVERY_AWAITING] +
+		RecoveryStats.state[CCTV_RECOVERY_VERIFIED] +
+		RecoveryStats.state[CCTV_RECOVERY_ESCALATED] : 0;
+	if (max) {
+		steps = (struct CCTvRecoveryStep *)malloc(max * sizeof *steps);
+		age = (double *)malloc(max * sizeof *age);
+	}
+	now = CCTvRecoveryNow();
+	for (b = 0; steps && age && b < CCTV_RECOVERY_BUCKETS; b++) {
+		for (rec = RecoveryBuckets[b]; rec && n < max; rec = rec->next) {
+			if (rec->state == CCTV_RECOVERY_HEALTHY)
+				continue;
+			steps[n].to = rec->state;
+			steps[n].reboots = rec->reboots;
+			strncpy(steps[n].UDN, rec->UDN, sizeof steps[n].UDN - 1);
+			steps[n].UDN[sizeof steps[n].UDN - 1] = '\0';
+			age[n] = now - rec->entered;
+			n++;
+		}
+	}
+	ithread_mutex_unlock(&RecoveryMutex);
+
+	SampleUtil_Print("Cameras in recovery:\n");
+	for (i = 0; i < n; i++) {
+		SampleUtil_Print("  %-10s %6.0f s  reboots %d  %s\n",
+			CCTvRecoveryStateNames[steps[i].to], age[i] / 1e3,
+			steps[i].reboots, steps[i].UDN);
+	}
+	if (!n)
+		SampleUtil_Print("  none\n");
+	free(steps);
+	free(age);
+}
+
+void CCTvRecoveryPrintStats(void)
+{
+	struct CCTvRecoveryStats stats;
+	struct CCTvRecoveryConfig config;
+
+	CCTvRecoveryGetStats(&stats);
+	CCTvRecoveryGetConfig(&config);
+	SampleUtil_Print(
+		"Recovery (%s):\n"
+		"    +- Suspects       = %lu\n"
+		"    +- False alarms   = %lu\n"
+		"    +- Reboots sent   = %lu\n"
+		"    +- Recovered      = %lu\n"
+		"    +- Escalated      = %lu\n"
+		"    +- Mean recovery  = %.1f s\n"
+		"    +- Max recovery   = %.1f s\n"
+		"    +- Now suspect    = %lu, rebooting %lu, awaiting %lu, "
+		"verified %lu, escalated %lu\n"
+		"    +- Thresholds     = suspect_failures %d, probe_ms %d, "
+		"reboot_ms %d, boot_ms %d, verify_ms %d, max_reboots %d\n",
+		config.enabled ? "enabled" : "tracking only",
+		stats.suspects,
+		stats.false_alarms,
+		stats.reboots,
+		stats.recoveries,
+		stats.escalations,
+		stats.recoveries ? stats.recovery_ms / stats.recoveries / 1e3 : 0.0,
+		stats.recovery_max_ms / 1e3,
+		stats.state[CCTV_RECOVERY_SUSPECT],
+		stats.state[CCTV_RECOVERY_REBOOTING],
+		stats.state[CCTV_RECOVERY_AWAITING],
+		stats.state[CCTV_RECOVERY_VERIFIED],
+		stats.state[CCTV_RECOVERY_ESCALATED],
+		config.suspect_failures,
+		config.probe_ms,
+		config.reboot_ms,
+		config.boot_ms,
+		config.verify_ms,
+		config.max_reboots);
+}
+
+/*! @} Control Point Camera Recovery */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,292 @@
+#ifndef UPNP_CCTV_RECOVERY_H
+#define UPNP_CCTV_RECOVERY_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Camera Recovery
+ *
+ * @{
+ *
+ * \file
+ *
+ * Reboots hung cameras without waiting for an operator. The control point
+ * reports what it sees of every camera: requests that succeed or fail,
+ * events, advertisements, byebyes and expiries. Each camera goes through
+ *
+ *     healthy -> suspect -> rebooting -> awaiting -> verified -> healthy
+ *
+ * A camera becomes suspect after a number of failures in a row and is
+ * probed. If nothing from it succeeds before the probe times out, Reboot is
+ * sent. Once the reboot is answered or the camera says byebye, it is
+ * awaited; the first advertisement after it has had time to boot verifies
+ * it. A camera that keeps failing for a while after that is suspect again.
+ * If the reboots run out, or the camera vanishes while it was not being
+ * rebooted, it is escalated, and stays so until something from it succeeds
+ * again or an operator resets it.
+ *
+ * The transitions are driven from the control point timer wheel. Probes,
+ * reboots and escalations are made through callbacks, never with the
+ * module lock held.
+ */
+
+#include "cctv_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Failures in a row after which a camera is suspect. */
+#define CCTV_RECOVERY_SUSPECT_FAILURES 3
+
+/*! How long a probe may take, in milliseconds. */
+#define CCTV_RECOVERY_PROBE_MS 10000
+
+/*! How long a camera may take to come back after Reboot was sent, in
+ * milliseconds. */
+#define CCTV_RECOVERY_REBOOT_MS 180000
+
+/*! Time after the reboot was answered before an advertisement counts as
+ * the camera being back, in milliseconds. */
+#define CCTV_RECOVERY_BOOT_MS 10000
+
+/*! How long a rebooted camera is watched before it counts as healthy, in
+ * milliseconds. */
+#define CCTV_RECOVERY_VERIFY_MS 60000
+
+/*! Reboots per incident before escalating. */
+#define CCTV_RECOVERY_MAX_REBOOTS 2
+
+/*! Action the module reboots cameras with. */
+#define CCTV_RECOVERY_ACTION "Reboot"
+
+/*! Recovery state of a camera. */
+enum CCTvRecoveryState {
+	/*! Nothing wrong seen. */
+	CCTV_RECOVERY_HEALTHY = 0,
+	/*! Failed repeatedly, probed. */
+	CCTV_RECOVERY_SUSPECT,
+	/*! Reboot sent, not answered yet. */
+	CCTV_RECOVERY_REBOOTING,
+	/*! Rebooting, waiting for it to advertise again. */
+	CCTV_RECOVERY_AWAITING,
+	/*! Back after a reboot, watched for a while. */
+	CCTV_RECOVERY_VERIFIED,
+	/*! Could not be recovered, needs an operator. */
+	CCTV_RECOVERY_ESCALATED,
+	CCTV_RECOVERY_STATES
+};
+
+/*! Thresholds, all changeable at run time. */
+struct CCTvRecoveryConfig {
+	/*! Send probes and reboots; when 0, states are only tracked. */
+	int enabled;
+	int suspect_failures;
+	int probe_ms;
+	int reboot_ms;
+	int boot_ms;
+	int verify_ms;
+	int max_reboots;
+};
+
+/*! How the module acts on cameras. Called from the timer wheel thread. */
+struct CCTvRecoveryOps {
+	/*!
+	 * \brief Send a request whose outcome is reported with
+	 * CCTvRecoveryReport().
+	 *
+	 * \return CCTV_SUCCESS if it was sent.
+	 */
+	int (*probe)(const char *UDN);
+	/*!
+	 * \brief Send CCTV_RECOVERY_ACTION, whose answer is reported with
+	 * CCTvRecoveryRebootAnswered().
+	 *
+	 * \return CCTV_SUCCESS if it was sent.
+	 */
+	int (*reboot)(const char *UDN);
+	/*!
+	 * \brief Tell an operator, may be NULL.
+	 */
+	void (*escalate)(const char *UDN, int reboots);
+	/*!
+	 * \brief Told that a camera changed state, may be NULL. Read the
+	 * state with CCTvRecoveryGetState(), as later changes may already
+	 * have happened.
+	 */
+	void (*changed)(const char *UDN);
+};
+
+/*! Counters of the recovery engine. */
+struct CCTvRecoveryStats {
+	/*! Cameras that became suspect. */
+	unsigned long suspects;
+	/*! Suspect cameras that answered the probe. */
+	unsigned long false_alarms;
+	/*! Reboots sent. */
+	unsigned long reboots;
+	/*! Cameras verified after a reboot. */
+	unsigned long recoveries;
+	/*! Cameras escalated. */
+	unsigned long escalations;
+	/*! Time from suspect to verified, summed over the recoveries, in
+	 * milliseconds. */
+	double recovery_ms;
+	/*! Longest of those. */
+	double recovery_max_ms;
+	/*! Cameras in each state now. */
+	unsigned long state[CCTV_RECOVERY_STATES];
+};
+
+/*!
+ * \brief Start the module.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvRecoveryStart(
+	/*! [in] Running timer wheel the transitions are scheduled on. It
+	 * must outlive the module. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in] Thresholds, NULL for the defaults above. */
+	const struct CCTvRecoveryConfig *config,
+	/*! [in] Callbacks, copied. */
+	const struct CCTvRecoveryOps *ops);
+
+/*!
+ * \brief Stop the module and forget all cameras.
+ */
+void CCTvRecoveryStop(void);
+
+/*!
+ * \brief Forget a camera that left the device list, unless it is being
+ * rebooted and so expected back. Waits for a state timer of the camera
+ * that is running on another thread.
+ */
+void CCTvRecoveryRemove(
+	/*! [in] Camera UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Change a threshold by the name of its field in
+ * struct CCTvRecoveryConfig. Applies to the next transition.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the name is unknown or the value
+ * negative.
+ */
+int CCTvRecoverySet(
+	/*! [in] Field name. */
+	const char *name,
+	/*! [in] Value. */
+	int value);
+
+/*!
+ * \brief Copy the thresholds.
+ */
+void CCTvRecoveryGetConfig(
+	/*! [out] Thresholds. */
+	struct CCTvRecoveryConfig *config);
+
+/*!
+ * \brief Report the outcome of a request to a camera, or with ok set, any
+ * other sign of life such as an event.
+ */
+void CCTvRecoveryReport(
+	/*! [in] Camera UDN. */
+	const char *UDN,
+	/*! [in] Whether it succeeded. */
+	int ok);
+
+/*!
+ * \brief Whether the outcome of a request shows the camera alive. A UPnP
+ * or SOAP error, a positive code, is an answer; only timeouts and
+ * transport errors, the negative UPNP_E_* codes, are failures.
+ *
+ * \return 1 if so, else 0. Meant as the ok of CCTvRecoveryReport().
+ */
+int CCTvRecoveryAnswered(
+	/*! [in] UPnP error code of the request. */
+	int errCode);
+
+/*!
+ * \brief Report the answer to CCTV_RECOVERY_ACTION.
+ */
+void CCTvRecoveryRebootAnswered(
+	/*! [in] Camera UDN. */
+	const char *UDN,
+	/*! [in] UPnP error code of the request. */
+	int errCode);
+
+/*!
+ * \brief Report an advertisement or search response of a camera.
+ */
+void CCTvRecoveryAlive(
+	/*! [in] Camera UDN. */
+	const char *UDN,
+	/*! [in] Whether the camera was not in the device list before. */
+	int added);
+
+/*!
+ * \brief Report a byebye of a camera.
+ */
+void CCTvRecoveryByebye(
+	/*! [in] Camera UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Report that the advertisement of a camera expired.
+ */
+void CCTvRecoveryExpired(
+	/*! [in] Camera UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Put a camera back to healthy, e.g. after an operator fixed it.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the camera is unknown.
+ */
+int CCTvRecoveryReset(
+	/*! [in] Camera UDN. */
+	const char *UDN);
+
+/*!
+ * \brief State of a camera; unknown cameras are healthy.
+ */
+enum CCTvRecoveryState CCTvRecoveryGetState(
+	/*! [in] Camera UDN. */
+	const char *UDN);
+
+/*!
+ * \brief Name of a state, for printing.
+ */
+const char *CCTvRecoveryStateName(
+	/*! [in] State. */
+	enum CCTvRecoveryState state);
+
+/*!
+ * \brief Copy the counters.
+ */
+void CCTvRecoveryGetStats(
+	/*! [out] Counters. */
+	struct CCTvRecoveryStats *stats);
+
+/*!
+ * \brief Print the cameras that are not healthy, with SampleUtil_Print().
+ */
+void CCTvRecoveryPrint(void);
+
+/*!
+ * \brief Print the counters and thresholds with SampleUtil_Print().
+ */
+void CCTvRecoveryPrintStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Camera Recovery */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_RECOVERY_H */
@@ -0,0 +1,500 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Device Registry
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_registry.h"
+
+#include "cctv_ctrlpt.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*! Initial number of buckets per index, must be a power of two. */
+#define CCTV_REGISTRY_MIN_BUCKETS 64
+
+/*! Initial capacity of the ordered device array. */
+#define CCTV_REGISTRY_MIN_DEVICES 16
+
+unsigned int CCTvRegistryHash(const char *key)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*key) {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static int CCTvRegistryIndexInit(struct CCTvRegistryIndex *idx)
+{
+	idx->buckets = (struct CCTvRegistryEntry **)calloc(
+		CCTV_REGISTRY_MIN_BUCKETS, sizeof (struct CCTvRegistryEntry *));
+	if (!idx->buckets)
+		return CCTV_ERROR;
+	idx->nbuckets = CCTV_REGISTRY_MIN_BUCKETS;
+	idx->count = 0;
+
+	return CCTV_SUCCESS;
+}
+
+static void CCTvRegistryIndexClear(struct CCTvRegistryIndex *idx)
+{
+	struct CCTvRegistryEntry *entry;
+	struct CCTvRegistryEntry *next;
+	unsigned int i;
+
+	for (i = 0; i < idx->nbuckets; i++) {
+		for (entry = idx->buckets[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry->key);
+			free(entry);
+		}
+		idx->buckets[i] = NULL;
+	}
+	idx->count = 0;
+}
+
+/*!
+ * \brief Double the bucket array once the load factor exceeds one, so that
+ * chains stay short as the fleet grows. Failing to grow is not fatal.
+ */
+static void CCTvRegistryIndexGrow(struct CCTvRegistryIndex *idx)
+{
+	struct CCTvRegistryEntry **buckets;
+	struct CCTvRegistryEntry *entry;
+	struct CCTvRegistryEntry *next;
+	unsigned int nbuckets = idx->nbuckets * 2;
+	unsigned int i;
+
+	buckets = (struct CCTvRegistryEntry **)calloc(
+		nbuckets, sizeof (struct CCTvRegistryEntry *));
+	if (!buckets)
+		return;
+	for (i = 0; i < idx->nbuckets; i++) {
+		for (entry = idx->buckets[i]; entry; entry = next) {
+			next = entry->next;
+			entry->next = buckets[entry->hash & (nbuckets - 1)];
+			buckets[entry->hash & (nbuckets - 1)] = entry;
+		}
+	}
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->nbuckets = nbuckets;
+}
+
+static int CCTvRegistryIndexAdd(
+	struct CCTvRegistryIndex *idx,
+	const char *key,
+	struct CCTvDeviceNode *node,
+	int service)
+{
+	struct CCTvRegistryEntry *entry;
+	unsigned int b;
+
+	if (!key || !key[0])
+		return CCTV_SUCCESS;
+	entry = (struct CCTvRegistryEntry *)malloc(sizeof *entry);
+	if (!entry)
+		return CCTV_ERROR;
+	entry->key = strdup(key);
+	if (!entry->key) {
+		free(entry);
+		return CCTV_ERROR;
+	}
+	entry->hash = CCTvRegistryHash(key);
+	entry->node = node;
+	entry->service = service;
+	b = entry->hash & (idx->nbuckets - 1);
+	entry->next = idx->buckets[b];
+	idx->buckets[b] = entry;
+	if (++idx->count > idx->nbuckets)
+		CCTvRegistryIndexGrow(idx);
+
+	return CCTV_SUCCESS;
+}
+
+static void CCTvRegistryIndexDel(
+	struct CCTvRegistryIndex *idx,
+	const char *key,
+	struct CCTvDeviceNode *node,
+	int service)
+{
+	struct CCTvRegistryEntry **link;
+	struct CCTvRegistryEntry *entry;
+	unsigned int hash;
+
+	if (!key || !key[0])
+		return;
+	hash = CCTvRegistryHash(key);
+	link = &idx->buckets[hash & (idx->nbuckets - 1)];
+	while ((entry = *link)) {
+		if (entry->node == node && entry->service == service &&
+		    entry->hash == hash && strcmp(entry->key, key) == 0) {
+			*link = entry->next;
+			free(entry->key);
+			free(entry);
+			idx->count--;
+			return;
+		}
+		link = &entry->next;
+	}
+}
+
+int CCTvRegistryInit(struct CCTvRegistry *reg)
+{
+	int i;
+
+	memset(reg, 0, sizeof *reg);
+	for (i = 0; i < CCTV_KEY_COUNT; i++) {
+		if (CCTvRegistryIndexInit(&reg->index[i]) != CCTV_SUCCESS) {
+			CCTvRegistryDestroy(reg);
+			return CCTV_ERROR;
+		}
+	}
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvRegistryClear(struct CCTvRegistry *reg)
+{
+	int i;
+
+	for (i = 0; i < CCTV_KEY_COUNT; i++)
+		if (reg->index[i].buckets)
+			CCTvRegistryIndexClear(&reg->index[i]);
+	reg->count = 0;
+}
+
+void CCTvRegistryDestroy(struct CCTvRegistry *reg)
+{
+	int i;
+
+	CCTvRegistryClear(reg);
+	for (i = 0; i < CCTV_KEY_COUNT; i++) {
+		free(reg->index[i].buckets);
+		reg->index[i].buckets = NULL;
+		reg->index[i].nbuckets = 0;
+	}
+	free(reg->devices);
+	reg->devices = NULL;
+	reg->capacity = 0;
+}
+
+/*!
+ * \brief Add or remove (add == 0) every key of a device.
+ */
+static int CCTvRegistryIndexDevice(
+	struct CCTvRegistry *reg,
+	struct CCTvDeviceNode *node,
+	int add)
+{
+	struct CCTvDevice *dev = &node->device;
+	int rc = CCTV_SUCCESS;
+	int service;
+
+	if (add) {
+		rc |= CCTvRegistryIndexAdd(&reg->index[CCTV_KEY_UDN],
+			dev->UDN, node, -1);
+	} else {
+		CCTvRegistryIndexDel(&reg->index[CCTV_KEY_UDN],
+			dev->UDN, node, -1);
+	}
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		struct cctv_service *s = &dev->CCTvService[service];
+
+		if (add) {
+			rc |= CCTvRegistryIndexAdd(&reg->index[CCTV_KEY_SID],
+				s->SID, node, service);
+			rc |= CCTvRegistryIndexAdd(&reg->index[CCTV_KEY_EVENTURL],
+				s->EventURL, node, service);
+			rc |= CCTvRegistryIndexAdd(&reg->index[CCTV_KEY_CONTROLURL],
+				s->ControlURL, node, service);
+		} else {
+			CCTvRegistryIndexDel(&reg->index[CCTV_KEY_SID],
+				s->SID, node, service);
+			CCTvRegistryIndexDel(&reg->index[CCTV_KEY_EVENTURL],
+				s->EventURL, node, service);
+			CCTvRegistryIndexDel(&reg->index[CCTV_KEY_CONTROLURL],
+				s->ControlURL, node, service);
+		}
+	}
+
+	return rc ? CCTV_ERROR : CCTV_SUCCESS;
+}
+
+int CCTvRegistryInsert(struct CCTvRegistry *reg, struct CCTvDeviceNode *node)
+{
+	struct CCTvDeviceNode **devices;
+	int capacity;
+
+	if (reg->count == reg->capacity) {
+		capacity = reg->capacity ?
+			reg->capacity * 2 : CCTV_REGISTRY_MIN_DEVICES;
+		devices = (struct CCTvDeviceNode **)realloc(reg->devices,
+			capacity * sizeof (struct CCTvDeviceNode *));
+		if (!devices)
+			return CCTV_ERROR;
+		reg->devices = devices;
+		reg->capacity = capacity;
+	}
+	if (CCTvRegistryIndexDevice(reg, node, 1) != CCTV_SUCCESS) {
+		CCTvRegistryIndexDevice(reg, node, 0);
+		return CCTV_ERROR;
+	}
+	reg->devices[reg->count++] = node;
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvRegistryRemove(struct CCTvRegistry *reg, struct CCTvDeviceNode *node)
+{
+	int i;
+
+	for (i = 0; i < reg->count; i++) {
+		if (reg->devices[i] == node)
+			break;
+	}
+	if (i == reg->count)
+		return CCTV_WARNING;
+	CCTvRegistryIndexDevice(reg, node, 0);
+	memmove(&reg->devices[i], &reg->devices[i + 1],
+		(reg->count - i - 1) * sizeof (struct CCTvDeviceNode *));
+	reg->count--;
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvRegistryUpdateSID(
+	struct CCTvRegistry *reg,
+	struct CCTvDeviceNode *node,
+	int service,
+	const char *oldsid,
+	const char *newsid)
+{
+	CCTvRegistryIndexDel(&reg->index[CCTV_KEY_SID], oldsid, node, service);
+
+	return CCTvRegistryIndexAdd(&reg->index[CCTV_KEY_SID],
+		newsid, node, service);
+}
+
+struct CCTvDeviceNode *CCTvRegistryFind(
+	const struct CCTvRegistry *reg,
+	enum CCTvRegistryKey which,
+	const char *key,
+	int *service)
+{
+	const struct CCTvRegistryIndex *idx = &reg->index[which];
+	const struct CCTvRegistryEntry *entry;
+	unsigned int hash;
+
+	if (!key)
+		return NULL;
+	hash = CCTvRegistryHash(key);
+	for (entry = idx->buckets[hash & (idx->nbuckets - 1)];
+	     entry; entry = entry->next) {
+		if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+			if (service)
+				*service = entry->service;
+			return entry->node;
+		}
+	}
+
+	return NULL;
+}
+
+struct CCTvDeviceNode *CCTvRegistryGet(const struct CCTvRegistry *reg,
+	int devnum)
+{
+	if (devnum <= 0 || devnum > reg->count)
+		return NULL;
+
+	return reg->devices[devnum - 1];
+}
+
+int CCTvDeviceTableInit(struct CCTvDeviceTable *table)
+{
+	memset(table, 0, sizeof *table);
+	if (CCTvRegistryInit(&table->side[0]) != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	if (CCTvRegistryInit(&table->side[1]) != CCTV_SUCCESS) {
+		CCTvRegistryDestroy(&table->side[0]);
+		return CCTV_ERROR;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvDeviceTableDestroy(struct CCTvDeviceTable *table)
+{
+	CCTvRegistryDestroy(&table->side[0]);
+	CCTvRegistryDestroy(&table->side[1]);
+}
+
+const struct CCTvRegistry *CCTvDeviceTableReadBegin(
+	struct CCTvDeviceTable *table,
+	int *token)
+{
+	int version = __atomic_load_n(&table->version, __ATOMIC_SEQ_CST);
+
+	__atomic_add_fetch(&table->readers[version], 1, __ATOMIC_SEQ_CST);
+	*token = version;
+
+	return &table->side[__atomic_load_n(&table->published,
+		__ATOMIC_SEQ_CST)];
+}
+
+void CCTvDeviceTableReadEnd(struct CCTvDeviceTable *table, int token)
+{
+	__atomic_sub_fetch(&table->readers[token], 1, __ATOMIC_RELEASE);
+}
+
+const struct CCTvRegistry *CCTvDeviceTableWriterView(
+	struct CCTvDeviceTable *table)
+{
+	return &table->side[table->published];
+}
+
+static void CCTvDeviceTableWaitReaders(struct CCTvDeviceTable *table,
+	int version)
+{
+	int spins = 0;
+
+	while (__atomic_load_n(&table->readers[version], __ATOMIC_SEQ_CST)) {
+		/* read sections are short, spin a little before sleeping */
+		if (++spins < 100)
+			sched_yield();
+		else
+			usleep(50);
+	}
+}
+
+/*!
+ * \brief Publish the standby side and wait until no reader can still be
+ * using the previously published one.
+ */
+static void CCTvDeviceTableFlip(struct CCTvDeviceTable *table)
+{
+	int prev = table->version;
+
+	__atomic_store_n(&table->published, !table->published,
+		__ATOMIC_SEQ_CST);
+	/* readers that arrived on !prev before the last flip are done first,
+	 * then new readers are moved over and the remaining old ones drained */
+	CCTvDeviceTableWaitReaders(table, !prev);
+	__atomic_store_n(&table->version, !prev, __ATOMIC_SEQ_CST);
+	CCTvDeviceTableWaitReaders(table, prev);
+}
+
+/*! A registry change, applied once per side. */
+struct CCTvDeviceTableOp {
+	enum { OP_INSERT, OP_REMOVE, OP_UPDATESID, OP_CLEAR } type;
+	struct CCTvDeviceNode *node;
+	int service;
+	const char *oldsid;
+	const char *newsid;
+};
+
+static int CCTvDeviceTableApply(struct CCTvRegistry *reg,
+	const struct CCTvDeviceTableOp *op)
+{
+	switch (op->type) {
+	case OP_INSERT:
+		return CCTvRegistryInsert(reg, op->node);
+	case OP_REMOVE:
+		return CCTvRegistryRemove(reg, op->node);
+	case OP_UPDATESID:
+		return CCTvRegistryUpdateSID(reg, op->node, op->service,
+			op->oldsid, op->newsid);
+	case OP_CLEAR:
+		CCTvRegistryClear(reg);
+		break;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Apply op to the standby side, publish it, then replay op on the
+ * side that was published before. If the replay fails (out of memory)
+ * the change is undone on both sides so that they never diverge.
+ */
+static int CCTvDeviceTableWrite(struct CCTvDeviceTable *table,
+	const struct CCTvDeviceTableOp *op)
+{
+	struct CCTvDeviceTableOp undo = *op;
+	int rc;
+
+	rc = CCTvDeviceTableApply(&table->side[!table->published], op);
+	if (rc == CCTV_ERROR)
+		return rc;
+	CCTvDeviceTableFlip(table);
+	if (CCTvDeviceTableApply(&table->side[!table->published], op) !=
+	    CCTV_ERROR)
+		return rc;
+	switch (op->type) {
+	case OP_INSERT:
+		undo.type = OP_REMOVE;
+		break;
+	case OP_UPDATESID:
+		undo.oldsid = op->newsid;
+		undo.newsid = op->oldsid;
+		break;
+	default:
+		return CCTV_ERROR;
+	}
+	CCTvDeviceTableApply(&table->side[table->published], &undo);
+	CCTvDeviceTableFlip(table);
+	CCTvDeviceTableApply(&table->side[!table->published], &undo);
+
+	return CCTV_ERROR;
+}
+
+int CCTvDeviceTableInsert(struct CCTvDeviceTable *table,
+	struct CCTvDeviceNode *node)
+{
+	struct CCTvDeviceTableOp op = { OP_INSERT, node, -1, NULL, NULL };
+
+	return CCTvDeviceTableWrite(table, &op);
+}
+
+int CCTvDeviceTableRemove(struct CCTvDeviceTable *table,
+	struct CCTvDeviceNode *node)
+{
+	struct CCTvDeviceTableOp op = { OP_REMOVE, node, -1, NULL, NULL };
+
+	return CCTvDeviceTableWrite(table, &op);
+}
+
+int CCTvDeviceTableUpdateSID(struct CCTvDeviceTable *table,
+	struct CCTvDeviceNode *node, int service,
+	const char *oldsid, const char *newsid)
+{
+	struct CCTvDeviceTableOp op = {
+		OP_UPDATESID, node, service, oldsid, newsid
+	};
+
+	return CCTvDeviceTableWrite(table, &op);
+}
+
+void CCTvDeviceTableClear(struct CCTvDeviceTable *table)
+{
+	struct CCTvDeviceTableOp op = { OP_CLEAR, NULL, -1, NULL, NULL };
+
+	CCTvDeviceTableWrite(table, &op);
+}
+
+/*! @} Control Point Device Registry */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,288 @@
+#ifndef UPNP_CCTV_REGISTRY_H
+#define UPNP_CCTV_REGISTRY_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Device Registry
+ *
+ * @{
+ *
+ * \file
+ *
+ * Multi-key index over the control point device nodes. Devices are kept
+ * in discovery order (which is what the "devnum" CLI arguments refer to)
+ * and are additionally hashed by UDN, and per service by SID, EventURL
+ * and ControlURL, so that the SSDP, GENA and SOAP callbacks can find
+ * their device in constant time.
+ *
+ * The registry does not own the device nodes and does not lock. The
+ * control point wraps two copies of it in a CCTvDeviceTable, which gives
+ * readers a wait-free, stable view while writers (serialized by
+ * DeviceListMutex) add, remove or resubscribe devices.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct CCTvDeviceNode;
+
+/*! Keys the registry is indexed by. */
+enum CCTvRegistryKey {
+	CCTV_KEY_UDN = 0,
+	CCTV_KEY_SID,
+	CCTV_KEY_EVENTURL,
+	CCTV_KEY_CONTROLURL,
+	CCTV_KEY_COUNT
+};
+
+/*! One key of one device (and service) in a hash index. */
+struct CCTvRegistryEntry {
+	/*! FNV-1a hash of key. */
+	unsigned int hash;
+	/*! Private copy of the key. */
+	char *key;
+	/*! Device the key belongs to. */
+	struct CCTvDeviceNode *node;
+	/*! Service the key belongs to, or -1 for device keys. */
+	int service;
+	/*! Next entry in the same bucket. */
+	struct CCTvRegistryEntry *next;
+};
+
+/*! Chained hash table for one key. */
+struct CCTvRegistryIndex {
+	/*! Bucket heads, nbuckets is always a power of two. */
+	struct CCTvRegistryEntry **buckets;
+	unsigned int nbuckets;
+	unsigned int count;
+};
+
+struct CCTvRegistry {
+	/*! One hash index per CCTvRegistryKey. */
+	struct CCTvRegistryIndex index[CCTV_KEY_COUNT];
+	/*! Devices in discovery order, devices[devnum - 1]. */
+	struct CCTvDeviceNode **devices;
+	int count;
+	int capacity;
+};
+
+/*!
+ * \brief Initialize an empty registry.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR if out of memory.
+ */
+int CCTvRegistryInit(
+	/*! [out] Registry to initialize. */
+	struct CCTvRegistry *reg);
+
+/*!
+ * \brief Drop every device from the registry and release the indexes.
+ * The device nodes themselves are not freed.
+ */
+void CCTvRegistryDestroy(
+	/*! [in,out] Registry to destroy. */
+	struct CCTvRegistry *reg);
+
+/*!
+ * \brief Drop every device from the registry, keeping it usable.
+ */
+void CCTvRegistryClear(
+	/*! [in,out] Registry to clear. */
+	struct CCTvRegistry *reg);
+
+/*!
+ * \brief Append a device and index its UDN and the SID, EventURL and
+ * ControlURL of each of its services. Empty keys are not indexed.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR if out of memory.
+ */
+int CCTvRegistryInsert(
+	/*! [in,out] Registry. */
+	struct CCTvRegistry *reg,
+	/*! [in] Device node to add. */
+	struct CCTvDeviceNode *node);
+
+/*!
+ * \brief Remove a device and all of its keys from the registry.
+ *
+ * \return CCTV_SUCCESS, or CCTV_WARNING if the node was not registered.
+ */
+int CCTvRegistryRemove(
+	/*! [in,out] Registry. */
+	struct CCTvRegistry *reg,
+	/*! [in] Device node to remove. */
+	struct CCTvDeviceNode *node);
+
+/*!
+ * \brief Re-key the SID index of one service after a (re)subscription.
+ * The device node itself is not modified.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR if out of memory.
+ */
+int CCTvRegistryUpdateSID(
+	/*! [in,out] Registry. */
+	struct CCTvRegistry *reg,
+	/*! [in] Device node owning the subscription. */
+	struct CCTvDeviceNode *node,
+	/*! [in] Service index. */
+	int service,
+	/*! [in] Previous SID, may be NULL or empty. */
+	const char *oldsid,
+	/*! [in] New SID, may be NULL or empty to only drop the old one. */
+	const char *newsid);
+
+/*!
+ * \brief Look up a device by one of its keys.
+ *
+ * \return The device node, or NULL if no device has that key.
+ */
+struct CCTvDeviceNode *CCTvRegistryFind(
+	/*! [in] Registry. */
+	const struct CCTvRegistry *reg,
+	/*! [in] Which index to search. */
+	enum CCTvRegistryKey which,
+	/*! [in] Key to search for. */
+	const char *key,
+	/*! [out] Service the key belongs to, may be NULL. */
+	int *service);
+
+/*!
+ * \brief Return the device at position devnum (starting with 1).
+ *
+ * \return The device node, or NULL if devnum is out of range.
+ */
+struct CCTvDeviceNode *CCTvRegistryGet(
+	/*! [in] Registry. */
+	const struct CCTvRegistry *reg,
+	/*! [in] Device number. */
+	int devnum);
+
+/*!
+ * \brief Read-mostly device table using the left-right technique.
+ *
+ * Two identical registries are kept. Readers announce themselves on a
+ * per-version counter and use whichever side is published; they never
+ * block and never see a registry that is being modified. A writer applies
+ * its change to the unpublished side, publishes it, waits until no reader
+ * can still be on the old side and then replays the change there. Device
+ * nodes removed by a writer are therefore unreachable by any reader once
+ * the remove call returns and can be freed right away.
+ */
+struct CCTvDeviceTable {
+	struct CCTvRegistry side[2];
+	/*! Side readers use, 0 or 1. */
+	int published;
+	/*! Reader counter readers currently arrive on, 0 or 1. */
+	int version;
+	/*! Readers in progress, per version. */
+	long readers[2];
+};
+
+/*!
+ * \brief Initialize an empty device table.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR if out of memory.
+ */
+int CCTvDeviceTableInit(
+	/*! [out] Table to initialize. */
+	struct CCTvDeviceTable *table);
+
+/*!
+ * \brief Release the device table. There must be no readers left.
+ */
+void CCTvDeviceTableDestroy(
+	/*! [in,out] Table to destroy. */
+	struct CCTvDeviceTable *table);
+
+/*!
+ * \brief Enter a read section. The returned registry and every device node
+ * reached through it stay valid and unchanged until the matching
+ * CCTvDeviceTableReadEnd(). Read sections do not block and may nest.
+ *
+ * \return The published registry.
+ */
+const struct CCTvRegistry *CCTvDeviceTableReadBegin(
+	/*! [in] Table. */
+	struct CCTvDeviceTable *table,
+	/*! [out] Token to pass to CCTvDeviceTableReadEnd(). */
+	int *token);
+
+/*!
+ * \brief Leave a read section.
+ */
+void CCTvDeviceTableReadEnd(
+	/*! [in] Table. */
+	struct CCTvDeviceTable *table,
+	/*! [in] Token returned by CCTvDeviceTableReadBegin(). */
+	int token);
+
+/*!
+ * \brief Registry as seen by the writer. Must be called with the writer
+ * lock (DeviceListMutex) held; both sides are identical at that point.
+ */
+const struct CCTvRegistry *CCTvDeviceTableWriterView(
+	/*! [in] Table. */
+	struct CCTvDeviceTable *table);
+
+/*!
+ * \brief Writer side CCTvRegistryInsert(), visible to readers on return.
+ */
+int CCTvDeviceTableInsert(
+	/*! [in,out] Table. */
+	struct CCTvDeviceTable *table,
+	/*! [in] Device node to add. */
+	struct CCTvDeviceNode *node);
+
+/*!
+ * \brief Writer side CCTvRegistryRemove(). No reader can reach the node
+ * once this returns.
+ */
+int CCTvDeviceTableRemove(
+	/*! [in,out] Table. */
+	struct CCTvDeviceTable *table,
+	/*! [in] Device node to remove. */
+	struct CCTvDeviceNode *node);
+
+/*!
+ * \brief Writer side CCTvRegistryUpdateSID().
+ */
+int CCTvDeviceTableUpdateSID(
+	/*! [in,out] Table. */
+	struct CCTvDeviceTable *table,
+	/*! [in] Device node owning the subscription. */
+	struct CCTvDeviceNode *node,
+	/*! [in] Service index. */
+	int service,
+	/*! [in] Previous SID, may be NULL or empty. */
+	const char *oldsid,
+	/*! [in] New SID, may be NULL or empty. */
+	const char *newsid);
+
+/*!
+ * \brief Writer side CCTvRegistryClear(). No reader can reach any of the
+ * previous nodes once this returns.
+ */
+void CCTvDeviceTableClear(
+	/*! [in,out] Table. */
+	struct CCTvDeviceTable *table);
+
+/*!
+ * \brief 32 bit FNV-1a string hash used by the registry indexes.
+ */
+unsigned int CCTvRegistryHash(
+	/*! [in] Nul terminated string. */
+	const char *key);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Device Registry */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_REGISTRY_H */
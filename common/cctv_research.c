@@ -0,0 +1,239 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Re-search Batching
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_research.h"
+
+#include "cctv_ctrlpt.h"
+#include "cctv_registry.h"
+#include "sample_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*! One device due in the open window. */
+struct CCTvResearchEntry {
+	char *UDN;
+	char *deviceType;
+};
+
+/*! Guards everything below. */
+static ithread_mutex_t ResearchMutex;
+static int ResearchRunning;
+static struct CCTvTimerWheel *ResearchWheel;
+static int ResearchWindowMs;
+static int ResearchTypeMin;
+static CCTvResearchSendFn ResearchSend;
+/*! Closes the open window. */
+static struct CCTvTimer ResearchTimer;
+/*! Devices due in the open window. */
+static struct CCTvResearchEntry *ResearchDue;
+static int ResearchNumDue;
+static int ResearchMaxDue;
+static struct CCTvResearchStats ResearchStats;
+
+static int CCTvResearchCompare(const void *a, const void *b)
+{
+	const struct CCTvResearchEntry *ea = (const struct CCTvResearchEntry *)a;
+	const struct CCTvResearchEntry *eb = (const struct CCTvResearchEntry *)b;
+	int cmp = strcmp(ea->deviceType, eb->deviceType);
+
+	return cmp ? cmp : strcmp(ea->UDN, eb->UDN);
+}
+
+static void CCTvResearchFree(struct CCTvResearchEntry *due, int ndue)
+{
+	int i;
+
+	for (i = 0; i < ndue; i++) {
+		free(due[i].UDN);
+		free(due[i].deviceType);
+	}
+	free(due);
+}
+
+static void CCTvResearchSendOne(const char *target, unsigned long *count)
+{
+	int rc = ResearchSend(target);
+
+	ithread_mutex_lock(&ResearchMutex);
+	if (rc == UPNP_E_SUCCESS)
+		(*count)++;
+	else
+		ResearchStats.failed++;
+	ithread_mutex_unlock(&ResearchMutex);
+}
+
+/*!
+ * \brief Window timer callback: search for everything that fell due, one
+ * search per device type where enough devices of it are due.
+ */
+static void CCTvResearchFlush(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvResearchEntry *due;
+	int ndue;
+	int first;
+	int i;
+	int j;
+
+	ithread_mutex_lock(&ResearchMutex);
+	due = ResearchDue;
+	ndue = ResearchNumDue;
+	ResearchDue = NULL;
+	ResearchNumDue = 0;
+	ResearchMaxDue = 0;
+	ResearchStats.windows++;
+	ithread_mutex_unlock(&ResearchMutex);
+
+	/* group by type, and drop devices that fell due twice */
+	qsort(due, (size_t)ndue, sizeof *due, CCTvResearchCompare);
+	for (first = 0; first < ndue; first = j) {
+		for (j = first + 1; j < ndue && strcmp(due[j].deviceType,
+			due[first].deviceType) == 0; j++)
+			;
+		if (j - first >= ResearchTypeMin) {
+			CCTvResearchSendOne(due[first].deviceType,
+				&ResearchStats.type_searches);
+			continue;
+		}
+		for (i = first; i < j; i++) {
+			if (i > first && strcmp(due[i].UDN, due[i - 1].UDN) == 0)
+				continue;
+			CCTvResearchSendOne(due[i].UDN,
+				&ResearchStats.udn_searches);
+		}
+	}
+	CCTvResearchFree(due, ndue);
+	timer = timer;
+	arg = arg;
+}
+
+int CCTvResearchStart(struct CCTvTimerWheel *wheel, int window_ms,
+	int type_min, CCTvResearchSendFn send)
+{
+	if (window_ms < 0 || type_min < 1 || !send)
+		return CCTV_ERROR;
+	ithread_mutex_init(&ResearchMutex, 0);
+	ResearchWheel = wheel;
+	ResearchWindowMs = window_ms;
+	ResearchTypeMin = type_min;
+	ResearchSend = send;
+	CCTvTimerInit(&ResearchTimer, CCTvResearchFlush, NULL);
+	ResearchDue = NULL;
+	ResearchNumDue = 0;
+	ResearchMaxDue = 0;
+	memset(&ResearchStats, 0, sizeof ResearchStats);
+	ResearchRunning = 1;
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvResearchStop(void)
+{
+	ithread_mutex_lock(&ResearchMutex);
+	if (!ResearchRunning) {
+		ithread_mutex_unlock(&ResearchMutex);
+		return;
+	}
+	ResearchRunning = 0;
+	ithread_mutex_unlock(&ResearchMutex);
+
+	/* a flush running now takes the lock, so wait without it */
+	CCTvTimerCancel(ResearchWheel, &ResearchTimer);
+	ithread_mutex_lock(&ResearchMutex);
+	CCTvResearchFree(ResearchDue, ResearchNumDue);
+	ResearchDue = NULL;
+	ResearchNumDue = 0;
+	ResearchMaxDue = 0;
+	ithread_mutex_unlock(&ResearchMutex);
+}
+
+long CCTvResearchDelay(const char *UDN, long lifetime_ms, long margin_ms)
+{
+	long spread;
+
+	if (margin_ms > lifetime_ms / 2)
+		margin_ms = lifetime_ms / 2;
+	spread = margin_ms / 2;
+	if (spread <= 0)
+		return lifetime_ms - margin_ms;
+
+	return lifetime_ms - margin_ms +
+		(long)(CCTvRegistryHash(UDN) % (unsigned long)spread);
+}
+
+int CCTvResearchDue(const char *UDN, const char *deviceType)
+{
+	struct CCTvResearchEntry *tmp;
+	struct CCTvResearchEntry *e;
+
+	ithread_mutex_lock(&ResearchMutex);
+	if (!ResearchRunning) {
+		ithread_mutex_unlock(&ResearchMutex);
+		return CCTV_ERROR;
+	}
+	if (ResearchNumDue == ResearchMaxDue) {
+		tmp = (struct CCTvResearchEntry *)realloc(ResearchDue,
+			(size_t)(ResearchMaxDue * 2 + 16) * sizeof *tmp);
+		if (!tmp) {
+			ithread_mutex_unlock(&ResearchMutex);
+			return CCTV_ERROR;
+		}
+		ResearchDue = tmp;
+		ResearchMaxDue = ResearchMaxDue * 2 + 16;
+	}
+	e = &ResearchDue[ResearchNumDue];
+	e->UDN = strdup(UDN);
+	e->deviceType = strdup(deviceType);
+	if (!e->UDN || !e->deviceType) {
+		free(e->UDN);
+		free(e->deviceType);
+		ithread_mutex_unlock(&ResearchMutex);
+		return CCTV_ERROR;
+	}
+	/* the first device due opens the window */
+	if (ResearchNumDue++ == 0)
+		CCTvTimerArm(ResearchWheel, &ResearchTimer, ResearchWindowMs);
+	ResearchStats.due++;
+	ithread_mutex_unlock(&ResearchMutex);
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvResearchGetStats(struct CCTvResearchStats *stats)
+{
+	ithread_mutex_lock(&ResearchMutex);
+	*stats = ResearchStats;
+	ithread_mutex_unlock(&ResearchMutex);
+}
+
+void CCTvResearchPrintStats(void)
+{
+	struct CCTvResearchStats stats;
+
+	CCTvResearchGetStats(&stats);
+	SampleUtil_Print(
+		"Re-search:\n"
+		"    +- Devices due    = %lu\n"
+		"    +- Windows        = %lu\n"
+		"    +- By type        = %lu\n"
+		"    +- By UDN         = %lu\n"
+		"    +- Failed         = %lu\n",
+		stats.due,
+		stats.windows,
+		stats.type_searches,
+		stats.udn_searches,
+		stats.failed);
+}
+
+/*! @} Control Point Re-search Batching */
+
+/*! @} UpnpSamples */
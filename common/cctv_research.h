@@ -0,0 +1,133 @@
+#ifndef UPNP_CCTV_RESEARCH_H
+#define UPNP_CCTV_RESEARCH_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Re-search Batching
+ *
+ * @{
+ *
+ * \file
+ *
+ * Devices whose advertisement is about to expire are searched for once more,
+ * so that a camera that is still there renews it. Cameras behind one PoE
+ * switch power up together and advertise together, so their re-searches
+ * would all fall due in the same tick. Instead of sending one M-SEARCH per
+ * device right away, CCTvResearchDue() collects the devices in a search
+ * window. When the window closes, every device type with at least type_min
+ * devices due is searched for once by type, the others by UDN.
+ *
+ * CCTvResearchDelay() also spreads the re-searches of devices that
+ * advertised at the same moment over part of the margin before expiry.
+ */
+
+#include "cctv_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Length of a search window, in milliseconds. */
+#define CCTV_RESEARCH_WINDOW_MS 1000
+
+/*! Devices of one type due in a window from which a single search by
+ * device type is sent instead of one per UDN. */
+#define CCTV_RESEARCH_TYPE_MIN 8
+
+/*!
+ * \brief Send one M-SEARCH.
+ *
+ * \return UPNP_E_SUCCESS or an UPnP error code.
+ */
+typedef int (*CCTvResearchSendFn)(
+	/*! [in] Search target, a UDN or a device type. */
+	const char *target);
+
+/*! Counters of the re-search batching. */
+struct CCTvResearchStats {
+	/*! Devices that fell due. */
+	unsigned long due;
+	/*! Windows closed. */
+	unsigned long windows;
+	/*! Searches sent by device type. */
+	unsigned long type_searches;
+	/*! Searches sent by UDN. */
+	unsigned long udn_searches;
+	/*! Searches that could not be sent. */
+	unsigned long failed;
+};
+
+/*!
+ * \brief Start the module.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvResearchStart(
+	/*! [in] Running timer wheel the windows are scheduled on. It must
+	 * outlive the module. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in] Length of a search window, in milliseconds. */
+	int window_ms,
+	/*! [in] Devices of one type due in a window from which a search by
+	 * type is sent. */
+	int type_min,
+	/*! [in] Sends the searches, from the timer wheel thread. */
+	CCTvResearchSendFn send);
+
+/*!
+ * \brief Stop the module, dropping the devices of the open window.
+ */
+void CCTvResearchStop(void);
+
+/*!
+ * \brief Delay after which the re-search of a device falls due: between
+ * margin and half the margin before the advertisement expires, at a point
+ * that depends on the UDN only.
+ *
+ * \return Milliseconds.
+ */
+long CCTvResearchDelay(
+	/*! [in] Device UDN. */
+	const char *UDN,
+	/*! [in] Advertisement lifetime, in milliseconds. */
+	long lifetime_ms,
+	/*! [in] How long before expiry to search at the earliest, in
+	 * milliseconds. */
+	long margin_ms);
+
+/*!
+ * \brief Add a device to the current search window, opening one if
+ * needed. Never sends anything itself.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if out of memory or stopped.
+ */
+int CCTvResearchDue(
+	/*! [in] Device UDN. */
+	const char *UDN,
+	/*! [in] Device type. */
+	const char *deviceType);
+
+/*!
+ * \brief Copy the counters.
+ */
+void CCTvResearchGetStats(
+	/*! [out] Counters. */
+	struct CCTvResearchStats *stats);
+
+/*!
+ * \brief Print the counters with SampleUtil_Print().
+ */
+void CCTvResearchPrintStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Re-search Batching */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_RESEARCH_H */
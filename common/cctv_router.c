@@ -0,0 +1,983 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Shard Router
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_router.h"
+
+#include "cctv_ctlsock.h"
+#include "cctv_ctrlpt.h"
+#include "sample_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*! Buckets of the camera table. */
+#define CCTV_ROUTER_BUCKETS 16384
+
+/*! Longest reply header of a worker. */
+#define CCTV_ROUTER_MAX_HEADER 128
+
+/*! A camera the front-end has seen, and the worker owning it. */
+struct CCTvRouterDevice {
+	unsigned int hash;
+	int shard;
+	/*! Expiry of the last notification, and when it came in seconds. */
+	int expires;
+	int seen;
+	char *location;
+	struct CCTvRouterDevice *next;
+	char UDN[1];
+};
+
+/*! A worker. */
+struct CCTvRouterShard {
+	int pid;
+	/*! Its command socket, closed on stop. */
+	int fd;
+	int up;
+	char path[sizeof ((struct sockaddr_un *)0)->sun_path];
+	ithread_t reader;
+	int reader_started;
+	/*! Writes what the socket did not take at once. */
+	ithread_t sender;
+	int sender_started;
+	/*! Guards the queue, sending and closed, and serializes the writes
+	 * to fd. */
+	ithread_mutex_t write_mutex;
+	/*! Signaled when requests are queued or the worker is closed. */
+	ithread_cond_t write_cond;
+	char *queue;
+	size_t queue_len;
+	size_t queue_cap;
+	/*! The sender is writing what it took from the queue. */
+	int sending;
+	/*! No more writes: stopped, or the socket failed. */
+	int closed;
+	/*! Serializes the commands, one waits for its reply at a time. */
+	ithread_mutex_t command_mutex;
+	/*! Tag of the command waiting, 0 if none, and its reply. */
+	unsigned long waiting;
+	unsigned long seq;
+	int replied;
+	int reply_ok;
+	char *reply;
+	size_t reply_len;
+	struct CCTvRouterShardStats stats;
+};
+
+/*! Set from start to CCTvRouterDestroy(), only by the caller of those. */
+static int RouterInitialized;
+
+/*! Guards everything below but the fds, which only Start and Stop touch. */
+static ithread_mutex_t RouterMutex;
+/*! Broadcast when a reply arrives or a worker exits. */
+static ithread_cond_t RouterCond;
+static int RouterRunning;
+static int RouterStopping;
+static ithread_t RouterMonitor;
+static int RouterMonitorStarted;
+static struct CCTvRouterShard RouterShards[CCTV_SHARD_MAX];
+static int RouterCount;
+static struct CCTvShardRing RouterRing;
+static struct CCTvRouterDevice **RouterDevices;
+static struct CCTvRouterStats RouterStats;
+
+static int CCTvRouterNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int)ts.tv_sec;
+}
+
+/*!
+ * \brief Find a camera. Call with RouterMutex held.
+ *
+ * \return Where the camera is linked, or where it would be.
+ */
+static struct CCTvRouterDevice **CCTvRouterLookup(const char *UDN,
+	unsigned int hash)
+{
+	struct CCTvRouterDevice **pdev;
+
+	pdev = &RouterDevices[hash % CCTV_ROUTER_BUCKETS];
+	while (*pdev && ((*pdev)->hash != hash || strcmp((*pdev)->UDN, UDN)))
+		pdev = &(*pdev)->next;
+
+	return pdev;
+}
+
+/*!
+ * \brief Send a request to a worker without waiting: what the socket does
+ * not take at once is queued for the sender. A request is dropped whole
+ * when the queue is full.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if the worker is closed or the
+ * request was dropped.
+ */
+static int CCTvRouterWrite(struct CCTvRouterShard *shard, const char *data,
+	size_t len)
+{
+	int rc = CCTV_SUCCESS;
+	int dropped = 0;
+	size_t sent = 0;
+	size_t cap;
+	char *grown;
+	ssize_t n;
+
+	ithread_mutex_lock(&shard->write_mutex);
+	if (shard->closed) {
+		ithread_mutex_unlock(&shard->write_mutex);
+		return CCTV_ERROR;
+	}
+	/* nothing ahead of it, the request may go straight out */
+	while (!shard->queue_len && !shard->sending && sent < len) {
+		n = send(shard->fd, data + sent, len - sent,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			/* the reader sees the socket close and takes it down */
+			shard->closed = 1;
+			rc = CCTV_ERROR;
+			break;
+		}
+		if (n <= 0)
+			break;
+		sent += (size_t)n;
+	}
+	/* the rest of a request partly sent is queued past the bound, the
+	 * worker would misread what follows otherwise */
+	if (rc == CCTV_SUCCESS && sent == 0 &&
+	    shard->queue_len + len > CCTV_ROUTER_MAX_QUEUE)
+		dropped = 1;
+	if (rc == CCTV_SUCCESS && !dropped && sent < len &&
+	    shard->queue_len + len - sent > shard->queue_cap) {
+		cap = shard->queue_cap ? shard->queue_cap : 4096;
+		while (cap < shard->queue_len + len - sent)
+			cap *= 2;
+		grown = (char *)realloc(shard->queue, cap);
+		if (grown) {
+			shard->queue = grown;
+			shard->queue_cap = cap;
+		} else {
+			dropped = 1;
+		}
+	}
+	if (dropped) {
+		rc = CCTV_ERROR;
+		/* a request partly sent leaves the stream broken */
+		if (sent > 0)
+			shard->closed = 1;
+	} else if (rc == CCTV_SUCCESS && sent < len) {
+		memcpy(shard->queue + shard->queue_len, data + sent, len - sent);
+		shard->queue_len += len - sent;
+		ithread_cond_signal(&shard->write_cond);
+	}
+	ithread_mutex_unlock(&shard->write_mutex);
+	if (dropped) {
+		ithread_mutex_lock(&RouterMutex);
+		shard->stats.overflows++;
+		ithread_mutex_unlock(&RouterMutex);
+	}
+
+	return rc;
+}
+
+/*!
+ * \brief Thread of a worker writing its queue, until it is closed.
+ */
+static void *CCTvRouterSend(void *arg)
+{
+	struct CCTvRouterShard *shard = (struct CCTvRouterShard *)arg;
+	char *spare = NULL;
+	size_t spare_cap = 0;
+	char *data;
+	size_t len;
+	size_t cap;
+	size_t done;
+	ssize_t n;
+
+	ithread_mutex_lock(&shard->write_mutex);
+	while (!shard->closed) {
+		if (!shard->queue_len) {
+			ithread_cond_wait(&shard->write_cond,
+				&shard->write_mutex);
+			continue;
+		}
+		/* the requests queued meanwhile go to the other buffer */
+		data = shard->queue;
+		len = shard->queue_len;
+		cap = shard->queue_cap;
+		shard->queue = spare;
+		shard->queue_len = 0;
+		shard->queue_cap = spare_cap;
+		shard->sending = 1;
+		ithread_mutex_unlock(&shard->write_mutex);
+
+		for (done = 0; done < len; done += (size_t)n) {
+			n = send(shard->fd, data + done, len - done,
+				MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				n = 0;
+			else if (n <= 0)
+				break;
+		}
+		spare = data;
+		spare_cap = cap;
+
+		ithread_mutex_lock(&shard->write_mutex);
+		shard->sending = 0;
+		/* the reader sees the socket close and takes it down */
+		if (done < len)
+			shard->closed = 1;
+	}
+	ithread_mutex_unlock(&shard->write_mutex);
+	free(spare);
+
+	return NULL;
+}
+
+/*! An Adopt request, built with the lock held and sent without. */
+struct CCTvRouterMove {
+	int shard;
+	char *request;
+};
+
+/*!
+ * \brief Build the Adopt request of a camera.
+ */
+static char *CCTvRouterAdoptRequest(const struct CCTvRouterDevice *dev)
+{
+	size_t size = strlen(dev->UDN) + strlen(dev->location) + 32;
+	char *request = (char *)malloc(size);
+
+	if (request)
+		snprintf(request, size, "n Adopt %s %s %d\n", dev->UDN,
+			dev->location, dev->expires);
+
+	return request;
+}
+
+/*!
+ * \brief Take a worker off the ring and hand its cameras to the others.
+ * Safe to call more than once, and from its reader thread.
+ */
+static void CCTvRouterShardDown(int i, const char *why)
+{
+	struct CCTvRouterShard *shard = &RouterShards[i];
+	struct CCTvRouterDevice **pdev;
+	struct CCTvRouterDevice *dev;
+	struct CCTvRouterMove *moves = NULL;
+	int nmoves = 0;
+	int stopping;
+	int now = CCTvRouterNow();
+	int b;
+	int m;
+
+	ithread_mutex_lock(&RouterMutex);
+	if (!shard->up) {
+		ithread_mutex_unlock(&RouterMutex);
+		return;
+	}
+	shard->up = 0;
+	RouterStats.up--;
+	CCTvShardRingRemove(&RouterRing, i);
+	/* a command waiting gives up */
+	shard->replied = 1;
+	shard->reply_ok = 0;
+	ithread_cond_broadcast(&RouterCond);
+	/* wakes the reader; the fd is closed on stop */
+	shutdown(shard->fd, SHUT_RDWR);
+	stopping = RouterStopping;
+	if (!stopping)
+		moves = (struct CCTvRouterMove *)calloc(
+			shard->stats.devices + 1, sizeof *moves);
+	for (b = 0; !stopping && b < CCTV_ROUTER_BUCKETS; b++) {
+		pdev = &RouterDevices[b];
+		while ((dev = *pdev)) {
+			if (dev->shard != i) {
+				pdev = &dev->next;
+				continue;
+			}
+			dev->shard = CCTvShardRingOwner(&RouterRing, dev->UDN);
+			/* gone anyway, or nobody left to take it */
+			if (dev->seen + dev->expires < now || dev->shard < 0) {
+				*pdev = dev->next;
+				RouterStats.devices--;
+				if (dev->shard < 0)
+					RouterStats.dropped++;
+				free(dev->location);
+				free(dev);
+				continue;
+			}
+			RouterShards[dev->shard].stats.devices++;
+			RouterStats.moved++;
+			if (moves && nmoves < (int)shard->stats.devices) {
+				moves[nmoves].shard = dev->shard;
+				moves[nmoves].request =
+					CCTvRouterAdoptRequest(dev);
+				nmoves++;
+			}
+			pdev = &dev->next;
+		}
+	}
+	shard->stats.devices = 0;
+	ithread_mutex_unlock(&RouterMutex);
+
+	if (stopping)
+		return;
+	SampleUtil_Print("Shard %d down (%s), %d cameras moved\n", i, why,
+		nmoves);
+	/* they would otherwise wait for their next ALIVE */
+	for (m = 0; m < nmoves; m++) {
+		if (moves[m].request)
+			CCTvRouterWrite(&RouterShards[moves[m].shard],
+				moves[m].request, strlen(moves[m].request));
+		free(moves[m].request);
+	}
+	free(moves);
+}
+
+/*!
+ * \brief Hand a reply to the command waiting for it.
+ */
+static void CCTvRouterReply(struct CCTvRouterShard *shard, const char *tag,
+	int ok, const char *body, size_t len)
+{
+	char *copy;
+
+	ithread_mutex_lock(&RouterMutex);
+	if (tag[0] == 'n') {
+		/* notifications are not waited for */
+		shard->stats.errors += !ok;
+	} else if (tag[0] == 'c' && shard->waiting &&
+		   strtoul(tag + 1, NULL, 10) == shard->waiting) {
+		copy = (char *)malloc(len + 1);
+		if (copy) {
+			memcpy(copy, body, len);
+			copy[len] = '\0';
+		}
+		shard->reply = copy;
+		shard->reply_len = copy ? len : 0;
+		shard->reply_ok = ok;
+		shard->replied = 1;
+		shard->stats.errors += !ok;
+		ithread_cond_broadcast(&RouterCond);
+	}
+	ithread_mutex_unlock(&RouterMutex);
+}
+
+/*!
+ * \brief Read the replies of a worker until its socket closes.
+ */
+static void *CCTvRouterRead(void *arg)
+{
+	struct CCTvRouterShard *shard = (struct CCTvRouterShard *)arg;
+	char tag[CCTV_ROUTER_MAX_HEADER];
+	char status[8];
+	unsigned long body;
+	char *buf = NULL;
+	char *grown;
+	char *eol;
+	size_t need = 65536;
+	size_t cap = 0;
+	size_t len = 0;
+	size_t pos;
+	size_t end;
+	ssize_t n;
+
+	for (;;) {
+		/* room for the whole reply being read */
+		if (need > cap) {
+			grown = (char *)realloc(buf, need);
+			if (!grown)
+				break;
+			buf = grown;
+			cap = need;
+		}
+		n = recv(shard->fd, buf + len, cap - len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += (size_t)n;
+		pos = 0;
+		while ((eol = (char *)memchr(buf + pos, '\n', len - pos))) {
+			*eol = '\0';
+			if (eol - (buf + pos) >= CCTV_ROUTER_MAX_HEADER ||
+			    sscanf(buf + pos, "%127s %7s %lu", tag, status,
+				&body) != 3 ||
+			    body > 2 * CCTV_CTLSOCK_MAX_OUTPUT)
+				goto done;
+			end = (size_t)(eol + 1 - buf) + body;
+			if (end > len) {
+				*eol = '\n';
+				need = end - pos;
+				break;
+			}
+			CCTvRouterReply(shard, tag, strcmp(status, "ok") == 0,
+				eol + 1, body);
+			pos = end;
+		}
+		if (len - pos >= CCTV_ROUTER_MAX_HEADER &&
+		    !memchr(buf + pos, '\n', CCTV_ROUTER_MAX_HEADER))
+			break;
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+
+done:
+	free(buf);
+	CCTvRouterShardDown((int)(shard - RouterShards),
+		"command socket closed");
+
+	return NULL;
+}
+
+/*!
+ * \brief Reap the workers as they exit.
+ */
+static void *CCTvRouterWait(void *arg)
+{
+	int status;
+	int pid;
+	int i;
+
+	for (;;) {
+		pid = (int)waitpid(-1, &status, 0);
+		if (pid < 0 && errno == EINTR)
+			continue;
+		/* none left */
+		if (pid < 0)
+			break;
+		for (i = 0; i < RouterCount; i++) {
+			ithread_mutex_lock(&RouterMutex);
+			if (RouterShards[i].pid != pid) {
+				ithread_mutex_unlock(&RouterMutex);
+				continue;
+			}
+			RouterShards[i].pid = 0;
+			RouterShards[i].stats.pid = 0;
+			ithread_cond_broadcast(&RouterCond);
+			ithread_mutex_unlock(&RouterMutex);
+			CCTvRouterShardDown(i, WIFEXITED(status) ?
+				"exited" : "killed");
+			break;
+		}
+	}
+
+	return NULL;
+	arg = arg;
+}
+
+/*!
+ * \brief Start a worker.
+ *
+ * \return Its pid, or -1.
+ */
+static int CCTvRouterSpawn(const char *exe, const char *path,
+	const char *log)
+{
+	char level[16];
+	int pid;
+	int fd;
+
+	/* the workers log as much as the front-end */
+	snprintf(level, sizeof level, "%d", (int)gLogLevel);
+	pid = (int)fork();
+	if (pid != 0)
+		return pid;
+	/* not to outlive the front-end */
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	fd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (fd >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+	fd = open("/dev/null", O_RDONLY);
+	if (fd >= 0) {
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+	execl(exe, exe, "-W", "-s", path, "-v", level, (char *)NULL);
+	_exit(127);
+
+	return -1;
+}
+
+/*!
+ * \brief Connect to the command socket of a worker, waiting for it to be
+ * opened.
+ *
+ * \return The socket, or -1.
+ */
+static int CCTvRouterConnect(const char *path, int pid)
+{
+	struct sockaddr_un addr;
+	struct timespec pause = { 0, 50000000L };
+	int waited;
+	int fd;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	for (waited = 0; waited < CCTV_ROUTER_CONNECT_MS; waited += 50) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0)
+			return fd;
+		close(fd);
+		/* gave up before opening it */
+		if (waitpid(pid, NULL, WNOHANG) == pid)
+			return -1;
+		nanosleep(&pause, NULL);
+	}
+
+	return -1;
+}
+
+int CCTvRouterStart(const char *exe, int nshards, const char *dir)
+{
+	struct CCTvRouterShard *shard;
+	char log[512];
+	int i;
+
+	if (RouterInitialized || nshards < 1 || nshards > CCTV_SHARD_MAX)
+		return CCTV_ERROR;
+	RouterDevices = (struct CCTvRouterDevice **)calloc(
+		CCTV_ROUTER_BUCKETS, sizeof *RouterDevices);
+	if (!RouterDevices)
+		return CCTV_ERROR;
+	ithread_mutex_init(&RouterMutex, 0);
+	ithread_cond_init(&RouterCond, 0);
+	RouterInitialized = 1;
+	memset(RouterShards, 0, sizeof RouterShards);
+	memset(&RouterStats, 0, sizeof RouterStats);
+	CCTvShardRingInit(&RouterRing);
+	RouterCount = nshards;
+	RouterStopping = 0;
+	/* all forked before any thread runs */
+	for (i = 0; i < nshards; i++) {
+		shard = &RouterShards[i];
+		shard->fd = -1;
+		ithread_mutex_init(&shard->write_mutex, 0);
+		ithread_cond_init(&shard->write_cond, 0);
+		ithread_mutex_init(&shard->command_mutex, 0);
+		if ((size_t)snprintf(shard->path, sizeof shard->path,
+			"%s/cctv_shard%d.sock", dir, i) >= sizeof shard->path)
+			continue;
+		snprintf(log, sizeof log, "%s/cctv_shard%d.log", dir, i);
+		unlink(shard->path);
+		shard->pid = CCTvRouterSpawn(exe, shard->path, log);
+		if (shard->pid < 0)
+			shard->pid = 0;
+	}
+	for (i = 0; i < nshards; i++) {
+		shard = &RouterShards[i];
+		if (shard->pid)
+			shard->fd = CCTvRouterConnect(shard->path, shard->pid);
+		if (shard->fd >= 0 && ithread_create(&shard->sender, NULL,
+			CCTvRouterSend, shard) == 0)
+			shard->sender_started = 1;
+		if (!shard->sender_started) {
+			SampleUtil_Print("Error starting shard %d, see "
+				"%s/cctv_shard%d.log\n", i, dir, i);
+			continue;
+		}
+		shard->up = 1;
+		RouterStats.up++;
+		CCTvShardRingAdd(&RouterRing, i);
+		if (ithread_create(&shard->reader, NULL, CCTvRouterRead,
+			shard) == 0)
+			shard->reader_started = 1;
+	}
+	ithread_mutex_lock(&RouterMutex);
+	RouterRunning = 1;
+	ithread_mutex_unlock(&RouterMutex);
+	RouterMonitorStarted = ithread_create(&RouterMonitor, NULL,
+		CCTvRouterWait, NULL) == 0;
+	if (!RouterStats.up) {
+		CCTvRouterStop();
+		CCTvRouterDestroy();
+		return CCTV_ERROR;
+	}
+	SampleUtil_Print("Started %d of %d shards\n", RouterStats.up,
+		nshards);
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvRouterStop(void)
+{
+	struct CCTvRouterShard *shard;
+	struct CCTvRouterDevice *dev;
+	struct timespec deadline;
+	int alive;
+	int i;
+
+	if (!RouterInitialized)
+		return;
+	ithread_mutex_lock(&RouterMutex);
+	if (!RouterRunning) {
+		ithread_mutex_unlock(&RouterMutex);
+		return;
+	}
+	/* notifications from now on see it stopped */
+	RouterRunning = 0;
+	RouterStopping = 1;
+	for (i = 0; i < RouterCount; i++) {
+		if (RouterShards[i].pid)
+			kill(RouterShards[i].pid, SIGINT);
+	}
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += CCTV_ROUTER_STOP_MS / 1000;
+	do {
+		for (alive = 0, i = 0; i < RouterCount; i++)
+			alive += RouterShards[i].pid != 0;
+	} while (alive && ithread_cond_timedwait(&RouterCond, &RouterMutex,
+		&deadline) != ETIMEDOUT);
+	for (i = 0; i < RouterCount; i++) {
+		if (RouterShards[i].pid)
+			kill(RouterShards[i].pid, SIGKILL);
+	}
+	ithread_mutex_unlock(&RouterMutex);
+	/* returns once the last worker is reaped */
+	if (RouterMonitorStarted)
+		ithread_join(RouterMonitor, NULL);
+	RouterMonitorStarted = 0;
+	for (i = 0; i < RouterCount; i++) {
+		shard = &RouterShards[i];
+		CCTvRouterShardDown(i, "stopped");
+		/* a notification still on its way finds it closed */
+		ithread_mutex_lock(&shard->write_mutex);
+		shard->closed = 1;
+		ithread_cond_signal(&shard->write_cond);
+		ithread_mutex_unlock(&shard->write_mutex);
+		if (shard->sender_started)
+			ithread_join(shard->sender, NULL);
+		shard->sender_started = 0;
+		if (shard->reader_started)
+			ithread_join(shard->reader, NULL);
+		shard->reader_started = 0;
+		if (shard->fd >= 0)
+			close(shard->fd);
+		shard->fd = -1;
+		if (shard->path[0])
+			unlink(shard->path);
+	}
+	ithread_mutex_lock(&RouterMutex);
+	for (i = 0; i < CCTV_ROUTER_BUCKETS; i++) {
+		while ((dev = RouterDevices[i])) {
+			RouterDevices[i] = dev->next;
+			free(dev->location);
+			free(dev);
+		}
+	}
+	ithread_mutex_unlock(&RouterMutex);
+}
+
+void CCTvRouterDestroy(void)
+{
+	struct CCTvRouterShard *shard;
+	int i;
+
+	if (!RouterInitialized)
+		return;
+	for (i = 0; i < RouterCount; i++) {
+		shard = &RouterShards[i];
+		ithread_mutex_destroy(&shard->write_mutex);
+		ithread_cond_destroy(&shard->write_cond);
+		ithread_mutex_destroy(&shard->command_mutex);
+		free(shard->queue);
+		shard->queue = NULL;
+		free(shard->reply);
+		shard->reply = NULL;
+	}
+	free(RouterDevices);
+	RouterDevices = NULL;
+	ithread_cond_destroy(&RouterCond);
+	ithread_mutex_destroy(&RouterMutex);
+	RouterCount = 0;
+	RouterInitialized = 0;
+}
+
+int CCTvRouterNotify(const char *UDN, const char *location, int expires)
+{
+	struct CCTvRouterDevice **pdev;
+	struct CCTvRouterDevice *dev;
+	unsigned int hash;
+	char *request = NULL;
+	char *copy;
+	int shard = -1;
+	int rc = CCTV_SUCCESS;
+
+	if (!UDN || !*UDN || !location || !*location || !RouterInitialized)
+		return CCTV_ERROR;
+	/* else the Adopt line would not fit the worker's command line */
+	if (strlen(UDN) >= CCTV_MAX_UDN || strlen(location) >= CCTV_MAX_LOCATION)
+		return CCTV_ERROR;
+	hash = CCTvShardHash(UDN);
+	ithread_mutex_lock(&RouterMutex);
+	if (!RouterRunning) {
+		ithread_mutex_unlock(&RouterMutex);
+		return CCTV_ERROR;
+	}
+	pdev = CCTvRouterLookup(UDN, hash);
+	dev = *pdev;
+	if (!dev) {
+		shard = CCTvShardRingOwner(&RouterRing, UDN);
+		if (shard < 0) {
+			RouterStats.dropped++;
+			ithread_mutex_unlock(&RouterMutex);
+			return CCTV_WARNING;
+		}
+		dev = (struct CCTvRouterDevice *)calloc(1,
+			sizeof *dev + strlen(UDN));
+		if (!dev) {
+			ithread_mutex_unlock(&RouterMutex);
+			return CCTV_ERROR;
+		}
+		strcpy(dev->UDN, UDN);
+		dev->hash = hash;
+		dev->shard = shard;
+		*pdev = dev;
+		RouterShards[shard].stats.devices++;
+		RouterStats.devices++;
+	}
+	if (!dev->location || strcmp(dev->location, location) != 0) {
+		copy = strdup(location);
+		if (copy) {
+			free(dev->location);
+			dev->location = copy;
+		}
+	}
+	dev->expires = expires;
+	dev->seen = CCTvRouterNow();
+	shard = dev->shard;
+	if (dev->location) {
+		request = CCTvRouterAdoptRequest(dev);
+		RouterShards[shard].stats.notifies++;
+	}
+	ithread_mutex_unlock(&RouterMutex);
+
+	/* the worker refreshes a camera it knows without a download */
+	if (!request ||
+	    CCTvRouterWrite(&RouterShards[shard], request, strlen(request)) !=
+	    CCTV_SUCCESS)
+		rc = CCTV_ERROR;
+	free(request);
+
+	return rc;
+}
+
+void CCTvRouterByebye(const char *UDN)
+{
+	struct CCTvRouterDevice **pdev;
+	struct CCTvRouterDevice *dev;
+	char request[NAME_SIZE + 16];
+	int shard = -1;
+
+	if (!UDN || !*UDN || !RouterInitialized)
+		return;
+	ithread_mutex_lock(&RouterMutex);
+	if (!RouterRunning) {
+		ithread_mutex_unlock(&RouterMutex);
+		return;
+	}
+	pdev = CCTvRouterLookup(UDN, CCTvShardHash(UDN));
+	dev = *pdev;
+	if (dev) {
+		*pdev = dev->next;
+		shard = dev->shard;
+		RouterShards[shard].stats.devices--;
+		RouterStats.devices--;
+	}
+	ithread_mutex_unlock(&RouterMutex);
+	if (!dev)
+		return;
+	free(dev->location);
+	free(dev);
+	if ((size_t)snprintf(request, sizeof request, "n Drop %s\n", UDN) <
+	    sizeof request)
+		CCTvRouterWrite(&RouterShards[shard], request,
+			strlen(request));
+}
+
+int CCTvRouterOwner(const char *UDN)
+{
+	int shard = -1;
+
+	if (!RouterInitialized)
+		return -1;
+	ithread_mutex_lock(&RouterMutex);
+	if (RouterRunning)
+		shard = CCTvShardRingOwner(&RouterRing, UDN);
+	ithread_mutex_unlock(&RouterMutex);
+
+	return shard;
+}
+
+/*!
+ * \brief Print a reply, in pieces that fit SampleUtil_Print().
+ */
+static void CCTvRouterPrint(const char *text, size_t len)
+{
+	size_t n;
+
+	while (len > 0) {
+		n = len < 4096 ? len : 4096;
+		SampleUtil_Print("%.*s", (int)n, text);
+		text += n;
+		len -= n;
+	}
+}
+
+/*!
+ * \brief Run a command on one worker and print its output.
+ */
+static int CCTvRouterRun(int i, const char *cmdline)
+{
+	struct CCTvRouterShard *shard = &RouterShards[i];
+	struct timespec deadline;
+	char request[CCTV_CTLSOCK_MAX_LINE + 32];
+	char *reply = NULL;
+	size_t reply_len = 0;
+	int len = (int)strcspn(cmdline, "\r\n");
+	int ok = 0;
+
+	ithread_mutex_lock(&shard->command_mutex);
+	ithread_mutex_lock(&RouterMutex);
+	if (!shard->up) {
+		ithread_mutex_unlock(&RouterMutex);
+		ithread_mutex_unlock(&shard->command_mutex);
+		SampleUtil_Print("Shard %d is down\n", i);
+		return CCTV_ERROR;
+	}
+	shard->waiting = ++shard->seq;
+	shard->replied = 0;
+	shard->stats.commands++;
+	snprintf(request, sizeof request, "c%lu %.*s\n", shard->waiting, len,
+		cmdline);
+	ithread_mutex_unlock(&RouterMutex);
+
+	if (CCTvRouterWrite(shard, request, strlen(request)) == CCTV_SUCCESS) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += CCTV_ROUTER_REPLY_MS / 1000;
+		ithread_mutex_lock(&RouterMutex);
+		while (!shard->replied &&
+		       ithread_cond_timedwait(&RouterCond, &RouterMutex,
+			&deadline) != ETIMEDOUT)
+			;
+		ok = shard->replied && shard->reply_ok;
+		reply = shard->reply;
+		reply_len = shard->reply_len;
+		shard->reply = NULL;
+		shard->waiting = 0;
+		ithread_mutex_unlock(&RouterMutex);
+	}
+	ithread_mutex_unlock(&shard->command_mutex);
+
+	if (reply)
+		CCTvRouterPrint(reply, reply_len);
+	else if (!ok)
+		SampleUtil_Print("No reply from shard %d\n", i);
+	free(reply);
+
+	return ok ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+int CCTvRouterCommand(int shard, const char *cmdline)
+{
+	int rc = CCTV_SUCCESS;
+	int running;
+	int i;
+
+	if (!RouterInitialized)
+		return CCTV_ERROR;
+	ithread_mutex_lock(&RouterMutex);
+	running = RouterRunning;
+	ithread_mutex_unlock(&RouterMutex);
+	/* a shard stopped meanwhile is down, see CCTvRouterRun() */
+	if (!running)
+		return CCTV_ERROR;
+	if (shard >= 0)
+		return shard < RouterCount ? CCTvRouterRun(shard, cmdline) :
+			CCTV_ERROR;
+	for (i = 0; i < RouterCount; i++) {
+		SampleUtil_Print("Shard %d:\n", i);
+		if (CCTvRouterRun(i, cmdline) != CCTV_SUCCESS)
+			rc = CCTV_ERROR;
+	}
+
+	return rc;
+}
+
+void CCTvRouterGetStats(struct CCTvRouterStats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof *stats);
+	if (!RouterInitialized)
+		return;
+	ithread_mutex_lock(&RouterMutex);
+	if (!RouterRunning) {
+		ithread_mutex_unlock(&RouterMutex);
+		return;
+	}
+	*stats = RouterStats;
+	stats->shards = RouterCount;
+	for (i = 0; i < RouterCount; i++) {
+		stats->shard[i] = RouterShards[i].stats;
+		stats->shard[i].pid = RouterShards[i].pid;
+		stats->shard[i].up = RouterShards[i].up;
+	}
+	ithread_mutex_unlock(&RouterMutex);
+}
+
+void CCTvRouterPrintStats(void)
+{
+	struct CCTvRouterStats stats;
+	int i;
+
+	CCTvRouterGetStats(&stats);
+	if (!stats.shards)
+		return;
+	SampleUtil_Print("Shards: %d of %d up, %lu cameras, %lu moved, "
+		"%lu dropped\n"
+		"  shard     pid  up  cameras  notifies  commands  errors"
+		"  overflows\n",
+		stats.up, stats.shards, stats.devices, stats.moved,
+		stats.dropped);
+	for (i = 0; i < stats.shards; i++) {
+		SampleUtil_Print("  %5d %7d %3s %8lu %9lu %9lu %7lu %10lu\n",
+			i, stats.shard[i].pid, stats.shard[i].up ? "yes" : "no",
+			stats.shard[i].devices, stats.shard[i].notifies,
+			stats.shard[i].commands, stats.shard[i].errors,
+			stats.shard[i].overflows);
+	}
+}
+
+/*! @} Control Point Shard Router */
+
+/*! @} UpnpSamples */
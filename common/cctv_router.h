@@ -0,0 +1,170 @@
+#ifndef UPNP_CCTV_ROUTER_H
+#define UPNP_CCTV_ROUTER_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Shard Router
+ *
+ * @{
+ *
+ * \file
+ *
+ * Front-end of a sharded control point. It starts the workers, each a
+ * control point process of its own with a command socket (see
+ * cctv_ctlsock.h), and talks to them over those sockets. The front-end
+ * does the discovery: every notification of a camera is handed to the
+ * worker owning it on the shard ring (see cctv_shard.h) as an Adopt
+ * command, byebyes as a Drop command. That worker fetches the description,
+ * subscribes, polls and recovers the camera.
+ *
+ * When a worker exits, it is taken off the ring and the cameras it owned
+ * are adopted by the others right away, from the locations the front-end
+ * keeps.
+ *
+ * Requests to a worker are sent without waiting: what its socket does not
+ * take at once is queued, up to CCTV_ROUTER_MAX_QUEUE bytes, and written
+ * by a thread of the worker. Notifications do not hold up the SDK thread
+ * delivering them.
+ */
+
+#include "cctv_shard.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Milliseconds a worker has to open its command socket. */
+#define CCTV_ROUTER_CONNECT_MS 15000
+
+/*! Milliseconds a command waits for the reply of a worker. */
+#define CCTV_ROUTER_REPLY_MS 30000
+
+/*! Milliseconds the workers have to exit on stop. */
+#define CCTV_ROUTER_STOP_MS 5000
+
+/*! Bytes of requests queued for a worker; further ones are dropped. */
+#define CCTV_ROUTER_MAX_QUEUE (1024 * 1024)
+
+/*! Counters of a worker. */
+struct CCTvRouterShardStats {
+	/*! Process, 0 once it exited. */
+	int pid;
+	/*! On the ring. */
+	int up;
+	/*! Cameras it owns. */
+	unsigned long devices;
+	/*! Notifications and commands sent to it, and errors replied. */
+	unsigned long notifies;
+	unsigned long commands;
+	unsigned long errors;
+	/*! Requests dropped for a full queue. */
+	unsigned long overflows;
+};
+
+/*! Counters of the router. */
+struct CCTvRouterStats {
+	int shards;
+	/*! Workers on the ring. */
+	int up;
+	/*! Cameras known. */
+	unsigned long devices;
+	/*! Cameras adopted by another worker when theirs went down. */
+	unsigned long moved;
+	/*! Notifications dropped for want of a worker. */
+	unsigned long dropped;
+	struct CCTvRouterShardStats shard[CCTV_SHARD_MAX];
+};
+
+/*!
+ * \brief Start the workers and connect to them. A worker is started as
+ * "<exe> -W -s <dir>/cctv_shard<n>.sock -v <log level>", with its output
+ * going to <dir>/cctv_shard<n>.log. Call before any thread is started.
+ *
+ * \return CCTV_SUCCESS if at least one worker is up, else CCTV_ERROR.
+ */
+int CCTvRouterStart(
+	/*! [in] Executable of the workers. */
+	const char *exe,
+	/*! [in] Number of workers, 1 to CCTV_SHARD_MAX. */
+	int nshards,
+	/*! [in] Directory of the sockets and logs. */
+	const char *dir);
+
+/*!
+ * \brief Stop the workers and wait for them. Does nothing if not started.
+ * Notifications arriving afterwards are ignored.
+ */
+void CCTvRouterStop(void);
+
+/*!
+ * \brief Free what the notifications use, once they cannot arrive any
+ * more: after the client is unregistered. Call after CCTvRouterStop().
+ */
+void CCTvRouterDestroy(void);
+
+/*!
+ * \brief Hand an ALIVE or search response of a camera to its worker.
+ *
+ * \return CCTV_SUCCESS, CCTV_WARNING if no worker is up, or CCTV_ERROR.
+ */
+int CCTvRouterNotify(
+	/*! [in] UDN of the camera. */
+	const char *UDN,
+	/*! [in] Description document URL. */
+	const char *location,
+	/*! [in] Advertisement expiry, in seconds. */
+	int expires);
+
+/*!
+ * \brief Hand a byebye of a camera to its worker, and forget the camera.
+ */
+void CCTvRouterByebye(
+	/*! [in] UDN of the camera. */
+	const char *UDN);
+
+/*!
+ * \brief Worker owning a camera.
+ *
+ * \return The shard, or -1 if no worker is up.
+ */
+int CCTvRouterOwner(
+	/*! [in] UDN of the camera. */
+	const char *UDN);
+
+/*!
+ * \brief Run a command on a worker, or on all workers one after the
+ * other, and print what it printed with SampleUtil_Print().
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if a worker failed the command, is
+ * down or did not reply.
+ */
+int CCTvRouterCommand(
+	/*! [in] Shard, -1 for all, each output preceded by its number. */
+	int shard,
+	/*! [in] Command line. */
+	const char *cmdline);
+
+/*!
+ * \brief Get the counters.
+ */
+void CCTvRouterGetStats(
+	/*! [out] Counters. */
+	struct CCTvRouterStats *stats);
+
+/*!
+ * \brief Print the counters with SampleUtil_Print(), if started.
+ */
+void CCTvRouterPrintStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Shard Router */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_ROUTER_H */
@@ -0,0 +1,114 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Shard Ring
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_shard.h"
+
+#include "cctv_ctrlpt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+unsigned int CCTvShardHash(const char *str)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619u;
+	}
+	/* FNV-1a alone leaves UDNs that differ in the last digit close
+	 * together on the ring */
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+void CCTvShardRingInit(struct CCTvShardRing *ring)
+{
+	ring->npoints = 0;
+}
+
+static int CCTvShardPointCompare(const void *a, const void *b)
+{
+	const struct CCTvShardPoint *pa = (const struct CCTvShardPoint *)a;
+	const struct CCTvShardPoint *pb = (const struct CCTvShardPoint *)b;
+
+	if (pa->hash != pb->hash)
+		return pa->hash < pb->hash ? -1 : 1;
+
+	/* the same on every front-end, whatever the order of adding */
+	return pa->shard - pb->shard;
+}
+
+int CCTvShardRingAdd(struct CCTvShardRing *ring, int shard)
+{
+	char name[32];
+	int i;
+
+	if (shard < 0 || shard >= CCTV_SHARD_MAX)
+		return CCTV_ERROR;
+	for (i = 0; i < ring->npoints; i++) {
+		if (ring->points[i].shard == shard)
+			return CCTV_ERROR;
+	}
+	for (i = 0; i < CCTV_SHARD_POINTS; i++) {
+		snprintf(name, sizeof name, "shard-%d-%d", shard, i);
+		ring->points[ring->npoints].hash = CCTvShardHash(name);
+		ring->points[ring->npoints].shard = shard;
+		ring->npoints++;
+	}
+	qsort(ring->points, (size_t)ring->npoints, sizeof ring->points[0],
+		CCTvShardPointCompare);
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvShardRingRemove(struct CCTvShardRing *ring, int shard)
+{
+	int n = 0;
+	int i;
+
+	/* stays sorted */
+	for (i = 0; i < ring->npoints; i++) {
+		if (ring->points[i].shard != shard)
+			ring->points[n++] = ring->points[i];
+	}
+	ring->npoints = n;
+}
+
+int CCTvShardRingOwner(const struct CCTvShardRing *ring, const char *UDN)
+{
+	unsigned int hash = CCTvShardHash(UDN);
+	int lo = 0;
+	int hi = ring->npoints;
+	int mid;
+
+	if (!ring->npoints)
+		return -1;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ring->points[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return ring->points[lo == ring->npoints ? 0 : lo].shard;
+}
+
+/*! @} Control Point Shard Ring */
+
+/*! @} UpnpSamples */
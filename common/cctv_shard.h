@@ -0,0 +1,97 @@
+#ifndef UPNP_CCTV_SHARD_H
+#define UPNP_CCTV_SHARD_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Shard Ring
+ *
+ * @{
+ *
+ * \file
+ *
+ * Consistent hashing of UDNs onto shards. Every shard has
+ * CCTV_SHARD_POINTS points on a ring of 32 bit hashes, and a device
+ * belongs to the shard of the first point at or after the hash of its
+ * UDN. Removing a shard only moves its own devices, spread over the
+ * others.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Most shards of a ring. */
+#define CCTV_SHARD_MAX 32
+
+/*! Points of every shard on the ring. */
+#define CCTV_SHARD_POINTS 160
+
+struct CCTvShardPoint {
+	unsigned int hash;
+	int shard;
+};
+
+/*! The ring, sorted by hash. */
+struct CCTvShardRing {
+	struct CCTvShardPoint points[CCTV_SHARD_MAX * CCTV_SHARD_POINTS];
+	int npoints;
+};
+
+/*!
+ * \brief Hash of a UDN on the ring.
+ */
+unsigned int CCTvShardHash(
+	/*! [in] String to hash. */
+	const char *str);
+
+/*!
+ * \brief Make an empty ring.
+ */
+void CCTvShardRingInit(
+	/*! [out] Ring. */
+	struct CCTvShardRing *ring);
+
+/*!
+ * \brief Put a shard on the ring.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if shard is out of range or already
+ * on the ring.
+ */
+int CCTvShardRingAdd(
+	/*! [in,out] Ring. */
+	struct CCTvShardRing *ring,
+	/*! [in] Shard, 0 to CCTV_SHARD_MAX - 1. */
+	int shard);
+
+/*!
+ * \brief Take a shard off the ring.
+ */
+void CCTvShardRingRemove(
+	/*! [in,out] Ring. */
+	struct CCTvShardRing *ring,
+	/*! [in] Shard. */
+	int shard);
+
+/*!
+ * \brief Shard a device belongs to.
+ *
+ * \return The shard, or -1 if the ring is empty.
+ */
+int CCTvShardRingOwner(
+	/*! [in] Ring. */
+	const struct CCTvShardRing *ring,
+	/*! [in] UDN of the device. */
+	const char *UDN);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Shard Ring */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_SHARD_H */
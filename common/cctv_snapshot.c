@@ -0,0 +1,429 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Registry Snapshot
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_snapshot.h"
+
+#include "sample_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*! Start of a snapshot file. */
+#define CCTV_SNAPSHOT_MAGIC "CCTVSNAP"
+
+/*! Changes whenever the layout does. */
+#define CCTV_SNAPSHOT_VERSION 1
+
+/*! Strings per device, in the order of struct CCTvSnapshotRecord. */
+#define CCTV_SNAPSHOT_STRINGS \
+	(4 + CCTV_SERVICE_SERVCOUNT * (3 + CCTV_MAXVARS))
+
+/*! Largest snapshot loaded. */
+#define CCTV_SNAPSHOT_MAX_BYTES (256 * 1024 * 1024)
+
+struct CCTvSnapshotHeader {
+	char magic[8];
+	unsigned int version;
+	/*! CCTV_SNAPSHOT_STRINGS of the writer. */
+	unsigned int strings;
+	unsigned int count;
+	/*! Bytes after the header, and their hash. */
+	unsigned int length;
+	unsigned int hash;
+};
+
+struct CCTvSnapshotWriter {
+	char *data;
+	size_t len;
+	size_t cap;
+	int count;
+	int failed;
+};
+
+/*! Guards everything below. */
+static ithread_mutex_t SnapshotMutex;
+/*! Signalled to stop the writer thread. */
+static ithread_cond_t SnapshotCond;
+static ithread_t SnapshotThread;
+static int SnapshotStarted;
+static int SnapshotRunning;
+static char *SnapshotPath;
+static long SnapshotPeriod;
+static CCTvSnapshotCollectFn SnapshotCollect;
+static struct CCTvSnapshotStats SnapshotStats;
+/*! Devices of the last load, set before the module starts. */
+static int SnapshotLoaded;
+
+static double CCTvSnapshotNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/*!
+ * \brief FNV-1a, to tell a damaged file.
+ */
+static unsigned int CCTvSnapshotHash(const char *data, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void CCTvSnapshotPut(struct CCTvSnapshotWriter *writer,
+	const char *str)
+{
+	size_t len = strlen(str ? str : "") + 1;
+	size_t cap;
+	char *grown;
+
+	if (writer->failed)
+		return;
+	if (writer->len + len > writer->cap) {
+		cap = writer->cap ? writer->cap : 65536;
+		while (cap < writer->len + len)
+			cap *= 2;
+		grown = (char *)realloc(writer->data, cap);
+		if (!grown) {
+			writer->failed = 1;
+			return;
+		}
+		writer->data = grown;
+		writer->cap = cap;
+	}
+	memcpy(writer->data + writer->len, str ? str : "", len);
+	writer->len += len;
+}
+
+int CCTvSnapshotAdd(struct CCTvSnapshotWriter *writer,
+	const struct CCTvSnapshotRecord *record)
+{
+	int service;
+	int var;
+
+	CCTvSnapshotPut(writer, record->UDN);
+	CCTvSnapshotPut(writer, record->location);
+	CCTvSnapshotPut(writer, record->friendlyName);
+	CCTvSnapshotPut(writer, record->presURL);
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		CCTvSnapshotPut(writer, record->serviceId[service]);
+		CCTvSnapshotPut(writer, record->eventURL[service]);
+		CCTvSnapshotPut(writer, record->controlURL[service]);
+		for (var = 0; var < CCTV_MAXVARS; var++)
+			CCTvSnapshotPut(writer, record->values[service][var]);
+	}
+	writer->count++;
+
+	return writer->failed ? CCTV_ERROR : CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Write all of a buffer.
+ */
+static int CCTvSnapshotWriteAll(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return CCTV_ERROR;
+		data += n;
+		len -= (size_t)n;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvSnapshotWrite(const char *path, CCTvSnapshotCollectFn collect)
+{
+	struct CCTvSnapshotWriter writer;
+	struct CCTvSnapshotHeader header;
+	char *tmp;
+	int rc = CCTV_ERROR;
+	int fd = -1;
+
+	memset(&writer, 0, sizeof writer);
+	collect(&writer);
+	tmp = (char *)malloc(strlen(path) + 5);
+	if (!writer.failed && writer.len <= CCTV_SNAPSHOT_MAX_BYTES && tmp) {
+		memset(&header, 0, sizeof header);
+		memcpy(header.magic, CCTV_SNAPSHOT_MAGIC, sizeof header.magic);
+		header.version = CCTV_SNAPSHOT_VERSION;
+		header.strings = CCTV_SNAPSHOT_STRINGS;
+		header.count = (unsigned int)writer.count;
+		header.length = (unsigned int)writer.len;
+		header.hash = CCTvSnapshotHash(writer.data, writer.len);
+		strcpy(tmp, path);
+		strcat(tmp, ".tmp");
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	}
+	/* written aside and renamed over, so there always is a whole one */
+	if (fd >= 0) {
+		if (CCTvSnapshotWriteAll(fd, (const char *)&header,
+			sizeof header) == CCTV_SUCCESS &&
+		    CCTvSnapshotWriteAll(fd, writer.data, writer.len) ==
+			CCTV_SUCCESS &&
+		    fsync(fd) == 0)
+			rc = CCTV_SUCCESS;
+		if (close(fd) != 0)
+			rc = CCTV_ERROR;
+		if (rc == CCTV_SUCCESS && rename(tmp, path) != 0)
+			rc = CCTV_ERROR;
+		if (rc != CCTV_SUCCESS)
+			unlink(tmp);
+	}
+	free(tmp);
+	free(writer.data);
+
+	return rc == CCTV_SUCCESS ? writer.count : CCTV_ERROR;
+}
+
+/*!
+ * \brief Point the fields of a record at the next strings of a snapshot.
+ *
+ * \return Where the next record starts, or NULL if a string runs past the
+ * end.
+ */
+static const char *CCTvSnapshotParse(const char *p, const char *end,
+	struct CCTvSnapshotRecord *record)
+{
+	const char **fields[CCTV_SNAPSHOT_STRINGS];
+	const char *nul;
+	int n = 0;
+	int service;
+	int var;
+	int i;
+
+	fields[n++] = &record->UDN;
+	fields[n++] = &record->location;
+	fields[n++] = &record->friendlyName;
+	fields[n++] = &record->presURL;
+	for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+		fields[n++] = &record->serviceId[service];
+		fields[n++] = &record->eventURL[service];
+		fields[n++] = &record->controlURL[service];
+		for (var = 0; var < CCTV_MAXVARS; var++)
+			fields[n++] = &record->values[service][var];
+	}
+	for (i = 0; i < n; i++) {
+		nul = (const char *)memchr(p, '\0', (size_t)(end - p));
+		if (!nul)
+			return NULL;
+		*fields[i] = p;
+		p = nul + 1;
+	}
+
+	return p;
+}
+
+int CCTvSnapshotLoad(const char *path, CCTvSnapshotRestoreFn restore,
+	void *arg)
+{
+	struct CCTvSnapshotHeader header;
+	struct CCTvSnapshotRecord record;
+	struct stat st;
+	const char *data;
+	const char *end;
+	const char *p;
+	void *map;
+	int count = CCTV_ERROR;
+	unsigned int i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return CCTV_ERROR;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof header ||
+	    st.st_size > CCTV_SNAPSHOT_MAX_BYTES) {
+		close(fd);
+		return CCTV_ERROR;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return CCTV_ERROR;
+	memcpy(&header, map, sizeof header);
+	data = (const char *)map + sizeof header;
+	end = data + header.length;
+	if (memcmp(header.magic, CCTV_SNAPSHOT_MAGIC, sizeof header.magic) ||
+	    header.version != CCTV_SNAPSHOT_VERSION ||
+	    header.strings != CCTV_SNAPSHOT_STRINGS ||
+	    header.length != (size_t)st.st_size - sizeof header ||
+	    header.hash != CCTvSnapshotHash(data, header.length))
+		goto done;
+	/* check it all before restoring anything */
+	for (i = 0, p = data; i < header.count && p; i++)
+		p = CCTvSnapshotParse(p, end, &record);
+	if (!p || p != end)
+		goto done;
+	for (i = 0, p = data; i < header.count; i++) {
+		p = CCTvSnapshotParse(p, end, &record);
+		restore(&record, arg);
+	}
+	count = (int)header.count;
+	SnapshotLoaded = count;
+
+done:
+	munmap(map, (size_t)st.st_size);
+
+	return count;
+}
+
+/*!
+ * \brief Write a snapshot and count it.
+ */
+static void CCTvSnapshotRun(void)
+{
+	double t0 = CCTvSnapshotNow();
+	struct stat st;
+	int count;
+
+	count = CCTvSnapshotWrite(SnapshotPath, SnapshotCollect);
+	ithread_mutex_lock(&SnapshotMutex);
+	if (count < 0) {
+		SnapshotStats.failed++;
+	} else {
+		SnapshotStats.written++;
+		SnapshotStats.devices = count;
+		SnapshotStats.bytes = stat(SnapshotPath, &st) == 0 ?
+			(unsigned long)st.st_size : 0;
+		SnapshotStats.write_ms = CCTvSnapshotNow() - t0;
+	}
+	ithread_mutex_unlock(&SnapshotMutex);
+	if (count < 0)
+		SampleUtil_Print("Error writing the snapshot %s\n",
+			SnapshotPath);
+}
+
+static void *CCTvSnapshotWorker(void *arg)
+{
+	struct timespec deadline;
+
+	ithread_mutex_lock(&SnapshotMutex);
+	while (SnapshotRunning) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += SnapshotPeriod / 1000;
+		deadline.tv_nsec += (SnapshotPeriod % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (SnapshotRunning &&
+		       ithread_cond_timedwait(&SnapshotCond, &SnapshotMutex,
+			&deadline) != ETIMEDOUT)
+			;
+		if (!SnapshotRunning)
+			break;
+		ithread_mutex_unlock(&SnapshotMutex);
+		CCTvSnapshotRun();
+		ithread_mutex_lock(&SnapshotMutex);
+	}
+	ithread_mutex_unlock(&SnapshotMutex);
+
+	return NULL;
+	arg = arg;
+}
+
+int CCTvSnapshotStart(const char *path, long period_ms,
+	CCTvSnapshotCollectFn collect)
+{
+	if (SnapshotStarted)
+		return CCTV_ERROR;
+	SnapshotPath = strdup(path);
+	if (!SnapshotPath)
+		return CCTV_ERROR;
+	ithread_mutex_init(&SnapshotMutex, 0);
+	ithread_cond_init(&SnapshotCond, 0);
+	SnapshotPeriod = period_ms > 0 ? period_ms : CCTV_SNAPSHOT_PERIOD_MS;
+	SnapshotCollect = collect;
+	memset(&SnapshotStats, 0, sizeof SnapshotStats);
+	SnapshotStats.loaded = SnapshotLoaded;
+	SnapshotRunning = 1;
+	if (ithread_create(&SnapshotThread, NULL, CCTvSnapshotWorker,
+		NULL) != 0) {
+		SnapshotRunning = 0;
+		ithread_cond_destroy(&SnapshotCond);
+		ithread_mutex_destroy(&SnapshotMutex);
+		free(SnapshotPath);
+		SnapshotPath = NULL;
+		return CCTV_ERROR;
+	}
+	SnapshotStarted = 1;
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvSnapshotStop(void)
+{
+	if (!SnapshotStarted)
+		return;
+	ithread_mutex_lock(&SnapshotMutex);
+	SnapshotRunning = 0;
+	ithread_cond_signal(&SnapshotCond);
+	ithread_mutex_unlock(&SnapshotMutex);
+	ithread_join(SnapshotThread, NULL);
+	CCTvSnapshotRun();
+	ithread_cond_destroy(&SnapshotCond);
+	ithread_mutex_destroy(&SnapshotMutex);
+	free(SnapshotPath);
+	SnapshotPath = NULL;
+	SnapshotStarted = 0;
+}
+
+void CCTvSnapshotGetStats(struct CCTvSnapshotStats *stats)
+{
+	if (!SnapshotStarted) {
+		memset(stats, 0, sizeof *stats);
+		stats->loaded = SnapshotLoaded;
+		return;
+	}
+	ithread_mutex_lock(&SnapshotMutex);
+	*stats = SnapshotStats;
+	ithread_mutex_unlock(&SnapshotMutex);
+}
+
+void CCTvSnapshotPrintStats(void)
+{
+	struct CCTvSnapshotStats stats;
+
+	if (!SnapshotStarted)
+		return;
+	CCTvSnapshotGetStats(&stats);
+	SampleUtil_Print("Snapshot %s:\n"
+		"  loaded at start %d devices\n"
+		"  written         %lu (%lu failed)\n"
+		"  last            %d devices, %lu bytes, %.1f ms\n",
+		SnapshotPath, stats.loaded, stats.written, stats.failed,
+		stats.devices, stats.bytes, stats.write_ms);
+}
+
+/*! @} Control Point Registry Snapshot */
+
+/*! @} UpnpSamples */
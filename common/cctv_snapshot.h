@@ -0,0 +1,158 @@
+#ifndef UPNP_CCTV_SNAPSHOT_H
+#define UPNP_CCTV_SNAPSHOT_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Registry Snapshot
+ *
+ * @{
+ *
+ * \file
+ *
+ * Keeps the known devices in a file, so that a restarted control point
+ * lists them at once instead of waiting for search responses and
+ * advertisements. The file is rewritten periodically and on stop: a
+ * header, then per device its strings one after the other, each ended by
+ * a NUL. It is replaced with a rename, so a crash leaves the previous
+ * one. Loading maps the file and hands out pointers into the mapping.
+ *
+ * What was loaded is only a hint: the control point lists the devices as
+ * unverified until their description was fetched again.
+ */
+
+#include "cctv_ctrlpt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Milliseconds between snapshots. */
+#define CCTV_SNAPSHOT_PERIOD_MS 60000
+
+/*! One device, as written and loaded. Missing strings are "". */
+struct CCTvSnapshotRecord {
+	const char *UDN;
+	/*! Location of the description document. */
+	const char *location;
+	const char *friendlyName;
+	const char *presURL;
+	/*! Per service, "" if the device does not have it. */
+	const char *serviceId[CCTV_SERVICE_SERVCOUNT];
+	const char *eventURL[CCTV_SERVICE_SERVCOUNT];
+	const char *controlURL[CCTV_SERVICE_SERVCOUNT];
+	/*! Last known state variable values. */
+	const char *values[CCTV_SERVICE_SERVCOUNT][CCTV_MAXVARS];
+};
+
+/*! A snapshot being written. */
+struct CCTvSnapshotWriter;
+
+/*!
+ * \brief Fill a snapshot with CCTvSnapshotAdd().
+ */
+typedef void (*CCTvSnapshotCollectFn)(
+	/*! [in] The snapshot. */
+	struct CCTvSnapshotWriter *writer);
+
+/*!
+ * \brief Called for every device of a loaded snapshot.
+ */
+typedef void (*CCTvSnapshotRestoreFn)(
+	/*! [in] The device, only valid during the call. */
+	const struct CCTvSnapshotRecord *record,
+	/*! [in] Argument given to CCTvSnapshotLoad(). */
+	void *arg);
+
+/*! Counters of the snapshots. */
+struct CCTvSnapshotStats {
+	/*! Devices loaded at start. */
+	int loaded;
+	/*! Snapshots written, and failures. */
+	unsigned long written;
+	unsigned long failed;
+	/*! Devices and bytes of the last one, and how long it took. */
+	int devices;
+	unsigned long bytes;
+	double write_ms;
+};
+
+/*!
+ * \brief Add a device to a snapshot.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if out of memory.
+ */
+int CCTvSnapshotAdd(
+	/*! [in,out] The snapshot. */
+	struct CCTvSnapshotWriter *writer,
+	/*! [in] The device. */
+	const struct CCTvSnapshotRecord *record);
+
+/*!
+ * \brief Write a snapshot now.
+ *
+ * \return The number of devices written, or CCTV_ERROR.
+ */
+int CCTvSnapshotWrite(
+	/*! [in] File name. */
+	const char *path,
+	/*! [in] Fills the snapshot. */
+	CCTvSnapshotCollectFn collect);
+
+/*!
+ * \brief Read a snapshot. Call before CCTvSnapshotStart(), which counts
+ * the devices loaded.
+ *
+ * \return The number of devices, or CCTV_ERROR if there is no snapshot or
+ * it is damaged, in which case restore is not called.
+ */
+int CCTvSnapshotLoad(
+	/*! [in] File name. */
+	const char *path,
+	/*! [in] Called for every device. */
+	CCTvSnapshotRestoreFn restore,
+	/*! [in] Argument of restore. */
+	void *arg);
+
+/*!
+ * \brief Write a snapshot every period_ms from a thread of its own.
+ *
+ * \return CCTV_SUCCESS, or CCTV_ERROR if already started.
+ */
+int CCTvSnapshotStart(
+	/*! [in] File name. */
+	const char *path,
+	/*! [in] Period, 0 for CCTV_SNAPSHOT_PERIOD_MS. */
+	long period_ms,
+	/*! [in] Fills the snapshots. */
+	CCTvSnapshotCollectFn collect);
+
+/*!
+ * \brief Stop writing, after one last snapshot. Does nothing if not
+ * started.
+ */
+void CCTvSnapshotStop(void);
+
+/*!
+ * \brief Get the counters.
+ */
+void CCTvSnapshotGetStats(
+	/*! [out] Counters. */
+	struct CCTvSnapshotStats *stats);
+
+/*!
+ * \brief Print the counters with SampleUtil_Print(), if started.
+ */
+void CCTvSnapshotPrintStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Registry Snapshot */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_SNAPSHOT_H */
@@ -0,0 +1,255 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Event Subscriptions
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_subscribe.h"
+
+#include "cctv_ctrlpt.h"
+#include "cctv_registry.h"
+#include "sample_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*! Number of hash buckets, a power of two. */
+#define CCTV_SUBSCRIBE_BUCKETS 1024
+
+/*! One wanted subscription. */
+struct CCTvSubscription {
+	char *eventURL;
+	unsigned int hash;
+	/*! Failed attempts since the last success. */
+	int attempts;
+	/*! Pending while a retry is scheduled. */
+	struct CCTvTimer timer;
+	/*! Next subscription in the same bucket. */
+	struct CCTvSubscription *next;
+};
+
+/*! Guards everything below. */
+static ithread_mutex_t SubscribeMutex;
+static int SubscribeRunning;
+static struct CCTvTimerWheel *SubscribeWheel;
+static const UpnpClient_Handle *SubscribeHandle;
+static Upnp_FunPtr SubscribeCallback;
+static CCTvSubscribeCompleteFn SubscribeComplete;
+static int SubscribeTimeout;
+static struct CCTvSubscription *SubscribeBuckets[CCTV_SUBSCRIBE_BUCKETS];
+/*! Seed of the backoff jitter. */
+static unsigned int SubscribeSeed = 1;
+
+static struct CCTvSubscription **CCTvSubscribeLookup(const char *eventURL)
+{
+	struct CCTvSubscription **psub;
+	unsigned int hash = CCTvRegistryHash(eventURL);
+
+	psub = &SubscribeBuckets[hash & (CCTV_SUBSCRIBE_BUCKETS - 1)];
+	while (*psub && ((*psub)->hash != hash ||
+		strcmp((*psub)->eventURL, eventURL) != 0))
+		psub = &(*psub)->next;
+
+	return psub;
+}
+
+/*!
+ * \brief Send one subscription request. Must be called without the lock,
+ * since libupnp may report the outcome before returning.
+ */
+static void CCTvSubscribeSend(const char *eventURL)
+{
+	int rc;
+
+	SampleUtil_Print("Subscribing to EventURL %s...\n", eventURL);
+	rc = UpnpSubscribeAsync(*SubscribeHandle, eventURL, SubscribeTimeout,
+		SubscribeCallback, NULL);
+	/* handled like a failed SUBSCRIBE_COMPLETE, which also records
+	 * the retry in the device node */
+	if (rc != UPNP_E_SUCCESS)
+		SubscribeComplete(eventURL, NULL, 0, rc);
+}
+
+/*!
+ * \brief Retry timer callback. The subscription is not freed while this
+ * runs, CCTvSubscribeCancel() waits for it.
+ */
+static void CCTvSubscribeRetry(struct CCTvTimer *timer, void *arg)
+{
+	struct CCTvSubscription *sub = (struct CCTvSubscription *)arg;
+
+	CCTvSubscribeSend(sub->eventURL);
+	timer = timer;
+}
+
+int CCTvSubscribeStart(struct CCTvTimerWheel *wheel,
+	const UpnpClient_Handle *handle, Upnp_FunPtr callback,
+	CCTvSubscribeCompleteFn complete, int timeout)
+{
+	if (!complete)
+		return CCTV_ERROR;
+	ithread_mutex_init(&SubscribeMutex, 0);
+	SubscribeWheel = wheel;
+	SubscribeHandle = handle;
+	SubscribeCallback = callback;
+	SubscribeComplete = complete;
+	SubscribeTimeout = timeout;
+	SubscribeRunning = 1;
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvSubscribeStop(void)
+{
+	struct CCTvSubscription *list = NULL;
+	struct CCTvSubscription *sub;
+	int i;
+
+	ithread_mutex_lock(&SubscribeMutex);
+	if (!SubscribeRunning) {
+		ithread_mutex_unlock(&SubscribeMutex);
+		return;
+	}
+	SubscribeRunning = 0;
+	for (i = 0; i < CCTV_SUBSCRIBE_BUCKETS; i++) {
+		while ((sub = SubscribeBuckets[i])) {
+			SubscribeBuckets[i] = sub->next;
+			sub->next = list;
+			list = sub;
+		}
+	}
+	ithread_mutex_unlock(&SubscribeMutex);
+
+	while ((sub = list)) {
+		list = sub->next;
+		CCTvTimerCancel(SubscribeWheel, &sub->timer);
+		free(sub->eventURL);
+		free(sub);
+	}
+}
+
+int CCTvSubscribeRequest(const char *eventURL)
+{
+	struct CCTvSubscription **psub;
+	struct CCTvSubscription *sub;
+
+	ithread_mutex_lock(&SubscribeMutex);
+	if (!SubscribeRunning) {
+		ithread_mutex_unlock(&SubscribeMutex);
+		return CCTV_ERROR;
+	}
+	psub = CCTvSubscribeLookup(eventURL);
+	sub = *psub;
+	if (!sub) {
+		sub = (struct CCTvSubscription *)calloc(1, sizeof *sub);
+		if (sub)
+			sub->eventURL = strdup(eventURL);
+		if (!sub || !sub->eventURL) {
+			free(sub);
+			ithread_mutex_unlock(&SubscribeMutex);
+			return CCTV_ERROR;
+		}
+		sub->hash = CCTvRegistryHash(eventURL);
+		CCTvTimerInit(&sub->timer, CCTvSubscribeRetry, sub);
+		*psub = sub;
+	}
+	/* send now, whatever retry was pending */
+	CCTvTimerDel(SubscribeWheel, &sub->timer);
+	ithread_mutex_unlock(&SubscribeMutex);
+
+	CCTvSubscribeSend(eventURL);
+
+	return CCTV_SUCCESS;
+}
+
+int CCTvSubscribeDone(const char *eventURL)
+{
+	struct CCTvSubscription *sub;
+	int ret = CCTV_SUCCESS;
+
+	ithread_mutex_lock(&SubscribeMutex);
+	sub = *CCTvSubscribeLookup(eventURL);
+	if (sub) {
+		sub->attempts = 0;
+		CCTvTimerDel(SubscribeWheel, &sub->timer);
+	} else {
+		ret = CCTV_WARNING;
+	}
+	ithread_mutex_unlock(&SubscribeMutex);
+
+	return ret;
+}
+
+int CCTvSubscribeFailed(const char *eventURL, int errCode)
+{
+	struct CCTvSubscription *sub;
+	int delay = -1;
+	int shift;
+
+	ithread_mutex_lock(&SubscribeMutex);
+	sub = *CCTvSubscribeLookup(eventURL);
+	if (sub && SubscribeRunning) {
+		sub->attempts++;
+		shift = sub->attempts - 1 < 16 ? sub->attempts - 1 : 16;
+		delay = CCTV_SUBSCRIBE_BACKOFF_MIN << shift;
+		if (delay > CCTV_SUBSCRIBE_BACKOFF_MAX || delay <= 0)
+			delay = CCTV_SUBSCRIBE_BACKOFF_MAX;
+		/* jitter, so cameras behind a rebooted switch do not all
+		 * retry in the same tick */
+		delay = delay / 2 + (int)(rand_r(&SubscribeSeed) %
+			(unsigned int)(delay / 2 + 1));
+		CCTvTimerArm(SubscribeWheel, &sub->timer, delay);
+		SampleUtil_Print(
+			"Error Subscribing to EventURL %s -- %d, retry %d in %d ms\n",
+			eventURL, errCode, sub->attempts, delay);
+	}
+	ithread_mutex_unlock(&SubscribeMutex);
+
+	return delay;
+}
+
+void CCTvSubscribeCancel(const char *eventURL)
+{
+	struct CCTvSubscription **psub;
+	struct CCTvSubscription *sub;
+
+	if (!eventURL || !*eventURL)
+		return;
+	ithread_mutex_lock(&SubscribeMutex);
+	psub = CCTvSubscribeLookup(eventURL);
+	sub = *psub;
+	if (sub)
+		*psub = sub->next;
+	ithread_mutex_unlock(&SubscribeMutex);
+	if (sub) {
+		/* unlinked, so a retry already running finds nothing to
+		 * reschedule; wait for it before freeing */
+		CCTvTimerCancel(SubscribeWheel, &sub->timer);
+		free(sub->eventURL);
+		free(sub);
+	}
+}
+
+const char *CCTvSubStateName(int state)
+{
+	switch (state) {
+	case CCTV_SUB_SUBSCRIBING:
+		return "subscribing";
+	case CCTV_SUB_SUBSCRIBED:
+		return "subscribed";
+	case CCTV_SUB_RETRYING:
+		return "retrying";
+	default:
+		return "none";
+	}
+}
+
+/*! @} Control Point Event Subscriptions */
+
+/*! @} UpnpSamples */
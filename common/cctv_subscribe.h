@@ -0,0 +1,144 @@
+#ifndef UPNP_CCTV_SUBSCRIBE_H
+#define UPNP_CCTV_SUBSCRIBE_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Event Subscriptions
+ *
+ * @{
+ *
+ * \file
+ *
+ * Subscriptions are sent with UpnpSubscribeAsync(), so no caller waits for a
+ * camera to answer. The outcome arrives as UPNP_EVENT_SUBSCRIBE_COMPLETE on
+ * the control point callback, which reports it back with
+ * CCTvSubscribeDone() or CCTvSubscribeFailed(). A failed subscription is
+ * retried from the control point timer wheel with exponential backoff,
+ * until it succeeds or the device goes away and CCTvSubscribeCancel() is
+ * called.
+ */
+
+#include "cctv_timer.h"
+#include "upnp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! First retry delay, in milliseconds. */
+#define CCTV_SUBSCRIBE_BACKOFF_MIN 1000
+
+/*! Longest retry delay, in milliseconds. */
+#define CCTV_SUBSCRIBE_BACKOFF_MAX 60000
+
+/*! Subscription state of one service of a device node. */
+enum CCTvSubState {
+	/*! The device has no event URL for the service. */
+	CCTV_SUB_NONE = 0,
+	/*! A subscription request is on its way. */
+	CCTV_SUB_SUBSCRIBING,
+	/*! SID is valid. */
+	CCTV_SUB_SUBSCRIBED,
+	/*! The last request failed, waiting to retry. */
+	CCTV_SUB_RETRYING
+};
+
+/*!
+ * \brief Handle the outcome of a subscription request, as
+ * CCTvCtrlPointHandleSubscribeComplete() does. Also called with the error
+ * of a request that could not be sent, so a failure is handled the same
+ * way whether it happened before or after sending.
+ */
+typedef void (*CCTvSubscribeCompleteFn)(
+	/*! [in] Event URL of the subscription. */
+	const char *eventURL,
+	/*! [in] SID, NULL unless errCode is UPNP_E_SUCCESS. */
+	const char *sid,
+	/*! [in] Subscription timeout, in seconds. */
+	int timeout,
+	/*! [in] UPnP error code of the request. */
+	int errCode);
+
+/*!
+ * \brief Start the module. This can be done before the client is
+ * registered, so that no SSDP callback can find the module stopped.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvSubscribeStart(
+	/*! [in] Running timer wheel the retries are scheduled on. It must
+	 * outlive the module. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in] Client handle to subscribe with, read at each request. */
+	const UpnpClient_Handle *handle,
+	/*! [in] Callback receiving UPNP_EVENT_SUBSCRIBE_COMPLETE. */
+	Upnp_FunPtr callback,
+	/*! [in] Told about requests that could not be sent. */
+	CCTvSubscribeCompleteFn complete,
+	/*! [in] Requested subscription timeout, in seconds. */
+	int timeout);
+
+/*!
+ * \brief Cancel all retries and forget all subscriptions.
+ */
+void CCTvSubscribeStop(void);
+
+/*!
+ * \brief Subscribe to an event URL. Returns without waiting for the device;
+ * if the request cannot even be sent it is retried later.
+ *
+ * \return CCTV_SUCCESS if the request was sent or a retry is scheduled,
+ * CCTV_ERROR if out of memory or stopped.
+ */
+int CCTvSubscribeRequest(
+	/*! [in] Event URL of the service. */
+	const char *eventURL);
+
+/*!
+ * \brief Report a completed subscription, resetting the backoff.
+ *
+ * \return CCTV_SUCCESS, or CCTV_WARNING if the subscription is no longer
+ * wanted (the device went away) and the SID should be released.
+ */
+int CCTvSubscribeDone(
+	/*! [in] Event URL of the service. */
+	const char *eventURL);
+
+/*!
+ * \brief Report a failed subscription and schedule a retry.
+ *
+ * \return The retry delay in milliseconds, or -1 if the subscription is no
+ * longer wanted.
+ */
+int CCTvSubscribeFailed(
+	/*! [in] Event URL of the service. */
+	const char *eventURL,
+	/*! [in] UPnP error code. */
+	int errCode);
+
+/*!
+ * \brief Stop subscribing and retrying an event URL.
+ */
+void CCTvSubscribeCancel(
+	/*! [in] Event URL of the service. */
+	const char *eventURL);
+
+/*!
+ * \brief Name of a subscription state, for printing.
+ */
+const char *CCTvSubStateName(
+	/*! [in] State. */
+	int state);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Event Subscriptions */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_SUBSCRIBE_H */
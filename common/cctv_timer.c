@@ -0,0 +1,291 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Timer Wheel
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "cctv_timer.h"
+
+#include "cctv_ctrlpt.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/*! Largest delay the wheel can hold, in ticks. */
+#define CCTV_TIMER_MAX_TICKS \
+	((1UL << (CCTV_TIMER_ROOT_BITS + \
+		CCTV_TIMER_LEVELS * CCTV_TIMER_LEVEL_BITS)) - 1)
+
+static double CCTvTimerNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void CCTvTimerListInit(struct CCTvTimer *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static void CCTvTimerListAdd(struct CCTvTimer *head, struct CCTvTimer *timer)
+{
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void CCTvTimerListDel(struct CCTvTimer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+/*! Move all timers of the list at from to the empty list at to. */
+static void CCTvTimerListMove(struct CCTvTimer *from, struct CCTvTimer *to)
+{
+	if (from->next == from) {
+		CCTvTimerListInit(to);
+		return;
+	}
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	CCTvTimerListInit(from);
+}
+
+/*! Put a timer in the slot of its expiry tick. Wheel lock held. */
+static void CCTvTimerInsert(struct CCTvTimerWheel *wheel,
+	struct CCTvTimer *timer)
+{
+	unsigned long delta = timer->expires - wheel->jiffies;
+	unsigned long expires = timer->expires;
+	int shift;
+	int l;
+
+	if (delta < CCTV_TIMER_ROOT_SIZE) {
+		CCTvTimerListAdd(&wheel->root[expires &
+			(CCTV_TIMER_ROOT_SIZE - 1)], timer);
+		return;
+	}
+	for (l = 0; l < CCTV_TIMER_LEVELS; l++) {
+		shift = CCTV_TIMER_ROOT_BITS + (l + 1) * CCTV_TIMER_LEVEL_BITS;
+		if (delta < (1UL << shift) || l == CCTV_TIMER_LEVELS - 1)
+			break;
+	}
+	shift = CCTV_TIMER_ROOT_BITS + l * CCTV_TIMER_LEVEL_BITS;
+	CCTvTimerListAdd(&wheel->level[l][(expires >> shift) &
+		(CCTV_TIMER_LEVEL_SIZE - 1)], timer);
+}
+
+/*!
+ * \brief Redistribute one slot of a higher level into the levels below.
+ *
+ * \return The slot index, so the caller knows whether to cascade further.
+ */
+static int CCTvTimerCascade(struct CCTvTimerWheel *wheel, int l)
+{
+	struct CCTvTimer list;
+	struct CCTvTimer *timer;
+	int shift = CCTV_TIMER_ROOT_BITS + l * CCTV_TIMER_LEVEL_BITS;
+	int index = (int)((wheel->jiffies >> shift) &
+		(CCTV_TIMER_LEVEL_SIZE - 1));
+
+	CCTvTimerListMove(&wheel->level[l][index], &list);
+	while (list.next != &list) {
+		timer = list.next;
+		CCTvTimerListDel(timer);
+		CCTvTimerInsert(wheel, timer);
+	}
+
+	return index;
+}
+
+/*! Fire everything due up to tick target. Wheel lock held. */
+static void CCTvTimerRun(struct CCTvTimerWheel *wheel, unsigned long target)
+{
+	struct CCTvTimer work;
+	struct CCTvTimer *timer;
+	int index;
+	int l;
+
+	while ((long)(target - wheel->jiffies) >= 0 && wheel->running) {
+		index = (int)(wheel->jiffies & (CCTV_TIMER_ROOT_SIZE - 1));
+		if (index == 0) {
+			for (l = 0; l < CCTV_TIMER_LEVELS; l++) {
+				if (CCTvTimerCascade(wheel, l) != 0)
+					break;
+			}
+		}
+		CCTvTimerListMove(&wheel->root[index], &work);
+		wheel->jiffies++;
+		/* callbacks may arm or cancel any timer, including the ones
+		 * still on the work list */
+		while (work.next != &work) {
+			timer = work.next;
+			CCTvTimerListDel(timer);
+			wheel->current = timer;
+			ithread_mutex_unlock(&wheel->mutex);
+			timer->fn(timer, timer->arg);
+			ithread_mutex_lock(&wheel->mutex);
+			wheel->current = NULL;
+			ithread_cond_broadcast(&wheel->cond);
+		}
+	}
+}
+
+static void *CCTvTimerThread(void *args)
+{
+	struct CCTvTimerWheel *wheel = (struct CCTvTimerWheel *)args;
+	struct timespec next;
+	double due;
+
+	ithread_mutex_lock(&wheel->mutex);
+	while (wheel->running) {
+		CCTvTimerRun(wheel, (unsigned long)((CCTvTimerNow() -
+			wheel->start) / wheel->tick_ms));
+		due = wheel->start + (double)wheel->jiffies * wheel->tick_ms;
+		ithread_mutex_unlock(&wheel->mutex);
+		next.tv_sec = (time_t)(due / 1e3);
+		next.tv_nsec = (long)((due - (double)next.tv_sec * 1e3) * 1e6);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		ithread_mutex_lock(&wheel->mutex);
+	}
+	ithread_mutex_unlock(&wheel->mutex);
+
+	return NULL;
+}
+
+void CCTvTimerInit(struct CCTvTimer *timer, CCTvTimerFn fn, void *arg)
+{
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+	timer->fn = fn;
+	timer->arg = arg;
+}
+
+int CCTvTimerWheelStart(struct CCTvTimerWheel *wheel, int tick_ms)
+{
+	int i;
+	int l;
+
+	if (tick_ms <= 0)
+		return CCTV_ERROR;
+	memset(wheel, 0, sizeof *wheel);
+	for (i = 0; i < CCTV_TIMER_ROOT_SIZE; i++)
+		CCTvTimerListInit(&wheel->root[i]);
+	for (l = 0; l < CCTV_TIMER_LEVELS; l++) {
+		for (i = 0; i < CCTV_TIMER_LEVEL_SIZE; i++)
+			CCTvTimerListInit(&wheel->level[l][i]);
+	}
+	ithread_mutex_init(&wheel->mutex, 0);
+	ithread_cond_init(&wheel->cond, 0);
+	wheel->tick_ms = tick_ms;
+	wheel->start = CCTvTimerNow();
+	wheel->running = 1;
+	if (ithread_create(&wheel->thread, NULL, CCTvTimerThread, wheel) != 0) {
+		wheel->running = 0;
+		return CCTV_ERROR;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+void CCTvTimerWheelStop(struct CCTvTimerWheel *wheel)
+{
+	ithread_mutex_lock(&wheel->mutex);
+	if (!wheel->running) {
+		ithread_mutex_unlock(&wheel->mutex);
+		return;
+	}
+	wheel->running = 0;
+	ithread_mutex_unlock(&wheel->mutex);
+	ithread_join(wheel->thread, NULL);
+}
+
+void CCTvTimerArm(struct CCTvTimerWheel *wheel, struct CCTvTimer *timer,
+	long delay_ms)
+{
+	unsigned long ticks;
+
+	if (delay_ms < 0)
+		delay_ms = 0;
+	ticks = ((unsigned long)delay_ms + (unsigned long)wheel->tick_ms - 1) /
+		(unsigned long)wheel->tick_ms;
+	if (ticks > CCTV_TIMER_MAX_TICKS)
+		ticks = CCTV_TIMER_MAX_TICKS;
+	ithread_mutex_lock(&wheel->mutex);
+	if (timer->next)
+		CCTvTimerListDel(timer);
+	timer->expires = wheel->jiffies + ticks;
+	CCTvTimerInsert(wheel, timer);
+	ithread_mutex_unlock(&wheel->mutex);
+}
+
+int CCTvTimerCancel(struct CCTvTimerWheel *wheel, struct CCTvTimer *timer)
+{
+	int pending = 0;
+
+	ithread_mutex_lock(&wheel->mutex);
+	if (timer->next) {
+		CCTvTimerListDel(timer);
+		pending = 1;
+	}
+	/* a callback cancelling its own timer must not wait for itself */
+	while (wheel->current == timer &&
+	       !pthread_equal(ithread_self(), wheel->thread))
+		ithread_cond_wait(&wheel->cond, &wheel->mutex);
+	ithread_mutex_unlock(&wheel->mutex);
+
+	return pending;
+}
+
+int CCTvTimerDel(struct CCTvTimerWheel *wheel, struct CCTvTimer *timer)
+{
+	int pending = 0;
+
+	ithread_mutex_lock(&wheel->mutex);
+	if (timer->next) {
+		CCTvTimerListDel(timer);
+		pending = 1;
+	}
+	ithread_mutex_unlock(&wheel->mutex);
+
+	return pending;
+}
+
+long CCTvTimerRemaining(struct CCTvTimerWheel *wheel, struct CCTvTimer *timer)
+{
+	long remaining = -1;
+	double due;
+
+	ithread_mutex_lock(&wheel->mutex);
+	if (timer->next) {
+		due = wheel->start + (double)timer->expires * wheel->tick_ms;
+		remaining = (long)(due - CCTvTimerNow());
+		if (remaining < 0)
+			remaining = 0;
+	}
+	ithread_mutex_unlock(&wheel->mutex);
+
+	return remaining;
+}
+
+/*! @} Control Point Timer Wheel */
+
+/*! @} UpnpSamples */
@@ -0,0 +1,167 @@
+#ifndef UPNP_CCTV_TIMER_H
+#define UPNP_CCTV_TIMER_H
+
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Control Point Timer Wheel
+ *
+ * @{
+ *
+ * \file
+ *
+ * Hierarchical timer wheel on CLOCK_MONOTONIC. Timers are embedded in the
+ * objects they belong to; arming, re-arming and cancelling one is O(1),
+ * and a tick costs O(1) amortized no matter how many timers are pending.
+ * The first level has 256 slots of one tick each, the three levels above
+ * it 64 slots each, so with the control point's 100 ms tick a timer can be
+ * up to about 77 days out (longer delays are clamped).
+ *
+ * Callbacks run on the wheel's own thread without the wheel lock held, so
+ * they may arm or cancel timers, including their own.
+ */
+
+#include "ithread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Tick of the control point timer wheel, in milliseconds. */
+#define CCTV_TIMER_TICK_MS 100
+
+#define CCTV_TIMER_ROOT_BITS 8
+#define CCTV_TIMER_LEVEL_BITS 6
+#define CCTV_TIMER_ROOT_SIZE (1 << CCTV_TIMER_ROOT_BITS)
+#define CCTV_TIMER_LEVEL_SIZE (1 << CCTV_TIMER_LEVEL_BITS)
+/*! Number of levels above the root level. */
+#define CCTV_TIMER_LEVELS 3
+
+struct CCTvTimer;
+
+/*!
+ * \brief Timer callback.
+ */
+typedef void (*CCTvTimerFn)(
+	/*! [in] The timer that fired. It is no longer pending. */
+	struct CCTvTimer *timer,
+	/*! [in] Argument given to CCTvTimerInit(). */
+	void *arg);
+
+/*! A timer, embedded in its owner. Initialize with CCTvTimerInit(). */
+struct CCTvTimer {
+	/*! Slot list links, NULL when not pending. */
+	struct CCTvTimer *next;
+	struct CCTvTimer *prev;
+	/*! Tick the timer is due. */
+	unsigned long expires;
+	CCTvTimerFn fn;
+	void *arg;
+};
+
+struct CCTvTimerWheel {
+	/*! Guards the slots and the tick counter. */
+	ithread_mutex_t mutex;
+	/*! Broadcast when a callback returns. */
+	ithread_cond_t cond;
+	ithread_t thread;
+	int running;
+	int tick_ms;
+	/*! Next tick to process. */
+	unsigned long jiffies;
+	/*! CLOCK_MONOTONIC milliseconds of tick 0. */
+	double start;
+	/*! Timer whose callback is running, if any. */
+	struct CCTvTimer *current;
+	/*! Slot list heads. */
+	struct CCTvTimer root[CCTV_TIMER_ROOT_SIZE];
+	struct CCTvTimer level[CCTV_TIMER_LEVELS][CCTV_TIMER_LEVEL_SIZE];
+};
+
+/*!
+ * \brief Initialize a timer, not pending.
+ */
+void CCTvTimerInit(
+	/*! [out] Timer. */
+	struct CCTvTimer *timer,
+	/*! [in] Callback. */
+	CCTvTimerFn fn,
+	/*! [in] Callback argument. */
+	void *arg);
+
+/*!
+ * \brief Start the wheel and its thread.
+ *
+ * \return CCTV_SUCCESS or CCTV_ERROR.
+ */
+int CCTvTimerWheelStart(
+	/*! [out] Wheel. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in] Tick, in milliseconds. */
+	int tick_ms);
+
+/*!
+ * \brief Stop the wheel thread. Pending timers are dropped without firing.
+ */
+void CCTvTimerWheelStop(
+	/*! [in,out] Wheel. */
+	struct CCTvTimerWheel *wheel);
+
+/*!
+ * \brief Arm or re-arm a timer to fire after delay_ms, rounded up to whole
+ * ticks.
+ */
+void CCTvTimerArm(
+	/*! [in,out] Wheel. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in,out] Timer. */
+	struct CCTvTimer *timer,
+	/*! [in] Delay, in milliseconds. */
+	long delay_ms);
+
+/*!
+ * \brief Cancel a timer. If its callback is running on another thread, wait
+ * for it to return, so the owner of the timer can be freed afterwards.
+ *
+ * \return 1 if the timer was pending, 0 otherwise.
+ */
+int CCTvTimerCancel(
+	/*! [in,out] Wheel. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in,out] Timer. */
+	struct CCTvTimer *timer);
+
+/*!
+ * \brief Cancel a timer without waiting for a running callback. Safe to
+ * call with locks held that the callback may take.
+ *
+ * \return 1 if the timer was pending, 0 otherwise.
+ */
+int CCTvTimerDel(
+	/*! [in,out] Wheel. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in,out] Timer. */
+	struct CCTvTimer *timer);
+
+/*!
+ * \brief Time left until a timer fires.
+ *
+ * \return Milliseconds, or -1 if the timer is not pending.
+ */
+long CCTvTimerRemaining(
+	/*! [in] Wheel. */
+	struct CCTvTimerWheel *wheel,
+	/*! [in] Timer. */
+	struct CCTvTimer *timer);
+
+#ifdef __cplusplus
+};
+#endif
+
+/*! @} Control Point Timer Wheel */
+
+/*! @} UpnpSamples */
+
+#endif /* UPNP_CCTV_TIMER_H */
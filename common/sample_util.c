@@ -41,8 +41,10 @@
 
 #include "sample_util.h"
 
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <time.h>
 
 #if !UPNP_HAVE_TOOLS
 #	error "Need upnptools.h to compile samples ; try ./configure --enable-tools"
@@ -59,8 +61,268 @@ state_update gStateUpdateFun = NULL;
 /*! mutex to control displaying of events */
 ithread_mutex_t display_mutex;
 
+/*! Highest level printed. */
+sample_log_level gLogLevel = (sample_log_level)SAMPLE_LOG_MAX_LEVEL;
+
+/*! Capture of the output of the current thread, see SampleUtil_SetCapture(). */
+static __thread print_capture gCaptureFun = NULL;
+static __thread void *gCaptureArg = NULL;
+
+/*! Formatting buffer of the current thread. */
+static __thread char gLogText[SAMPLE_LOG_MAX_LINE];
+
+/*! Whether the current thread waits for room in a full ring, see
+ * SampleUtil_SetLogWait(). */
+static __thread int gLogWait = 0;
+
+/*!
+ * Header of a message in the ring, followed by its text and padded to a
+ * multiple of its size. A message never wraps around the end of the ring:
+ * the bytes up to the end are skipped by a header of length LOG_SKIP.
+ */
+typedef struct {
+	unsigned int len;
+	/*! Set once the text is copied; the ring is zeroed once printed. */
+	unsigned int ready;
+} log_header;
+
+#define LOG_SKIP 0xffffffffu
+#define LOG_ALIGN(n) (((n) + sizeof(log_header) - 1) & \
+	~(sizeof(log_header) - 1))
+
+/*! Longest message in the ring; longer text is cut into several. */
+#define LOG_MAX_TEXT (SAMPLE_LOG_RING / 4 - sizeof(log_header))
+
+/*!
+ * The ring. The writers reserve space by moving gLogHead with a
+ * compare-and-swap, the flusher alone moves gLogTail; both only grow.
+ */
+static log_header gLogRing[SAMPLE_LOG_RING / sizeof(log_header)];
+static unsigned long gLogHead;
+static unsigned long gLogTail;
+
+static int gLogRunning;
+/*! Set while the flusher waits, so the writers know to wake it up. */
+static int gLogWaiting;
+static unsigned long gLogPrinted;
+static unsigned long gLogDropped;
+static ithread_t gLogThread;
+static ithread_mutex_t gLogMutex;
+static ithread_cond_t gLogCond;
+
+/*! Text handed to the print function at once, at most one message more
+ * than LOG_MAX_TEXT. */
+static char gLogBatch[2 * LOG_MAX_TEXT + 1];
+
+static log_header *SampleUtil_LogAt(unsigned long pos)
+{
+	return (log_header *)((char *)gLogRing +
+		(pos & (SAMPLE_LOG_RING - 1)));
+}
+
+/*!
+ * \brief Print the batch, with the number of messages dropped since the
+ * last one.
+ */
+static void SampleUtil_LogOutput(size_t len, unsigned long *dropped)
+{
+	unsigned long n = __atomic_load_n(&gLogDropped, __ATOMIC_RELAXED);
+
+	gLogBatch[len] = '\0';
+	if (gPrintFun && len)
+		gPrintFun("%s", gLogBatch);
+	if (gPrintFun && n != *dropped)
+		gPrintFun("[%lu messages dropped]\n", n - *dropped);
+	*dropped = n;
+}
+
+/*!
+ * \brief Print the messages in the ring, up to the first one still being
+ * copied.
+ *
+ * \return Whether something was printed.
+ */
+static int SampleUtil_LogDrain(unsigned long *dropped)
+{
+	unsigned long tail = gLogTail;
+	log_header *header;
+	size_t batch = 0;
+	size_t size;
+	int printed = 0;
+
+	while (tail != __atomic_load_n(&gLogHead, __ATOMIC_ACQUIRE)) {
+		header = SampleUtil_LogAt(tail);
+		if (!__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE))
+			break;
+		if (header->len == LOG_SKIP) {
+			size = SAMPLE_LOG_RING - (tail & (SAMPLE_LOG_RING - 1));
+		} else {
+			if (batch > LOG_MAX_TEXT) {
+				SampleUtil_LogOutput(batch, dropped);
+				batch = 0;
+			}
+			memcpy(gLogBatch + batch, header + 1, header->len);
+			batch += header->len;
+			__atomic_fetch_add(&gLogPrinted, 1, __ATOMIC_RELAXED);
+			size = LOG_ALIGN(sizeof *header + header->len);
+		}
+		/* the next headers may land anywhere in there */
+		memset(header, 0, size);
+		tail += size;
+		__atomic_store_n(&gLogTail, tail, __ATOMIC_RELEASE);
+		printed = 1;
+	}
+	if (printed ||
+	    __atomic_load_n(&gLogDropped, __ATOMIC_RELAXED) != *dropped)
+		SampleUtil_LogOutput(batch, dropped);
+
+	return printed;
+}
+
+/*!
+ * \brief Whether the message at the tail can be printed.
+ */
+static int SampleUtil_LogReady(void)
+{
+	unsigned long tail = gLogTail;
+
+	return tail != __atomic_load_n(&gLogHead, __ATOMIC_ACQUIRE) &&
+		__atomic_load_n(&SampleUtil_LogAt(tail)->ready,
+			__ATOMIC_ACQUIRE);
+}
+
+static void *SampleUtil_LogFlusher(void *arg)
+{
+	unsigned long dropped = 0;
+	struct timespec deadline;
+
+	while (1) {
+		if (SampleUtil_LogDrain(&dropped))
+			continue;
+		if (!__atomic_load_n(&gLogRunning, __ATOMIC_ACQUIRE)) {
+			/* what came in since */
+			SampleUtil_LogDrain(&dropped);
+			break;
+		}
+		ithread_mutex_lock(&gLogMutex);
+		__atomic_store_n(&gLogWaiting, 1, __ATOMIC_SEQ_CST);
+		/* pairs with the fence of SampleUtil_LogWrite() */
+		if (!SampleUtil_LogReady() &&
+		    __atomic_load_n(&gLogRunning, __ATOMIC_ACQUIRE)) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += SAMPLE_LOG_IDLE_MS / 1000;
+			ithread_cond_timedwait(&gLogCond, &gLogMutex, &deadline);
+		}
+		__atomic_store_n(&gLogWaiting, 0, __ATOMIC_RELAXED);
+		ithread_mutex_unlock(&gLogMutex);
+	}
+
+	return NULL;
+	arg = arg;
+}
+
+/*!
+ * \brief Wake up the flusher if it waits.
+ */
+static void SampleUtil_LogWake(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&gLogWaiting, __ATOMIC_RELAXED)) {
+		ithread_mutex_lock(&gLogMutex);
+		ithread_cond_signal(&gLogCond);
+		ithread_mutex_unlock(&gLogMutex);
+	}
+}
+
+/*!
+ * \brief Copy a message into the ring. Never blocks, but to wake up the
+ * flusher, or if the thread asked to wait for room.
+ */
+static void SampleUtil_LogWrite(const char *text, size_t len)
+{
+	log_header *header;
+	unsigned long head;
+	size_t offset;
+	size_t need;
+	size_t skip;
+	size_t n;
+
+	while (len > 0) {
+		n = len < LOG_MAX_TEXT ? len : LOG_MAX_TEXT;
+		need = LOG_ALIGN(sizeof *header + n);
+		head = __atomic_load_n(&gLogHead, __ATOMIC_RELAXED);
+		while (1) {
+			offset = head & (SAMPLE_LOG_RING - 1);
+			skip = offset + need > SAMPLE_LOG_RING ?
+				SAMPLE_LOG_RING - offset : 0;
+			if (head + skip + need - __atomic_load_n(&gLogTail,
+				__ATOMIC_ACQUIRE) <= SAMPLE_LOG_RING) {
+				if (__atomic_compare_exchange_n(&gLogHead, &head,
+					head + skip + need, 1, __ATOMIC_ACQ_REL,
+					__ATOMIC_RELAXED))
+					break;
+				continue;
+			}
+			if (!gLogWait ||
+			    !__atomic_load_n(&gLogRunning, __ATOMIC_ACQUIRE)) {
+				__atomic_fetch_add(&gLogDropped, 1,
+					__ATOMIC_RELAXED);
+				SampleUtil_LogWake();
+				return;
+			}
+			SampleUtil_LogWake();
+			imillisleep(1);
+			head = __atomic_load_n(&gLogHead, __ATOMIC_RELAXED);
+		}
+		if (skip) {
+			header = SampleUtil_LogAt(head);
+			header->len = LOG_SKIP;
+			__atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+		}
+		header = SampleUtil_LogAt(head + skip);
+		header->len = (unsigned int)n;
+		memcpy(header + 1, text, n);
+		__atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+		text += n;
+		len -= n;
+	}
+	SampleUtil_LogWake();
+}
+
+/*!
+ * \brief Stop the flusher once the ring is printed.
+ */
+static void SampleUtil_LogStop(void)
+{
+	if (!__atomic_exchange_n(&gLogRunning, 0, __ATOMIC_ACQ_REL))
+		return;
+	ithread_mutex_lock(&gLogMutex);
+	ithread_cond_signal(&gLogCond);
+	ithread_mutex_unlock(&gLogMutex);
+	ithread_join(gLogThread, NULL);
+}
+
+/*!
+ * \brief Send text to the capture of the thread, or else to the ring, or
+ * straight to the print function if the flusher did not start.
+ */
+static void SampleUtil_Emit(const char *text, size_t len)
+{
+	if (gCaptureFun) {
+		gCaptureFun(text, gCaptureArg);
+	} else if (__atomic_load_n(&gLogRunning, __ATOMIC_ACQUIRE)) {
+		SampleUtil_LogWrite(text, len);
+	} else if (gPrintFun) {
+		ithread_mutex_lock(&display_mutex);
+		gPrintFun("%s", text);
+		ithread_mutex_unlock(&display_mutex);
+	}
+}
+
 int SampleUtil_Initialize(print_string print_function)
 {
+	static int registered = 0;
+
 	if (initialize_init) {
 		ithread_mutexattr_t attr;
 
@@ -72,6 +334,17 @@ int SampleUtil_Initialize(print_string print_function)
 		ithread_mutex_lock(&display_mutex);
 		gPrintFun = print_function;
 		ithread_mutex_unlock(&display_mutex);
+		ithread_mutex_init(&gLogMutex, NULL);
+		ithread_cond_init(&gLogCond, NULL);
+		gLogRunning = 1;
+		if (ithread_create(&gLogThread, NULL, SampleUtil_LogFlusher,
+			NULL) != 0)
+			gLogRunning = 0;
+		/* what is printed just before exit() still shows */
+		if (!registered) {
+			atexit(SampleUtil_LogStop);
+			registered = 1;
+		}
 		/* Finished initializing. */
 		initialize_init = 0;
 	}
@@ -91,6 +364,9 @@ int SampleUtil_RegisterUpdateFunction(state_update update_function)
 
 int SampleUtil_Finish()
 {
+	SampleUtil_LogStop();
+	ithread_cond_destroy(&gLogCond);
+	ithread_mutex_destroy(&gLogMutex);
 	ithread_mutex_destroy(&display_mutex);
 	gPrintFun = NULL;
 	gStateUpdateFun = NULL;
@@ -179,7 +455,7 @@ static IXML_NodeList *SampleUtil_GetNthServiceList(
 			ServiceList = ixmlElement_getElementsByTagName(
 				(IXML_Element *)servlistnode, "service");
 		} else
-			SampleUtil_Print("%s(%d): ixmlNodeList_item(nodeList, n) returned NULL\n",
+			SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): ixmlNodeList_item(nodeList, n) returned NULL\n",
 				__FILE__, __LINE__);
 	}
 	if (servlistnodelist)
@@ -203,29 +479,29 @@ char *SampleUtil_GetFirstDocumentItem(IXML_Document *doc, const char *item)
 		if (tmpNode) {
 			textNode = ixmlNode_getFirstChild(tmpNode);
 			if (!textNode) {
-				SampleUtil_Print("%s(%d): (BUG) ixmlNode_getFirstChild(tmpNode) returned NULL\n",
+				SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): (BUG) ixmlNode_getFirstChild(tmpNode) returned NULL\n",
 					__FILE__, __LINE__); 
 				ret = strdup("");
 				goto epilogue;
 			}
 			nodeValue = ixmlNode_getNodeValue(textNode);
 			if (!nodeValue) {
-				SampleUtil_Print("%s(%d): ixmlNode_getNodeValue returned NULL\n",
+				SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): ixmlNode_getNodeValue returned NULL\n",
 					__FILE__, __LINE__); 
 				ret = strdup("");
 				goto epilogue;
 			}
 			ret = strdup(nodeValue);
 			if (!ret) {
-				SampleUtil_Print("%s(%d): Error allocating memory for XML Node value\n",
+				SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): Error allocating memory for XML Node value\n",
 					__FILE__, __LINE__); 
 				ret = strdup("");
 			}
 		} else
-			SampleUtil_Print("%s(%d): ixmlNodeList_item(nodeList, 0) returned NULL\n",
+			SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): ixmlNodeList_item(nodeList, 0) returned NULL\n",
 				__FILE__, __LINE__);
 	} /*else
-		SampleUtil_Print("%s(%d): Error finding %s in XML Node\n",
+		SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): Error finding %s in XML Node\n",
 			__FILE__, __LINE__, item);*/
 
 epilogue:
@@ -244,13 +520,13 @@ char *SampleUtil_GetFirstElementItem(IXML_Element *element, const char *item)
 
 	nodeList = ixmlElement_getElementsByTagName(element, (char *)item);
 	if (nodeList == NULL) {
-		SampleUtil_Print("%s(%d): Error finding %s in XML Node\n",
+		SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): Error finding %s in XML Node\n",
 			__FILE__, __LINE__, item);
 		return NULL;
 	}
 	tmpNode = ixmlNodeList_item(nodeList, 0);
 	if (!tmpNode) {
-		SampleUtil_Print("%s(%d): Error finding %s value in XML Node\n",
+		SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): Error finding %s value in XML Node\n",
 			__FILE__, __LINE__, item);
 		ixmlNodeList_free(nodeList);
 		return NULL;
@@ -258,7 +534,7 @@ char *SampleUtil_GetFirstElementItem(IXML_Element *element, const char *item)
 	textNode = ixmlNode_getFirstChild(tmpNode);
 	ret = strdup(ixmlNode_getNodeValue(textNode));
 	if (!ret) {
-		SampleUtil_Print("%s(%d): Error allocating memory for %s in XML Node\n",
+		SampleUtil_Log(SAMPLE_LOG_ERROR, "%s(%d): Error allocating memory for %s in XML Node\n",
 			__FILE__, __LINE__, item);
 		ixmlNodeList_free(nodeList);
 		return NULL;
@@ -322,9 +598,29 @@ void SampleUtil_PrintEventType(Upnp_EventType S)
 	}
 }
 
+/*!
+ * \brief Capture collecting the lines of SampleUtil_PrintEvent().
+ */
+static void SampleUtil_CaptureEvent(const char *text, void *arg)
+{
+	fputs(text, (FILE *)arg);
+}
+
 int SampleUtil_PrintEvent(Upnp_EventType EventType, const void *Event)
 {
-	ithread_mutex_lock(&display_mutex);
+	print_capture capture = gCaptureFun;
+	void *capture_arg = gCaptureArg;
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out;
+
+	if (!SampleUtil_LogEnabled(SAMPLE_LOG_DEBUG))
+		return 0;
+	/* the lines go out as one message, not mixed with other threads' */
+	out = open_memstream(&text, &len);
+	if (!out)
+		return 0;
+	SampleUtil_SetCapture(SampleUtil_CaptureEvent, out);
 
 	SampleUtil_Print(
 		"======================================================================\n"
@@ -550,18 +846,47 @@ int SampleUtil_PrintEvent(Upnp_EventType EventType, const void *Event)
 		"======================================================================\n"
 		"\n\n\n");
 
-	ithread_mutex_unlock(&display_mutex);
+	SampleUtil_SetCapture(capture, capture_arg);
+	if (fclose(out) == 0)
+		SampleUtil_Emit(text, len);
+	free(text);
 
 	return 0;
 }
 
+/*!
+ * \brief Read the identifiers of a service element, resolving its URLs
+ * against base.
+ */
+static void SampleUtil_ParseService(IXML_Element *service, const char *base,
+	char **serviceId, char **eventURL, char **controlURL)
+{
+	char *relcontrolURL;
+	char *releventURL;
+	int ret;
+
+	*serviceId = SampleUtil_GetFirstElementItem(service, "serviceId");
+	SampleUtil_Print("serviceId: %s\n", *serviceId);
+	relcontrolURL = SampleUtil_GetFirstElementItem(service, "controlURL");
+	releventURL = SampleUtil_GetFirstElementItem(service, "eventSubURL");
+	ret = UpnpResolveURL2(base, relcontrolURL, controlURL);
+	if (ret != UPNP_E_SUCCESS)
+		SampleUtil_Print("Error generating controlURL from %s + %s\n",
+				 base, relcontrolURL);
+	ret = UpnpResolveURL2(base, releventURL, eventURL);
+	if (ret != UPNP_E_SUCCESS)
+		SampleUtil_Print("Error generating eventURL from %s + %s\n",
+				 base, releventURL);
+	free(relcontrolURL);
+	free(releventURL);
+}
+
 int SampleUtil_FindAndParseService(IXML_Document *DescDoc, const char *location,
 	const char *serviceType, char **serviceId, char **eventURL, char **controlURL)
 {
 	unsigned int i;
 	unsigned long length;
 	int found = 0;
-	int ret;
 #ifdef OLD_FIND_SERVICE_CODE
 #else /* OLD_FIND_SERVICE_CODE */
 	unsigned int sindex = 0;
@@ -569,8 +894,6 @@ int SampleUtil_FindAndParseService(IXML_Document *DescDoc, const char *location,
 	char *tempServiceType = NULL;
 	char *baseURL = NULL;
 	const char *base = NULL;
-	char *relcontrolURL = NULL;
-	char *releventURL = NULL;
 	IXML_NodeList *serviceList = NULL;
 	IXML_Element *service = NULL;
 
@@ -586,8 +909,6 @@ int SampleUtil_FindAndParseService(IXML_Document *DescDoc, const char *location,
 	     (serviceList = SampleUtil_GetNthServiceList(DescDoc , sindex)) != NULL;
 	     sindex++) {
 		tempServiceType = NULL;
-		relcontrolURL = NULL;
-		releventURL = NULL;
 		service = NULL;
 #endif /* OLD_FIND_SERVICE_CODE */
 		length = ixmlNodeList_length(serviceList);
@@ -597,22 +918,8 @@ int SampleUtil_FindAndParseService(IXML_Document *DescDoc, const char *location,
 				(IXML_Element *)service, "serviceType");
 			if (tempServiceType && strcmp(tempServiceType, serviceType) == 0) {
 				SampleUtil_Print("Found service: %s\n", serviceType);
-				*serviceId = SampleUtil_GetFirstElementItem(service, "serviceId");
-				SampleUtil_Print("serviceId: %s\n", *serviceId);
-				relcontrolURL = SampleUtil_GetFirstElementItem(service, "controlURL");
-				releventURL = SampleUtil_GetFirstElementItem(service, "eventSubURL");
-				ret = UpnpResolveURL2(base, relcontrolURL, controlURL);
-				if (ret != UPNP_E_SUCCESS)
-					SampleUtil_Print("Error generating controlURL from %s + %s\n",
-							 base, relcontrolURL);
-				ret = UpnpResolveURL2(base, releventURL, eventURL);
-				if (ret != UPNP_E_SUCCESS)
-					SampleUtil_Print("Error generating eventURL from %s + %s\n",
-							 base, releventURL);
-				free(relcontrolURL);
-				free(releventURL);
-				relcontrolURL = NULL;
-				releventURL = NULL;
+				SampleUtil_ParseService(service, base, serviceId,
+					eventURL, controlURL);
 				found = 1;
 				break;
 			}
@@ -633,27 +940,180 @@ int SampleUtil_FindAndParseService(IXML_Document *DescDoc, const char *location,
 	return found;
 }
 
+/*!
+ * \brief First child of element that is an element named name.
+ */
+static IXML_Element *SampleUtil_GetChildElement(IXML_Element *element,
+	const char *name)
+{
+	IXML_Node *child;
+
+	for (child = ixmlNode_getFirstChild((IXML_Node *)element); child;
+	     child = ixmlNode_getNextSibling(child)) {
+		if (ixmlNode_getNodeType(child) == eELEMENT_NODE &&
+		    strcmp(ixmlNode_getNodeName(child), name) == 0)
+			return (IXML_Element *)child;
+	}
+
+	return NULL;
+}
+
+char *SampleUtil_GetDeviceItem(IXML_Element *device, const char *item)
+{
+	IXML_Element *child = SampleUtil_GetChildElement(device, item);
+
+	return child ? SampleUtil_GetElementValue(child) : NULL;
+}
+
+int SampleUtil_FindAndParseDeviceService(IXML_Element *device,
+	const char *base, const char *serviceType, char **serviceId,
+	char **eventURL, char **controlURL)
+{
+	IXML_Element *serviceList;
+	IXML_Node *service;
+	char *type;
+	int found = 0;
+
+	serviceList = SampleUtil_GetChildElement(device, "serviceList");
+	if (!serviceList)
+		return 0;
+	for (service = ixmlNode_getFirstChild((IXML_Node *)serviceList);
+	     service && !found; service = ixmlNode_getNextSibling(service)) {
+		if (ixmlNode_getNodeType(service) != eELEMENT_NODE ||
+		    strcmp(ixmlNode_getNodeName(service), "service") != 0)
+			continue;
+		type = SampleUtil_GetFirstElementItem(
+			(IXML_Element *)service, "serviceType");
+		if (type && strcmp(type, serviceType) == 0) {
+			SampleUtil_ParseService((IXML_Element *)service, base,
+				serviceId, eventURL, controlURL);
+			found = 1;
+		}
+		free(type);
+	}
+
+	return found;
+}
+
+static int SampleUtil_VLog(sample_log_level level, const char *fmt,
+	va_list ap)
+{
+	int rc;
+	size_t len;
+
+	if (!SampleUtil_LogEnabled(level))
+		return 0;
+	/* only this thread sees the buffer, no need for a mutex */
+	rc = vsnprintf(gLogText, sizeof gLogText, fmt, ap);
+	if (rc < 0)
+		return rc;
+	len = (size_t)rc < sizeof gLogText ? (size_t)rc :
+		sizeof gLogText - 1;
+	SampleUtil_Emit(gLogText, len);
+
+	return rc;
+}
+
 int SampleUtil_Print(const char *fmt, ...)
 {
-#define MAX_BUF (8 * 1024)
 	va_list ap;
-	static char buf[MAX_BUF];
 	int rc;
 
-	/* Protect both the display and the static buffer with the mutex */
-	ithread_mutex_lock(&display_mutex);
-
 	va_start(ap, fmt);
-	rc = vsnprintf(buf, MAX_BUF, fmt, ap);
+	rc = SampleUtil_VLog(SAMPLE_LOG_INFO, fmt, ap);
 	va_end(ap);
-	if (gPrintFun)
-		gPrintFun("%s", buf);
 
-	ithread_mutex_unlock(&display_mutex);
+	return rc;
+}
+
+int SampleUtil_Log(sample_log_level level, const char *fmt, ...)
+{
+	va_list ap;
+	int rc;
+
+	va_start(ap, fmt);
+	rc = SampleUtil_VLog(level, fmt, ap);
+	va_end(ap);
 
 	return rc;
 }
 
+void SampleUtil_SetLogLevel(sample_log_level level)
+{
+	__atomic_store_n(&gLogLevel, level, __ATOMIC_RELAXED);
+}
+
+int SampleUtil_LogEnabled(sample_log_level level)
+{
+	return SAMPLE_LOG_ENABLED(level);
+}
+
+int SampleUtil_ParseLogLevel(const char *name)
+{
+	static const char *names[] = { "error", "warning", "info", "debug" };
+	int i;
+
+	for (i = 0; i <= SAMPLE_LOG_DEBUG; i++) {
+		if (strcasecmp(name, names[i]) == 0 ||
+		    (name[0] == '0' + i && name[1] == '\0'))
+			return i;
+	}
+
+	return -1;
+}
+
+int SampleUtil_ParseAddressPort(const char *arg, char *address, size_t size,
+	unsigned short *port)
+{
+	const char *colon = strrchr(arg, ':');
+	const char *digits = colon ? colon + 1 : arg;
+	unsigned long value;
+	char *end;
+
+	if (*digits < '0' || *digits > '9')
+		return -1;
+	errno = 0;
+	value = strtoul(digits, &end, 10);
+	if (*end != '\0' || errno != 0 || value < 1 || value > 65535)
+		return -1;
+	if (colon) {
+		if (colon == arg || (size_t)(colon - arg) >= size)
+			return -1;
+		memcpy(address, arg, (size_t)(colon - arg));
+		address[colon - arg] = '\0';
+	}
+	*port = (unsigned short)value;
+
+	return 0;
+}
+
+void SampleUtil_SetLogWait(int wait)
+{
+	gLogWait = wait;
+}
+
+void SampleUtil_Flush(void)
+{
+	unsigned long head = __atomic_load_n(&gLogHead, __ATOMIC_ACQUIRE);
+
+	/* the flusher moves the tail past head, unless it stopped */
+	while (__atomic_load_n(&gLogRunning, __ATOMIC_ACQUIRE) &&
+	       (long)(__atomic_load_n(&gLogTail, __ATOMIC_ACQUIRE) - head) < 0)
+		imillisleep(1);
+}
+
+void SampleUtil_GetLogStats(sample_log_stats *stats)
+{
+	stats->printed = __atomic_load_n(&gLogPrinted, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&gLogDropped, __ATOMIC_RELAXED);
+}
+
+void SampleUtil_SetCapture(print_capture capture, void *arg)
+{
+	gCaptureFun = capture;
+	gCaptureArg = arg;
+}
+
 void SampleUtil_StateUpdate(const char *varName, const char *varValue,
 	const char *UDN, eventType type)
 {
@@ -118,6 +118,19 @@ char *SampleUtil_GetFirstElementItem(
 	/*! [in] The item to search for. */
 	const char *item); 
 
+/*!
+ * \brief Given the DOM element of a device, returns the value of its child
+ * element named by item, not looking into its embedded devices.
+ * The string must be freed using free.
+ *
+ * \return The value, or NULL if the device has no such child.
+ */
+char *SampleUtil_GetDeviceItem(
+	/*! [in] The device element. */
+	IXML_Element *device,
+	/*! [in] The item to search for. */
+	const char *item);
+
 /*!
  * \brief Prints a callback event type as a string.
  */
@@ -154,6 +167,26 @@ int SampleUtil_FindAndParseService (
 	/*! [out] The control URL for the service. */
 	char **controlURL);
 
+/*!
+ * \brief Like SampleUtil_FindAndParseService(), for the services of a
+ * single device of the description, root or embedded.
+ *
+ * \return 1 if the device has the service, else 0.
+ */
+int SampleUtil_FindAndParseDeviceService(
+	/*! [in] The device element. */
+	IXML_Element *device,
+	/*! [in] The URL relative URLs are resolved against. */
+	const char *base,
+	/*! [in] The type of service to search for. */
+	const char *serviceType,
+	/*! [out] The service ID. */
+	char **serviceId,
+	/*! [out] The event URL for the service. */
+	char **eventURL,
+	/*! [out] The control URL for the service. */
+	char **controlURL);
+
 /*!
  * \brief Prototype for displaying strings. All printing done by the device,
  * control point, and sample util, ultimately use this to display strings 
@@ -189,26 +222,101 @@ typedef void (*state_update)(
 /*! global state update function used by smaple util */
 extern state_update gStateUpdateFun;
 
+/*! Bytes of output waiting for the print function, a power of two. */
+#define SAMPLE_LOG_RING (256 * 1024)
+
+/*! Longest text SampleUtil_Print() formats; longer text is truncated. */
+#define SAMPLE_LOG_MAX_LINE (8 * 1024)
+
+/*! Milliseconds the flusher sleeps at most with nothing to print. */
+#define SAMPLE_LOG_IDLE_MS 1000
+
+/*! Importance of a message, see SampleUtil_Log(). */
+typedef enum {
+	SAMPLE_LOG_ERROR = 0,
+	SAMPLE_LOG_WARNING = 1,
+	SAMPLE_LOG_INFO = 2,
+	SAMPLE_LOG_DEBUG = 3
+} sample_log_level;
+
+/*!
+ * Highest level compiled in, a number as in sample_log_level. The
+ * SAMPLE_LOG() and SAMPLE_PRINT_EVENT() above it compile to nothing, so
+ * a release build (without --enable-debug) prints no event dumps and
+ * no per-event lines. Define it to override.
+ */
+#ifndef SAMPLE_LOG_MAX_LEVEL
+#	ifdef UPNP_HAVE_DEBUG
+#		define SAMPLE_LOG_MAX_LEVEL 3
+#	else
+#		define SAMPLE_LOG_MAX_LEVEL 2
+#	endif
+#endif
+
+/*! Highest level printed, see SampleUtil_SetLogLevel(). */
+extern sample_log_level gLogLevel;
+
+/*!
+ * \brief Whether messages of a level are compiled in and printed. Costs
+ * one load, or nothing for a level above SAMPLE_LOG_MAX_LEVEL.
+ */
+#define SAMPLE_LOG_ENABLED(level) \
+	((level) <= SAMPLE_LOG_MAX_LEVEL && \
+	 (level) <= __atomic_load_n(&gLogLevel, __ATOMIC_RELAXED))
+
+/*!
+ * \brief SampleUtil_Log() for the hot paths: the arguments are evaluated
+ * only if the level is printed.
+ */
+#define SAMPLE_LOG(level, ...) \
+	do { \
+		if (SAMPLE_LOG_ENABLED(level)) \
+			SampleUtil_Log(level, __VA_ARGS__); \
+	} while (0)
+
+/*!
+ * \brief SampleUtil_PrintEvent() at level SAMPLE_LOG_DEBUG.
+ */
+#define SAMPLE_PRINT_EVENT(EventType, Event) \
+	do { \
+		if (SAMPLE_LOG_ENABLED(SAMPLE_LOG_DEBUG)) \
+			SampleUtil_PrintEvent(EventType, Event); \
+	} while (0)
+
+/*! Counters of the output. */
+typedef struct {
+	/*! Messages handed to the print function. */
+	unsigned long printed;
+	/*! Messages dropped because the ring was full. */
+	unsigned long dropped;
+} sample_log_stats;
+
 /*!
  * \brief Initializes the sample util. Must be called before any sample util
  * functions. May be called multiple times.
+ *
+ * Starts the thread calling the print function: SampleUtil_Print() only
+ * formats into a buffer of the calling thread and copies the text into a
+ * lock-free ring, so a slow terminal never blocks the SDK threads. When
+ * the ring is full, the message is dropped and counted instead.
  */
 int SampleUtil_Initialize(
 	/*! [in] Print function to use in SampleUtil_Print. */
 	print_string print_function);
 
 /*!
- * \brief Releases Resources held by sample util.
+ * \brief Releases Resources held by sample util, after printing what is
+ * left in the ring.
  */
 int SampleUtil_Finish();
 
 /*!
  * \brief Function emulating printf that ultimately calls the registered print
- * function with the formatted string.
+ * function with the formatted string, at level SAMPLE_LOG_INFO.
  *
  * Provides platform-specific print functionality.  This function should be
  * called when you want to print content suitable for console output (i.e.,
- * in a large text box or on a screen).  If your device/operating system is 
+ * in a large text box or on a screen).  If your device/operating system is
  * not supported here, you should add a port.
  *
  * \return The same as printf.
@@ -224,6 +332,108 @@ int SampleUtil_Print(
 #endif
 ;
 
+/*!
+ * \brief SampleUtil_Print() at a given level. Nothing is formatted if the
+ * level is above the one set with SampleUtil_SetLogLevel().
+ *
+ * \return The same as printf, 0 if not printed.
+ */
+int SampleUtil_Log(
+	/*! [in] Level of the message. */
+	sample_log_level level,
+	/*! [in] Format (see printf). */
+	const char *fmt,
+	/*! [in] Format data. */
+	...)
+#if (__GNUC__ >= 3)
+	/* This enables printf like format checking by the compiler */
+	__attribute__((format (__printf__, 2, 3)))
+#endif
+;
+
+/*!
+ * \brief Print only the messages up to a level, SAMPLE_LOG_MAX_LEVEL (all
+ * those compiled in) by default.
+ */
+void SampleUtil_SetLogLevel(
+	/*! [in] Highest level printed. */
+	sample_log_level level);
+
+/*!
+ * \brief Whether messages of a level are printed, see SAMPLE_LOG_ENABLED().
+ */
+int SampleUtil_LogEnabled(
+	/*! [in] Level. */
+	sample_log_level level);
+
+/*!
+ * \brief Level named error, warning, info or debug, or given by its number.
+ *
+ * \return The level, or -1 if unknown.
+ */
+int SampleUtil_ParseLogLevel(
+	/*! [in] Name or number. */
+	const char *name);
+
+/*!
+ * \brief Parse "[address:]port", as the -metrics options take it. The
+ * address is left as it is unless given.
+ *
+ * \return 0, or -1 if the port is not a number from 1 to 65535 or the
+ * address is empty or does not fit.
+ */
+int SampleUtil_ParseAddressPort(
+	/*! [in] Argument. */
+	const char *arg,
+	/*! [in,out] Address, kept unless the argument has one. */
+	char *address,
+	/*! [in] Size of address. */
+	size_t size,
+	/*! [out] Port. */
+	unsigned short *port);
+
+/*!
+ * \brief Make the calling thread wait for room when the ring is full,
+ * rather than drop its messages. For threads whose whole output matters,
+ * such as a command loop; not for the SDK threads.
+ */
+void SampleUtil_SetLogWait(
+	/*! [in] 1 to wait, 0 to drop. */
+	int wait);
+
+/*!
+ * \brief Wait until everything printed so far went to the print function.
+ */
+void SampleUtil_Flush(void);
+
+/*!
+ * \brief Get the counters of the output.
+ */
+void SampleUtil_GetLogStats(
+	/*! [out] Counters. */
+	sample_log_stats *stats);
+
+/*!
+ * \brief Prototype for receiving the output of a thread instead of the
+ * print function, see SampleUtil_SetCapture().
+ */
+typedef void (*print_capture)(
+	/*! [in] Formatted text, only valid during the call. */
+	const char *text,
+	/*! [in] Argument given to SampleUtil_SetCapture(). */
+	void *arg);
+
+/*!
+ * \brief Send what the calling thread prints with SampleUtil_Print() to
+ * capture rather than to the print function, until called again with
+ * NULL. Other threads still print as before.
+ */
+void SampleUtil_SetCapture(
+	/*! [in] Receives the text, NULL to print again. */
+	print_capture capture,
+	/*! [in] Argument of capture. */
+	void *arg);
+
 /*!
  * \brief
  */
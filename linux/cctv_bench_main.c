@@ -0,0 +1,3578 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name CCTV Benchmarks
+ *
+ * @{
+ *
+ * \file
+ *
+ * Stand-alone benchmarks for the CCTV control point data structures.
+ * Each benchmark prints one line per measurement in the form
+ * "<bench> <param>=<value> ... <metric>=<value>" so that runs can be
+ * compared with diff or a spreadsheet, or with -compare against a stored
+ * baseline.
+ *
+ * The e2e_* benchmarks run the control point against a farm of emulated
+ * cameras (see cctv_farm.h) in the same process, through the SDK and the
+ * network stack of this host.
+ *
+ * The handlers benchmark calls the request handlers of the device directly
+ * with synthetic requests, the servos going to the mock HAL (cctv_hal.h).
+ */
+
+#include "sample_util.h"
+#include "cctv_actions.h"
+#include "cctv_ctlsock.h"
+#include "cctv_ctrlpt.h"
+#include "cctv_device.h"
+#include "cctv_discovery.h"
+#include "cctv_fanout.h"
+#include "cctv_farm.h"
+#include "cctv_hal.h"
+#include "cctv_histogram.h"
+#include "cctv_hot.h"
+#include "cctv_metrics.h"
+#include "cctv_poll.h"
+#include "cctv_propset.h"
+#include "cctv_recovery.h"
+#include "cctv_registry.h"
+#include "cctv_research.h"
+#include "cctv_shard.h"
+#include "cctv_snapshot.h"
+#include "cctv_timer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/*! Fleet sizes swept by the registry benchmark. */
+static const int bench_fleet_sizes[] = { 10, 100, 1000, 10000 };
+
+#define BENCH_NUM_FLEETS \
+	((int)(sizeof bench_fleet_sizes / sizeof bench_fleet_sizes[0]))
+
+static void bench_sleep_ms(int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Room for the strings of a synthetic device */
+#define BENCH_FLEET_STRINGS 192
+
+/*!
+ * \brief Copy a string into the tail of a fleet, see bench_make_fleet().
+ */
+static const char *bench_pack(char **space, const char *str)
+{
+	char *copy = *space;
+	size_t len = strlen(str) + 1;
+
+	memcpy(copy, str, len);
+	*space += len;
+
+	return copy;
+}
+
+/*!
+ * \brief Build a synthetic fleet of device nodes with unique keys. Like the
+ * control point does per node, the strings are packed in the same
+ * allocation, behind the nodes, so the fleet is freed with free().
+ */
+static struct CCTvDeviceNode *bench_make_fleet(int n)
+{
+	struct CCTvDeviceNode *fleet;
+	struct cctv_service *s;
+	char str[NAME_SIZE];
+	char *space;
+	int i;
+
+	fleet = (struct CCTvDeviceNode *)calloc(1,
+		(size_t)n * (sizeof *fleet + BENCH_FLEET_STRINGS));
+	if (!fleet)
+		return NULL;
+	space = (char *)(fleet + n);
+	for (i = 0; i < n; i++) {
+		s = &fleet[i].device.CCTvService[CCTV_SERVICE_CONTROL];
+		snprintf(str, sizeof str,
+			"uuid:Upnp-CCTVEmulator-1_0-bench%05d", i);
+		fleet[i].device.UDN = bench_pack(&space, str);
+		fleet[i].device.DescDocURL = "";
+		fleet[i].device.FriendlyName = fleet[i].device.UDN + 5;
+		fleet[i].device.PresURL = "";
+		fleet[i].device.Slot = -1;
+		snprintf(s->SID, sizeof s->SID,
+			"uuid:%08x-0000-0000-0000-%012d", (unsigned)i * 2654435761u, i);
+		s->ServiceId = "urn:upnp-org:serviceId:cctvcontrol1";
+		s->ServiceType = "urn:schemas-upnp-org:service:cctvcontrol:1";
+		snprintf(str, sizeof str,
+			"http://10.%d.%d.%d:49152/upnp/event/cctvtvcontrol1",
+			(i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		s->EventURL = bench_pack(&space, str);
+		snprintf(str, sizeof str,
+			"http://10.%d.%d.%d:49152/upnp/control/cctvtvcontrol1",
+			(i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		s->ControlURL = bench_pack(&space, str);
+	}
+
+	return fleet;
+}
+
+/*!
+ * \brief The lookup CCTvCtrlPointHandleEvent used to do before the registry.
+ */
+static struct CCTvDeviceNode *bench_linear_find_sid(
+	struct CCTvDeviceNode *fleet, int n, const char *sid)
+{
+	int i;
+	int service;
+
+	for (i = 0; i < n; i++) {
+		for (service = 0; service < CCTV_SERVICE_SERVCOUNT; service++) {
+			if (strcmp(fleet[i].device.CCTvService[service].SID,
+				   sid) == 0)
+				return &fleet[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Per-event lookup cost of the registry against a linear scan, for
+ * fleets of 10 to 10,000 devices. Events are drawn uniformly over the fleet.
+ */
+static int bench_registry(int iterations)
+{
+	struct CCTvRegistry reg;
+	struct CCTvDeviceNode *fleet;
+	struct CCTvDeviceNode *hit;
+	const char *sid;
+	double t0;
+	double hashed_ns;
+	double linear_ns;
+	unsigned int seed = 1;
+	int linear_iter;
+	int f;
+	int i;
+	int n;
+
+	for (f = 0; f < BENCH_NUM_FLEETS; f++) {
+		n = bench_fleet_sizes[f];
+		fleet = bench_make_fleet(n);
+		if (!fleet || CCTvRegistryInit(&reg) != CCTV_SUCCESS) {
+			free(fleet);
+			return CCTV_ERROR;
+		}
+		t0 = bench_now();
+		for (i = 0; i < n; i++)
+			CCTvRegistryInsert(&reg, &fleet[i]);
+		printf("registry devices=%d insert_ns=%.1f\n",
+			n, (bench_now() - t0) / n);
+
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++) {
+			sid = fleet[rand_r(&seed) % n].device.
+				CCTvService[CCTV_SERVICE_CONTROL].SID;
+			hit = CCTvRegistryFind(&reg, CCTV_KEY_SID, sid, NULL);
+			if (!hit)
+				abort();
+		}
+		hashed_ns = (bench_now() - t0) / iterations;
+
+		/* keep the O(n) baseline from running for minutes */
+		linear_iter = iterations / (n / 10 + 1) + 1;
+		t0 = bench_now();
+		for (i = 0; i < linear_iter; i++) {
+			sid = fleet[rand_r(&seed) % n].device.
+				CCTvService[CCTV_SERVICE_CONTROL].SID;
+			hit = bench_linear_find_sid(fleet, n, sid);
+			if (!hit)
+				abort();
+		}
+		linear_ns = (bench_now() - t0) / linear_iter;
+
+		printf("registry devices=%d sid_lookup_ns=%.1f linear_ns=%.1f\n",
+			n, hashed_ns, linear_ns);
+
+		CCTvRegistryDestroy(&reg);
+		free(fleet);
+	}
+
+	return CCTV_SUCCESS;
+}
+
+/*! Reader thread counts swept by the contention benchmark. */
+static const int bench_reader_counts[] = { 1, 2, 4, 8 };
+
+#define BENCH_NUM_READER_COUNTS \
+	((int)(sizeof bench_reader_counts / sizeof bench_reader_counts[0]))
+
+/*! Devices in the table, and devices the writer keeps adding/removing. */
+#define BENCH_CONTENTION_DEVICES 1000
+#define BENCH_CONTENTION_CHURN 16
+
+/*! Shared state of one contention run. */
+struct bench_contention {
+	/*! 1 = left-right DeviceTable, 0 = one mutex around a registry. */
+	int leftright;
+	struct CCTvDeviceTable table;
+	struct CCTvRegistry reg;
+	pthread_mutex_t mutex;
+	struct CCTvDeviceNode *fleet;
+	int iterations;
+	/*! Set once every reader has finished. */
+	int done;
+	long writes;
+};
+
+static void *bench_contention_reader(void *arg)
+{
+	struct bench_contention *c = (struct bench_contention *)arg;
+	const struct CCTvRegistry *reg;
+	const char *sid;
+	unsigned int seed = (unsigned int)(size_t)pthread_self();
+	int token;
+	int i;
+
+	for (i = 0; i < c->iterations; i++) {
+		/* only look up the devices the writer leaves alone */
+		sid = c->fleet[rand_r(&seed) % BENCH_CONTENTION_DEVICES].device.
+			CCTvService[CCTV_SERVICE_CONTROL].SID;
+		if (c->leftright) {
+			reg = CCTvDeviceTableReadBegin(&c->table, &token);
+			if (!CCTvRegistryFind(reg, CCTV_KEY_SID, sid, NULL))
+				abort();
+			CCTvDeviceTableReadEnd(&c->table, token);
+		} else {
+			pthread_mutex_lock(&c->mutex);
+			if (!CCTvRegistryFind(&c->reg, CCTV_KEY_SID, sid, NULL))
+				abort();
+			pthread_mutex_unlock(&c->mutex);
+		}
+	}
+
+	return NULL;
+}
+
+static void *bench_contention_writer(void *arg)
+{
+	struct bench_contention *c = (struct bench_contention *)arg;
+	struct CCTvDeviceNode *node;
+	int i = 0;
+
+	while (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE)) {
+		node = &c->fleet[BENCH_CONTENTION_DEVICES +
+			i % BENCH_CONTENTION_CHURN];
+		/* like a device appearing and its advertisement expiring */
+		if (c->leftright) {
+			CCTvDeviceTableInsert(&c->table, node);
+			CCTvDeviceTableRemove(&c->table, node);
+		} else {
+			pthread_mutex_lock(&c->mutex);
+			CCTvRegistryInsert(&c->reg, node);
+			pthread_mutex_unlock(&c->mutex);
+			pthread_mutex_lock(&c->mutex);
+			CCTvRegistryRemove(&c->reg, node);
+			pthread_mutex_unlock(&c->mutex);
+		}
+		c->writes += 2;
+		i++;
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief SID lookups from N event handler threads while one writer adds and
+ * removes devices, left-right DeviceTable against a single mutex.
+ */
+static int bench_contention(int iterations)
+{
+	struct bench_contention c;
+	pthread_t readers[8];
+	pthread_t writer;
+	double t0;
+	double elapsed;
+	int nreaders;
+	int r;
+	int i;
+
+	memset(&c, 0, sizeof c);
+	c.fleet = bench_make_fleet(BENCH_CONTENTION_DEVICES +
+		BENCH_CONTENTION_CHURN);
+	if (!c.fleet)
+		return CCTV_ERROR;
+	c.iterations = iterations;
+	pthread_mutex_init(&c.mutex, NULL);
+	for (c.leftright = 0; c.leftright <= 1; c.leftright++) {
+		for (r = 0; r < BENCH_NUM_READER_COUNTS; r++) {
+			nreaders = bench_reader_counts[r];
+			if (CCTvDeviceTableInit(&c.table) != CCTV_SUCCESS ||
+			    CCTvRegistryInit(&c.reg) != CCTV_SUCCESS) {
+				free(c.fleet);
+				return CCTV_ERROR;
+			}
+			for (i = 0; i < BENCH_CONTENTION_DEVICES; i++) {
+				CCTvDeviceTableInsert(&c.table, &c.fleet[i]);
+				CCTvRegistryInsert(&c.reg, &c.fleet[i]);
+			}
+			c.done = 0;
+			c.writes = 0;
+			t0 = bench_now();
+			pthread_create(&writer, NULL, bench_contention_writer,
+				&c);
+			for (i = 0; i < nreaders; i++)
+				pthread_create(&readers[i], NULL,
+					bench_contention_reader, &c);
+			for (i = 0; i < nreaders; i++)
+				pthread_join(readers[i], NULL);
+			elapsed = bench_now() - t0;
+			__atomic_store_n(&c.done, 1, __ATOMIC_RELEASE);
+			pthread_join(writer, NULL);
+			printf("contention table=%s readers=%d "
+				"read_ops_s=%.0f write_ops_s=%.0f\n",
+				c.leftright ? "leftright" : "mutex", nreaders,
+				(double)iterations * nreaders / elapsed * 1e9,
+				(double)c.writes / elapsed * 1e9);
+			CCTvDeviceTableDestroy(&c.table);
+			CCTvRegistryDestroy(&c.reg);
+		}
+	}
+	pthread_mutex_destroy(&c.mutex);
+	free(c.fleet);
+
+	return CCTV_SUCCESS;
+}
+
+/*! Cameras in the simulated site, as in the discovery requirements. */
+#define BENCH_DISCOVERY_FLEET 500
+
+/*! SSDP notifications per camera and round: root device, UUID, type. */
+#define BENCH_DISCOVERY_NOTIFY 3
+
+/*! Simulated description download time, milliseconds. */
+#define BENCH_DISCOVERY_FETCH_MS 2
+
+/*! Fetcher pool sizes swept by the discovery benchmark. */
+static const int bench_discovery_workers[] = { 1, 4, 8, 16 };
+
+#define BENCH_NUM_DISCOVERY_WORKERS \
+	((int)(sizeof bench_discovery_workers / \
+	       sizeof bench_discovery_workers[0]))
+
+static long bench_discovery_added;
+
+static int bench_discovery_fetch(const char *location, IXML_Document **doc)
+{
+	bench_sleep_ms(BENCH_DISCOVERY_FETCH_MS);
+	*doc = NULL;
+
+	return UPNP_E_SUCCESS;
+	location = location;
+}
+
+static int bench_discovery_add(IXML_Document *doc, const char *location,
+	int expires)
+{
+	__atomic_add_fetch(&bench_discovery_added, 1, __ATOMIC_RELAXED);
+	return CCTV_SUCCESS;
+	doc = doc;
+	location = location;
+	expires = expires;
+}
+
+static int bench_discovery_refresh(const char *UDN, int expires)
+{
+	return CCTV_SUCCESS;
+	UDN = UDN;
+	expires = expires;
+}
+
+/*!
+ * \brief Send the SSDP notifications of one round for the whole fleet.
+ */
+static void bench_discovery_round(void)
+{
+	char location[64];
+	char UDN[64];
+	int n;
+	int i;
+
+	for (n = 0; n < BENCH_DISCOVERY_NOTIFY; n++) {
+		for (i = 0; i < BENCH_DISCOVERY_FLEET; i++) {
+			snprintf(location, sizeof location,
+				"http://10.0.%d.%d:49152/cctvdevicedesc.xml",
+				i >> 8, i & 0xff);
+			snprintf(UDN, sizeof UDN,
+				"uuid:Upnp-CCTVEmulator-1_0-bench%05d", i);
+			CCTvDiscoveryEnqueue(UDN, location, 1800);
+		}
+	}
+}
+
+/*!
+ * \brief Wait until the pool has handled every queued location.
+ */
+static void bench_discovery_drain(struct CCTvDiscoveryStats *stats)
+{
+	do {
+		bench_sleep_ms(1);
+		CCTvDiscoveryGetStats(stats);
+	} while (stats->pending > 0);
+}
+
+/*!
+ * \brief Time to discover a site of 500 cameras answering an M-SEARCH, when
+ * every notification is fetched inline on the callback thread (as before the
+ * discovery pool) and with fetcher pools of 1 to 16 threads. Then the cost
+ * of the following ALIVE round, which the description cache answers.
+ */
+static int bench_discovery(int iterations)
+{
+	struct CCTvDiscoveryStats stats;
+	const char *location = "http://10.0.0.1:49152/cctvdevicedesc.xml";
+	IXML_Document *doc;
+	unsigned long fetched;
+	double elapsed;
+	double t0;
+	int w;
+	int i;
+
+	/* the old SSDP callback: one download per notification */
+	t0 = bench_now();
+	for (i = 0; i < BENCH_DISCOVERY_FLEET * BENCH_DISCOVERY_NOTIFY; i++) {
+		bench_discovery_fetch(location, &doc);
+		bench_discovery_add(doc, location, 1800);
+	}
+	printf("discovery mode=inline devices=%d fetches=%d discover_ms=%.1f\n",
+		BENCH_DISCOVERY_FLEET, i, (bench_now() - t0) / 1e6);
+
+	for (w = 0; w < BENCH_NUM_DISCOVERY_WORKERS; w++) {
+		if (CCTvDiscoveryStart(bench_discovery_workers[w],
+			CCTV_DISCOVERY_MAX_PENDING, bench_discovery_fetch,
+			bench_discovery_add, bench_discovery_refresh) !=
+		    CCTV_SUCCESS)
+			return CCTV_ERROR;
+		CCTvDiscoveryStartRound();
+		t0 = bench_now();
+		bench_discovery_round();
+		printf("discovery mode=pool workers=%d enqueue_ns=%.1f\n",
+			bench_discovery_workers[w], (bench_now() - t0) /
+			(BENCH_DISCOVERY_FLEET * BENCH_DISCOVERY_NOTIFY));
+		bench_discovery_drain(&stats);
+		printf("discovery mode=pool workers=%d devices=%d fetches=%lu "
+			"coalesced=%lu discover_ms=%.1f\n",
+			bench_discovery_workers[w], BENCH_DISCOVERY_FLEET,
+			stats.fetched, stats.coalesced, stats.round_ms);
+
+		/* periodic ALIVEs of the now known fleet */
+		fetched = stats.fetched;
+		t0 = bench_now();
+		bench_discovery_round();
+		elapsed = bench_now() - t0;
+		bench_discovery_drain(&stats);
+		printf("discovery mode=alive workers=%d fetches=%lu "
+			"cache_hits=%lu cache_misses=%lu notify_ns=%.1f\n",
+			bench_discovery_workers[w], stats.fetched - fetched,
+			stats.cache_hits, stats.cache_misses, elapsed /
+			(BENCH_DISCOVERY_FLEET * BENCH_DISCOVERY_NOTIFY));
+		CCTvDiscoveryStop();
+		CCTvDiscoveryDestroy();
+	}
+
+	return CCTV_SUCCESS;
+	iterations = iterations;
+}
+
+/*! Period of the advertisement scan the timer wheel replaced, seconds. */
+#define BENCH_TIMERS_SCAN_PERIOD 30
+
+/*! Timers fired by the expiry latency measurement. */
+#define BENCH_TIMERS_LATENCY 1000
+
+/*! Longest delay of those timers, milliseconds. */
+#define BENCH_TIMERS_LATENCY_MS 3000
+
+static double bench_timers_late_sum;
+static double bench_timers_late_max;
+static int bench_timers_fired;
+
+static void bench_timers_fire(struct CCTvTimer *timer, void *arg)
+{
+	double late = (bench_now() - *(double *)arg) / 1e6;
+
+	bench_timers_late_sum += late;
+	if (late > bench_timers_late_max)
+		bench_timers_late_max = late;
+	__atomic_add_fetch(&bench_timers_fired, 1, __ATOMIC_RELEASE);
+	timer = timer;
+}
+
+static void bench_timers_noop(struct CCTvTimer *timer, void *arg)
+{
+	timer = timer;
+	arg = arg;
+}
+
+/*!
+ * \brief Cost of arming and refreshing the advertisement timers of 10 to
+ * 10000 devices, against one pass of the periodic scan they replaced. Then
+ * how late an expiry is noticed, against the scan period.
+ */
+static int bench_timers(int iterations)
+{
+	struct CCTvTimerWheel wheel;
+	struct CCTvDeviceNode *fleet;
+	pthread_mutex_t mutex;
+	int *timeout;
+	double *due;
+	unsigned int seed = 1;
+	long delay;
+	double t0;
+	int f;
+	int n;
+	int i;
+
+	if (CCTvTimerWheelStart(&wheel, CCTV_TIMER_TICK_MS) != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	pthread_mutex_init(&mutex, NULL);
+	for (f = 0; f < BENCH_NUM_FLEETS; f++) {
+		n = bench_fleet_sizes[f];
+		fleet = bench_make_fleet(n);
+		/* the advertisement timeouts the timer loop counted down */
+		timeout = (int *)malloc((size_t)n * sizeof *timeout);
+		if (!fleet || !timeout) {
+			free(fleet);
+			free(timeout);
+			CCTvTimerWheelStop(&wheel);
+			return CCTV_ERROR;
+		}
+		for (i = 0; i < n; i++) {
+			CCTvTimerInit(&fleet[i].device.ExpiryTimer,
+				bench_timers_noop, &fleet[i]);
+			timeout[i] = 1800;
+		}
+		t0 = bench_now();
+		for (i = 0; i < n; i++)
+			CCTvTimerArm(&wheel, &fleet[i].device.ExpiryTimer,
+				60000 + (long)(rand_r(&seed) % 1740000));
+		printf("timers devices=%d arm_ns=%.1f", n, (bench_now() - t0) / n);
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++)
+			CCTvTimerArm(&wheel, &fleet[i % n].device.ExpiryTimer,
+				1800000);
+		printf(" refresh_ns=%.1f", (bench_now() - t0) / iterations);
+		/* what the timer loop did every 30 s */
+		t0 = bench_now();
+		for (i = 0; i < n; i++) {
+			pthread_mutex_lock(&mutex);
+			timeout[i] -= BENCH_TIMERS_SCAN_PERIOD;
+			pthread_mutex_unlock(&mutex);
+		}
+		printf(" scan_pass_ns=%.1f\n", bench_now() - t0);
+		for (i = 0; i < n; i++)
+			CCTvTimerCancel(&wheel, &fleet[i].device.ExpiryTimer);
+		free(timeout);
+		free(fleet);
+	}
+	pthread_mutex_destroy(&mutex);
+
+	/* all fired from the wheel thread, read once it is done */
+	fleet = bench_make_fleet(BENCH_TIMERS_LATENCY);
+	due = (double *)calloc(BENCH_TIMERS_LATENCY, sizeof *due);
+	if (!fleet || !due) {
+		free(fleet);
+		free(due);
+		CCTvTimerWheelStop(&wheel);
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < BENCH_TIMERS_LATENCY; i++) {
+		delay = (long)(rand_r(&seed) % BENCH_TIMERS_LATENCY_MS);
+		due[i] = bench_now() + (double)delay * 1e6;
+		CCTvTimerInit(&fleet[i].device.ExpiryTimer, bench_timers_fire,
+			&due[i]);
+		CCTvTimerArm(&wheel, &fleet[i].device.ExpiryTimer, delay);
+	}
+	while (__atomic_load_n(&bench_timers_fired, __ATOMIC_ACQUIRE) <
+	       BENCH_TIMERS_LATENCY)
+		bench_sleep_ms(10);
+	printf("timers mode=wheel tick_ms=%d expired=%d late_avg_ms=%.1f "
+		"late_max_ms=%.1f\n", CCTV_TIMER_TICK_MS, bench_timers_fired,
+		bench_timers_late_sum / bench_timers_fired,
+		bench_timers_late_max);
+	printf("timers mode=scan period_ms=%d late_max_ms=%d\n",
+		BENCH_TIMERS_SCAN_PERIOD * 1000, BENCH_TIMERS_SCAN_PERIOD * 1000);
+	CCTvTimerWheelStop(&wheel);
+	free(fleet);
+	free(due);
+
+	return CCTV_SUCCESS;
+}
+
+/*! Cameras in the simulated fleet. */
+#define BENCH_RESEARCH_FLEET 1000
+
+/*! Cameras per PoE switch; those of one switch advertise together. */
+#define BENCH_RESEARCH_PER_SWITCH 50
+
+/*! Seconds between the advertisements of two switches. */
+#define BENCH_RESEARCH_SWITCH_GAP 10
+
+/*! Device type of the fleet. */
+#define BENCH_RESEARCH_TYPE "urn:schemas-upnp-org:device:cctvdevice:1"
+
+/*! Simulated milliseconds per real one; a 100 ms tick takes 1 ms. */
+#define BENCH_RESEARCH_SCALE 100
+
+/*! Searches sent, in real milliseconds since the start of the run. */
+static double *bench_research_sent;
+static int bench_research_nsent;
+static double bench_research_t0;
+
+static int bench_research_send(const char *target)
+{
+	/* only ever called from the wheel thread */
+	if (bench_research_nsent < BENCH_RESEARCH_FLEET)
+		bench_research_sent[bench_research_nsent++] =
+			(bench_now() - bench_research_t0) / 1e6;
+
+	return UPNP_E_SUCCESS;
+	target = target;
+}
+
+/*! What the re-search timer did before batching: search right away. */
+static void bench_research_direct(struct CCTvTimer *timer, void *arg)
+{
+	bench_research_send(((struct CCTvDeviceNode *)arg)->device.UDN);
+	timer = timer;
+}
+
+static void bench_research_due(struct CCTvTimer *timer, void *arg)
+{
+	CCTvResearchDue(((struct CCTvDeviceNode *)arg)->device.UDN,
+		BENCH_RESEARCH_TYPE);
+	timer = timer;
+}
+
+/*!
+ * \brief Multicast searches per 100 ms tick when the advertisements of
+ * 1000 cameras, 50 per PoE switch, are about to expire: one search per
+ * device when its timer fires, against jittered and batched search
+ * windows. Time runs 100 times faster than real, starting where the first
+ * switch's cameras fall due.
+ */
+static int bench_research(int iterations)
+{
+	struct CCTvTimerWheel wheel;
+	struct CCTvDeviceNode *fleet;
+	struct CCTvResearchStats stats;
+	const long lifetime = 1800000L;
+	const long margin = CCTV_RESEARCH_MARGIN * 1000L;
+	int *per_tick;
+	int nticks;
+	int busy;
+	int peak;
+	int batched;
+	long delay;
+	int i;
+
+	fleet = bench_make_fleet(BENCH_RESEARCH_FLEET);
+	bench_research_sent = (double *)calloc(BENCH_RESEARCH_FLEET,
+		sizeof *bench_research_sent);
+	nticks = (BENCH_RESEARCH_FLEET / BENCH_RESEARCH_PER_SWITCH + 1) *
+		BENCH_RESEARCH_SWITCH_GAP * 10 + (int)(margin / 100) + 100;
+	per_tick = (int *)calloc((size_t)nticks, sizeof *per_tick);
+	if (!fleet || !bench_research_sent || !per_tick) {
+		free(fleet);
+		free(bench_research_sent);
+		free(per_tick);
+		return CCTV_ERROR;
+	}
+	for (batched = 0; batched < 2; batched++) {
+		if (CCTvTimerWheelStart(&wheel, CCTV_TIMER_TICK_MS /
+			BENCH_RESEARCH_SCALE) != CCTV_SUCCESS)
+			break;
+		CCTvResearchStart(&wheel, CCTV_RESEARCH_WINDOW_MS /
+			BENCH_RESEARCH_SCALE, CCTV_RESEARCH_TYPE_MIN,
+			bench_research_send);
+		bench_research_nsent = 0;
+		bench_research_t0 = bench_now();
+		for (i = 0; i < BENCH_RESEARCH_FLEET; i++) {
+			delay = (long)(i / BENCH_RESEARCH_PER_SWITCH) *
+				BENCH_RESEARCH_SWITCH_GAP * 1000L;
+			if (batched)
+				delay += CCTvResearchDelay(fleet[i].device.UDN,
+					lifetime, margin) - (lifetime - margin);
+			CCTvTimerInit(&fleet[i].device.SearchTimer, batched ?
+				bench_research_due : bench_research_direct,
+				&fleet[i]);
+			CCTvTimerArm(&wheel, &fleet[i].device.SearchTimer,
+				delay / BENCH_RESEARCH_SCALE);
+		}
+		bench_sleep_ms(nticks * CCTV_TIMER_TICK_MS / BENCH_RESEARCH_SCALE);
+		CCTvResearchGetStats(&stats);
+		CCTvResearchStop();
+		CCTvTimerWheelStop(&wheel);
+
+		memset(per_tick, 0, (size_t)nticks * sizeof *per_tick);
+		for (i = 0; i < bench_research_nsent; i++) {
+			if ((int)bench_research_sent[i] < nticks)
+				per_tick[(int)bench_research_sent[i]]++;
+		}
+		busy = 0;
+		peak = 0;
+		for (i = 0; i < nticks; i++) {
+			if (per_tick[i])
+				busy++;
+			if (per_tick[i] > peak)
+				peak = per_tick[i];
+		}
+		printf("research mode=%s devices=%d searches=%d by_type=%lu "
+			"busy_ticks=%d max_per_tick=%d avg_per_busy_tick=%.2f\n",
+			batched ? "batched" : "per-device", BENCH_RESEARCH_FLEET,
+			bench_research_nsent, stats.type_searches, busy, peak,
+			busy ? (double)bench_research_nsent / busy : 0.0);
+	}
+	free(fleet);
+	free(bench_research_sent);
+	free(per_tick);
+
+	return batched == 2 ? CCTV_SUCCESS : CCTV_ERROR;
+	iterations = iterations;
+}
+
+/*! SCPD the action templates are built from, relative to the source
+ * tree. */
+#define BENCH_ACTIONS_SCPD "web/cctvcontrolSCPD.xml"
+
+/*!
+ * \brief Print one actions measurement.
+ */
+static void bench_actions_report(const char *mode, int iterations, double ns)
+{
+	printf("actions mode=%s iterations=%d ns_per_action=%.1f "
+		"actions_per_sec=%.0f\n", mode, iterations, ns / iterations,
+		iterations / (ns / 1e9));
+}
+
+/*!
+ * \brief Cost of preparing an action request on one core: building the
+ * document with UpnpMakeAction() and freeing it, as each send did before,
+ * against looking up its template. The "+print" modes add the
+ * serialization UpnpSendActionAsync() does in any case.
+ */
+static int bench_actions(int iterations)
+{
+	const char *serviceType = "urn:schemas-upnp-org:service:cctvcontrol:1";
+	static const char *names[] = { "PowerOn", "PowerOff", "Reboot",
+		"TopMountMiddle" };
+	IXML_Document *scpd;
+	IXML_Document *doc;
+	DOMString str;
+	double t0;
+	int print;
+	int i;
+
+	scpd = ixmlLoadDocument(BENCH_ACTIONS_SCPD);
+	if (!scpd) {
+		printf("actions: cannot load %s, run from the source tree\n",
+			BENCH_ACTIONS_SCPD);
+		return CCTV_ERROR;
+	}
+	CCTvActionCacheLoad(CCTV_SERVICE_CONTROL, serviceType, scpd);
+	ixmlDocument_free(scpd);
+	for (i = 0; i < 4; i++) {
+		if (!CCTvActionCacheGet(CCTV_SERVICE_CONTROL, names[i])) {
+			printf("actions: no template for %s\n", names[i]);
+			CCTvActionCacheClear();
+			return CCTV_ERROR;
+		}
+	}
+
+	for (print = 0; print < 2; print++) {
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++) {
+			doc = UpnpMakeAction(names[i & 3], serviceType, 0, NULL);
+			if (print) {
+				str = ixmlPrintNode((IXML_Node *)doc);
+				ixmlFreeDOMString(str);
+			}
+			ixmlDocument_free(doc);
+		}
+		bench_actions_report(print ? "build+print" : "build",
+			iterations, bench_now() - t0);
+
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++) {
+			doc = CCTvActionCacheGet(CCTV_SERVICE_CONTROL,
+				names[i & 3]);
+			if (print) {
+				str = ixmlPrintNode((IXML_Node *)doc);
+				ixmlFreeDOMString(str);
+			}
+		}
+		bench_actions_report(print ? "template+print" : "template",
+			iterations, bench_now() - t0);
+	}
+	CCTvActionCacheClear();
+
+	return CCTV_SUCCESS;
+}
+
+/*! Cameras rebooted by the fan-out benchmark. */
+#define BENCH_FANOUT_FLEET 300
+
+/*! Simulated action round trip, milliseconds. */
+#define BENCH_FANOUT_RTT_MS 20
+
+/*! In-flight limits swept by the fan-out benchmark; 1 is one at a time. */
+static const int bench_fanout_inflight[] = { 1, 8, 32, 128 };
+
+#define BENCH_NUM_FANOUT_INFLIGHT \
+	((int)(sizeof bench_fanout_inflight / sizeof bench_fanout_inflight[0]))
+
+/*! A simulated request, answered from the timer wheel. */
+struct bench_fanout_request {
+	struct CCTvTimer timer;
+	void *cookie;
+};
+
+static struct CCTvTimerWheel bench_fanout_wheel;
+static struct CCTvFanoutResult bench_fanout_result;
+static int bench_fanout_done;
+static int bench_fanout_inflight_now;
+static int bench_fanout_inflight_peak;
+
+static void bench_fanout_answer(struct CCTvTimer *timer, void *arg)
+{
+	struct bench_fanout_request *req = (struct bench_fanout_request *)arg;
+
+	__atomic_sub_fetch(&bench_fanout_inflight_now, 1, __ATOMIC_RELAXED);
+	CCTvFanoutComplete(req->cookie, UPNP_E_SUCCESS);
+	free(req);
+	timer = timer;
+}
+
+static int bench_fanout_send(const char *controlURL, const char *serviceType,
+	const char *actionName, IXML_Document *action, void *cookie)
+{
+	struct bench_fanout_request *req;
+	int now;
+	int peak;
+
+	req = (struct bench_fanout_request *)malloc(sizeof *req);
+	if (!req)
+		return UPNP_E_OUTOF_MEMORY;
+	now = __atomic_add_fetch(&bench_fanout_inflight_now, 1,
+		__ATOMIC_RELAXED);
+	peak = __atomic_load_n(&bench_fanout_inflight_peak, __ATOMIC_RELAXED);
+	while (now > peak && !__atomic_compare_exchange_n(
+		&bench_fanout_inflight_peak, &peak, now, 0, __ATOMIC_RELAXED,
+		__ATOMIC_RELAXED))
+		;
+	req->cookie = cookie;
+	CCTvTimerInit(&req->timer, bench_fanout_answer, req);
+	CCTvTimerArm(&bench_fanout_wheel, &req->timer, BENCH_FANOUT_RTT_MS);
+
+	return UPNP_E_SUCCESS;
+	controlURL = controlURL;
+	serviceType = serviceType;
+	actionName = actionName;
+	action = action;
+}
+
+static void bench_fanout_finished(const struct CCTvFanoutResult *result,
+	void *arg)
+{
+	bench_fanout_result = *result;
+	__atomic_store_n(&bench_fanout_done, 1, __ATOMIC_RELEASE);
+	arg = arg;
+}
+
+/*!
+ * \brief Time to reboot 300 cameras answering after 20 ms each, one at a
+ * time as from the command line, and with fan-outs of growing in-flight
+ * limits.
+ */
+static int bench_fanout(int iterations)
+{
+	struct CCTvDeviceNode *fleet;
+	const char **UDNs;
+	const char **controlURLs;
+	int w;
+	int i;
+
+	fleet = bench_make_fleet(BENCH_FANOUT_FLEET);
+	UDNs = (const char **)calloc(BENCH_FANOUT_FLEET, sizeof *UDNs);
+	controlURLs = (const char **)calloc(BENCH_FANOUT_FLEET,
+		sizeof *controlURLs);
+	if (!fleet || !UDNs || !controlURLs ||
+	    CCTvTimerWheelStart(&bench_fanout_wheel, 1) != CCTV_SUCCESS) {
+		free(fleet);
+		free(UDNs);
+		free(controlURLs);
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < BENCH_FANOUT_FLEET; i++) {
+		UDNs[i] = fleet[i].device.UDN;
+		controlURLs[i] = fleet[i].device.CCTvService[
+			CCTV_SERVICE_CONTROL].ControlURL;
+	}
+	CCTvFanoutStart(bench_fanout_send);
+	for (w = 0; w < BENCH_NUM_FANOUT_INFLIGHT; w++) {
+		bench_fanout_done = 0;
+		bench_fanout_inflight_peak = 0;
+		if (CCTvFanoutSubmit("Reboot", "urn:schemas-upnp-org:service:"
+			"cctvcontrol:1", NULL, 0, UDNs, controlURLs,
+			BENCH_FANOUT_FLEET, bench_fanout_inflight[w],
+			bench_fanout_finished, NULL) == CCTV_ERROR)
+			break;
+		while (!__atomic_load_n(&bench_fanout_done, __ATOMIC_ACQUIRE))
+			bench_sleep_ms(1);
+		printf("fanout devices=%d rtt_ms=%d inflight=%d peak=%d ok=%d "
+			"failed=%d elapsed_ms=%.1f\n", BENCH_FANOUT_FLEET,
+			BENCH_FANOUT_RTT_MS, bench_fanout_inflight[w],
+			bench_fanout_inflight_peak, bench_fanout_result.ok,
+			bench_fanout_result.failed,
+			bench_fanout_result.elapsed_ms);
+	}
+	CCTvFanoutStop();
+	CCTvTimerWheelStop(&bench_fanout_wheel);
+	CCTvFanoutDestroy();
+	free(fleet);
+	free(UDNs);
+	free(controlURLs);
+
+	return w == BENCH_NUM_FANOUT_INFLIGHT ? CCTV_SUCCESS : CCTV_ERROR;
+	iterations = iterations;
+}
+
+/*! Cameras watched by the recovery benchmark. */
+#define BENCH_RECOVERY_FLEET 200
+
+/*! Every this many cameras one is hung... */
+#define BENCH_RECOVERY_HUNG_EVERY 10
+
+/*! ...and every this many it does not even answer a reboot. */
+#define BENCH_RECOVERY_DEAD_EVERY 50
+
+/*! Every this many cameras one that is not hung answers every request
+ * with a SOAP fault. It is alive and must never be rebooted. */
+#define BENCH_RECOVERY_FAULTY_EVERY 7
+
+/*! The fault it answers with, 501 Action Failed. */
+#define BENCH_RECOVERY_FAULT 501
+
+/*! Simulated milliseconds per real one. */
+#define BENCH_RECOVERY_SCALE 100
+
+/*! Simulated answer time of a camera, a hung camera's SOAP timeout, and
+ * the time a camera takes to boot, in milliseconds. */
+#define BENCH_RECOVERY_RTT_MS 200
+#define BENCH_RECOVERY_TIMEOUT_MS 30000
+#define BENCH_RECOVERY_BOOT_MS 60000
+
+/*! What a simulated camera does next. */
+enum bench_recovery_step {
+	BENCH_RECOVERY_IDLE = 0,
+	BENCH_RECOVERY_PROBED,
+	BENCH_RECOVERY_REBOOT_ANSWER,
+	BENCH_RECOVERY_REBOOT_TIMEOUT,
+	BENCH_RECOVERY_BYEBYE,
+	BENCH_RECOVERY_ALIVE
+};
+
+/*! A simulated camera, driven from the timer wheel thread only. */
+struct bench_recovery_camera {
+	struct CCTvTimer timer;
+	char UDN[64];
+	int hung;
+	int dead;
+	int faulty;
+	/*! Reboots sent to it. */
+	int reboots;
+	enum bench_recovery_step step;
+};
+
+static struct CCTvTimerWheel bench_recovery_wheel;
+static struct bench_recovery_camera *bench_recovery_fleet;
+
+static struct bench_recovery_camera *bench_recovery_find(const char *UDN)
+{
+	int i;
+
+	/* "...bench%05d" */
+	i = atoi(UDN + strlen(UDN) - 5);
+	if (i < 0 || i >= BENCH_RECOVERY_FLEET)
+		return NULL;
+
+	return &bench_recovery_fleet[i];
+}
+
+/*!
+ * \brief Outcome of a request to a camera, as the SDK reports it.
+ */
+static int bench_recovery_errcode(const struct bench_recovery_camera *cam)
+{
+	if (cam->hung)
+		return UPNP_E_TIMEDOUT;
+	if (cam->faulty)
+		return BENCH_RECOVERY_FAULT;
+
+	return UPNP_E_SUCCESS;
+}
+
+static void bench_recovery_next(struct bench_recovery_camera *cam,
+	enum bench_recovery_step step, long ms)
+{
+	cam->step = step;
+	CCTvTimerArm(&bench_recovery_wheel, &cam->timer,
+		ms / BENCH_RECOVERY_SCALE);
+}
+
+static void bench_recovery_event(struct CCTvTimer *timer, void *arg)
+{
+	struct bench_recovery_camera *cam =
+		(struct bench_recovery_camera *)arg;
+
+	switch (cam->step) {
+	case BENCH_RECOVERY_PROBED:
+		CCTvRecoveryReport(cam->UDN,
+			CCTvRecoveryAnswered(bench_recovery_errcode(cam)));
+		break;
+	case BENCH_RECOVERY_REBOOT_ANSWER:
+		CCTvRecoveryRebootAnswered(cam->UDN, UPNP_E_SUCCESS);
+		bench_recovery_next(cam, BENCH_RECOVERY_BYEBYE,
+			BENCH_RECOVERY_RTT_MS);
+		return;
+	case BENCH_RECOVERY_REBOOT_TIMEOUT:
+		CCTvRecoveryRebootAnswered(cam->UDN, UPNP_E_SOCKET_ERROR);
+		break;
+	case BENCH_RECOVERY_BYEBYE:
+		CCTvRecoveryByebye(cam->UDN);
+		bench_recovery_next(cam, BENCH_RECOVERY_ALIVE,
+			BENCH_RECOVERY_BOOT_MS);
+		return;
+	case BENCH_RECOVERY_ALIVE:
+		cam->hung = 0;
+		CCTvRecoveryAlive(cam->UDN, 1);
+		break;
+	default:
+		break;
+	}
+	cam->step = BENCH_RECOVERY_IDLE;
+	timer = timer;
+}
+
+static int bench_recovery_probe(const char *UDN)
+{
+	struct bench_recovery_camera *cam = bench_recovery_find(UDN);
+
+	if (!cam)
+		return CCTV_ERROR;
+	bench_recovery_next(cam, BENCH_RECOVERY_PROBED, cam->hung ?
+		BENCH_RECOVERY_TIMEOUT_MS : BENCH_RECOVERY_RTT_MS);
+
+	return CCTV_SUCCESS;
+}
+
+static int bench_recovery_reboot(const char *UDN)
+{
+	struct bench_recovery_camera *cam = bench_recovery_find(UDN);
+
+	if (!cam)
+		return CCTV_ERROR;
+	cam->reboots++;
+	if (cam->dead)
+		bench_recovery_next(cam, BENCH_RECOVERY_REBOOT_TIMEOUT,
+			BENCH_RECOVERY_TIMEOUT_MS);
+	else
+		bench_recovery_next(cam, BENCH_RECOVERY_REBOOT_ANSWER,
+			BENCH_RECOVERY_RTT_MS);
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Time for the recovery engine to bring back hung cameras: one in
+ * ten of 200 cameras fails three requests in a row and ignores the probe;
+ * most answer the reboot, say byebye and are back after a 60 s boot, one
+ * in fifty never answers and has to be escalated. One in seven of the
+ * others answers with SOAP faults only, which must not get it rebooted;
+ * the benchmark fails if one is. Time runs 100 times
+ * faster than real, with the engine's default thresholds scaled to match.
+ * Without the engine, recovery takes as long as an operator needs to
+ * notice.
+ */
+static int bench_recovery(int iterations)
+{
+	struct CCTvRecoveryOps ops = {
+		bench_recovery_probe,
+		bench_recovery_reboot,
+		NULL,
+		NULL
+	};
+	struct CCTvRecoveryConfig config = {
+		1,
+		CCTV_RECOVERY_SUSPECT_FAILURES,
+		CCTV_RECOVERY_PROBE_MS / BENCH_RECOVERY_SCALE,
+		CCTV_RECOVERY_REBOOT_MS / BENCH_RECOVERY_SCALE,
+		CCTV_RECOVERY_BOOT_MS / BENCH_RECOVERY_SCALE,
+		CCTV_RECOVERY_VERIFY_MS / BENCH_RECOVERY_SCALE,
+		CCTV_RECOVERY_MAX_REBOOTS
+	};
+	struct CCTvRecoveryStats stats;
+	struct bench_recovery_camera *cam;
+	double t0;
+	double elapsed;
+	int hung = 0;
+	int faulty = 0;
+	int faulty_rebooted = 0;
+	int settled = 0;
+	int i;
+	int f;
+
+	bench_recovery_fleet = (struct bench_recovery_camera *)calloc(
+		BENCH_RECOVERY_FLEET, sizeof *bench_recovery_fleet);
+	if (!bench_recovery_fleet ||
+	    CCTvTimerWheelStart(&bench_recovery_wheel, 1) != CCTV_SUCCESS) {
+		free(bench_recovery_fleet);
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < BENCH_RECOVERY_FLEET; i++) {
+		cam = &bench_recovery_fleet[i];
+		snprintf(cam->UDN, sizeof cam->UDN,
+			"uuid:Upnp-CCTVEmulator-1_0-bench%05d", i);
+		cam->hung = i % BENCH_RECOVERY_HUNG_EVERY == 0;
+		cam->dead = i % BENCH_RECOVERY_DEAD_EVERY == 0;
+		cam->faulty = !cam->hung &&
+			i % BENCH_RECOVERY_FAULTY_EVERY == 0;
+		hung += cam->hung;
+		faulty += cam->faulty;
+		CCTvTimerInit(&cam->timer, bench_recovery_event, cam);
+	}
+	CCTvRecoveryStart(&bench_recovery_wheel, &config, &ops);
+
+	t0 = bench_now();
+	for (i = 0; i < BENCH_RECOVERY_FLEET; i++) {
+		cam = &bench_recovery_fleet[i];
+		for (f = 0; f < CCTV_RECOVERY_SUSPECT_FAILURES; f++)
+			CCTvRecoveryReport(cam->UDN, CCTvRecoveryAnswered(
+				bench_recovery_errcode(cam)));
+	}
+	/* until every camera is healthy or escalated */
+	while (!settled && bench_now() - t0 < 30e9) {
+		bench_sleep_ms(10);
+		CCTvRecoveryGetStats(&stats);
+		settled = stats.state[CCTV_RECOVERY_SUSPECT] +
+			stats.state[CCTV_RECOVERY_REBOOTING] +
+			stats.state[CCTV_RECOVERY_AWAITING] +
+			stats.state[CCTV_RECOVERY_VERIFIED] == 0;
+	}
+	elapsed = (bench_now() - t0) / 1e6 * BENCH_RECOVERY_SCALE;
+	CCTvRecoveryGetStats(&stats);
+	for (i = 0; i < BENCH_RECOVERY_FLEET; i++) {
+		cam = &bench_recovery_fleet[i];
+		if (cam->faulty && (cam->reboots || CCTvRecoveryGetState(
+		    cam->UDN) != CCTV_RECOVERY_HEALTHY))
+			faulty_rebooted++;
+	}
+	printf("recovery cameras=%d hung=%d faulty=%d faulty_rebooted=%d "
+		"recovered=%lu escalated=%lu "
+		"reboots=%lu mean_recovery_s=%.1f max_recovery_s=%.1f "
+		"settled_s=%.1f\n", BENCH_RECOVERY_FLEET, hung, faulty,
+		faulty_rebooted,
+		stats.recoveries, stats.escalations, stats.reboots,
+		stats.recoveries ? stats.recovery_ms / stats.recoveries *
+		BENCH_RECOVERY_SCALE / 1e3 : 0.0,
+		stats.recovery_max_ms * BENCH_RECOVERY_SCALE / 1e3,
+		elapsed / 1e3);
+	CCTvRecoveryStop();
+	CCTvTimerWheelStop(&bench_recovery_wheel);
+	free(bench_recovery_fleet);
+
+	return settled && !faulty_rebooted ? CCTV_SUCCESS : CCTV_ERROR;
+	iterations = iterations;
+}
+
+/*! Fleet sizes swept by the polling benchmark. */
+static const int bench_poll_fleets[] = { 100, 1000, 5000 };
+
+#define BENCH_NUM_POLL_FLEETS \
+	((int)(sizeof bench_poll_fleets / sizeof bench_poll_fleets[0]))
+
+/*! Every this many cameras one hangs during the measurement. */
+#define BENCH_POLL_HUNG_EVERY 100
+
+/*! How often a working camera sends an event, in simulated ms. */
+#define BENCH_POLL_EVENT_MS 30000
+
+/*! Simulated time before the cameras hang, and the time measured after,
+ * in ms. */
+#define BENCH_POLL_WARMUP_MS 600000
+#define BENCH_POLL_MEASURE_MS 600000
+
+/*! Simulated milliseconds per real one. */
+#define BENCH_POLL_SCALE 200
+
+/*! A simulated camera, driven from the timer wheel thread only. */
+struct bench_poll_camera {
+	struct CCTvTimer event_timer;
+	char UDN[64];
+	char controlURL[64];
+	int hung;
+	/*! Real time it hung, and time from then to the first failed poll,
+	 * -1 until seen. */
+	double hung_at;
+	double detected_ms;
+};
+
+/*! A request in flight, answered after the round trip or the timeout. */
+struct bench_poll_request {
+	struct CCTvTimer timer;
+	struct bench_poll_camera *cam;
+	void *cookie;
+};
+
+static struct CCTvTimerWheel bench_poll_wheel;
+static struct bench_poll_camera *bench_poll_fleet;
+static int bench_poll_fleet_size;
+
+static void bench_poll_answer(struct CCTvTimer *timer, void *arg)
+{
+	struct bench_poll_request *req = (struct bench_poll_request *)arg;
+	struct bench_poll_camera *cam = req->cam;
+
+	if (cam->hung && cam->detected_ms < 0)
+		cam->detected_ms = (bench_now() - cam->hung_at) / 1e6 *
+			BENCH_POLL_SCALE;
+	CCTvPollComplete(req->cookie,
+		cam->hung ? UPNP_E_SOCKET_ERROR : UPNP_E_SUCCESS);
+	/* the wheel does not touch a timer after its callback returned */
+	free(req);
+	timer = timer;
+}
+
+static int bench_poll_send(const char *controlURL, const char *varName,
+	void *cookie)
+{
+	struct bench_poll_request *req;
+	int i;
+
+	/* "...bench%05d" */
+	i = atoi(controlURL + strlen(controlURL) - 5);
+	if (i < 0 || i >= bench_poll_fleet_size)
+		return UPNP_E_INVALID_URL;
+	req = (struct bench_poll_request *)calloc(1, sizeof *req);
+	if (!req)
+		return UPNP_E_OUTOF_MEMORY;
+	req->cam = &bench_poll_fleet[i];
+	req->cookie = cookie;
+	CCTvTimerInit(&req->timer, bench_poll_answer, req);
+	CCTvTimerArm(&bench_poll_wheel, &req->timer, (req->cam->hung ?
+		BENCH_RECOVERY_TIMEOUT_MS : BENCH_RECOVERY_RTT_MS) /
+		BENCH_POLL_SCALE);
+
+	return UPNP_E_SUCCESS;
+	varName = varName;
+}
+
+/*! Hangs the cameras, from the timer wheel thread like everything else
+ * that touches them. */
+static void bench_poll_hang(struct CCTvTimer *timer, void *arg)
+{
+	struct bench_poll_camera *cam;
+	int i;
+
+	for (i = 0; i < bench_poll_fleet_size; i += BENCH_POLL_HUNG_EVERY) {
+		cam = &bench_poll_fleet[i];
+		CCTvTimerDel(&bench_poll_wheel, &cam->event_timer);
+		cam->hung_at = bench_now();
+		cam->hung = 1;
+	}
+	timer = timer;
+	arg = arg;
+}
+
+static void bench_poll_event(struct CCTvTimer *timer, void *arg)
+{
+	struct bench_poll_camera *cam = (struct bench_poll_camera *)arg;
+
+	if (cam->hung)
+		return;
+	CCTvPollEvent(cam->UDN);
+	CCTvTimerArm(&bench_poll_wheel, timer,
+		BENCH_POLL_EVENT_MS / BENCH_POLL_SCALE);
+}
+
+/*!
+ * \brief Run one fleet with one configuration.
+ */
+static int bench_poll_run(const char *mode, int fleet,
+	const struct CCTvPollConfig *config)
+{
+	static const char *vars[] = { "Power", "Temperature" };
+	struct CCTvPollStats before;
+	struct CCTvPollStats after;
+	struct bench_poll_camera *cam;
+	struct CCTvTimer hang;
+	double t0;
+	double sum = 0.0;
+	double max = 0.0;
+	int detected = 0;
+	int hung = 0;
+	int i;
+
+	bench_poll_fleet = (struct bench_poll_camera *)calloc(
+		(size_t)fleet, sizeof *bench_poll_fleet);
+	if (!bench_poll_fleet ||
+	    CCTvTimerWheelStart(&bench_poll_wheel, 1) != CCTV_SUCCESS) {
+		free(bench_poll_fleet);
+		return CCTV_ERROR;
+	}
+	bench_poll_fleet_size = fleet;
+	CCTvPollStart(&bench_poll_wheel, config, vars, 2, bench_poll_send);
+	for (i = 0; i < fleet; i++) {
+		cam = &bench_poll_fleet[i];
+		snprintf(cam->UDN, sizeof cam->UDN,
+			"uuid:Upnp-CCTVEmulator-1_0-bench%05d", i);
+		snprintf(cam->controlURL, sizeof cam->controlURL,
+			"http://10.0.0.1/upnp/control/bench%05d", i);
+		cam->detected_ms = -1.0;
+		CCTvTimerInit(&cam->event_timer, bench_poll_event, cam);
+		CCTvTimerArm(&bench_poll_wheel, &cam->event_timer,
+			(long)(i % (BENCH_POLL_EVENT_MS / BENCH_POLL_SCALE)));
+		CCTvPollAdd(cam->UDN, cam->controlURL);
+	}
+	bench_sleep_ms(BENCH_POLL_WARMUP_MS / BENCH_POLL_SCALE);
+
+	CCTvPollGetStats(&before);
+	t0 = bench_now();
+	CCTvTimerInit(&hang, bench_poll_hang, NULL);
+	CCTvTimerArm(&bench_poll_wheel, &hang, 0);
+	bench_sleep_ms(BENCH_POLL_MEASURE_MS / BENCH_POLL_SCALE);
+	CCTvPollGetStats(&after);
+
+	CCTvPollStop();
+	CCTvTimerWheelStop(&bench_poll_wheel);
+	for (i = 0; i < fleet; i++) {
+		cam = &bench_poll_fleet[i];
+		hung += cam->hung;
+		if (!cam->hung || cam->detected_ms < 0)
+			continue;
+		detected++;
+		sum += cam->detected_ms;
+		if (cam->detected_ms > max)
+			max = cam->detected_ms;
+	}
+	printf("poll mode=%s cameras=%d req_per_s=%.1f inflight_peak=%d "
+		"queued_peak=%lu at_max=%lu hung=%d detected=%d "
+		"mean_detect_s=%.1f max_detect_s=%.1f\n",
+		mode, fleet,
+		(double)(after.requests - before.requests) /
+		((bench_now() - t0) / 1e9 * BENCH_POLL_SCALE),
+		after.inflight_peak, after.queued_peak, before.at_max, hung,
+		detected, detected ? sum / detected / 1e3 : 0.0, max / 1e3);
+	free(bench_poll_fleet);
+	bench_poll_fleet = NULL;
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief SOAP load and time to notice a hung camera, polling Power and
+ * Temperature of every camera every 15 s without limits, vs. adaptively
+ * under the default rate cap. Cameras send an event every 30 s; one in
+ * 100 hangs, goes quiet and lets its requests time out after 30 s. Time
+ * runs 200 times faster than real, with the thresholds scaled to match.
+ */
+static int bench_poll(int iterations)
+{
+	struct CCTvPollConfig fixed = {
+		1,
+		CCTV_POLL_MIN_MS / BENCH_POLL_SCALE,
+		CCTV_POLL_MIN_MS / BENCH_POLL_SCALE,
+		CCTV_POLL_QUIET_MS / BENCH_POLL_SCALE,
+		1000000,
+		1000000
+	};
+	struct CCTvPollConfig adaptive = {
+		1,
+		CCTV_POLL_MIN_MS / BENCH_POLL_SCALE,
+		CCTV_POLL_MAX_MS / BENCH_POLL_SCALE,
+		CCTV_POLL_QUIET_MS / BENCH_POLL_SCALE,
+		CCTV_POLL_RATE * BENCH_POLL_SCALE,
+		CCTV_POLL_MAX_INFLIGHT
+	};
+	int f;
+
+	for (f = 0; f < BENCH_NUM_POLL_FLEETS; f++) {
+		if (bench_poll_run("fixed", bench_poll_fleets[f], &fixed) !=
+			CCTV_SUCCESS ||
+		    bench_poll_run("adaptive", bench_poll_fleets[f],
+			&adaptive) != CCTV_SUCCESS)
+			return CCTV_ERROR;
+	}
+
+	return CCTV_SUCCESS;
+	iterations = iterations;
+}
+
+/*! NOTIFY bodies as the camera emulator sends them through libupnp: the
+ * periodic temperature event, the initial event of a subscription, and
+ * an event with a variable the control point does not know. */
+static const char *bench_propset_bodies[] = {
+	"<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">\n"
+	"<e:property>\n<Temperature>41</Temperature>\n</e:property>\n"
+	"</e:propertyset>\n\n",
+	"<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">\n"
+	"<e:property>\n<Power>1</Power>\n</e:property>\n"
+	"<e:property>\n<Temperature>38</Temperature>\n</e:property>\n"
+	"</e:propertyset>\n\n",
+	"<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">\n"
+	"<e:property>\n<Uptime>86400</Uptime>\n</e:property>\n"
+	"<e:property>\n<Temperature>52</Temperature>\n</e:property>\n"
+	"</e:propertyset>\n\n"
+};
+
+static const char *bench_propset_names[] = { "Power", "Temperature" };
+
+#define BENCH_NUM_PROPSET_BODIES \
+	((int)(sizeof bench_propset_bodies / sizeof bench_propset_bodies[0]))
+
+/*!
+ * \brief The state update as it was: a node list of properties, a node
+ * list per known variable and property, and a copy of each value.
+ */
+static int bench_propset_lists(IXML_Document *changes, char **state)
+{
+	IXML_NodeList *properties;
+	IXML_NodeList *variables;
+	char *value;
+	unsigned long length;
+	unsigned long i;
+	int count = 0;
+	int j;
+
+	properties = ixmlDocument_getElementsByTagName(changes, "e:property");
+	if (!properties)
+		return 0;
+	length = ixmlNodeList_length(properties);
+	for (i = 0; i < length; i++) {
+		for (j = 0; j < 2; j++) {
+			variables = ixmlElement_getElementsByTagName(
+				(IXML_Element *)ixmlNodeList_item(properties, i),
+				bench_propset_names[j]);
+			if (!variables)
+				continue;
+			if (ixmlNodeList_length(variables)) {
+				value = SampleUtil_GetElementValue(
+					(IXML_Element *)ixmlNodeList_item(
+					variables, 0));
+				if (value) {
+					strncpy(state[j], value,
+						CCTV_MAX_VAL_LEN - 1);
+					count++;
+					free(value);
+				}
+			}
+			ixmlNodeList_free(variables);
+		}
+	}
+	ixmlNodeList_free(properties);
+
+	return count;
+}
+
+static void bench_propset_store(int var, const char *value, void *arg)
+{
+	strncpy(((char **)arg)[var], value, CCTV_MAX_VAL_LEN - 1);
+}
+
+/*!
+ * \brief Cost of taking the variables out of a parsed NOTIFY body on one
+ * core, with node lists as before against one walk along the tree.
+ */
+static int bench_propset(int iterations)
+{
+	char values[2][CCTV_MAX_VAL_LEN];
+	char *state[2] = { values[0], values[1] };
+	IXML_Document *changes;
+	double t0;
+	double lists_ns;
+	double walk_ns;
+	int lists = 0;
+	int walk = 0;
+	int b;
+	int i;
+
+	memset(values, 0, sizeof values);
+	for (b = 0; b < BENCH_NUM_PROPSET_BODIES; b++) {
+		changes = ixmlParseBuffer(bench_propset_bodies[b]);
+		if (!changes)
+			return CCTV_ERROR;
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++)
+			lists += bench_propset_lists(changes, state);
+		lists_ns = bench_now() - t0;
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++)
+			walk += CCTvPropertySetParse(changes,
+				bench_propset_names, 2, bench_propset_store,
+				state);
+		walk_ns = bench_now() - t0;
+		ixmlDocument_free(changes);
+		printf("propset body=%d mode=lists ns_per_event=%.1f\n",
+			b, lists_ns / iterations);
+		printf("propset body=%d mode=walk ns_per_event=%.1f "
+			"speedup=%.1f\n", b, walk_ns / iterations,
+			lists_ns / walk_ns);
+	}
+
+	return lists == walk ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+/*! Fleet sizes swept by the hot table benchmark. */
+static const int bench_hot_sizes[] = { 1000, 10000, 100000 };
+
+#define BENCH_NUM_HOT_SIZES \
+	((int)(sizeof bench_hot_sizes / sizeof bench_hot_sizes[0]))
+
+/*! Seconds within which an advertisement counts as expiring. */
+#define BENCH_HOT_HORIZON 300
+
+/*! A device node as it was, with its strings inline and a separate
+ * allocation per state variable. */
+struct bench_hot_node {
+	char UDN[250];
+	char DescDocURL[250];
+	char FriendlyName[250];
+	char PresURL[250];
+	int AdvrTimeOut;
+	char ServiceId[NAME_SIZE];
+	char ServiceType[NAME_SIZE];
+	char *VariableStrVal[CCTV_MAXVARS];
+	char EventURL[NAME_SIZE];
+	char ControlURL[NAME_SIZE];
+	char SID[NAME_SIZE];
+	int SubState;
+	struct CCTvTimer ExpiryTimer;
+	struct CCTvTimer SearchTimer;
+	struct CCTvHistogram *Latency[CCTV_LATENCY_ACTIONS];
+};
+
+/*!
+ * \brief The same sweep over the nodes as they were, from the pointers
+ * the registry keeps.
+ */
+static void bench_hot_sweep_nodes(struct bench_hot_node **nodes, int n,
+	int hot_threshold, int horizon, struct CCTvHotSummary *summary)
+{
+	struct bench_hot_node *node;
+	double temp_sum = 0.0;
+	int temp;
+	int i;
+
+	memset(summary, 0, sizeof *summary);
+	for (i = 0; i < n; i++) {
+		node = nodes[i];
+		summary->devices++;
+		summary->powered_on += atoi(node->VariableStrVal[0]) == 1;
+		summary->powered_off += atoi(node->VariableStrVal[0]) == 0;
+		summary->unsubscribed += node->SID[0] == '\0';
+		summary->expiring += node->AdvrTimeOut <= horizon;
+		temp = atoi(node->VariableStrVal[1]);
+		if (!summary->temp_known || temp < summary->temp_min)
+			summary->temp_min = temp;
+		if (!summary->temp_known || temp > summary->temp_max)
+			summary->temp_max = temp;
+		summary->temp_known++;
+		temp_sum += temp;
+		summary->hot += temp >= hot_threshold;
+	}
+	if (summary->temp_known)
+		summary->temp_mean = temp_sum / summary->temp_known;
+}
+
+/*!
+ * \brief Cost of a fleet-wide sweep (power, temperature, subscription and
+ * expiry of every device) over the device nodes as they were against the
+ * hot table, and the memory each takes per device.
+ */
+static int bench_hot(int iterations)
+{
+	struct bench_hot_node **nodes;
+	struct CCTvDeviceNode *fleet;
+	struct CCTvHotTable table;
+	struct CCTvHotSummary before;
+	struct CCTvHotSummary after;
+	unsigned int seed = 1;
+	double nodes_ns;
+	double hot_ns;
+	double t0;
+	size_t strings;
+	int sweeps;
+	int slot;
+	int rc = CCTV_SUCCESS;
+	int f;
+	int n;
+	int i;
+	int j;
+
+	for (f = 0; f < BENCH_NUM_HOT_SIZES && rc == CCTV_SUCCESS; f++) {
+		n = bench_hot_sizes[f];
+		sweeps = iterations / n > 3 ? iterations / n : 3;
+		nodes = (struct bench_hot_node **)calloc((size_t)n,
+			sizeof *nodes);
+		fleet = bench_make_fleet(n);
+		if (!nodes || !fleet) {
+			free(nodes);
+			free(fleet);
+			return CCTV_ERROR;
+		}
+		CCTvHotInit(&table);
+		/* packed behind the node, the other strings are empty */
+		strings = strlen(fleet[0].device.UDN) + strlen(fleet[0].device.
+			CCTvService[CCTV_SERVICE_CONTROL].EventURL) +
+			strlen(fleet[0].device.CCTvService[
+			CCTV_SERVICE_CONTROL].ControlURL) + 3;
+		for (i = 0; i < n; i++) {
+			nodes[i] = (struct bench_hot_node *)calloc(1,
+				sizeof *nodes[i]);
+			if (!nodes[i]) {
+				rc = CCTV_ERROR;
+				break;
+			}
+			for (j = 0; j < CCTV_MAXVARS; j++)
+				nodes[i]->VariableStrVal[j] =
+					(char *)calloc(1, CCTV_MAX_VAL_LEN);
+			strcpy(nodes[i]->UDN, fleet[i].device.UDN);
+			strcpy(nodes[i]->SID, fleet[i].device.CCTvService[
+				CCTV_SERVICE_CONTROL].SID);
+			nodes[i]->AdvrTimeOut = 60 + (int)(rand_r(&seed) % 1740);
+			snprintf(nodes[i]->VariableStrVal[0], CCTV_MAX_VAL_LEN,
+				"%d", i % 10 != 0);
+			snprintf(nodes[i]->VariableStrVal[1], CCTV_MAX_VAL_LEN,
+				"%d", 30 + (int)(rand_r(&seed) % 50));
+
+			slot = CCTvHotAlloc(&table, &fleet[i]);
+			if (slot < 0) {
+				rc = CCTV_ERROR;
+				break;
+			}
+			fleet[i].device.Slot = slot;
+			CCTV_HOT(&table, slot, expiry) = CCTvHotNow() +
+				nodes[i]->AdvrTimeOut;
+			CCTV_HOT(&table, slot, sid_hash) = CCTvRegistryHash(
+				nodes[i]->SID) | 1;
+			CCTV_HOT(&table, slot, power) =
+				(signed char)atoi(nodes[i]->VariableStrVal[0]);
+			CCTV_HOT(&table, slot, temperature) =
+				(short)atoi(nodes[i]->VariableStrVal[1]);
+		}
+		if (rc == CCTV_SUCCESS) {
+			t0 = bench_now();
+			for (i = 0; i < sweeps; i++)
+				bench_hot_sweep_nodes(nodes, n,
+					CCTV_HOT_THRESHOLD,
+					BENCH_HOT_HORIZON, &before);
+			nodes_ns = (bench_now() - t0) / sweeps;
+			t0 = bench_now();
+			for (i = 0; i < sweeps; i++)
+				CCTvHotSummarize(&table, CCTV_HOT_THRESHOLD,
+					BENCH_HOT_HORIZON, &after);
+			hot_ns = (bench_now() - t0) / sweeps;
+			if (before.hot != after.hot ||
+			    before.powered_on != after.powered_on ||
+			    before.unsubscribed != after.unsubscribed)
+				rc = CCTV_ERROR;
+			printf("hot devices=%d layout=nodes ns_per_device=%.2f "
+				"bytes_per_device=%lu\n", n, nodes_ns / n,
+				(unsigned long)(sizeof(struct bench_hot_node) +
+				CCTV_MAXVARS * CCTV_MAX_VAL_LEN));
+			printf("hot devices=%d layout=columns ns_per_device=%.2f "
+				"bytes_per_device=%lu speedup=%.1f\n", n,
+				hot_ns / n,
+				(unsigned long)(sizeof(struct CCTvDeviceNode) +
+				strings + CCTV_MAXVARS * CCTV_MAX_VAL_LEN +
+				sizeof(struct CCTvHotChunk) / CCTV_HOT_CHUNK),
+				nodes_ns / hot_ns);
+		}
+		for (i = 0; i < n && nodes[i]; i++) {
+			for (j = 0; j < CCTV_MAXVARS; j++)
+				free(nodes[i]->VariableStrVal[j]);
+			free(nodes[i]);
+		}
+		CCTvHotDestroy(&table);
+		free(nodes);
+		free(fleet);
+	}
+
+	return rc;
+}
+
+/*! Socket of the command socket benchmark. */
+#define BENCH_CTLSOCK_PATH "/tmp/cctv_bench_ctlsock.sock"
+
+/*! Commands per batch. */
+#define BENCH_CTLSOCK_BATCH 256
+
+/*! Replies read by the client side of the command socket benchmark. */
+struct bench_ctlsock_reader {
+	int fd;
+	int expected;
+	int replies;
+	int errors;
+	/* results, and those not following the reply of their command */
+	int results;
+	int misordered;
+};
+
+/*!
+ * \brief A command as cheap as most are: print a line and return, with a
+ * result as an action that completes at once has.
+ */
+static int bench_ctlsock_exec(char *cmdline)
+{
+	struct CCTvCtlSockOrigin origin;
+
+	SampleUtil_Print("%s: sent\n", cmdline);
+	CCTvCtlSockGetOrigin(&origin);
+	CCTvCtlSockComplete(&origin, 1, "done\n", 5);
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Read replies until the expected number arrived.
+ */
+static void *bench_ctlsock_read(void *arg)
+{
+	struct bench_ctlsock_reader *reader =
+		(struct bench_ctlsock_reader *)arg;
+	static char buf[1 << 16];
+	size_t len = 0;
+	size_t pos;
+	char *eol;
+	char status[8];
+	unsigned long body;
+	ssize_t n;
+
+	while (reader->replies < reader->expected ||
+	       reader->results < reader->expected) {
+		n = recv(reader->fd, buf + len, sizeof buf - len, 0);
+		if (n <= 0)
+			break;
+		len += (size_t)n;
+		pos = 0;
+		while ((eol = (char *)memchr(buf + pos, '\n', len - pos))) {
+			*eol = '\0';
+			if (sscanf(buf + pos, "%*s %7s %lu", status, &body) != 2)
+				return NULL;
+			if ((size_t)(eol + 1 - buf) + body > len) {
+				*eol = '\n';
+				break;
+			}
+			if (strcmp(status, "done") == 0) {
+				reader->results++;
+				reader->misordered +=
+					reader->results > reader->replies;
+			} else {
+				reader->replies++;
+				reader->errors += strcmp(status, "ok") != 0;
+			}
+			pos = (size_t)(eol + 1 - buf) + body;
+		}
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+
+	return NULL;
+}
+
+static int bench_ctlsock_connect(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, BENCH_CTLSOCK_PATH);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+static int bench_ctlsock_send(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return CCTV_ERROR;
+		data += n;
+		len -= (size_t)n;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Run n commands in one of three ways: waiting for each reply like a
+ * script driving the prompt would, pipelined, or in batches.
+ *
+ * \return Commands per second, or a negative value on failure.
+ */
+static double bench_ctlsock_run(const char *mode, int n)
+{
+	struct bench_ctlsock_reader reader;
+	pthread_t thread;
+	char *requests;
+	char *p;
+	char line[64];
+	double t0;
+	double elapsed;
+	int len;
+	int rc = CCTV_SUCCESS;
+	int b;
+	int i;
+
+	requests = (char *)malloc((size_t)n * 64);
+	reader.fd = bench_ctlsock_connect();
+	if (!requests || reader.fd < 0) {
+		free(requests);
+		if (reader.fd >= 0)
+			close(reader.fd);
+		return -1.0;
+	}
+	reader.replies = 0;
+	reader.errors = 0;
+	reader.results = 0;
+	reader.misordered = 0;
+	reader.expected = n;
+	t0 = bench_now();
+	if (strcmp(mode, "wait") == 0) {
+		for (i = 0; i < n && rc == CCTV_SUCCESS; i++) {
+			len = snprintf(line, sizeof line, "t%d PowerOn %d\n", i,
+				i % 300 + 1);
+			rc = bench_ctlsock_send(reader.fd, line, (size_t)len);
+			reader.expected = i + 1;
+			bench_ctlsock_read(&reader);
+		}
+	} else {
+		pthread_create(&thread, NULL, bench_ctlsock_read, &reader);
+		p = requests;
+		for (b = 0; b < n; b += BENCH_CTLSOCK_BATCH) {
+			for (i = b; i < n && i < b + BENCH_CTLSOCK_BATCH; i++) {
+				if (strcmp(mode, "pipelined") == 0)
+					p += sprintf(p, "t%d ", i);
+				p += sprintf(p, "PowerOn %d\n", i % 300 + 1);
+			}
+			if (strcmp(mode, "batch") == 0) {
+				len = snprintf(line, sizeof line, "b%d *%ld\n",
+					b, (long)(p - requests));
+				rc = bench_ctlsock_send(reader.fd, line,
+					(size_t)len);
+			}
+			if (rc == CCTV_SUCCESS)
+				rc = bench_ctlsock_send(reader.fd, requests,
+					(size_t)(p - requests));
+			p = requests;
+		}
+		pthread_join(thread, NULL);
+	}
+	elapsed = bench_now() - t0;
+	close(reader.fd);
+	free(requests);
+	if (rc != CCTV_SUCCESS || reader.replies != n || reader.errors ||
+	    reader.results != n || reader.misordered)
+		return -1.0;
+
+	return n / (elapsed / 1e9);
+}
+
+/*!
+ * \brief Commands a script gets through the command socket, waiting for
+ * every reply against pipelining them or sending them in batches.
+ */
+static int bench_ctlsock(int iterations)
+{
+	static const char *modes[] = { "wait", "pipelined", "batch" };
+	struct CCTvCtlSockStats stats;
+	double rate;
+	double base = 0.0;
+	int n = iterations / 10;
+	int rc = CCTV_SUCCESS;
+	int m;
+
+	if (n > 100000)
+		n = 100000;
+	if (n < 1000)
+		n = 1000;
+	if (CCTvCtlSockStart(BENCH_CTLSOCK_PATH, bench_ctlsock_exec) !=
+	    CCTV_SUCCESS)
+		return CCTV_ERROR;
+	for (m = 0; m < 3; m++) {
+		rate = bench_ctlsock_run(modes[m], n);
+		if (rate < 0) {
+			rc = CCTV_ERROR;
+			break;
+		}
+		if (m == 0)
+			base = rate;
+		printf("ctlsock mode=%s commands=%d commands_s=%.0f "
+			"speedup=%.1f\n", modes[m], n, rate, rate / base);
+	}
+	CCTvCtlSockGetStats(&stats);
+	printf("ctlsock replies=%lu results=%lu dropped=%lu writes=%lu "
+		"replies_per_write=%.1f\n", stats.replies, stats.results,
+		stats.dropped, stats.writes,
+		stats.writes ? (double)(stats.replies + stats.results) /
+			stats.writes : 0.0);
+	CCTvCtlSockStop();
+	CCTvCtlSockDestroy();
+
+	return rc;
+}
+
+/*! Snapshot file of the snapshot benchmark. */
+#define BENCH_SNAPSHOT_PATH "/tmp/cctv_bench.snapshot"
+
+/*! Fleet sizes of the snapshot benchmark. */
+static const int bench_snapshot_sizes[] = { 1000, 10000 };
+
+#define BENCH_NUM_SNAPSHOT_SIZES \
+	((int)(sizeof bench_snapshot_sizes / sizeof bench_snapshot_sizes[0]))
+
+/*! MX of the search a control point starts with, milliseconds. */
+#define BENCH_SNAPSHOT_MX_MS 5000
+
+/*! Wait when the discovery queue is full, as the control point does. */
+#define BENCH_SNAPSHOT_RETRY_MS 50
+
+static struct CCTvDeviceNode *bench_snapshot_fleet;
+static int bench_snapshot_size;
+
+/*! Devices restored from the snapshot, one allocation each. */
+static char **bench_snapshot_restored;
+static int bench_snapshot_nrestored;
+
+static void bench_snapshot_location(char *buf, size_t size, int i)
+{
+	snprintf(buf, size, "http://10.%d.%d.%d:49152/cctvdevicedesc.xml",
+		(i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+}
+
+static void bench_snapshot_collect(struct CCTvSnapshotWriter *writer)
+{
+	struct CCTvSnapshotRecord record;
+	const struct cctv_service *s;
+	char location[64];
+	int i;
+
+	for (i = 0; i < bench_snapshot_size; i++) {
+		s = &bench_snapshot_fleet[i].device.CCTvService[0];
+		bench_snapshot_location(location, sizeof location, i);
+		record.UDN = bench_snapshot_fleet[i].device.UDN;
+		record.location = location;
+		record.friendlyName =
+			bench_snapshot_fleet[i].device.FriendlyName;
+		record.presURL = bench_snapshot_fleet[i].device.PresURL;
+		record.serviceId[0] = s->ServiceId;
+		record.eventURL[0] = s->EventURL;
+		record.controlURL[0] = s->ControlURL;
+		record.values[0][CCTV_CONTROL_POWER] = "1";
+		record.values[0][1] = "42";
+		CCTvSnapshotAdd(writer, &record);
+	}
+}
+
+/*!
+ * \brief Copy a device out of the snapshot, as the control point does into
+ * a new node.
+ */
+static void bench_snapshot_restore(const struct CCTvSnapshotRecord *record,
+	void *arg)
+{
+	char *copy;
+	char *space;
+	int var;
+
+	copy = (char *)malloc(BENCH_FLEET_STRINGS + 64);
+	if (!copy)
+		return;
+	space = copy;
+	bench_pack(&space, record->UDN);
+	bench_pack(&space, record->location);
+	bench_pack(&space, record->friendlyName);
+	bench_pack(&space, record->presURL);
+	bench_pack(&space, record->eventURL[0]);
+	bench_pack(&space, record->controlURL[0]);
+	for (var = 0; var < CCTV_MAXVARS; var++)
+		bench_pack(&space, record->values[0][var]);
+	bench_snapshot_restored[bench_snapshot_nrestored++] = copy;
+	arg = arg;
+}
+
+/*!
+ * \brief Queue the descriptions of the restored devices, waiting while the
+ * discovery queue is full.
+ */
+static void bench_snapshot_verify(void)
+{
+	const char *UDN;
+	int i;
+
+	for (i = 0; i < bench_snapshot_nrestored; i++) {
+		UDN = bench_snapshot_restored[i];
+		while (CCTvDiscoveryEnqueue(UDN, UDN + strlen(UDN) + 1,
+			CCTV_SNAPSHOT_VERIFY_S) == CCTV_WARNING)
+			bench_sleep_ms(BENCH_SNAPSHOT_RETRY_MS);
+	}
+}
+
+/*!
+ * \brief Send the search responses of the fleet spread over the MX, as a
+ * control point starting without a snapshot gets them.
+ *
+ * \return Responses dropped because the discovery queue was full.
+ */
+static int bench_snapshot_search(int n)
+{
+	char location[64];
+	char UDN[64];
+	double t0 = bench_now();
+	int dropped = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		while (bench_now() < t0 + (double)i * BENCH_SNAPSHOT_MX_MS *
+			1e6 / n)
+			bench_sleep_ms(1);
+		snprintf(UDN, sizeof UDN,
+			"uuid:Upnp-CCTVEmulator-1_0-bench%05d", i);
+		bench_snapshot_location(location, sizeof location, i);
+		dropped += CCTvDiscoveryEnqueue(UDN, location, 1800) ==
+			CCTV_WARNING;
+	}
+
+	return dropped;
+}
+
+/*!
+ * \brief Cost of writing and loading the registry snapshot for 1k and 10k
+ * devices, and the time until a restarted control point lists and has
+ * verified the whole fleet, without a snapshot (search responses over the
+ * MX, then fetches) and with one (listed on load, then fetches).
+ */
+static int bench_snapshot(int iterations)
+{
+	struct CCTvDiscoveryStats stats;
+	struct stat st;
+	double write_ms;
+	double load_ms;
+	double t0;
+	int dropped;
+	int loaded;
+	int n;
+	int z;
+	int i;
+
+	for (z = 0; z < BENCH_NUM_SNAPSHOT_SIZES; z++) {
+		n = bench_snapshot_sizes[z];
+		bench_snapshot_fleet = bench_make_fleet(n);
+		bench_snapshot_restored = (char **)calloc((size_t)n,
+			sizeof *bench_snapshot_restored);
+		if (!bench_snapshot_fleet || !bench_snapshot_restored) {
+			free(bench_snapshot_fleet);
+			free(bench_snapshot_restored);
+			return CCTV_ERROR;
+		}
+		bench_snapshot_size = n;
+		bench_snapshot_nrestored = 0;
+
+		t0 = bench_now();
+		if (CCTvSnapshotWrite(BENCH_SNAPSHOT_PATH,
+			bench_snapshot_collect) != n)
+			return CCTV_ERROR;
+		write_ms = (bench_now() - t0) / 1e6;
+		t0 = bench_now();
+		loaded = CCTvSnapshotLoad(BENCH_SNAPSHOT_PATH,
+			bench_snapshot_restore, NULL);
+		load_ms = (bench_now() - t0) / 1e6;
+		if (loaded != n || bench_snapshot_nrestored != n)
+			return CCTV_ERROR;
+		if (stat(BENCH_SNAPSHOT_PATH, &st) != 0)
+			return CCTV_ERROR;
+		printf("snapshot devices=%d write_ms=%.2f load_ms=%.2f "
+			"bytes_per_device=%.0f\n", n, write_ms, load_ms,
+			(double)st.st_size / n);
+
+		/* no snapshot: nothing listed until fetched */
+		if (CCTvDiscoveryStart(CCTV_DISCOVERY_WORKERS,
+			CCTV_DISCOVERY_MAX_PENDING, bench_discovery_fetch,
+			bench_discovery_add, NULL) != CCTV_SUCCESS)
+			return CCTV_ERROR;
+		CCTvDiscoveryStartRound();
+		t0 = bench_now();
+		dropped = bench_snapshot_search(n);
+		bench_discovery_drain(&stats);
+		printf("snapshot mode=cold devices=%d listed_ms=%.0f "
+			"verified_ms=%.0f dropped=%d\n", n,
+			(bench_now() - t0) / 1e6, (bench_now() - t0) / 1e6,
+			dropped);
+		CCTvDiscoveryStop();
+		CCTvDiscoveryDestroy();
+
+		/* snapshot: listed when loaded, fetched in parallel */
+		if (CCTvDiscoveryStart(CCTV_DISCOVERY_WORKERS,
+			CCTV_DISCOVERY_MAX_PENDING, bench_discovery_fetch,
+			bench_discovery_add, NULL) != CCTV_SUCCESS)
+			return CCTV_ERROR;
+		for (i = 0; i < n; i++)
+			free(bench_snapshot_restored[i]);
+		bench_snapshot_nrestored = 0;
+		t0 = bench_now();
+		CCTvSnapshotLoad(BENCH_SNAPSHOT_PATH, bench_snapshot_restore,
+			NULL);
+		load_ms = (bench_now() - t0) / 1e6;
+		bench_snapshot_verify();
+		bench_discovery_drain(&stats);
+		printf("snapshot mode=warm devices=%d listed_ms=%.1f "
+			"verified_ms=%.0f dropped=0\n", n, load_ms,
+			(bench_now() - t0) / 1e6);
+		CCTvDiscoveryStop();
+		CCTvDiscoveryDestroy();
+
+		for (i = 0; i < bench_snapshot_nrestored; i++)
+			free(bench_snapshot_restored[i]);
+		free(bench_snapshot_restored);
+		free(bench_snapshot_fleet);
+	}
+	unlink(BENCH_SNAPSHOT_PATH);
+
+	return CCTV_SUCCESS;
+	iterations = iterations;
+}
+
+/*! Worker counts of the shard benchmark. */
+static const int bench_shard_counts[] = { 2, 4, 8, 16 };
+
+#define BENCH_NUM_SHARD_COUNTS \
+	((int)(sizeof bench_shard_counts / sizeof bench_shard_counts[0]))
+
+/*! Cameras spread over the workers. */
+#define BENCH_SHARD_DEVICES 10000
+
+/*!
+ * \brief Spread 10,000 UDNs over 2 to 16 workers on the ring and by
+ * hash modulo the worker count: the largest share against the mean, and
+ * the cameras changing worker when the last one goes down (1/workers at
+ * best).
+ */
+static int bench_shard(int iterations)
+{
+	static struct CCTvShardRing ring;
+	char (*UDNs)[32];
+	unsigned int *hashes;
+	int *owners;
+	int count[CCTV_SHARD_MAX];
+	int modcount[CCTV_SHARD_MAX];
+	int ringmax;
+	int modmax;
+	int ringmoved;
+	int modmoved;
+	int owner;
+	double t0;
+	double lookup_ns;
+	int sum = 0;
+	int ns;
+	int z;
+	int i;
+
+	UDNs = malloc(BENCH_SHARD_DEVICES * sizeof *UDNs);
+	hashes = (unsigned int *)malloc(BENCH_SHARD_DEVICES * sizeof *hashes);
+	owners = (int *)malloc(BENCH_SHARD_DEVICES * sizeof *owners);
+	if (!UDNs || !hashes || !owners) {
+		free(UDNs);
+		free(hashes);
+		free(owners);
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < BENCH_SHARD_DEVICES; i++) {
+		snprintf(UDNs[i], sizeof UDNs[i], "uuid:cctv-%05d", i);
+		hashes[i] = CCTvShardHash(UDNs[i]);
+	}
+
+	for (z = 0; z < BENCH_NUM_SHARD_COUNTS; z++) {
+		ns = bench_shard_counts[z];
+		CCTvShardRingInit(&ring);
+		for (i = 0; i < ns; i++)
+			CCTvShardRingAdd(&ring, i);
+		memset(count, 0, sizeof count);
+		memset(modcount, 0, sizeof modcount);
+		for (i = 0; i < BENCH_SHARD_DEVICES; i++) {
+			owners[i] = CCTvShardRingOwner(&ring, UDNs[i]);
+			count[owners[i]]++;
+			modcount[hashes[i] % (unsigned int)ns]++;
+		}
+		ringmax = 0;
+		modmax = 0;
+		for (i = 0; i < ns; i++) {
+			if (count[i] > ringmax)
+				ringmax = count[i];
+			if (modcount[i] > modmax)
+				modmax = modcount[i];
+		}
+
+		CCTvShardRingRemove(&ring, ns - 1);
+		ringmoved = 0;
+		modmoved = 0;
+		for (i = 0; i < BENCH_SHARD_DEVICES; i++) {
+			owner = CCTvShardRingOwner(&ring, UDNs[i]);
+			if (owner != owners[i])
+				ringmoved++;
+			if (owners[i] != ns - 1 && owner == ns - 1)
+				abort();
+			if (hashes[i] % (unsigned int)ns !=
+			    hashes[i] % (unsigned int)(ns - 1))
+				modmoved++;
+		}
+
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++)
+			sum += CCTvShardRingOwner(&ring,
+				UDNs[i % BENCH_SHARD_DEVICES]);
+		lookup_ns = (bench_now() - t0) / iterations;
+
+		printf("shard workers=%d devices=%d ring_max_over_mean=%.2f "
+			"modulo_max_over_mean=%.2f ring_moved=%.3f "
+			"modulo_moved=%.3f ideal_moved=%.3f lookup_ns=%.1f\n",
+			ns, BENCH_SHARD_DEVICES,
+			(double)ringmax * ns / BENCH_SHARD_DEVICES,
+			(double)modmax * ns / BENCH_SHARD_DEVICES,
+			(double)ringmoved / BENCH_SHARD_DEVICES,
+			(double)modmoved / BENCH_SHARD_DEVICES,
+			1.0 / ns, lookup_ns);
+	}
+	/* keep the lookups from being optimized away */
+	if (sum < 0)
+		abort();
+
+	free(UDNs);
+	free(hashes);
+	free(owners);
+
+	return CCTV_SUCCESS;
+}
+
+/*! Thread counts of the metrics benchmark. */
+static const int bench_metrics_threads[] = { 1, 2, 4, 8 };
+
+#define BENCH_NUM_METRICS_THREADS \
+	((int)(sizeof bench_metrics_threads / sizeof bench_metrics_threads[0]))
+
+static struct CCTvHistogram bench_metrics_histogram;
+static struct CCTvMetric bench_metrics_set[] = {
+	CCTV_METRIC_COUNTER_INIT("bench_events_total", "Events."),
+	CCTV_METRIC_HISTOGRAM_INIT("bench_action_seconds", "Actions.",
+		&bench_metrics_histogram)
+};
+
+static pthread_mutex_t bench_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long bench_metrics_locked;
+static int bench_metrics_mode;
+static int bench_metrics_iterations;
+
+static void *bench_metrics_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < bench_metrics_iterations; i++) {
+		switch (bench_metrics_mode) {
+		case 0:
+			pthread_mutex_lock(&bench_metrics_mutex);
+			bench_metrics_locked++;
+			pthread_mutex_unlock(&bench_metrics_mutex);
+			break;
+		case 1:
+			CCTvMetricsAdd(&bench_metrics_set[0], 1);
+			break;
+		default:
+			CCTvMetricsObserve(&bench_metrics_set[1],
+				(unsigned long)(i & 0xfffff));
+			break;
+		}
+	}
+
+	return NULL;
+	arg = arg;
+}
+
+/*!
+ * \brief Cost of counting an event from 1 to 8 threads at once: a counter
+ * behind a mutex, as the module stats are, against a lock-free metric and
+ * a histogram observation; then the cost of a scrape.
+ */
+static int bench_metrics(int iterations)
+{
+	static const char *modes[] = { "mutex", "metric", "histogram" };
+	pthread_t threads[8];
+	char *text;
+	size_t len;
+	double t0;
+	int nthreads;
+	int mode;
+	int z;
+	int i;
+
+	CCTvMetricsRegister(bench_metrics_set,
+		(int)(sizeof bench_metrics_set / sizeof bench_metrics_set[0]));
+	bench_metrics_iterations = iterations;
+	for (z = 0; z < BENCH_NUM_METRICS_THREADS; z++) {
+		nthreads = bench_metrics_threads[z];
+		for (mode = 0; mode < 3; mode++) {
+			bench_metrics_mode = mode;
+			t0 = bench_now();
+			for (i = 0; i < nthreads; i++)
+				pthread_create(&threads[i], NULL,
+					bench_metrics_thread, NULL);
+			for (i = 0; i < nthreads; i++)
+				pthread_join(threads[i], NULL);
+			printf("metrics mode=%s threads=%d ns_per_update=%.1f\n",
+				modes[mode], nthreads,
+				(bench_now() - t0) / iterations / nthreads);
+		}
+	}
+
+	t0 = bench_now();
+	for (i = 0; i < 100; i++) {
+		text = CCTvMetricsFormat(&len);
+		if (!text)
+			return CCTV_ERROR;
+		free(text);
+	}
+	printf("metrics scrape_us=%.1f bytes=%lu\n",
+		(bench_now() - t0) / 100 / 1e3, (unsigned long)len);
+
+	return CCTV_SUCCESS;
+}
+
+/*! Output of the logging benchmark, a file standing for the terminal. */
+static FILE *bench_log_out;
+
+/*! Microseconds a write to the terminal takes. */
+#define BENCH_LOG_WRITE_US 20
+
+static pthread_mutex_t bench_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int bench_log_async;
+static int bench_log_lines;
+
+/*!
+ * \brief Print function of the logging benchmark: what linux_print() does,
+ * into bench_log_out, then waiting as long as a terminal would.
+ */
+static void bench_log_sink(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(bench_log_out, format, ap);
+	fflush(bench_log_out);
+	va_end(ap);
+	usleep(BENCH_LOG_WRITE_US);
+}
+
+/*!
+ * \brief A log line as SampleUtil_Print() printed it before the ring: the
+ * formatting and the write under one mutex.
+ */
+static void bench_log_locked(const char *fmt, ...)
+{
+	static char buf[8 * 1024];
+	va_list ap;
+
+	pthread_mutex_lock(&bench_log_mutex);
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	bench_log_sink("%s", buf);
+	pthread_mutex_unlock(&bench_log_mutex);
+}
+
+static void *bench_log_thread(void *arg)
+{
+	long id = (long)arg;
+	int i;
+
+	for (i = 0; i < bench_log_lines; i++) {
+		if (bench_log_async)
+			SampleUtil_Print("Received event from %s: Temperature "
+				"= %d (thread %ld)\n", "uuid:cctv-bench", i, id);
+		else
+			bench_log_locked("Received event from %s: Temperature "
+				"= %d (thread %ld)\n", "uuid:cctv-bench", i, id);
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Time a callback thread spends logging, from 1 to 8 threads at
+ * once: formatting and writing under one mutex as before, against the
+ * ring and its flusher; and how much of the output the ring dropped.
+ */
+static int bench_log(int iterations)
+{
+	static const char *modes[] = { "locked", "async" };
+	sample_log_stats before;
+	sample_log_stats after;
+	print_string saved;
+	pthread_t threads[8];
+	double t0;
+	double ns;
+	int nthreads;
+	int z;
+	long i;
+
+	bench_log_out = fopen("/dev/null", "w");
+	if (!bench_log_out)
+		return CCTV_ERROR;
+	/* the locked lines wait for the terminal one by one */
+	bench_log_lines = iterations / 1000 > 0 ? iterations / 1000 : 1;
+	SampleUtil_Flush();
+	saved = gPrintFun;
+	gPrintFun = bench_log_sink;
+	for (z = 0; z < BENCH_NUM_METRICS_THREADS; z++) {
+		nthreads = bench_metrics_threads[z];
+		for (bench_log_async = 0; bench_log_async < 2;
+		     bench_log_async++) {
+			SampleUtil_GetLogStats(&before);
+			t0 = bench_now();
+			for (i = 0; i < nthreads; i++)
+				pthread_create(&threads[i], NULL,
+					bench_log_thread, (void *)i);
+			for (i = 0; i < nthreads; i++)
+				pthread_join(threads[i], NULL);
+			ns = (bench_now() - t0) / bench_log_lines / nthreads;
+			SampleUtil_Flush();
+			SampleUtil_GetLogStats(&after);
+			printf("log mode=%s threads=%d ns_per_line=%.1f "
+				"dropped=%.3f\n", modes[bench_log_async],
+				nthreads, ns,
+				(double)(after.dropped - before.dropped) /
+				bench_log_lines / nthreads);
+		}
+	}
+	gPrintFun = saved;
+	fclose(bench_log_out);
+
+	return CCTV_SUCCESS;
+}
+
+/*! Arguments of the log sites of the level benchmark. */
+static volatile int bench_level_value;
+
+static void bench_level_sink(const char *format, ...)
+{
+	return;
+	format = format;
+}
+
+/*!
+ * \brief Cost of a log site in a callback: compiled out, turned off at
+ * run time, off but called as a function, and printed into the ring.
+ */
+static int bench_loglevel(int iterations)
+{
+	static const char *modes[] = { "elided", "off", "call_off", "on" };
+	sample_log_level saved_level = gLogLevel;
+	print_string saved;
+	double t0;
+	int mode;
+	int i;
+
+	SampleUtil_Flush();
+	saved = gPrintFun;
+	gPrintFun = bench_level_sink;
+	for (mode = 0; mode < 4; mode++) {
+		SampleUtil_SetLogLevel(mode == 3 ? SAMPLE_LOG_INFO :
+			SAMPLE_LOG_ERROR);
+		t0 = bench_now();
+		for (i = 0; i < iterations; i++) {
+			switch (mode) {
+			case 0:
+				/* a level above any SAMPLE_LOG_MAX_LEVEL */
+				SAMPLE_LOG((sample_log_level)
+					(SAMPLE_LOG_MAX_LEVEL + 1),
+					"Received CCTv %s Event: %d for SID %s\n",
+					"Control", bench_level_value++,
+					"uuid:bench");
+				break;
+			case 1:
+			case 3:
+				SAMPLE_LOG(SAMPLE_LOG_INFO,
+					"Received CCTv %s Event: %d for SID %s\n",
+					"Control", bench_level_value++,
+					"uuid:bench");
+				break;
+			default:
+				SampleUtil_Log(SAMPLE_LOG_INFO,
+					"Received CCTv %s Event: %d for SID %s\n",
+					"Control", bench_level_value++,
+					"uuid:bench");
+				break;
+			}
+		}
+		printf("loglevel mode=%s ns_per_site=%.1f evaluated=%d\n",
+			modes[mode], (bench_now() - t0) / iterations,
+			bench_level_value);
+		bench_level_value = 0;
+		SampleUtil_Flush();
+	}
+	gPrintFun = saved;
+	SampleUtil_SetLogLevel(saved_level);
+
+	return CCTV_SUCCESS;
+}
+
+/* End-to-end benchmarks: the control point against a farm of emulated
+ * cameras in this process, over the SDK and the network stack. */
+
+/*! Cameras of the farm, and cameras per rack. */
+#define BENCH_E2E_CAMERAS 200
+#define BENCH_E2E_RACK 20
+
+/*! Seed of the farm, so that runs are comparable. */
+#define BENCH_E2E_SEED 1
+
+/*! Longest wait for the fleet, events or answers, in milliseconds. */
+#define BENCH_E2E_WAIT_MS 60000
+
+/*! Concurrent actions swept by the action benchmark. */
+static const int bench_e2e_inflight[] = { 1, 8, 32 };
+
+/*! Events per camera swept by the event benchmark. */
+static const int bench_e2e_batches[] = { 1, 5, 25 };
+
+/*! Subscribers swept by the fan-out benchmark. */
+static const int bench_e2e_subscribers[] = { 1, 16, 64, 256 };
+
+#define BENCH_E2E_MAX_SUBSCRIBERS 256
+
+/*! Where cctvcontrolSCPD.xml is, see -webdir. */
+static const char *bench_e2e_webdir = "./web";
+
+/*! 1 once the farm and control point are up, -1 if they failed to. */
+static int bench_e2e_state;
+static char bench_e2e_dir[64] = "/tmp/cctv_bench.XXXXXX";
+
+/*!
+ * \brief Value of a metric of this process, -1 if not registered.
+ */
+static double bench_metric(const char *name)
+{
+	size_t len = strlen(name);
+	double value = -1;
+	size_t textlen;
+	char *text;
+	char *p;
+
+	text = CCTvMetricsFormat(&textlen);
+	for (p = text; p && *p; p = strchr(p, '\n'), p = p ? p + 1 : NULL) {
+		if (strncmp(p, name, len) == 0 && p[len] == ' ') {
+			value = strtod(p + len + 1, NULL);
+			break;
+		}
+	}
+	free(text);
+
+	return value;
+}
+
+static long bench_e2e_metric(const char *name)
+{
+	return (long)bench_metric(name);
+}
+
+/*!
+ * \brief Wait until a metric reaches a value.
+ *
+ * \return The last value read.
+ */
+static long bench_e2e_wait_metric(const char *name, long target)
+{
+	double deadline = bench_now() + BENCH_E2E_WAIT_MS * 1e6;
+	long value;
+
+	while ((value = bench_e2e_metric(name)) < target &&
+	       bench_now() < deadline)
+		bench_sleep_ms(1);
+
+	return value;
+}
+
+static void bench_e2e_down(void)
+{
+	char path[128];
+	int r;
+
+	CCTvFarmStop();
+	CCTvCtrlPointStop();
+	for (r = 0; r < CCTV_FARM_MAX_RACKS; r++) {
+		snprintf(path, sizeof path, "%s/cctvfarm%d.xml",
+			bench_e2e_dir, r);
+		unlink(path);
+	}
+	snprintf(path, sizeof path, "%s/cctvcontrolSCPD.xml", bench_e2e_dir);
+	unlink(path);
+	rmdir(bench_e2e_dir);
+}
+
+/*!
+ * \brief Start the farm and the control point once for all end-to-end
+ * benchmarks, and wait for the control point to subscribe to the fleet.
+ * Their output goes to bench_level_sink().
+ */
+static int bench_e2e_up(void)
+{
+	struct CCTvFarmConfig config;
+	char prefix[32];
+	long subscribed;
+
+	if (bench_e2e_state)
+		return bench_e2e_state > 0 ? CCTV_SUCCESS : CCTV_ERROR;
+	bench_e2e_state = -1;
+	if (!mkdtemp(bench_e2e_dir)) {
+		perror(bench_e2e_dir);
+		return CCTV_ERROR;
+	}
+	CCTvFarmDefaults(&config);
+	config.cameras = BENCH_E2E_CAMERAS;
+	config.rack = BENCH_E2E_RACK;
+	/* events only when a benchmark sends them */
+	config.temp_ms = 0;
+	config.seed = BENCH_E2E_SEED;
+	snprintf(prefix, sizeof prefix, "bench%d", (int)getpid());
+	SampleUtil_Flush();
+	gPrintFun = bench_level_sink;
+	if (CCTvFarmStart(NULL, 0, bench_e2e_webdir, bench_e2e_dir, prefix,
+		&config, bench_level_sink) != UPNP_E_SUCCESS) {
+		printf("e2e: cannot start the farm\n");
+		rmdir(bench_e2e_dir);
+		return CCTV_ERROR;
+	}
+	/* the SDK is up already, as for cctv_combo */
+	if (CCTvCtrlPointStart(bench_level_sink, NULL, 1) != CCTV_SUCCESS) {
+		printf("e2e: cannot start the control point\n");
+		CCTvFarmStop();
+		return CCTV_ERROR;
+	}
+	atexit(bench_e2e_down);
+	bench_e2e_state = 1;
+	subscribed = bench_e2e_wait_metric(
+		"cctv_ctrlpt_subscriptions_total{result=\"ok\"}",
+		BENCH_E2E_CAMERAS);
+	if (subscribed < BENCH_E2E_CAMERAS)
+		printf("e2e: only %ld of %d cameras subscribed\n",
+			subscribed, BENCH_E2E_CAMERAS);
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Time from an M-SEARCH to the whole fleet described and
+ * subscribed, the search response delays of the cameras (MX 5 s) included.
+ */
+static int bench_e2e_discover(int iterations)
+{
+	const char *name = "cctv_ctrlpt_subscriptions_total{result=\"ok\"}";
+	long base;
+	long now;
+	double t0;
+	int rounds = iterations < 3 ? iterations : 3;
+	int i;
+
+	if (bench_e2e_up() != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	for (i = 0; i < rounds; i++) {
+		base = bench_e2e_metric(name);
+		t0 = bench_now();
+		/* forgets the fleet, then searches for it */
+		CCTvCtrlPointRefresh();
+		now = bench_e2e_wait_metric(name, base + BENCH_E2E_CAMERAS);
+		printf("e2e_discover cameras=%d racks=%d round=%d subscribed=%ld"
+			" search_to_subscribed_ms=%.1f\n", BENCH_E2E_CAMERAS,
+			BENCH_E2E_CAMERAS / BENCH_E2E_RACK, i, now - base,
+			(bench_now() - t0) / 1e6);
+		if (now - base < BENCH_E2E_CAMERAS)
+			return CCTV_ERROR;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Action round trips through CCTvCtrlPointSendAction(), with a
+ * bounded number in flight, and their latency percentiles.
+ */
+static int bench_e2e_actions(int iterations)
+{
+	const char *action = "TopMountMiddle";
+	struct CCTvHistogram before;
+	struct CCTvHistogram after;
+	long errors;
+	double t0;
+	double elapsed;
+	int actions = iterations < 2000 ? iterations : 2000;
+	int w;
+	int b;
+	int sent;
+
+	if (bench_e2e_up() != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	for (w = 0; w < (int)(sizeof bench_e2e_inflight /
+	     sizeof bench_e2e_inflight[0]); w++) {
+		CCTvCtrlPointGetLatency(action, &before);
+		errors = bench_e2e_metric(
+			"cctv_ctrlpt_actions_total{result=\"error\"}") +
+			bench_e2e_metric(
+			"cctv_ctrlpt_actions_total{result=\"timeout\"}");
+		t0 = bench_now();
+		sent = 0;
+		after = before;
+		while (after.count - before.count < (unsigned long)actions &&
+		       bench_now() - t0 < BENCH_E2E_WAIT_MS * 1e6) {
+			if (sent < actions && (unsigned long)sent -
+			    (after.count - before.count) <
+			    (unsigned long)bench_e2e_inflight[w]) {
+				if (CCTvCtrlPointSendAction(CCTV_SERVICE_CONTROL,
+					sent % BENCH_E2E_CAMERAS + 1, action,
+					NULL, NULL, 0) != CCTV_SUCCESS)
+					return CCTV_ERROR;
+				sent++;
+				continue;
+			}
+			sched_yield();
+			CCTvCtrlPointGetLatency(action, &after);
+		}
+		elapsed = bench_now() - t0;
+		errors = bench_e2e_metric(
+			"cctv_ctrlpt_actions_total{result=\"error\"}") +
+			bench_e2e_metric(
+			"cctv_ctrlpt_actions_total{result=\"timeout\"}") - errors;
+		/* what this sweep added */
+		for (b = 0; b < CCTV_HISTOGRAM_BUCKETS; b++)
+			after.counts[b] -= before.counts[b];
+		after.count -= before.count;
+		after.sum -= before.sum;
+		printf("e2e_actions cameras=%d inflight=%d actions=%lu"
+			" errors=%ld actions_per_s=%.0f mean_us=%.0f p50_us=%lu"
+			" p90_us=%lu p99_us=%lu\n", BENCH_E2E_CAMERAS,
+			bench_e2e_inflight[w], after.count, errors,
+			after.count / (elapsed / 1e9), CCTvHistogramMean(&after),
+			CCTvHistogramPercentile(&after, 50),
+			CCTvHistogramPercentile(&after, 90),
+			CCTvHistogramPercentile(&after, 99));
+		if (after.count < (unsigned long)actions)
+			return CCTV_ERROR;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+/*!
+ * \brief Throughput of temperature events sent by the whole fleet at once
+ * into CCTvCtrlPointHandleEvent().
+ */
+static int bench_e2e_events(int iterations)
+{
+	const char *name = "cctv_ctrlpt_events_received_total";
+	long base;
+	long received;
+	double t0;
+	double elapsed;
+	int sent;
+	int i;
+
+	if (bench_e2e_up() != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	for (i = 0; i < (int)(sizeof bench_e2e_batches /
+	     sizeof bench_e2e_batches[0]); i++) {
+		if (bench_e2e_batches[i] > iterations)
+			break;
+		base = bench_e2e_metric(name);
+		t0 = bench_now();
+		sent = CCTvFarmNotify(-1, bench_e2e_batches[i]);
+		received = bench_e2e_wait_metric(name, base + sent) - base;
+		elapsed = bench_now() - t0;
+		printf("e2e_events cameras=%d per_camera=%d sent=%d"
+			" received=%ld events_per_s=%.0f\n", BENCH_E2E_CAMERAS,
+			bench_e2e_batches[i], sent, received,
+			received / (elapsed / 1e9));
+		if (received < sent)
+			return CCTV_ERROR;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+static int bench_e2e_listen_fd = -1;
+/*! NOTIFYs the fan-out listener answered. */
+static long bench_e2e_notifies;
+
+/*!
+ * \brief Answer the GENA NOTIFYs of a connection, counting them.
+ */
+static void bench_e2e_serve(int fd)
+{
+	char buf[8192];
+	size_t have = 0;
+	ssize_t n;
+	char *end;
+	char *line;
+	size_t need;
+	const char *ok = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+
+	while (1) {
+		buf[have] = '\0';
+		end = strstr(buf, "\r\n\r\n");
+		if (end) {
+			need = (size_t)(end + 4 - buf);
+			for (line = strstr(buf, "\r\n"); line < end;
+			     line = strstr(line + 2, "\r\n")) {
+				if (strncasecmp(line + 2, "Content-Length:",
+					15) == 0)
+					need += strtoul(line + 17, NULL, 10);
+			}
+			if (need >= sizeof buf)
+				return;
+			if (have >= need) {
+				if (strncmp(buf, "NOTIFY ", 7) == 0)
+					__atomic_add_fetch(&bench_e2e_notifies,
+						1, __ATOMIC_RELAXED);
+				if (write(fd, ok, strlen(ok)) < 0)
+					return;
+				memmove(buf, buf + need, have - need);
+				have -= need;
+				continue;
+			}
+		}
+		if (have == sizeof buf - 1)
+			return;
+		n = read(fd, buf + have, sizeof buf - 1 - have);
+		if (n <= 0)
+			return;
+		have += (size_t)n;
+	}
+}
+
+static void *bench_e2e_listener(void *arg)
+{
+	int fd;
+
+	while ((fd = accept(bench_e2e_listen_fd, NULL, NULL)) >= 0) {
+		bench_e2e_serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+	arg = arg;
+}
+
+/*!
+ * \brief Subscribe to the events of farm camera 0 with a raw SUBSCRIBE,
+ * the NOTIFYs going to the listener.
+ */
+static int bench_e2e_subscribe(unsigned short lport, int k)
+{
+	struct sockaddr_in sa;
+	char req[512];
+	char resp[512];
+	ssize_t n;
+	int fd;
+	int ok;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(UpnpGetServerPort());
+	if (inet_pton(AF_INET, UpnpGetServerIpAddress(), &sa.sin_addr) != 1)
+		return CCTV_ERROR;
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return CCTV_ERROR;
+	if (connect(fd, (struct sockaddr *)&sa, sizeof sa) != 0) {
+		close(fd);
+		return CCTV_ERROR;
+	}
+	snprintf(req, sizeof req,
+		"SUBSCRIBE /upnp/event/cctvfarm0 HTTP/1.1\r\n"
+		"HOST: %s:%u\r\n"
+		"CALLBACK: <http://127.0.0.1:%u/subscriber%d>\r\n"
+		"NT: upnp:event\r\n"
+		"TIMEOUT: Second-1800\r\n"
+		"Content-Length: 0\r\n\r\n",
+		UpnpGetServerIpAddress(), UpnpGetServerPort(), lport, k);
+	ok = write(fd, req, strlen(req)) == (ssize_t)strlen(req);
+	n = ok ? read(fd, resp, sizeof resp - 1) : -1;
+	close(fd);
+	if (n <= 0)
+		return CCTV_ERROR;
+	resp[n] = '\0';
+
+	return strstr(resp, " 200 ") ? CCTV_SUCCESS : CCTV_ERROR;
+}
+
+/*!
+ * \brief Device side fan-out: how fast UpnpNotify() reaches K subscribers
+ * of one camera, each of them an HTTP listener of this process. The
+ * camera also has the control point as a subscriber.
+ */
+static int bench_e2e_fanout(int iterations)
+{
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof sa;
+	pthread_t listener;
+	/* NOTIFYs the listener has had by the end of the sweep */
+	long expect = 0;
+	long base;
+	double t0;
+	double elapsed;
+	int rounds = iterations < 20 ? iterations : 20;
+	int subscribed = 0;
+	int i;
+
+	if (bench_e2e_up() != CCTV_SUCCESS)
+		return CCTV_ERROR;
+	if (bench_e2e_listen_fd < 0) {
+		bench_e2e_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		memset(&sa, 0, sizeof sa);
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bench_e2e_listen_fd < 0 ||
+		    bind(bench_e2e_listen_fd, (struct sockaddr *)&sa,
+			sizeof sa) != 0 ||
+		    listen(bench_e2e_listen_fd, 1024) != 0 ||
+		    getsockname(bench_e2e_listen_fd, (struct sockaddr *)&sa,
+			&salen) != 0 ||
+		    pthread_create(&listener, NULL, bench_e2e_listener,
+			NULL) != 0) {
+			perror("e2e_fanout listener");
+			return CCTV_ERROR;
+		}
+		pthread_detach(listener);
+	} else if (getsockname(bench_e2e_listen_fd, (struct sockaddr *)&sa,
+		&salen) != 0) {
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < (int)(sizeof bench_e2e_subscribers /
+	     sizeof bench_e2e_subscribers[0]); i++) {
+		for (; subscribed < bench_e2e_subscribers[i]; subscribed++) {
+			if (bench_e2e_subscribe(ntohs(sa.sin_port),
+				subscribed) != CCTV_SUCCESS) {
+				printf("e2e_fanout: SUBSCRIBE %d failed\n",
+					subscribed);
+				return CCTV_ERROR;
+			}
+			/* each new subscriber gets an initial event */
+			expect++;
+		}
+		t0 = bench_now();
+		while (__atomic_load_n(&bench_e2e_notifies, __ATOMIC_RELAXED) <
+		       expect && bench_now() - t0 < BENCH_E2E_WAIT_MS * 1e6)
+			bench_sleep_ms(1);
+		base = __atomic_load_n(&bench_e2e_notifies, __ATOMIC_RELAXED);
+		t0 = bench_now();
+		CCTvFarmNotify(0, rounds);
+		while (__atomic_load_n(&bench_e2e_notifies, __ATOMIC_RELAXED) -
+		       base < (long)subscribed * rounds &&
+		       bench_now() - t0 < BENCH_E2E_WAIT_MS * 1e6)
+			sched_yield();
+		elapsed = bench_now() - t0;
+		base = __atomic_load_n(&bench_e2e_notifies, __ATOMIC_RELAXED) -
+			base;
+		printf("e2e_fanout subscribers=%d rounds=%d notifies=%ld"
+			" ms_per_round=%.2f notifies_per_s=%.0f\n", subscribed,
+			rounds, base, elapsed / 1e6 / rounds,
+			base / (elapsed / 1e9));
+		if (base < (long)subscribed * rounds)
+			return CCTV_ERROR;
+		expect += base;
+	}
+
+	return CCTV_SUCCESS;
+}
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/*! Allocations of this thread, counted by the wrappers of glibc's malloc
+ * below, which the SDK and ixml calls go through as well. */
+static __thread long bench_thread_allocs;
+
+void *malloc(size_t size)
+{
+	bench_thread_allocs++;
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	bench_thread_allocs++;
+
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	bench_thread_allocs++;
+
+	return __libc_realloc(ptr, size);
+}
+
+#define BENCH_COUNTS_ALLOCS 1
+#else
+static __thread long bench_thread_allocs;
+
+#define BENCH_COUNTS_ALLOCS 0
+#endif
+
+/*! Thread counts swept by the handlers benchmark. */
+static const int bench_handlers_threads[] = { 1, 2, 4, 8 };
+
+#define BENCH_HANDLERS_MAX_THREADS 8
+
+/*! Identifiers the synthetic requests are addressed to. */
+#define BENCH_HANDLERS_UDN "uuid:cctv-bench-device"
+#define BENCH_HANDLERS_SERVICE_ID "urn:upnp-org:serviceId:cctvcontrol1"
+
+enum bench_handlers_request {
+	BENCH_HANDLERS_ACTION = 0,
+	BENCH_HANDLERS_GETVAR,
+	BENCH_HANDLERS_SUBSCRIBE,
+	BENCH_HANDLERS_REQUESTS
+};
+
+static const char *bench_handlers_names[] = {
+	"action", "getvar", "subscribe"
+};
+
+/*! Actions sent round-robin: the mount moves, which do not reboot the box
+ * or start the video. */
+static const char *bench_handlers_actions[] = {
+	"BottomMountLeft", "BottomMountRight", "BottomMountMiddle",
+	"TopMountUp", "TopMountDown", "TopMountMiddle"
+};
+
+#define BENCH_HANDLERS_ACTIONS \
+	((int)(sizeof bench_handlers_actions / \
+	sizeof bench_handlers_actions[0]))
+
+/*! Variables asked round-robin. */
+static const char *bench_handlers_vars[] = { "Power", "Temperature" };
+
+/*! One handler thread. */
+struct bench_handlers_thread {
+	pthread_t thread;
+	enum bench_handlers_request request;
+	int iterations;
+	/*! Released once every thread has its requests built. */
+	pthread_barrier_t *start;
+	/*! Time in the handlers, allocations and failed requests. */
+	double ns;
+	long allocs;
+	int errors;
+};
+
+static void *bench_handlers_worker(void *arg)
+{
+	struct bench_handlers_thread *t = (struct bench_handlers_thread *)arg;
+	UpnpActionRequest *actions[BENCH_HANDLERS_ACTIONS];
+	UpnpStateVarRequest *vars[2];
+	UpnpSubscriptionRequest *sub;
+	char sid[64];
+	long allocs;
+	double t0;
+	int i;
+
+	/* built up front, as the SDK does before calling back */
+	for (i = 0; i < BENCH_HANDLERS_ACTIONS; i++) {
+		actions[i] = UpnpActionRequest_new();
+		UpnpActionRequest_strcpy_DevUDN(actions[i], BENCH_HANDLERS_UDN);
+		UpnpActionRequest_strcpy_ServiceID(actions[i],
+			BENCH_HANDLERS_SERVICE_ID);
+		UpnpActionRequest_strcpy_ActionName(actions[i],
+			bench_handlers_actions[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		vars[i] = UpnpStateVarRequest_new();
+		UpnpStateVarRequest_strcpy_DevUDN(vars[i], BENCH_HANDLERS_UDN);
+		UpnpStateVarRequest_strcpy_ServiceID(vars[i],
+			BENCH_HANDLERS_SERVICE_ID);
+		UpnpStateVarRequest_strcpy_StateVarName(vars[i],
+			bench_handlers_vars[i]);
+	}
+	snprintf(sid, sizeof sid, "uuid:bench-%lx",
+		(unsigned long)pthread_self());
+	sub = UpnpSubscriptionRequest_new();
+	UpnpSubscriptionRequest_strcpy_UDN(sub, BENCH_HANDLERS_UDN);
+	UpnpSubscriptionRequest_strcpy_ServiceId(sub,
+		BENCH_HANDLERS_SERVICE_ID);
+	UpnpSubscriptionRequest_strcpy_SID(sub, sid);
+
+	pthread_barrier_wait(t->start);
+	allocs = bench_thread_allocs;
+	t0 = bench_now();
+	for (i = 0; i < t->iterations; i++) {
+		switch (t->request) {
+		case BENCH_HANDLERS_ACTION:
+			if (CCTvDeviceHandleActionRequest(
+				actions[i % BENCH_HANDLERS_ACTIONS]) !=
+			    UPNP_E_SUCCESS)
+				t->errors++;
+			/* the response, freed as the SDK would once sent */
+			ixmlDocument_free(UpnpActionRequest_get_ActionResult(
+				actions[i % BENCH_HANDLERS_ACTIONS]));
+			UpnpActionRequest_set_ActionResult(
+				actions[i % BENCH_HANDLERS_ACTIONS], NULL);
+			break;
+		case BENCH_HANDLERS_GETVAR:
+			if (!CCTvDeviceHandleGetVarRequest(vars[i % 2]))
+				t->errors++;
+			break;
+		default:
+			CCTvDeviceHandleSubscriptionRequest(sub);
+			break;
+		}
+	}
+	t->ns = bench_now() - t0;
+	t->allocs = bench_thread_allocs - allocs;
+
+	for (i = 0; i < BENCH_HANDLERS_ACTIONS; i++)
+		UpnpActionRequest_delete(actions[i]);
+	for (i = 0; i < 2; i++)
+		UpnpStateVarRequest_delete(vars[i]);
+	UpnpSubscriptionRequest_delete(sub);
+
+	return NULL;
+}
+
+/*!
+ * \brief The action, GetVar and subscription handlers of the device, called
+ * in-process from 1..8 threads with synthetic requests: time, allocations
+ * and waits for the state table lock per request.
+ *
+ * The servos are the mock HAL; hal_ns_per_op is the part of the time spent
+ * in it. Subscriptions are accepted by an SDK that is not running, so the
+ * SDK's part of them is left out.
+ */
+static int bench_handlers(int iterations)
+{
+	static int ready;
+	struct bench_handlers_thread threads[BENCH_HANDLERS_MAX_THREADS];
+	struct CCTvHalMockStats before;
+	struct CCTvHalMockStats after;
+	pthread_barrier_t start;
+	double contended;
+	double waited;
+	double elapsed;
+	double ns;
+	double t0;
+	long allocs;
+	long ops;
+	int nthreads;
+	int errors;
+	int request;
+	int r;
+	int i;
+
+	if (!ready) {
+		if (CCTvHalSelect("mock") != CCTV_SUCCESS ||
+		    CCTvHalInit() != CCTV_SUCCESS ||
+		    !CCTvDeviceStateTableInitLocal(BENCH_HANDLERS_UDN,
+			BENCH_HANDLERS_SERVICE_ID))
+			return CCTV_ERROR;
+		for (i = 0; i < CCTV_HAL_PINS; i++)
+			CCTvHalServoSetup(i, 200);
+		ready = 1;
+	}
+	for (request = 0; request < BENCH_HANDLERS_REQUESTS; request++) {
+		for (r = 0; r < (int)(sizeof bench_handlers_threads /
+		     sizeof bench_handlers_threads[0]); r++) {
+			nthreads = bench_handlers_threads[r];
+			pthread_barrier_init(&start, NULL,
+				(unsigned)nthreads + 1);
+			memset(threads, 0, sizeof threads);
+			CCTvHalMockGetStats(&before);
+			contended = bench_metric(
+				"cctv_device_lock_contended_total");
+			waited = bench_metric(
+				"cctv_device_lock_wait_seconds_sum");
+			for (i = 0; i < nthreads; i++) {
+				threads[i].request =
+					(enum bench_handlers_request)request;
+				threads[i].iterations = iterations;
+				threads[i].start = &start;
+				pthread_create(&threads[i].thread, NULL,
+					bench_handlers_worker, &threads[i]);
+			}
+			pthread_barrier_wait(&start);
+			t0 = bench_now();
+			ns = 0;
+			allocs = 0;
+			errors = 0;
+			for (i = 0; i < nthreads; i++) {
+				pthread_join(threads[i].thread, NULL);
+				ns += threads[i].ns;
+				allocs += threads[i].allocs;
+				errors += threads[i].errors;
+			}
+			elapsed = bench_now() - t0;
+			pthread_barrier_destroy(&start);
+			CCTvHalMockGetStats(&after);
+			contended = bench_metric(
+				"cctv_device_lock_contended_total") - contended;
+			waited = bench_metric(
+				"cctv_device_lock_wait_seconds_sum") - waited;
+			ops = (long)iterations * nthreads;
+			printf("handlers request=%s threads=%d errors=%d"
+				" ns_per_op=%.1f ops_per_s=%.0f"
+				" allocs_per_op=%.2f lock_contended=%.0f"
+				" lock_contended_pct=%.3f lock_wait_ns_per_op=%.1f"
+				" hal_ns_per_op=%.1f\n",
+				bench_handlers_names[request], nthreads, errors,
+				ns / ops, ops / (elapsed / 1e9),
+				BENCH_COUNTS_ALLOCS ? (double)allocs / ops : -1.0,
+				contended, contended * 100.0 / ops,
+				waited * 1e9 / ops,
+				(double)(after.ns[CCTV_HAL_SERVO_WRITE] -
+				before.ns[CCTV_HAL_SERVO_WRITE]) / ops);
+			if (errors)
+				return CCTV_ERROR;
+		}
+	}
+
+	return CCTV_SUCCESS;
+}
+
+/*! Benchmark entry points, selected by name on the command line. */
+static const struct {
+	const char *name;
+	int (*run)(int iterations);
+	const char *help;
+} bench_list[] = {
+	{ "registry", bench_registry,
+	  "device lookup by SID, hashed vs. linear, 10..10000 devices" },
+	{ "contention", bench_contention,
+	  "SID lookups from 1..8 threads vs. one writer, left-right vs. mutex" },
+	{ "discovery", bench_discovery,
+	  "time to discover 500 cameras, inline fetch vs. fetcher pool" },
+	{ "timers", bench_timers,
+	  "advertisement expiry, timer wheel vs. 30 s scan" },
+	{ "actions", bench_actions,
+	  "action request preparation, UpnpMakeAction vs. templates" },
+	{ "fanout", bench_fanout,
+	  "reboot 300 cameras, one at a time vs. bounded fan-out" },
+	{ "research", bench_research,
+	  "M-SEARCHes per tick for 1000 expiring cameras, direct vs. batched" },
+	{ "recovery", bench_recovery,
+	  "time to recover 20 hung cameras out of 200 without an operator" },
+	{ "poll", bench_poll,
+	  "SOAP load and hang detection, fixed 15 s vs. adaptive polling" },
+	{ "propset", bench_propset,
+	  "variables out of a NOTIFY body, node lists vs. one tree walk" },
+	{ "hot", bench_hot,
+	  "fleet-wide sweep of 1k..100k devices, device nodes vs. hot columns" },
+	{ "ctlsock", bench_ctlsock,
+	  "commands through the command socket, one by one vs. pipelined" },
+	{ "snapshot", bench_snapshot,
+	  "restart with 1k..10k cameras, searching vs. loading a snapshot" },
+	{ "shard", bench_shard,
+	  "10k cameras over 2..16 workers, hash ring vs. modulo" },
+	{ "metrics", bench_metrics,
+	  "counting from 1..8 threads, mutex vs. lock-free metrics" },
+	{ "log", bench_log,
+	  "logging from 1..8 threads, mutex and write vs. ring and flusher" },
+	{ "loglevel", bench_loglevel,
+	  "a log site turned off, at compile time vs. at run time" },
+	{ "e2e_discover", bench_e2e_discover,
+	  "M-SEARCH to a subscribed fleet of 200 emulated cameras" },
+	{ "e2e_actions", bench_e2e_actions,
+	  "action round trips to 200 cameras, 1..32 in flight, percentiles" },
+	{ "e2e_events", bench_e2e_events,
+	  "events of 200 cameras into the control point, events per second" },
+	{ "e2e_fanout", bench_e2e_fanout,
+	  "UpnpNotify to 1..256 subscribers of one camera" },
+	{ "handlers", bench_handlers,
+	  "device request handlers from 1..8 threads, ns, allocs and waits" },
+};
+
+#define BENCH_NUM_BENCHES ((int)(sizeof bench_list / sizeof bench_list[0]))
+
+/*! Most lines and line length of a result file for -compare. */
+#define BENCH_COMPARE_LINES 4096
+#define BENCH_COMPARE_LINE 512
+
+/*!
+ * \brief Read the lines of a result file.
+ *
+ * \return The lines, to be freed, or NULL.
+ */
+static char (*bench_compare_read(const char *path, int *n))[BENCH_COMPARE_LINE]
+{
+	char (*lines)[BENCH_COMPARE_LINE];
+	FILE *fp;
+
+	*n = 0;
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return NULL;
+	}
+	lines = malloc(BENCH_COMPARE_LINES * sizeof *lines);
+	while (lines && *n < BENCH_COMPARE_LINES &&
+	       fgets(lines[*n], BENCH_COMPARE_LINE, fp)) {
+		lines[*n][strcspn(lines[*n], "\n")] = '\0';
+		if (lines[*n][0])
+			(*n)++;
+	}
+	fclose(fp);
+
+	return lines;
+}
+
+/*!
+ * \brief Value of a field of a result line, "name=value".
+ *
+ * \return The value, up to the next space, or NULL.
+ */
+static const char *bench_compare_field(const char *line, const char *name,
+	size_t *len)
+{
+	size_t n = strlen(name);
+	const char *p;
+
+	for (p = strchr(line, ' '); p; p = strchr(p + 1, ' ')) {
+		if (strncmp(p + 1, name, n) == 0 && p[n + 1] == '=') {
+			p += n + 2;
+			*len = strcspn(p, " ");
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Compare a result file with a baseline one. The n-th line of a
+ * benchmark is matched with the n-th line of that benchmark in the
+ * baseline. A numeric field that changed by at least threshold percent is
+ * printed as "compare <bench> line=<n> field=<name> base=<value>
+ * now=<value> change_pct=<change>"; lines found in one file only, and lines
+ * whose text fields differ, as "compare <bench> line=<n> new|missing|
+ * mismatch".
+ *
+ * \return CCTV_SUCCESS if nothing changed that much, CCTV_WARNING if
+ * something did, CCTV_ERROR if a file cannot be read.
+ */
+static int bench_compare(const char *base_path, const char *now_path,
+	double threshold)
+{
+	char (*base)[BENCH_COMPARE_LINE];
+	char (*now)[BENCH_COMPARE_LINE];
+	char name[BENCH_COMPARE_LINE];
+	const char *field;
+	const char *value;
+	const char *p;
+	char *end_base;
+	char *end_now;
+	size_t len;
+	size_t vlen;
+	size_t blen;
+	double vb;
+	double vn;
+	double change;
+	int nbase;
+	int nnow;
+	int rc = CCTV_SUCCESS;
+	int seen;
+	int i;
+	int j;
+	int k;
+
+	base = bench_compare_read(base_path, &nbase);
+	now = bench_compare_read(now_path, &nnow);
+	if (!base || !now) {
+		free(base);
+		free(now);
+		return CCTV_ERROR;
+	}
+	for (i = 0; i < nnow; i++) {
+		len = strcspn(now[i], " ");
+		/* which line of its benchmark, and its match in the baseline */
+		for (k = 0, j = 0; j < i; j++)
+			k += strncmp(now[j], now[i], len) == 0 &&
+				now[j][len] == now[i][len];
+		for (seen = 0, j = 0; j < nbase; j++) {
+			if (strncmp(base[j], now[i], len) == 0 &&
+			    base[j][len] == now[i][len] && seen++ == k)
+				break;
+		}
+		if (j == nbase) {
+			printf("compare %.*s line=%d new\n", (int)len, now[i], k);
+			rc = CCTV_WARNING;
+			continue;
+		}
+		for (p = strchr(now[i], ' '); p; p = strchr(p + 1, ' ')) {
+			vlen = strcspn(p + 1, "= ");
+			if (p[1 + vlen] != '=')
+				continue;
+			snprintf(name, sizeof name, "%.*s", (int)vlen, p + 1);
+			value = p + 1 + vlen + 1;
+			vlen = strcspn(value, " ");
+			field = bench_compare_field(base[j], name, &blen);
+			if (!field)
+				continue;
+			vb = strtod(field, &end_base);
+			vn = strtod(value, &end_now);
+			if (end_base != field + blen || end_now != value + vlen) {
+				if (blen != vlen || strncmp(field, value, vlen)) {
+					printf("compare %.*s line=%d mismatch"
+						" field=%s\n", (int)len, now[i],
+						k, name);
+					rc = CCTV_WARNING;
+				}
+				continue;
+			}
+			if (vb == vn)
+				continue;
+			change = vb != 0 ? (vn - vb) / (vb < 0 ? -vb : vb) * 100 :
+				100;
+			if (change < threshold && change > -threshold)
+				continue;
+			printf("compare %.*s line=%d field=%s base=%.*s now=%.*s"
+				" change_pct=%+.1f\n", (int)len, now[i], k, name,
+				(int)blen, field, (int)vlen, value, change);
+			rc = CCTV_WARNING;
+		}
+	}
+	for (j = 0; j < nbase; j++) {
+		len = strcspn(base[j], " ");
+		for (k = 0, i = 0; i < j; i++)
+			k += strncmp(base[i], base[j], len) == 0 &&
+				base[i][len] == base[j][len];
+		for (seen = 0, i = 0; i < nnow; i++) {
+			if (strncmp(now[i], base[j], len) == 0 &&
+			    now[i][len] == base[j][len] && seen++ == k)
+				break;
+		}
+		if (i == nnow) {
+			printf("compare %.*s line=%d missing\n", (int)len,
+				base[j], k);
+			rc = CCTV_WARNING;
+		}
+	}
+	free(base);
+	free(now);
+
+	return rc;
+}
+
+static void bench_usage(const char *prog)
+{
+	int i;
+
+	printf("Usage: %s [-n iterations] [-webdir web_dir_path]"
+		" <benchmark>|all\n"
+		"       %s -compare baseline results [-threshold percent]\n",
+		prog, prog);
+	for (i = 0; i < BENCH_NUM_BENCHES; i++)
+		printf("  %-12s %s\n", bench_list[i].name, bench_list[i].help);
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = 1000000;
+	const char *which = NULL;
+	const char *baseline = NULL;
+	double threshold = 10;
+	int rc = CCTV_SUCCESS;
+	int i;
+
+	SampleUtil_Initialize(linux_print);
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-webdir") == 0 && i + 1 < argc) {
+			bench_e2e_webdir = argv[++i];
+		} else if (strcmp(argv[i], "-compare") == 0 && i + 1 < argc) {
+			baseline = argv[++i];
+		} else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else if (argv[i][0] != '-') {
+			which = argv[i];
+		} else {
+			bench_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (baseline && which) {
+		/* 2 tells a change from an error */
+		rc = bench_compare(baseline, which, threshold);
+		return rc == CCTV_SUCCESS ? 0 : rc == CCTV_WARNING ? 2 : 1;
+	}
+	if (!which || iterations <= 0) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+	for (i = 0; i < BENCH_NUM_BENCHES; i++) {
+		if (strcmp(which, "all") == 0 ||
+		    strcmp(which, bench_list[i].name) == 0) {
+			if (bench_list[i].run(iterations) != CCTV_SUCCESS) {
+				printf("%s: failed\n", bench_list[i].name);
+				rc = CCTV_ERROR;
+			}
+		}
+	}
+
+	return rc == CCTV_SUCCESS ? 0 : 1;
+}
+
+/*! @} CCTV Benchmarks */
+
+/*! @} UpnpSamples */
@@ -34,6 +34,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 int main(int argc, char **argv)
@@ -46,12 +47,77 @@ int main(int argc, char **argv)
 	sigset_t sigs_to_catch;
 #endif
 	int code;
+	const char *socket_path = NULL;
+	const char *snapshot_path = NULL;
+	const char *shard_dir = "/tmp";
+	char metrics_address[64] = "127.0.0.1";
+	unsigned short metrics_port = 0;
+	int shards = 0;
+	int worker = 0;
+	int level;
+	int i;
 
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			snapshot_path = argv[++i];
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			shards = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			shard_dir = argv[++i];
+		} else if (strcmp(argv[i], "-W") == 0) {
+			worker = 1;
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc &&
+			   /* loopback unless an address is given */
+			   SampleUtil_ParseAddressPort(argv[i + 1],
+				metrics_address, sizeof metrics_address,
+				&metrics_port) == 0) {
+			i++;
+		} else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc &&
+			   (level = SampleUtil_ParseLogLevel(argv[i + 1])) >= 0) {
+			SampleUtil_SetLogLevel((sample_log_level)level);
+			i++;
+		} else {
+			printf("Usage: %s [-s <command socket>] "
+				"[-f <snapshot file>] "
+				"[-m [<address>:]<metrics port>] "
+				"[-v error|warning|info|debug] "
+				"[-n <workers> [-d <worker directory>] | -W]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (shards > 0 && snapshot_path) {
+		/* the cameras are the workers' */
+		printf("A snapshot cannot be used with workers\n");
+		return 1;
+	}
+	/* the workers are forked before any thread is started */
+	if (shards > 0 &&
+	    CCTvCtrlPointFrontEnd("/proc/self/exe", shards, shard_dir) !=
+	    CCTV_SUCCESS) {
+		printf("Error starting the %d workers\n", shards);
+		return 1;
+	}
+	if (worker)
+		CCTvCtrlPointWorker();
 	rc = CCTvCtrlPointStart(linux_print, NULL, 0);
 	if (rc != CCTV_SUCCESS) {
 		SampleUtil_Print("Error starting UPnP CCTV Control Point\n");
 		return rc;
 	}
+	/* after the start, whose search begins with an empty list */
+	if (snapshot_path && CCTvCtrlPointRestore(snapshot_path) < 0)
+		SampleUtil_Print("Error using the snapshot %s\n", snapshot_path);
+	if (socket_path && CCTvCtrlPointListen(socket_path) != CCTV_SUCCESS)
+		SampleUtil_Print("Error opening the command socket %s\n",
+			socket_path);
+	if (metrics_port && CCTvCtrlPointServeMetrics(metrics_address,
+		metrics_port) != CCTV_SUCCESS)
+		SampleUtil_Print("Error serving the metrics on %s:%u\n",
+			metrics_address, metrics_port);
 	/* start a command loop thread */
 	code = ithread_create(&cmdloop_thread, NULL, CCTvCtrlPointCommandLoop, NULL);
 	if (code !=  0) {
@@ -68,7 +134,5 @@ int main(int argc, char **argv)
 	rc = CCTvCtrlPointStop();
 
 	return rc;
-	argc = argc;
-	argv = argv;
 }
 
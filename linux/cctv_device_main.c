@@ -31,16 +31,13 @@
 
 #include "sample_util.h"
 #include "cctv_device.h"
+#include "cctv_hal.h"
 
 #include <stdarg.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
 
-#include <linux/watchdog.h>
-
-
-extern int fd;
 
 void handler(int sig)
 {
@@ -84,8 +81,7 @@ int main(int argc, char *argv[])
 	sigaddset(&sigs_to_catch, SIGINT);
 	sigwait(&sigs_to_catch, &sig);
 	SampleUtil_Print("Shutting down on signal %d...\n", sig);
-	write(fd, "V", 1);
-	close(fd);
+	CCTvHalWatchdogClose();
 #endif
 	rc = CCTvDeviceStop();
 
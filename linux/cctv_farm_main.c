@@ -0,0 +1,56 @@
+/*!
+ * \addtogroup UpnpSamples
+ *
+ * @{
+ *
+ * \name Device Emulator Farm
+ *
+ * @{
+ *
+ * \file
+ */
+
+#include "sample_util.h"
+#include "cctv_farm.h"
+
+#include <signal.h>
+#include <stdio.h>
+
+void handler(int sig)
+{
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	ithread_t cmdloop_thread;
+	int sig;
+	sigset_t sigs_to_catch;
+	int code;
+
+	/* no hardware, so no need to be root */
+	rc = farm_main(argc, argv);
+	if (rc != UPNP_E_SUCCESS) {
+		return rc;
+	}
+
+	/* start a command loop thread */
+	code = ithread_create(&cmdloop_thread, NULL, CCTvFarmCommandLoop, NULL);
+	if (code != 0) {
+		return UPNP_E_INTERNAL_ERROR;
+	}
+	signal(SIGINT, handler);
+	/* Catch Ctrl-C and properly shutdown */
+	sigemptyset(&sigs_to_catch);
+	sigaddset(&sigs_to_catch, SIGINT);
+	sigwait(&sigs_to_catch, &sig);
+	SampleUtil_Print("Shutting down on signal %d...\n", sig);
+	rc = CCTvFarmStop();
+
+	return rc;
+}
+
+/*! @} Device Emulator Farm */
+
+/*! @} UpnpSamples */